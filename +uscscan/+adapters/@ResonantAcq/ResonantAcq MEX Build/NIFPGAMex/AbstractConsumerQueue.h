@@ -5,6 +5,8 @@
 class AbstractConsumerQueue {
 
  public:
+
+  virtual ~AbstractConsumerQueue() {}
   
   virtual std::size_t recordSize(void) const = 0;
 
@@ -16,8 +18,8 @@ class AbstractConsumerQueue {
   // Return front of queue (thread unsafe)
   virtual const void* front_unsafe(void) const = 0;
 
-  // Return front of queue, and lock queue until
-  // front_checkin. Remember to call front_checkin when you are done!
+  // Return front of queue. The record stays valid until pop_front; call
+  // front_checkin when you are done reading it.
   virtual const void* front_checkout(void) = 0;
 
   virtual void front_checkin(void) = 0;
@@ -0,0 +1,249 @@
+#include "AsyncFileWriter.h"
+#include <string.h>
+#include <stdio.h>
+#include "Misc.h"
+
+AsyncFileWriter::AsyncFileWriter(void) :
+  fBufferBytes(DEFAULT_BUFFER_BYTES),
+  fNumBuffers(DEFAULT_NUM_BUFFERS),
+  fAllocatedBufferBytes(0),
+  fError(false),
+  fCurrent(0),
+  fFill(0),
+  fCurrentOffset(0)
+{
+}
+
+AsyncFileWriter::~AsyncFileWriter(void)
+{
+  close();
+  freeBuffers();
+}
+
+void
+AsyncFileWriter::configure(unsigned int bufferBytes, unsigned int numBuffers)
+{
+  assert(!isOpen());
+  if (bufferBytes<SECTOR_ALIGNMENT) {
+    bufferBytes = SECTOR_ALIGNMENT;
+  }
+  fBufferBytes = (bufferBytes+SECTOR_ALIGNMENT-1)/SECTOR_ALIGNMENT*SECTOR_ALIGNMENT;
+  fNumBuffers = numBuffers>0 ? numBuffers : 1;
+}
+
+void
+AsyncFileWriter::allocateBuffers(void)
+{
+  if (fBuffers.size()==fNumBuffers && fAllocatedBufferBytes==fBufferBytes) {
+    return;
+  }
+  freeBuffers();
+
+  // allocPages gives page-aligned memory, as unbuffered I/O requires.
+  fBuffers.resize(fNumBuffers);
+  for (unsigned int i=0;i<fNumBuffers;i++) {
+    Buffer &b = fBuffers[i];
+    b.data = static_cast<char*>(Platform::allocPages(fBufferBytes));
+    b.request = new Platform::AsyncFile::Request();
+    b.inFlight = false;
+  }
+  fAllocatedBufferBytes = fBufferBytes;
+}
+
+void
+AsyncFileWriter::freeBuffers(void)
+{
+  for (unsigned int i=0;i<fBuffers.size();i++) {
+    assert(!fBuffers[i].inFlight);
+    if (fBuffers[i].data!=NULL) {
+      Platform::freePages(fBuffers[i].data,fAllocatedBufferBytes);
+    }
+    delete fBuffers[i].request;
+  }
+  fBuffers.clear();
+  fAllocatedBufferBytes = 0;
+}
+
+bool
+AsyncFileWriter::open(const char *fname)
+{
+  close();
+  allocateBuffers();
+  for (unsigned int i=0;i<fBuffers.size();i++) {
+    if (fBuffers[i].data==NULL) {
+      CONSOLEPRINT("AsyncFileWriter: could not allocate %u write buffers of %u bytes.\n",fNumBuffers,fBufferBytes);
+      freeBuffers();
+      return false;
+    }
+  }
+
+  if (!fFile.create(fname)) {
+    CONSOLEPRINT("AsyncFileWriter: could not create %s (error %lu).\n",fname,Platform::lastError());
+    return false;
+  }
+  fFilename = fname;
+  fError = false;
+  fCurrent = 0;
+  fFill = 0;
+  fCurrentOffset = 0;
+  fPatches.clear();
+  return true;
+}
+
+bool
+AsyncFileWriter::isOpen(void) const
+{
+  return fFile.isOpen();
+}
+
+bool
+AsyncFileWriter::reserveSpace(uint64_t numBytes)
+{
+  return fFile.reserveSpace(numBytes);
+}
+
+uint64_t
+AsyncFileWriter::position(void) const
+{
+  return fCurrentOffset+fFill;
+}
+
+bool
+AsyncFileWriter::fail(const char *what)
+{
+  if (!fError) {
+    CONSOLEPRINT("AsyncFileWriter: %s failed for %s (error %lu).\n",what,fFilename.c_str(),Platform::lastError());
+  }
+  fError = true;
+  return false;
+}
+
+bool
+AsyncFileWriter::waitForBuffer(unsigned int i)
+{
+  Buffer &b = fBuffers[i];
+  if (!b.inFlight) {
+    return true;
+  }
+  b.inFlight = false;
+  if (!fFile.wait(*b.request)) {
+    return fail("write");
+  }
+  return true;
+}
+
+bool
+AsyncFileWriter::issueCurrent(unsigned int numBytes)
+{
+  assert(numBytes%SECTOR_ALIGNMENT==0);
+  Buffer &b = fBuffers[fCurrent];
+  assert(!b.inFlight);
+
+  if (!fFile.write(*b.request,b.data,numBytes,fCurrentOffset)) {
+    return fail("write");
+  }
+  // Completed or pending, the result is collected in waitForBuffer().
+  b.inFlight = true;
+
+  fCurrentOffset += numBytes;
+  fCurrent = (fCurrent+1)%fNumBuffers;
+  fFill = 0;
+  return waitForBuffer(fCurrent);
+}
+
+bool
+AsyncFileWriter::append(const void *buf, size_t sz)
+{
+  assert(isOpen());
+  const char *src = static_cast<const char*>(buf);
+  while (sz>0 && !fError) {
+    size_t n = fBufferBytes-fFill;
+    if (n>sz) {
+      n = sz;
+    }
+    memcpy(fBuffers[fCurrent].data+fFill,src,n);
+    fFill += (unsigned int) n;
+    src += n;
+    sz -= n;
+    if (fFill==fBufferBytes) {
+      issueCurrent(fBufferBytes);
+    }
+  }
+  return !fError;
+}
+
+bool
+AsyncFileWriter::appendZeros(size_t sz)
+{
+  assert(isOpen());
+  while (sz>0 && !fError) {
+    size_t n = fBufferBytes-fFill;
+    if (n>sz) {
+      n = sz;
+    }
+    memset(fBuffers[fCurrent].data+fFill,0,n);
+    fFill += (unsigned int) n;
+    sz -= n;
+    if (fFill==fBufferBytes) {
+      issueCurrent(fBufferBytes);
+    }
+  }
+  return !fError;
+}
+
+void
+AsyncFileWriter::patch(uint64_t offset, const void *buf, unsigned int sz)
+{
+  assert(offset+sz<=position());
+  if (offset>=fCurrentOffset) {
+    memcpy(fBuffers[fCurrent].data+(offset-fCurrentOffset),buf,sz);
+    return;
+  }
+  Patch p;
+  p.offset = offset;
+  p.bytes.assign(static_cast<const char*>(buf),static_cast<const char*>(buf)+sz);
+  fPatches.push_back(p);
+}
+
+bool
+AsyncFileWriter::close(void)
+{
+  if (!isOpen()) {
+    return true;
+  }
+
+  // Write out the partly filled buffer, padded to a whole sector, then
+  // wait for everything in flight.
+  uint64_t fileSize = position();
+  if (fFill>0 && !fError) {
+    unsigned int padded = (fFill+SECTOR_ALIGNMENT-1)/SECTOR_ALIGNMENT*SECTOR_ALIGNMENT;
+    memset(fBuffers[fCurrent].data+fFill,0,padded-fFill);
+    issueCurrent(padded);
+  }
+  for (unsigned int i=0;i<fBuffers.size();i++) {
+    waitForBuffer(i);
+  }
+  fFile.close();
+
+  // Trim the padding and apply patches through an ordinary stream, which
+  // has no alignment restrictions.
+  if (fileSize%SECTOR_ALIGNMENT!=0 || !fPatches.empty()) {
+    FILE *fh = NULL;
+    if (fopen_s(&fh,fFilename.c_str(),"r+b")!=0 || fh==NULL) {
+      fail("reopening to finish file");
+    } else {
+      for (unsigned int i=0;i<fPatches.size();i++) {
+	if (_fseeki64(fh,(int64_t) fPatches[i].offset,SEEK_SET)!=0 ||
+	    fwrite(&fPatches[i].bytes[0],1,fPatches[i].bytes.size(),fh)!=fPatches[i].bytes.size()) {
+	  fail("patching file");
+	}
+      }
+      if (fflush(fh)!=0 || !Platform::truncateFile(fh,fileSize)) {
+	fail("setting file size");
+      }
+      fclose(fh);
+    }
+  }
+  fPatches.clear();
+  return !fError;
+}
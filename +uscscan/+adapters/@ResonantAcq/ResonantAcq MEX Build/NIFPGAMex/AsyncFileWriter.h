@@ -0,0 +1,106 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "Platform.h"
+
+// Sequential file writer using asynchronous I/O (Platform::AsyncFile).
+//
+// append() copies into one of numBuffers large, sector-aligned buffers.
+// When a buffer fills it is handed to the OS as a single write at the
+// next file offset, and the following buffer is filled while that write
+// is in flight. append() only blocks when every buffer is still being
+// written. The file is opened unbuffered (where the OS allows), so
+// data goes from these buffers to the device without passing through,
+// or evicting, the system file cache.
+//
+// Bytes already handed to the OS cannot be changed in place. Small
+// fix-ups to earlier parts of the file (eg the last TIFF IFD's next-IFD
+// offset) are queued with patch() and applied by close(), which also
+// trims the sector padding off the end of the file.
+//
+// Not thread-safe; meant to be owned by a single writer thread.
+class AsyncFileWriter {
+
+ public:
+
+  // Unbuffered I/O requires sector-aligned sizes and offsets.
+  static const unsigned int SECTOR_ALIGNMENT = Platform::AsyncFile::SECTOR_ALIGNMENT;
+  static const unsigned int DEFAULT_BUFFER_BYTES = 8*1024*1024;
+  static const unsigned int DEFAULT_NUM_BUFFERS = 4;
+
+  AsyncFileWriter(void);
+
+  ~AsyncFileWriter(void);
+
+  // Buffer size and number of buffers (ie max writes in flight) to use
+  // from the next open(). bufferBytes is rounded up to a multiple of
+  // SECTOR_ALIGNMENT.
+  void configure(unsigned int bufferBytes, unsigned int numBuffers);
+
+  // Create (or truncate) fname for writing. Closes any open file first.
+  bool open(const char *fname);
+
+  bool isOpen(void) const;
+
+  // Preallocate numBytes for the open file (see Platform::reserveFileSpace).
+  bool reserveSpace(uint64_t numBytes);
+
+  // Append sz bytes. Returns false if this or an earlier write failed.
+  bool append(const void *buf, size_t sz);
+
+  bool appendZeros(size_t sz);
+
+  // Number of bytes appended since open(), ie the file offset the next
+  // append() writes to.
+  uint64_t position(void) const;
+
+  // Overwrite sz bytes at offset, which must already have been
+  // appended. Applied immediately if those bytes are still in the
+  // buffer being filled, otherwise at close().
+  void patch(uint64_t offset, const void *buf, unsigned int sz);
+
+  // Write out everything, wait for it, apply patches and close. Returns
+  // false if any write failed.
+  bool close(void);
+
+ private:
+  struct Buffer {
+    char *data;
+    Platform::AsyncFile::Request *request;
+    bool inFlight;
+  };
+
+  struct Patch {
+    uint64_t offset;
+    std::vector<char> bytes;
+  };
+
+  void allocateBuffers(void);
+  void freeBuffers(void);
+
+  // Hand the buffer being filled to the OS (numBytes of it, a multiple of
+  // SECTOR_ALIGNMENT) and move on to the next one.
+  bool issueCurrent(unsigned int numBytes);
+
+  // Wait for buffer i's write, if any, to finish.
+  bool waitForBuffer(unsigned int i);
+
+  bool fail(const char *what);
+
+ private:
+  unsigned int fBufferBytes;
+  unsigned int fNumBuffers;
+  std::vector<Buffer> fBuffers;
+  unsigned int fAllocatedBufferBytes;
+
+  std::string fFilename;
+  Platform::AsyncFile fFile;
+  bool fError;
+
+  unsigned int fCurrent;           // buffer being filled
+  unsigned int fFill;              // bytes in it
+  uint64_t fCurrentOffset; // file offset of its first byte
+
+  std::vector<Patch> fPatches;
+};
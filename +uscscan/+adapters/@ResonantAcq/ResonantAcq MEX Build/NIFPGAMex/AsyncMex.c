@@ -118,6 +118,19 @@ LRESULT CALLBACK AsyncMex_CallbackMessagePumpHook(int code, WPARAM wParam, LPARA
         ((AsyncMex*)(msg->wParam))->callback(msg->lParam, ((AsyncMex*)(msg->wParam))->userData);
         return 0;
       }
+      else if (msg->message == ASYNCMEX_COALESCED_WINDOWMESSAGE_ID)
+      {
+        //Clear the outstanding flag before taking the count: an event posted in between is either
+        //in the count, or posts a message of its own (which may then find nothing to deliver).
+        AsyncMex* asyncM = (AsyncMex*)(msg->wParam);
+        LONG numEvents;
+        InterlockedExchange(&asyncM->messageOutstanding, 0);
+        numEvents = InterlockedExchange(&asyncM->pendingEvents, 0);
+        AsyncMex_DebugMsg("AsyncMex_CallbackMessagePumpHook: Invoking user-level callback for %d coalesced events...\n", numEvents);
+        if (numEvents > 0)
+          asyncM->callback((LPARAM)numEvents, asyncM->userData);
+        return 0;
+      }
       else
 	  {
         result = CallNextHookEx(NULL, code, wParam, lParam);//This is a peek operation, let it slide.
@@ -182,7 +195,10 @@ int AsyncMex_intialize(AsyncMex* asyncM)
   if (ASYNCMEX_WINDOWMESSAGE_ID == 0)
     ASYNCMEX_WINDOWMESSAGE_ID = RegisterWindowMessage(ASYNCMEX_WINDOWMESSAGE_NAME);
 
-  if (!ASYNCMEX_WINDOWMESSAGE_ID)
+  if (ASYNCMEX_COALESCED_WINDOWMESSAGE_ID == 0)
+    ASYNCMEX_COALESCED_WINDOWMESSAGE_ID = RegisterWindowMessage(ASYNCMEX_COALESCED_WINDOWMESSAGE_NAME);
+
+  if (!ASYNCMEX_WINDOWMESSAGE_ID || !ASYNCMEX_COALESCED_WINDOWMESSAGE_ID)
   {
     AsyncMex_printWindowsErrorMessage(__LINE__);
     return -2;
@@ -206,6 +222,123 @@ int AsyncMex_postEventMessage(AsyncMex* asyncM, LPARAM lParam)
   return 0;
 }
 
+/**
+ * @brief Posts the coalesced event message, unless one is already waiting.
+ * @arg <tt>asyncM</tt> - The <tt>AsyncMex</tt> to be used to pass an event.
+ * @return 0 if successful, non-zero otherwise.
+ */
+static int AsyncMex_postCoalescedMessage(AsyncMex* asyncM)
+{
+  LARGE_INTEGER now;
+
+  if (InterlockedCompareExchange(&asyncM->messageOutstanding, 1, 0) != 0)
+    return 0;
+
+  QueryPerformanceCounter(&now);
+  asyncM->lastEventTicks = now.QuadPart;
+  if (!PostThreadMessage(asyncM->matlabThreadID, ASYNCMEX_COALESCED_WINDOWMESSAGE_ID, (WPARAM)asyncM, 0))
+  {
+    InterlockedExchange(&asyncM->messageOutstanding, 0);
+    return -2;
+  }
+
+  return 0;
+}
+
+/**
+ * @brief Timer-queue callback of a deferred post: delivers the events held back by the minimum
+ * event interval, which has passed by now.
+ */
+static VOID CALLBACK AsyncMex_deferredPostCallback(PVOID lpParameter, BOOLEAN timerOrWaitFired)
+{
+  AsyncMex* asyncM = (AsyncMex*)lpParameter;
+
+  //Clear the flag before looking at the count: an event held back in between either is in the
+  //count, or schedules a deferred post of its own.
+  InterlockedExchange(&asyncM->deferredPostScheduled, 0);
+  if (asyncM->pendingEvents > 0)
+    AsyncMex_postCoalescedMessage(asyncM);
+}
+
+/**
+ * @brief Schedules a deferred post for when the minimum event interval since the last coalesced
+ * event message has passed, unless one is already scheduled.
+ * @arg <tt>asyncM</tt> - The <tt>AsyncMex</tt> to be used to pass an event.
+ * @arg <tt>elapsedTicks</tt> - Performance counter ticks since the last coalesced event message.
+ * @return 0 if successful, non-zero otherwise.
+ */
+static int AsyncMex_scheduleDeferredPost(AsyncMex* asyncM, LONGLONG elapsedTicks)
+{
+  LARGE_INTEGER freq;
+  DWORD dueMs;
+  HANDLE timer;
+  HANDLE lastTimer;
+
+  if (InterlockedCompareExchange(&asyncM->deferredPostScheduled, 1, 0) != 0)
+    return 0;
+
+  QueryPerformanceFrequency(&freq);
+  dueMs = (DWORD)(((asyncM->minEventIntervalTicks - elapsedTicks) * 1000 + freq.QuadPart - 1) / freq.QuadPart);
+  if (!CreateTimerQueueTimer(&timer, NULL, AsyncMex_deferredPostCallback, asyncM,
+                             dueMs, 0, WT_EXECUTEONLYONCE))
+  {
+    InterlockedExchange(&asyncM->deferredPostScheduled, 0);
+    AsyncMex_printWindowsErrorMessage(__LINE__);
+    return -3;
+  }
+
+  //The last timer has fired (its callback cleared the flag), so deleting it does not cancel a post.
+  lastTimer = InterlockedExchangePointer(&asyncM->deferredPostTimer, timer);
+  if (lastTimer != NULL)
+    DeleteTimerQueueTimer(NULL, lastTimer, NULL);
+
+  return 0;
+}
+
+int AsyncMex_postCoalescedEvent(AsyncMex* asyncM)
+{
+  LARGE_INTEGER now;
+  LONGLONG elapsedTicks;
+
+  AsyncMex_DebugMsg("AsyncMex_postCoalescedEvent(@%p)\n", asyncM);
+  if (asyncM->matlabThreadID == 0)
+    return -1;
+
+  InterlockedIncrement(&asyncM->pendingEvents);
+  if (asyncM->messageOutstanding)
+    return 0;
+
+  if (asyncM->minEventIntervalTicks > 0)
+  {
+    QueryPerformanceCounter(&now);
+    elapsedTicks = now.QuadPart - asyncM->lastEventTicks;
+    if (elapsedTicks < asyncM->minEventIntervalTicks)
+      return AsyncMex_scheduleDeferredPost(asyncM, elapsedTicks);
+  }
+
+  return AsyncMex_postCoalescedMessage(asyncM);
+}
+
+int AsyncMex_flushCoalescedEvents(AsyncMex* asyncM)
+{
+  AsyncMex_DebugMsg("AsyncMex_flushCoalescedEvents(@%p)\n", asyncM);
+  if (asyncM->matlabThreadID == 0)
+    return -1;
+
+  if (asyncM->pendingEvents == 0)
+    return 0;
+
+  return AsyncMex_postCoalescedMessage(asyncM);
+}
+
+void AsyncMex_setMinEventInterval(AsyncMex* asyncM, double seconds)
+{
+  LARGE_INTEGER freq;
+
+  QueryPerformanceFrequency(&freq);
+  asyncM->minEventIntervalTicks = (seconds > 0) ? (LONGLONG)(seconds * freq.QuadPart) : 0;
+}
+
 AsyncMex* AsyncMex_create(AsyncMex_Callback* callback, void* userData)
 {
   AsyncMex* asyncM;
@@ -246,6 +379,10 @@ void AsyncMex_destroy(AsyncMex** asyncM)
 
   if ((*asyncM)->messagePumpHookID != 0)
     UnhookWindowsHookEx((*asyncM)->messagePumpHookID);
+
+  //Wait for a deferred post that is under way, which uses the object.
+  if ((*asyncM)->deferredPostTimer != NULL)
+    DeleteTimerQueueTimer(NULL, (*asyncM)->deferredPostTimer, INVALID_HANDLE_VALUE);
   
   //if ((*asyncM)->hwnd != NULL)
   //  AsyncMex_destroyClientWindow
@@ -47,6 +47,10 @@ extern "C" {
 LPCTSTR ASYNCMEX_WINDOWMESSAGE_NAME = "AsyncMex_Event";
 ///@brief The unique identifier (determined at runtime) for AsyncMex events.
 UINT ASYNCMEX_WINDOWMESSAGE_ID;
+///@brief The string used to generate the unique identifier (determined at runtime) for coalesced AsyncMex events.
+LPCTSTR ASYNCMEX_COALESCED_WINDOWMESSAGE_NAME = "AsyncMex_CoalescedEvent";
+///@brief The unique identifier (determined at runtime) for coalesced AsyncMex events.
+UINT ASYNCMEX_COALESCED_WINDOWMESSAGE_ID;
 ///@brief The ID of the (one and only) hook function.
 HHOOK ASYNCMEX_MESSAGE_PUMP_HOOK_ID;
 ///@brief The string used to generate the unique identifier (determined at runtime) for AsyncMex events.
@@ -76,6 +80,18 @@ typedef struct
   HWND hwnd;
   ///@brief The class used when creating the message processing client window.
   WNDCLASSEX wndClass;
+  ///@brief Coalesced events posted since the callback last ran.
+  volatile LONG pendingEvents;
+  ///@brief Non-zero while a coalesced event message is waiting in the Matlab thread's queue.
+  volatile LONG messageOutstanding;
+  ///@brief Minimum time between coalesced event messages, in performance counter ticks (0 = no minimum).
+  LONGLONG minEventIntervalTicks;
+  ///@brief Performance counter when the last coalesced event message was posted.
+  LONGLONG lastEventTicks;
+  ///@brief Non-zero while a deferred post, for events held back by the minimum interval, is scheduled.
+  volatile LONG deferredPostScheduled;
+  ///@brief The timer-queue timer of the last deferred post, deleted when the next one is scheduled.
+  HANDLE volatile deferredPostTimer;
 
 } AsyncMex;
 
@@ -118,6 +134,35 @@ void AsyncMex_destroy(AsyncMex** asyncM);
  */
 int AsyncMex_postEventMessage(AsyncMex* asyncM, LPARAM lParam);
 
+/**
+ * @brief Posts a coalesced event to the Matlab thread, via an <tt>AsyncMex</tt> object.
+ * At most one coalesced event message is waiting at a time: events posted while one waits, or
+ * within the minimum event interval of the last one, are counted instead, and the callback gets
+ * the count as its <tt>lParam</tt>. Events posted after the callback has taken the count are
+ * delivered by a later message, so none is lost. Events held back by the minimum interval are
+ * delivered once it has passed, by a timer if no later event comes first; so the last ones of a
+ * burst arrive at most one interval late.
+ * Safe to call from any thread.
+ * @arg <tt>asyncM</tt> - The <tt>AsyncMex</tt> to be used to pass an event.
+ * @return 0 if successful, non-zero otherwise.
+ */
+int AsyncMex_postCoalescedEvent(AsyncMex* asyncM);
+
+/**
+ * @brief Posts a coalesced event message for any coalesced events not yet delivered, ignoring the
+ * minimum event interval.
+ * @arg <tt>asyncM</tt> - The <tt>AsyncMex</tt> to be flushed.
+ * @return 0 if successful, non-zero otherwise.
+ */
+int AsyncMex_flushCoalescedEvents(AsyncMex* asyncM);
+
+/**
+ * @brief Sets the minimum time between coalesced event messages, capping the callback rate.
+ * @arg <tt>asyncM</tt> - The <tt>AsyncMex</tt> to be configured.
+ * @arg <tt>seconds</tt> - The minimum interval; 0 for none.
+ */
+void AsyncMex_setMinEventInterval(AsyncMex* asyncM, double seconds);
+
 /**
  * @brief Creates a window, for programs that need to process messages.
  * @arg <tt>asyncM</tt> - The <tt>AsyncMex</tt> for which to create a window.
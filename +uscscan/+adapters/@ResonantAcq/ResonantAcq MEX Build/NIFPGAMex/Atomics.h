@@ -0,0 +1,92 @@
+#pragma once
+
+#include "Platform.h"
+
+#ifdef _MSC_VER
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX // the core uses std::min/max
+#endif
+#include <windows.h>
+#endif
+
+// Full memory barrier (MemoryBarrier on Windows).
+inline void
+fullBarrier(void)
+{
+#ifdef _MSC_VER
+  MemoryBarrier();
+#else
+  __sync_synchronize();
+#endif
+}
+
+// Handoff of a word between threads. Used where each word has exactly
+// one writer, so no interlocked read-modify-write is needed; the
+// barriers order the data written before a storeRelease (eg a record
+// memcpy) against publication of the word, and the data read after a
+// loadAcquire against reading it.
+template <typename T>
+inline T
+loadAcquire(const volatile T &v)
+{
+  T val = v;
+  fullBarrier();
+  return val;
+}
+
+template <typename T>
+inline void
+storeRelease(volatile T &v, T val)
+{
+  fullBarrier();
+  v = val;
+}
+
+// Interlocked read-modify-writes, for words with more than one writer.
+// Like the Interlocked functions they wrap on Windows, each is a full
+// barrier. atomicIncrement/Decrement return the new value; the others
+// return the value before.
+#ifdef _MSC_VER
+
+inline long atomicIncrement(volatile long &v) { return InterlockedIncrement(&v); }
+inline long atomicDecrement(volatile long &v) { return InterlockedDecrement(&v); }
+inline long atomicExchange(volatile long &v, long val) { return InterlockedExchange(&v,val); }
+
+inline int64_t atomicIncrement64(volatile int64_t &v) { return InterlockedIncrement64(&v); }
+inline int64_t atomicAdd64(volatile int64_t &v, int64_t val) { return InterlockedExchangeAdd64(&v,val); }
+inline int64_t atomicExchange64(volatile int64_t &v, int64_t val) { return InterlockedExchange64(&v,val); }
+inline int64_t
+atomicCompareExchange64(volatile int64_t &v, int64_t val, int64_t comparand)
+{
+  return InterlockedCompareExchange64(&v,val,comparand);
+}
+
+#else
+
+inline long atomicIncrement(volatile long &v) { return __sync_add_and_fetch(&v,1L); }
+inline long atomicDecrement(volatile long &v) { return __sync_sub_and_fetch(&v,1L); }
+inline long
+atomicExchange(volatile long &v, long val)
+{
+  __sync_synchronize(); // __sync_lock_test_and_set is only an acquire
+  return __sync_lock_test_and_set(&v,val);
+}
+
+inline int64_t atomicIncrement64(volatile int64_t &v) { return __sync_add_and_fetch(&v,(int64_t) 1); }
+inline int64_t atomicAdd64(volatile int64_t &v, int64_t val) { return __sync_fetch_and_add(&v,val); }
+inline int64_t
+atomicExchange64(volatile int64_t &v, int64_t val)
+{
+  __sync_synchronize();
+  return __sync_lock_test_and_set(&v,val);
+}
+inline int64_t
+atomicCompareExchange64(volatile int64_t &v, int64_t val, int64_t comparand)
+{
+  return __sync_val_compare_and_swap(&v,comparand,val);
+}
+
+#endif
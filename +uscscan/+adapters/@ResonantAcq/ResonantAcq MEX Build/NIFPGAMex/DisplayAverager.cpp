@@ -0,0 +1,152 @@
+#include <string.h>
+#include "DisplayAverager.h"
+#include "FrameKernels.h"
+#include "Misc.h"
+
+DisplayAverager::Mode
+DisplayAverager::modeFromString(const char *str)
+{
+  if (strcmp(str,"boxcar")==0) {
+    return BOXCAR;
+  } else if (strcmp(str,"exponential")==0) {
+    return EXPONENTIAL;
+  }
+  return NONE;
+}
+
+DisplayAverager::DisplayAverager(void) :
+  fMode(NONE),
+  fNumPixels(0),
+  fNumFrames(1),
+  fWeight(1.0f),
+  fInterval(1),
+  fFramesAdded(0),
+  fFramesSinceEmit(0)
+{
+}
+
+void
+DisplayAverager::configure(Mode mode, std::size_t numPixels, unsigned int numFrames,
+			   double weight, unsigned int interval)
+{
+  fMode = mode;
+  fNumPixels = numPixels;
+  fNumFrames = numFrames>0 ? numFrames : 1;
+  if (fMode==BOXCAR && fNumFrames>MAX_BOXCAR_FRAMES) {
+    CONSOLEPRINT("DisplayAverager: %u frames is too many to average; using %u.\n",
+		 fNumFrames,MAX_BOXCAR_FRAMES);
+    fNumFrames = MAX_BOXCAR_FRAMES;
+  }
+  if (fMode==EXPONENTIAL && (weight<=0.0 || weight>1.0)) {
+    CONSOLEPRINT("DisplayAverager: weight %g is outside (0,1]; using 1.\n",weight);
+    weight = 1.0;
+  }
+  fWeight = (float) weight;
+
+  if (interval>0) {
+    fInterval = interval;
+  } else if (fMode==EXPONENTIAL) {
+    fInterval = (unsigned int) (1.0/weight+0.5);
+  } else {
+    fInterval = fNumFrames;
+  }
+
+  // Release whatever the other mode used.
+  std::vector<int32_t>().swap(fSums);
+  std::vector<int16_t>().swap(fHistory);
+  std::vector<float>().swap(fAverage);
+  if (fMode==BOXCAR) {
+    fSums.resize(fNumPixels);
+    fHistory.resize(fNumFrames*fNumPixels);
+  } else if (fMode==EXPONENTIAL) {
+    fAverage.resize(fNumPixels);
+  }
+
+  reset();
+}
+
+bool
+DisplayAverager::isEnabled(void) const
+{
+  return fMode!=NONE;
+}
+
+DisplayAverager::Mode
+DisplayAverager::mode(void) const
+{
+  return fMode;
+}
+
+unsigned int
+DisplayAverager::interval(void) const
+{
+  return fInterval;
+}
+
+void
+DisplayAverager::reset(void)
+{
+  fFramesAdded = 0;
+  fFramesSinceEmit = 0;
+  if (!fSums.empty()) {
+    memset(&fSums[0],0,fSums.size()*sizeof(int32_t));
+  }
+}
+
+bool
+DisplayAverager::addFrame(const int16_t *frame)
+{
+  assert(isEnabled());
+  if (fNumPixels==0) {
+    return false;
+  }
+
+  if (fMode==BOXCAR) {
+    int16_t *slot = &fHistory[(fFramesAdded%fNumFrames)*fNumPixels];
+    if (fFramesAdded<fNumFrames) {
+      FrameKernels::accumulate(frame,&fSums[0],fNumPixels);
+    } else {
+      // slot holds the frame leaving the window.
+      FrameKernels::slide(frame,slot,&fSums[0],fNumPixels);
+    }
+    memcpy(slot,frame,fNumPixels*sizeof(int16_t));
+  } else {
+    if (fFramesAdded==0) {
+      for (std::size_t i=0;i<fNumPixels;i++) {
+	fAverage[i] = (float) frame[i];
+      }
+    } else {
+      FrameKernels::exponentialAverage(frame,&fAverage[0],fNumPixels,fWeight);
+    }
+  }
+  fFramesAdded++;
+
+  if (++fFramesSinceEmit<fInterval) {
+    return false;
+  }
+  fFramesSinceEmit = 0;
+  return true;
+}
+
+void
+DisplayAverager::computeAverage(int16_t *dst) const
+{
+  assert(isEnabled());
+  if (fNumPixels==0 || fFramesAdded==0) {
+    return;
+  }
+  if (fMode==BOXCAR) {
+    FrameKernels::divideNarrow(&fSums[0],dst,fNumPixels,(unsigned int) framesAveraged());
+  } else {
+    FrameKernels::roundNarrow(&fAverage[0],dst,fNumPixels);
+  }
+}
+
+unsigned long
+DisplayAverager::framesAveraged(void) const
+{
+  if (fMode==BOXCAR && fFramesAdded>fNumFrames) {
+    return fNumFrames;
+  }
+  return fFramesAdded;
+}
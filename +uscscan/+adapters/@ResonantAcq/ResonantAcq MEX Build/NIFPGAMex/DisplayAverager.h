@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include "Platform.h" // for int16_t
+
+// Averages the frame stream for display, so that MATLAB gets a few
+// clean frames instead of every noisy one. Owned by FrameCopier, which
+// adds every frame it stores and, when addFrame() says one is due,
+// writes the average out to the display queue.
+//
+// Two modes:
+// * BOXCAR: the mean of the last numFrames frames. Kept as a running
+// int32 sum plus a ring of the frames in it, so each frame costs one
+// pass however large numFrames is.
+// * EXPONENTIAL: avg += weight*(frame-avg), kept in float. The first
+// frame after reset() starts the average.
+// Either way an averaged frame is due every interval frames. BOXCAR
+// averages truncate toward zero, like logging averages; EXPONENTIAL
+// ones are rounded to nearest.
+//
+// Frames are int16 pixels, all channels' planes back to back, as in the
+// shared frame queue; any frame tag is the caller's business.
+//
+// Not thread-safe; used by the copier thread only.
+class DisplayAverager {
+
+ public:
+
+  enum Mode { NONE = 0, BOXCAR, EXPONENTIAL };
+
+  // Longest BOXCAR window: the most int16 pixels an int32 sum can hold.
+  static const unsigned int MAX_BOXCAR_FRAMES = 65535;
+
+  // 'boxcar' or 'exponential'; anything else (eg 'none') is NONE.
+  static Mode modeFromString(const char *str);
+
+  DisplayAverager(void);
+
+  // Set up for frames of numPixels pixels. numFrames (BOXCAR) is the
+  // window length, clamped to MAX_BOXCAR_FRAMES; weight (EXPONENTIAL) is the weight of each new frame,
+  // in (0,1]. interval is the number of frames per averaged frame
+  // emitted; 0 means numFrames for BOXCAR and round(1/weight) for
+  // EXPONENTIAL, ie about one new frame's worth of signal per emitted
+  // frame. Also does reset().
+  void configure(Mode mode, std::size_t numPixels, unsigned int numFrames,
+		 double weight, unsigned int interval);
+
+  bool isEnabled(void) const;
+
+  Mode mode(void) const;
+
+  unsigned int interval(void) const;
+
+  // Start over, eg for a new acquisition.
+  void reset(void);
+
+  // Add the next frame. Returns true if an averaged frame is due.
+  bool addFrame(const int16_t *frame);
+
+  // Write the current average (numPixels pixels) to dst.
+  void computeAverage(int16_t *dst) const;
+
+  // Frames in the current average: up to numFrames for BOXCAR, frames
+  // since reset() for EXPONENTIAL.
+  unsigned long framesAveraged(void) const;
+
+ private:
+  Mode fMode;
+  std::size_t fNumPixels;
+  unsigned int fNumFrames;
+  float fWeight;
+  unsigned int fInterval;
+
+  unsigned long fFramesAdded;
+  unsigned int fFramesSinceEmit;
+
+  std::vector<int32_t> fSums;     // BOXCAR
+  std::vector<int16_t> fHistory;  // BOXCAR: numFrames frames, a ring
+  std::vector<float> fAverage;    // EXPONENTIAL
+};
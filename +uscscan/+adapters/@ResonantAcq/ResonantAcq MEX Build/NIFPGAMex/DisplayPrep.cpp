@@ -0,0 +1,230 @@
+#include <string.h>
+#include <algorithm>
+#include "DisplayPrep.h"
+#include "Misc.h"
+
+namespace {
+  const std::size_t LUT_SIZE = 65536;
+
+  // Default merge colours: green, red, blue, white.
+  const double DEFAULT_COLORS[DisplayPrep::MAX_CHANNELS][3] = {
+    {0.0, 1.0, 0.0},
+    {1.0, 0.0, 0.0},
+    {0.0, 0.0, 1.0},
+    {1.0, 1.0, 1.0}
+  };
+}
+
+DisplayPrep::DisplayPrep(void) :
+  fNumPlanes(0),
+  fLines(0),
+  fPixels(0),
+  fBinFactor(1),
+  fMerge(false),
+  fOutLines(0),
+  fOutPixels(0)
+{
+  for (int chan=0;chan<MAX_CHANNELS;chan++) {
+    fLuts[chan].resize(LUT_SIZE);
+    setLevels(chan,0,32767);
+    setColor(chan,DEFAULT_COLORS[chan][0],DEFAULT_COLORS[chan][1],DEFAULT_COLORS[chan][2]);
+  }
+}
+
+void
+DisplayPrep::configure(std::size_t numPlanes, std::size_t linesPerFrame, std::size_t pixelsPerLine,
+		       unsigned int binFactor, const std::vector<int> &channels, bool merge)
+{
+  fNumPlanes = numPlanes<(std::size_t) MAX_CHANNELS ? numPlanes : MAX_CHANNELS;
+  fLines = linesPerFrame;
+  fPixels = pixelsPerLine;
+  fMerge = merge;
+
+  std::size_t maxBin = fLines<fPixels ? fLines : fPixels;
+  fBinFactor = binFactor>0 ? binFactor : 1;
+  if (maxBin>0 && fBinFactor>maxBin) {
+    fBinFactor = (unsigned int) maxBin;
+  }
+  fOutLines = fLines/fBinFactor;
+  fOutPixels = fPixels/fBinFactor;
+
+  fChannels.clear();
+  for (std::size_t i=0;i<channels.size();i++) {
+    if (channels[i]>=0 && (std::size_t) channels[i]<fNumPlanes) {
+      fChannels.push_back(channels[i]);
+    } else {
+      CONSOLEPRINT("DisplayPrep: ignoring channel %d; frames have %d.\n",channels[i]+1,(int) fNumPlanes);
+    }
+  }
+  if (channels.empty()) {
+    for (std::size_t p=0;p<fNumPlanes;p++) {
+      fChannels.push_back((int) p);
+    }
+  }
+
+  fLineSums.assign(fOutPixels,0);
+  fBinned.assign(fOutPixels,0);
+  fRgb.assign(fMerge ? 3*fOutPixels : 0,0);
+}
+
+void
+DisplayPrep::setLevels(int chan, int black, int white)
+{
+  assert(chan>=0 && chan<MAX_CHANNELS);
+  if (white<=black) {
+    white = black+1;
+  }
+  // In integers, so that halves round up exactly.
+  int64_t range = (int64_t) white-(int64_t) black;
+  uint8_t *lut = &fLuts[chan][0];
+  for (int v=-32768;v<=32767;v++) {
+    uint8_t out;
+    if (v<=black) {
+      out = 0;
+    } else if (v>=white) {
+      out = 255;
+    } else {
+      out = (uint8_t) ((2*255*((int64_t) v-black)+range)/(2*range));
+    }
+    lut[(uint16_t) v] = out;
+  }
+}
+
+void
+DisplayPrep::setColor(int chan, double r, double g, double b)
+{
+  assert(chan>=0 && chan<MAX_CHANNELS);
+  double rgb[3] = {r,g,b};
+  for (int k=0;k<3;k++) {
+    double w = rgb[k]<0.0 ? 0.0 : rgb[k]>1.0 ? 1.0 : rgb[k];
+    fColorWeights[chan][k] = (unsigned int) (w*256.0+0.5);
+  }
+}
+
+unsigned int
+DisplayPrep::binFactor(void) const
+{
+  return fBinFactor;
+}
+
+bool
+DisplayPrep::merge(void) const
+{
+  return fMerge;
+}
+
+const std::vector<int>&
+DisplayPrep::channels(void) const
+{
+  return fChannels;
+}
+
+std::size_t
+DisplayPrep::outputLines(void) const
+{
+  return fOutLines;
+}
+
+std::size_t
+DisplayPrep::outputPixels(void) const
+{
+  return fOutPixels;
+}
+
+std::size_t
+DisplayPrep::outputPlanes(void) const
+{
+  return fMerge ? 3 : fChannels.size();
+}
+
+std::size_t
+DisplayPrep::outputBytes(void) const
+{
+  return fOutLines*fOutPixels*outputPlanes();
+}
+
+const uint8_t*
+DisplayPrep::lut(int chan) const
+{
+  assert(chan>=0 && chan<MAX_CHANNELS);
+  return &fLuts[chan][0];
+}
+
+const int16_t*
+DisplayPrep::binnedLine(const int16_t *plane, std::size_t outLine)
+{
+  const int16_t *line = plane + outLine*fBinFactor*fPixels;
+  if (fBinFactor==1) {
+    return line;
+  }
+
+  std::fill(fLineSums.begin(),fLineSums.end(),0);
+  for (unsigned int l=0;l<fBinFactor;l++,line+=fPixels) {
+    const int16_t *src = line;
+    for (std::size_t c=0;c<fOutPixels;c++) {
+      int32_t sum = 0;
+      for (unsigned int k=0;k<fBinFactor;k++) {
+	sum += *src++;
+      }
+      fLineSums[c] += sum;
+    }
+  }
+  int32_t binSize = (int32_t) (fBinFactor*fBinFactor);
+  for (std::size_t c=0;c<fOutPixels;c++) {
+    fBinned[c] = (int16_t) (fLineSums[c]/binSize);
+  }
+  return &fBinned[0];
+}
+
+// One output line at a time, so binning needs only a line of sums. The
+// output is column-major, so each line is written with a stride of
+// outputLines(); binned output is small enough for that not to matter.
+void
+DisplayPrep::prepare(const int16_t *frame, uint8_t *dst)
+{
+  std::size_t planeSizePixels = fLines*fPixels;
+  std::size_t outPlaneSize = fOutLines*fOutPixels;
+  if (outPlaneSize==0) {
+    return;
+  }
+
+  for (std::size_t r=0;r<fOutLines;r++) {
+    if (fMerge) {
+      std::fill(fRgb.begin(),fRgb.end(),0);
+    }
+
+    for (std::size_t i=0;i<fChannels.size();i++) {
+      int chan = fChannels[i];
+      const int16_t *line = binnedLine(frame + chan*planeSizePixels,r);
+      const uint8_t *lut = &fLuts[chan][0];
+      if (fMerge) {
+	const unsigned int *w = fColorWeights[chan];
+	uint32_t *red = &fRgb[0];
+	uint32_t *green = red + fOutPixels;
+	uint32_t *blue = green + fOutPixels;
+	for (std::size_t c=0;c<fOutPixels;c++) {
+	  uint32_t v = lut[(uint16_t) line[c]];
+	  red[c] += v*w[0];
+	  green[c] += v*w[1];
+	  blue[c] += v*w[2];
+	}
+      } else {
+	uint8_t *out = dst + i*outPlaneSize + r;
+	for (std::size_t c=0;c<fOutPixels;c++) {
+	  out[c*fOutLines] = lut[(uint16_t) line[c]];
+	}
+      }
+    }
+
+    if (fMerge) {
+      for (int k=0;k<3;k++) {
+	const uint32_t *sums = &fRgb[k*fOutPixels];
+	uint8_t *out = dst + k*outPlaneSize + r;
+	for (std::size_t c=0;c<fOutPixels;c++) {
+	  uint32_t v = (sums[c]+128)>>8;
+	  out[c*fOutLines] = (uint8_t) (v>255 ? 255 : v);
+	}
+      }
+    }
+  }
+}
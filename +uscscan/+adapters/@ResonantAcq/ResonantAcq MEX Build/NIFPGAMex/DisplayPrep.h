@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include "Platform.h" // for int16_t, uint8_t
+
+// Turns an int16 frame into what the display shows, so that MATLAB
+// gets small uint8 images instead of full frames to scale itself. Run
+// on its own thread by DisplayPreparer.
+//
+// For each channel shown:
+// * Bin binFactor x binFactor pixels into one: their mean, truncated
+// toward zero like logging averages. Lines and pixels left over at the
+// bottom and right edges are dropped.
+// * Map the binned value through the channel's contrast LUT: black
+// level and below to 0, white level and above to 255, linearly between
+// (rounded to nearest). The LUT covers all 65536 int16 values, so this
+// is one lookup a pixel; it is rebuilt only when the levels change.
+// * Either write the result as that channel's uint8 plane, or (merge)
+// add it, in the channel's colour, into one RGB image, saturating.
+//
+// Output is in MATLAB's column-major order, ready to copy into an
+// mxArray: outputLines x outputPixels x outputPlanes uint8, where the
+// planes are the channels shown, in order, or R, G and B when merged.
+//
+// Frames are int16 pixels, all channels' planes (linesPerFrame x
+// pixelsPerLine, row-major) back to back, as in the shared frame queue;
+// any frame tag is the caller's business.
+//
+// Not thread-safe; used by one thread at a time.
+class DisplayPrep {
+
+ public:
+
+  static const int MAX_CHANNELS = 4;
+
+  DisplayPrep(void);
+
+  // Set up for frames of numPlanes channel planes of linesPerFrame x
+  // pixelsPerLine. channels are the planes to show (0-based), in output
+  // order; empty means all of them. Planes out of range are ignored. A
+  // binFactor of 0 is taken as 1, and one bigger than the frame as the
+  // frame size. Levels and colours are kept.
+  void configure(std::size_t numPlanes, std::size_t linesPerFrame, std::size_t pixelsPerLine,
+		 unsigned int binFactor, const std::vector<int> &channels, bool merge);
+
+  // Black and white levels of plane chan, in pixel values. A white level
+  // not above black is taken as black+1.
+  void setLevels(int chan, int black, int white);
+
+  // Colour of plane chan in a merge: R, G and B weights in [0,1].
+  void setColor(int chan, double r, double g, double b);
+
+  unsigned int binFactor(void) const;
+  bool merge(void) const;
+  const std::vector<int>& channels(void) const;
+
+  std::size_t outputLines(void) const;
+  std::size_t outputPixels(void) const;
+  std::size_t outputPlanes(void) const;
+  std::size_t outputBytes(void) const;
+
+  // The contrast LUT of plane chan, indexed by (uint16_t) pixel value.
+  const uint8_t* lut(int chan) const;
+
+  // Prepare frame into dst (outputBytes() bytes).
+  void prepare(const int16_t *frame, uint8_t *dst);
+
+ private:
+  // Output line outLine of a plane, binned: outputPixels() values,
+  // pointing into the plane itself when there is no binning.
+  const int16_t* binnedLine(const int16_t *plane, std::size_t outLine);
+
+  std::size_t fNumPlanes;
+  std::size_t fLines;
+  std::size_t fPixels;
+  unsigned int fBinFactor;
+  bool fMerge;
+  std::vector<int> fChannels;
+  std::size_t fOutLines;
+  std::size_t fOutPixels;
+
+  std::vector<uint8_t> fLuts[MAX_CHANNELS];
+  unsigned int fColorWeights[MAX_CHANNELS][3]; // 0-256
+
+  std::vector<int32_t> fLineSums; // binning, one output line
+  std::vector<int16_t> fBinned;
+  std::vector<uint32_t> fRgb;     // merge, one output line: R, G then B
+};
@@ -0,0 +1,205 @@
+#include "DisplayPreparer.h"
+#include <string.h>
+#include "Misc.h"
+#include "Atomics.h"
+#include "MulticastFrameQueue.h"
+#include "PipelineStats.h"
+#include "PipelineTrace.h"
+
+void
+DisplayPreparer::configurePrep(const PipelineParams *params, DisplayPrep &prep)
+{
+  std::vector<int> channels(params->displayPrepChannels,params->displayPrepChannels+params->displayPrepNumChannels);
+  prep.configure(params->isMultiChannel ? 4 : 1,params->linesPerFrame,params->pixelsPerLine,
+		 params->displayPrepBinFactor,channels,params->displayPrepMerge);
+  for (int chan=0;chan<DisplayPrep::MAX_CHANNELS;chan++) {
+    prep.setLevels(chan,(int) params->displayPrepLevels[chan][0],(int) params->displayPrepLevels[chan][1]);
+    prep.setColor(chan,params->displayPrepColors[chan][0],params->displayPrepColors[chan][1],
+		  params->displayPrepColors[chan][2]);
+  }
+}
+
+std::size_t
+DisplayPreparer::recordSize(const PipelineParams *params)
+{
+  DisplayPrep prep;
+  configurePrep(params,prep);
+  return TAG_BYTES + prep.outputBytes();
+}
+
+DisplayPreparer::DisplayPreparer(PipelineParams *params) :
+  fmp(params),
+  fDownstream(NULL),
+  fStopping(false),
+  fLevelsPending(0),
+  fFramesPrepared(0),
+  fFramesDropped(0)
+{
+}
+
+DisplayPreparer::~DisplayPreparer(void)
+{
+  if (isRunning()) {
+    stop();
+  }
+}
+
+bool
+DisplayPreparer::start(FrameEventSink *downstream)
+{
+  assert(!isRunning());
+  assert(fmp->displayQueue!=NULL);
+
+  configurePrep(fmp,fPrep);
+  if (TAG_BYTES+fPrep.outputBytes()!=fmp->preparedFrameQueue->recordSize()) {
+    CONSOLEPRINT("DisplayPreparer: prepared frame queue holds %d-byte records, not %d; resize the acquisition.\n",
+		 (int) fmp->preparedFrameQueue->recordSize(),(int) (TAG_BYTES+fPrep.outputBytes()));
+    return false;
+  }
+  fmp->preparedFrameQueue->reinit();
+  fDownstream = downstream;
+  fLevelsPending = 0;
+  fFramesPrepared = 0;
+  fFramesDropped = 0;
+
+  fStopping = false;
+  if (!fThread.start(DisplayPreparer::threadFcn,this)) {
+    CONSOLEPRINT("DisplayPreparer: could not start the display prep thread.\n");
+    return false;
+  }
+  CONSOLEPRINT("DisplayPreparer: %d x %d x %d uint8 display frames (bin %u%s)\n",
+	       (int) fPrep.outputLines(),(int) fPrep.outputPixels(),(int) fPrep.outputPlanes(),
+	       fPrep.binFactor(),fPrep.merge() ? ", merged" : "");
+  return true;
+}
+
+void
+DisplayPreparer::stop(void)
+{
+  assert(isRunning());
+
+  fStopping = true;
+  fullBarrier();
+  fWakeEvent.set();
+  if (!fThread.join(STOP_TIMEOUT_MILLISECONDS)) {
+    // The thread still reads the queues and fmp, so it must be gone before
+    // stop returns; it has been told to stop, so keep waiting.
+    CONSOLEPRINT("DisplayPreparer: display prep thread is slow to stop; still waiting.\n");
+    fThread.join(Platform::Event::WAIT_FOREVER);
+  }
+}
+
+bool
+DisplayPreparer::isRunning(void) const
+{
+  return fThread.isStarted();
+}
+
+const DisplayPrep&
+DisplayPreparer::prep(void) const
+{
+  return fPrep;
+}
+
+void
+DisplayPreparer::setLevels(const double levels[][2])
+{
+  {
+    Platform::Mutex::Lock lock(fLevelsMutex);
+    for (int chan=0;chan<DisplayPrep::MAX_CHANNELS;chan++) {
+      fPendingLevels[chan][0] = levels[chan][0];
+      fPendingLevels[chan][1] = levels[chan][1];
+    }
+  }
+  atomicExchange(fLevelsPending,1);
+  fWakeEvent.set();
+}
+
+void
+DisplayPreparer::frameAvailable(void)
+{
+  fWakeEvent.set();
+}
+
+unsigned long
+DisplayPreparer::framesPrepared(void) const
+{
+  return (unsigned long) fFramesPrepared;
+}
+
+unsigned long
+DisplayPreparer::framesDropped(void) const
+{
+  return (unsigned long) fFramesDropped;
+}
+
+// Called by the display prep thread. Rebuilding the LUTs takes a
+// fraction of a millisecond, so it is done between frames.
+void
+DisplayPreparer::applyPendingLevels(void)
+{
+  if (atomicExchange(fLevelsPending,0)==0) {
+    return;
+  }
+  double levels[DisplayPrep::MAX_CHANNELS][2];
+  {
+    Platform::Mutex::Lock lock(fLevelsMutex);
+    memcpy(levels,fPendingLevels,sizeof(levels));
+  }
+  for (int chan=0;chan<DisplayPrep::MAX_CHANNELS;chan++) {
+    fPrep.setLevels(chan,(int) levels[chan][0],(int) levels[chan][1]);
+  }
+}
+
+// Called by the display prep thread, the display queue's only consumer
+// while it runs. The preparedQueue reader is DROP_OLDEST, so there is
+// room unless MATLAB holds the oldest slot.
+void
+DisplayPreparer::prepareWaitingFrames(void)
+{
+  FrameQueueReader *displayQueue = fmp->displayQueue;
+  const int16_t *src;
+  while ((src = static_cast<const int16_t*>(displayQueue->acquire_front()))!=NULL) {
+    fmp->stats->record(PipelineStats::DISPLAY_QUEUE_DWELL,displayQueue->acquired_ticks());
+
+    char *slot = static_cast<char*>(fmp->preparedFrameQueue->reserve_back());
+    if (slot!=NULL) {
+      int64_t t0 = fmp->stats->start();
+      unsigned long tag = 0;
+      if (fmp->frameTagging) {
+	// The FPGA's count of acquired records, in the tag's last two words.
+	size_t tagIdx = (fmp->frameSizeBytes-fmp->tagSizeBytes)/2;
+	tag = (unsigned long) (uint16_t) src[tagIdx+2]*65536UL + (unsigned long) (uint16_t) src[tagIdx+3];
+      }
+      memcpy(slot,&tag,sizeof(tag));
+      fPrep.prepare(src,reinterpret_cast<uint8_t*>(slot+TAG_BYTES));
+      fmp->preparedFrameQueue->commit_back();
+      fmp->stats->record(PipelineStats::DISPLAY_PREP,t0);
+      atomicIncrement(fFramesPrepared);
+    } else {
+      atomicIncrement(fFramesDropped);
+      TRACE_EVENT(TRACE_EVENTS,TRACE_PREPARED_QUEUE_FULL,fFramesDropped,0,0);
+    }
+    displayQueue->release_front();
+
+    if (slot!=NULL && fDownstream!=NULL) {
+      fDownstream->frameAvailable();
+    }
+  }
+}
+
+void
+DisplayPreparer::threadFcn(void *userData)
+{
+  DisplayPreparer *obj = static_cast<DisplayPreparer*>(userData);
+
+  // Stopping is checked first, so it wins over a frame.
+  for (;;) {
+    obj->fWakeEvent.wait(Platform::Event::WAIT_FOREVER);
+    if (loadAcquire(obj->fStopping)) {
+      break;
+    }
+    obj->applyPendingLevels();
+    obj->prepareWaitingFrames();
+  }
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "Platform.h"
+#include "PipelineParams.h"
+#include "DisplayPrep.h"
+
+// Runs DisplayPrep on its own thread, between the display queue and
+// MATLAB, with display prep on (displayPrepEnabled): binning, contrast
+// and channel merging are done here, off both the copier and the MATLAB
+// thread, and MATLAB gets only the small uint8 results.
+//
+// It sits in the frame event chain. While it runs it is the copier's
+// frame event sink (PipelineParams::frameEvents); each event wakes its
+// thread, which prepares every frame waiting in displayQueue (raw or
+// averaged) into preparedFrameQueue and tells the downstream sink (in
+// the MEX, MatlabParams) of each one. MATLAB reads preparedQueue in
+// place of displayQueue.
+//
+// A preparedFrameQueue record is the frame tag (an unsigned long; 0
+// without frame tagging) in the first TAG_BYTES, then the frame as
+// DisplayPrep::prepare writes it.
+//
+// Thread-safety. One controller thread calls start, stop and
+// setLevels; frameAvailable is called on the copier's thread.
+class DisplayPreparer : public FrameEventSink {
+
+ public:
+
+  static const std::size_t TAG_BYTES = 8;
+
+  // Configure prep for the frame geometry and display prep settings in
+  // params.
+  static void configurePrep(const PipelineParams *params, DisplayPrep &prep);
+
+  // Size of a preparedFrameQueue record for the settings in params.
+  static std::size_t recordSize(const PipelineParams *params);
+
+  // params is not owned, and must outlive the preparer. Its settings
+  // are read at start.
+  DisplayPreparer(PipelineParams *params);
+
+  ~DisplayPreparer(void);
+
+  // Configure from params, clear preparedFrameQueue and start the thread.
+  // params->displayQueue must already be chosen (FrameCopier does this at
+  // startProcessing); frames already in it are prepared right away.
+  // downstream is told of each prepared frame. Returns false if the
+  // thread could not be started.
+  bool start(FrameEventSink *downstream);
+
+  // Stop the thread, blocking until it has finished the frame in hand.
+  // Frames still waiting in displayQueue are left there.
+  void stop(void);
+
+  bool isRunning(void) const;
+
+  // The prep the thread runs, as configured at start: the output geometry
+  // for readers of preparedQueue.
+  const DisplayPrep& prep(void) const;
+
+  // New contrast levels, [black white] for each frame plane (as
+  // PipelineParams::displayPrepLevels), taken up before the next frame.
+  void setLevels(const double levels[][2]);
+
+  // FrameEventSink: wake the thread. Called on the copier's thread.
+  void frameAvailable(void);
+
+  // Since start: frames prepared, and frames dropped because
+  // preparedFrameQueue had no room.
+  unsigned long framesPrepared(void) const;
+  unsigned long framesDropped(void) const;
+
+ private:
+  static void threadFcn(void *userData);
+
+  void applyPendingLevels(void);
+
+  void prepareWaitingFrames(void);
+
+  static const unsigned long STOP_TIMEOUT_MILLISECONDS = 5000;
+
+  PipelineParams *fmp;
+  FrameEventSink *fDownstream;
+  DisplayPrep fPrep; // the thread's while it runs
+
+  Platform::Thread fThread;
+  Platform::Event fWakeEvent; // auto-reset: a frame, new levels, or stop
+  volatile bool fStopping;
+
+  Platform::Mutex fLevelsMutex;
+  double fPendingLevels[DisplayPrep::MAX_CHANNELS][2];
+  volatile long fLevelsPending;
+
+  volatile long fFramesPrepared;
+  volatile long fFramesDropped;
+};
@@ -0,0 +1,172 @@
+#include <vector>
+#include "FrameAverager.h"
+#include "FrameKernels.h"
+#include "Misc.h"
+
+namespace
+{
+  // Largest factor whose sums of 16-bit pixels fit in int32
+  // (65535*32768 < 2^31).
+  const unsigned int MAX_INT32_SUM_FRAMES = 32768;
+
+  template <typename PixelT, typename AccT>
+  inline void accumulatePixels(const PixelT *src, AccT *acc, std::size_t numPixels)
+  {
+    for (std::size_t i=0;i<numPixels;i++) {
+      acc[i] += src[i];
+    }
+  }
+
+  inline void accumulatePixels(const int16_t *src, int32_t *acc, std::size_t numPixels)
+  {
+    FrameKernels::accumulate(src,acc,numPixels);
+  }
+
+  inline void accumulatePixels(const uint16_t *src, int32_t *acc, std::size_t numPixels)
+  {
+    FrameKernels::accumulate(src,acc,numPixels);
+  }
+
+  // Integer division truncates toward zero, as the cast of the double
+  // quotient did.
+  template <typename PixelT, typename AccT>
+  inline void dividePixels(const AccT *acc, PixelT *dst, std::size_t numPixels, unsigned int divisor)
+  {
+    AccT d = (AccT) divisor;
+    for (std::size_t i=0;i<numPixels;i++) {
+      dst[i] = (PixelT) (acc[i]/d);
+    }
+  }
+
+  inline void dividePixels(const int32_t *acc, int16_t *dst, std::size_t numPixels, unsigned int divisor)
+  {
+    FrameKernels::divideNarrow(acc,dst,numPixels,divisor);
+  }
+
+  inline void dividePixels(const int32_t *acc, uint16_t *dst, std::size_t numPixels, unsigned int divisor)
+  {
+    FrameKernels::divideNarrow(acc,dst,numPixels,divisor);
+  }
+}
+
+template <typename PixelT, typename AccT>
+class FrameAverager::TypedAccumulator : public FrameAverager::Accumulator {
+ public:
+  explicit TypedAccumulator(std::size_t numPixels) : fSums(numPixels,0) {}
+
+  void reset(void) {
+    if (!fSums.empty()) {
+      memset(&fSums[0],0,fSums.size()*sizeof(AccT));
+    }
+  }
+
+  void add(const void *frame) {
+    if (!fSums.empty()) {
+      accumulatePixels(static_cast<const PixelT*>(frame),&fSums[0],fSums.size());
+    }
+  }
+
+  void computeAverage(void *dst, unsigned int divisor) const {
+    if (!fSums.empty()) {
+      dividePixels(&fSums[0],static_cast<PixelT*>(dst),fSums.size(),divisor);
+    }
+  }
+
+ private:
+  std::vector<AccT> fSums;
+};
+
+FrameAverager::FrameAverager(void) :
+  fAccumulator(NULL),
+  fAverageFactor(1)
+{
+}
+
+FrameAverager::~FrameAverager(void)
+{
+  clear();
+}
+
+bool
+FrameAverager::configure(std::size_t numPixels, unsigned short pixelSizeBytes,
+			 bool signedData, unsigned int averageFactor)
+{
+  assert(averageFactor>0);
+  clear();
+  fAverageFactor = averageFactor;
+
+  bool wideSums = averageFactor>MAX_INT32_SUM_FRAMES;
+  switch (pixelSizeBytes) {
+  case 1:
+    if (signedData) {
+      fAccumulator = new TypedAccumulator<int8_t,int32_t>(numPixels);
+    } else {
+      fAccumulator = new TypedAccumulator<uint8_t,int32_t>(numPixels);
+    }
+    break;
+  case 2:
+    if (wideSums && signedData) {
+      fAccumulator = new TypedAccumulator<int16_t,int64_t>(numPixels);
+    } else if (wideSums) {
+      fAccumulator = new TypedAccumulator<uint16_t,int64_t>(numPixels);
+    } else if (signedData) {
+      fAccumulator = new TypedAccumulator<int16_t,int32_t>(numPixels);
+    } else {
+      fAccumulator = new TypedAccumulator<uint16_t,int32_t>(numPixels);
+    }
+    break;
+  case 4:
+    if (signedData) {
+      fAccumulator = new TypedAccumulator<int32_t,int64_t>(numPixels);
+    } else {
+      fAccumulator = new TypedAccumulator<uint32_t,int64_t>(numPixels);
+    }
+    break;
+  default:
+    CONSOLEPRINT("FrameAverager: unsupported pixel size %u.\n",(unsigned int) pixelSizeBytes);
+    return false;
+  }
+  return true;
+}
+
+bool
+FrameAverager::isConfigured(void) const
+{
+  return fAccumulator!=NULL;
+}
+
+void
+FrameAverager::clear(void)
+{
+  if (fAccumulator!=NULL) {
+    delete fAccumulator;
+    fAccumulator = NULL;
+  }
+}
+
+void
+FrameAverager::reset(void)
+{
+  assert(isConfigured());
+  fAccumulator->reset();
+}
+
+void
+FrameAverager::add(const void *frame)
+{
+  assert(isConfigured());
+  fAccumulator->add(frame);
+}
+
+void
+FrameAverager::computeAverage(void *dst) const
+{
+  assert(isConfigured());
+  fAccumulator->computeAverage(dst,fAverageFactor);
+}
+
+unsigned int
+FrameAverager::averageFactor(void) const
+{
+  return fAverageFactor;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include "Platform.h" // for int16_t etc
+
+// Integer frame averaging for FrameLogger. Sums averageFactor frames
+// pixel by pixel, then writes out the mean, truncated toward zero (the
+// result the logger's original double arithmetic gave).
+//
+// configure() picks an accumulator for the pixel type, so there is no
+// per-pixel dispatch on pixel size. 8- and 16-bit pixels are summed in
+// int32, 32-bit pixels (or factors too large for int32 sums) in int64.
+// The 16-bit case, the one the scanner produces, uses the SSE2 kernels
+// in FrameKernels.
+//
+// Not thread-safe; owned by the logging thread while logging.
+class FrameAverager {
+
+ public:
+
+  FrameAverager(void);
+
+  ~FrameAverager(void);
+
+  // Set up to average frames of numPixels pixels, each pixelSizeBytes
+  // (1, 2 or 4) bytes, signed or unsigned, averageFactor frames at a
+  // time. Sums start at zero. Returns false for an unsupported pixel
+  // size.
+  bool configure(std::size_t numPixels, unsigned short pixelSizeBytes,
+		 bool signedData, unsigned int averageFactor);
+
+  bool isConfigured(void) const;
+
+  // Free the sums; isConfigured() is false afterwards.
+  void clear(void);
+
+  // Zero the sums.
+  void reset(void);
+
+  // Add a frame of numPixels pixels to the sums.
+  void add(const void *frame);
+
+  // Write the mean of the sums (sum/averageFactor) to dst, numPixels
+  // pixels of the configured type.
+  void computeAverage(void *dst) const;
+
+  unsigned int averageFactor(void) const;
+
+ private:
+  class Accumulator {
+   public:
+    virtual ~Accumulator(void) {}
+    virtual void reset(void) = 0;
+    virtual void add(const void *frame) = 0;
+    virtual void computeAverage(void *dst, unsigned int divisor) const = 0;
+  };
+
+  template <typename PixelT, typename AccT> class TypedAccumulator;
+
+  // Not copyable.
+  FrameAverager(const FrameAverager&);
+  FrameAverager& operator=(const FrameAverager&);
+
+ private:
+  Accumulator *fAccumulator;
+  unsigned int fAverageFactor;
+};
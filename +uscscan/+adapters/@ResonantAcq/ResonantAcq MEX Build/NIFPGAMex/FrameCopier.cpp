@@ -1,80 +1,61 @@
-#pragma once
-
-#include "stdafx.h"
 #include "FrameCopier.h"
 #include <sstream>
-#include <process.h>
-#include "StateModelObject.h"
-#include "FrameQueue.h"
-
-FrameCopier::FrameCopier(void) : 
+#include <string.h>
+#include <stdlib.h>
+#include "Misc.h"
+#include "Atomics.h"
+#include "MulticastFrameQueue.h"
+#include "FrameHistory.h"
+#include "PipelineStats.h"
+#include "FrameKernels.h"
+#include "FrameStatsRing.h"
+#include "FrameSource.h"
+#include "FrameSync.h"
+#include "PipelineTrace.h"
+
+FrameCopier::FrameCopier(PipelineParams *params) : 
 fProcessing(0),
 fFramesSeen(0),
 fFramesMissed(0),
 fLastFrameTagCopied(0),
 fInputBuffer(NULL),
-fOutputBuffer(NULL),
 fDeinterlaceBuffer(NULL),
 fMatlabFilteredInputBuf(NULL),
 fOutputDataFilteredInputBuf(NULL),
 fFrameTagEnable(true),
 fMatlabDecimationFactor(1),
-fmp(MatlabParams::getInstance()),
-fStopAcquisition(false)
-
-#define threadSafePrint(...) EnterCriticalSection(&fProcessFrameCS); _cprintf(__VA_ARGS__); LeaveCriticalSection(&fProcessFrameCS)
+fmp(params),
+fFrameSource(NULL),
+fStopAcquisition(false),
+fWaitingForLoggingTrigger(false),
+fLoggingTriggerRequested(0),
+fLoggingTriggerEvent(NULL)
 {
-	fNewFrameEvent = CreateEvent(NULL,FALSE,FALSE,NULL);
-	assert(fNewFrameEvent!=NULL);
-	fStartAcqEvent = CreateEvent(NULL,FALSE,FALSE,NULL);
-	assert(fStartAcqEvent!=NULL);
-	fKillEvent = CreateEvent(NULL,FALSE,FALSE,NULL);
-	assert(fKillEvent!=NULL);
-
-	InitializeCriticalSection(&fProcessFrameCS);
-
-	fmp->asyncMex = NULL;
-	fmp->callbackEnabled = false;
 }
 
 FrameCopier::~FrameCopier(void)
 {
-	if (fThread!=0) {
+	if (fThread.isStarted()) {
 		kill();
 	}
 
-	CFAEMisc::closeHandleAndSetToNULL(fNewFrameEvent);
-	CFAEMisc::closeHandleAndSetToNULL(fStartAcqEvent);
-	CFAEMisc::closeHandleAndSetToNULL(fKillEvent);
-	DeleteCriticalSection(&fProcessFrameCS);
-
-	// fInputBuffer, fOutputQs, fmp->asyncMex not owned
-	// by TFC.
-}
-
-HANDLE
-FrameCopier::getNewFrameEvent(void) const
-{
-	return fNewFrameEvent;
-}
-
+	delete fLoggingTriggerEvent;
 
+	delete fFrameSource;
 
-void
-FrameCopier::configureMatlabCallback(AsyncMex *asyncMex)
-{
-	assert(fState==CONSTRUCTED);
-
-	assert(asyncMex!=NULL);
-	fmp->asyncMex = asyncMex;
+	// fInputBuffer, fmp not owned
+	// by TFC.
 }
 
 void
-FrameCopier::setMatlabCallbackEnable(bool enable)
+FrameCopier::setFrameSource(FrameSource *src)
 {
-	assert(fState==CONSTRUCTED);
+	assert(fState!=RUNNING && fState!=PAUSED);
 
-	fmp->callbackEnabled = enable;
+	if (src!=fFrameSource) {
+		delete fFrameSource;
+		fFrameSource = src;
+	}
 }
 
 void
@@ -88,22 +69,6 @@ FrameCopier::setMatlabDecimationFactor(unsigned int fac)
 	fMatlabDecimationFactor = fac;
 }
 
-void
-FrameCopier::setOutputQueues(const std::vector<FrameQueue*> &outputQs)
-{
-	assert(fState==CONSTRUCTED);
-
-	fOutputQs = outputQs;
-}
-
-void
-FrameCopier::setMatlabQueue(FrameQueue *q)
-{
-	assert(fState==CONSTRUCTED);
-
-	fMatlabQ = q;
-}
-
 
 bool
 FrameCopier::arm(void)
@@ -124,35 +89,15 @@ FrameCopier::arm(void)
 		CONSOLETRACE();
 		tfSuccess = false; 
 	}
-	if (fOutputBuffer==NULL) { 
+	if (fmp->frameQueue==NULL) { 
 		CONSOLETRACE();
 		tfSuccess = false; 
 	}
-	if (fMatlabQ==NULL) { 
+	if (fFrameSource==NULL) { 
 		CONSOLETRACE();
 		tfSuccess = false; 
 	}
-	//if (fInputImageSize!=fMatlabQ->recordSize()) { 
-	//  CONSOLETRACE();
-	//  tfSuccess = false; 
-	//}
-	if (fOutputQs.empty()) { 
-		CONSOLETRACE();
-		tfSuccess = false; 
-	}
-	//std::size_t numQs = fOutputQs.size();
-	//for (std::size_t i=0;i<numQs;i++) {
-	//  if (fInputImageSize!=fOutputQs[i]->recordSize()) { 
-	//    CONSOLETRACE();
-	//    tfSuccess = false; 
-	//  }
-	//}
-
-	if (fmp->asyncMex==NULL) {
-		CONSOLETRACE();
-		tfSuccess = false; 
-	}
-	assert(fThread!=0);
+
 	assert(fProcessing==0);
 
 	if (tfSuccess) {
@@ -166,49 +111,81 @@ void
 FrameCopier::disarm(void)
 {
 	assert(fState==ARMED || fState==STOPPED);
-	assert(fThread!=0);
 	assert(fProcessing==0);
 
 	fState = CONSTRUCTED;
 }
 
-void
-FrameCopier::startAcq(void)
-{
-	SetEvent(fStartAcqEvent);
-}
-
 void
 FrameCopier::startProcessing(void) //const std::vector<int> &outputQsEnabled)
 {
-	MatlabParams* fmp = MatlabParams::getInstance();
-
 	assert(fState==ARMED || fState==STOPPED);
 	CONSOLETRACE();
-	CONSOLEPRINT("matlabQueue: %d",fmp->matlabQueue);
-
-	//fOutputQsEnabled = outputQsEnabled; 
 
 	// If processed data or output Q is not empty, that is unexpected. Throw up a MsgBox.
 	if (!fmp->matlabQueue->isEmpty())
 	{
 		CONSOLETRACE();
 		CONSOLEPRINT("FrameCopier: Processed data queue has size %d!\n",fmp->matlabQueue->size());
-        //Clear the frame queue if there is any residual data from a previous run.
-        fmp->matlabQueue->reinit();
+	}
+	//Clear the frame queue (all readers) of any residual data from a previous run.
+	fmp->frameQueue->reinit();
+
+	//Display averaging. When on, Matlab reads averaged frames from their
+	//own queue, and the raw display reader must not hold frames.
+	fDisplayAverager.configure(DisplayAverager::modeFromString(fmp->displayAveragingMode),
+		fmp->frameSizePixels*fmp->numLoggingChannels,fmp->displayAveragingFrames,
+		fmp->displayAveragingWeight,fmp->displayAveragingInterval);
+	fmp->matlabQueue->setEnabled(!fDisplayAverager.isEnabled());
+	if (fDisplayAverager.isEnabled())
+	{
+		fmp->averagedFrameQueue->reinit();
+		fmp->displayQueue = fmp->averagedQueue;
+		CONSOLEPRINT("FrameCopier: display averaging '%s', one frame to Matlab every %u\n",
+			fmp->displayAveragingMode,fDisplayAverager.interval());
+	}
+	else
+		fmp->displayQueue = fmp->matlabQueue;
+
+	//Triggered logging. Until the trigger, the logging reader is off and the
+	//most recent frames are kept in the frame history instead.
+	fmp->frameHistory->reset();
+	fLoggingTriggerRequested = 0;
+	fWaitingForLoggingTrigger = fmp->loggingEnabled && fmp->loggingWaitForTrigger;
+	if (fWaitingForLoggingTrigger)
+	{
+		if (strlen(fmp->loggingTriggerEventName)>0)
+		{
+			fLoggingTriggerEvent = Platform::Event::openNamed(fmp->loggingTriggerEventName);
+			if (fLoggingTriggerEvent==NULL)
+				CONSOLEPRINT("FrameCopier: could not open logging trigger event '%s' (error %lu).\n",
+					fmp->loggingTriggerEventName,Platform::lastError());
+		}
+		CONSOLEPRINT("FrameCopier: logging waits for its trigger, keeping up to %lu frames before it\n",
+			fmp->frameHistory->capacity());
 	}
 
-	//ResetEvent(fStartAcqEvent);
-	//ResetEvent(fNewFrameEvent);
-	//ResetEvent(fKillEvent);
+	//Pipeline stats (getStats) start afresh with each acquisition. Queue
+	//dwell times need the queues to timestamp their frames.
+	fmp->stats->setEnabled(fmp->statsEnabled);
+	fmp->stats->reset();
+	fmp->frameQueue->setTimestamping(fmp->statsEnabled);
+	fmp->averagedFrameQueue->setTimestamping(fmp->statsEnabled);
+
+	//Frame statistics, numbered afresh with each acquisition.
+	fmp->frameStats->reset();
+	if (fmp->frameStatsEnabled)
+		CONSOLEPRINT("FrameCopier: frame statistics on (%u-bit ADC)\n",fmp->adcBitDepth);
+
 	CONSOLETRACE();
 
 	safeStartProcessing();
 
-	fThread = (HANDLE) _beginthreadex(NULL, 0, FrameCopier::threadFcn, (LPVOID)this, 0, NULL);
+	bool started = fThread.start(FrameCopier::threadFcn, this);
 
-	//Set thread state to RUNNING if fThread is not 0.
-	assert(fThread!=0);
+	//Set thread state to RUNNING if the thread started.
+	assert(started);
+	(void) started;
 	fState = RUNNING;
 }
 
@@ -216,36 +193,25 @@ void
 FrameCopier::stopProcessing(void)
 {
     assert(fState==RUNNING || fState==STOPPED || fState==PAUSED);
-	assert(fThread!=0);
+	assert(fThread.isStarted());
 
 	// Send stop signal.
 	safeStopProcessing();
-	// Stop signal sent. Now wait for logging thread to terminate.
-
-	DWORD retval = WaitForSingleObject(fThread,STOP_TIMEOUT_MILLISECONDS);
-	switch (retval) {
-	  case WAIT_OBJECT_0:
-		  // logging thread completed.
-		  {
-			  BOOL b = CloseHandle(fThread);
-			  assert(b!=0);
-			  fThread = 0;
-		  }
-		  fState = STOPPED;
-		  break;
-
-	  case WAIT_TIMEOUT:
-	  case WAIT_ABANDONED:
-	  case WAIT_FAILED:
-	  default:
-		  CONSOLEPRINT("FrameCopier::HARD STOP!!\n");
-		  assert(fState==STOPPED || fState==KILLED);
-
-		  if (fState==STOPPED) {
-			  CONSOLEPRINT("FrameCopier: Copier could not finish processing. %d frames were unlogged.\n", fmp->matlabQueue->size());
-		  }
-
-		  break;
+	// Stop signal sent. Now wait for the processing thread to terminate.
+
+	if (fThread.join(STOP_TIMEOUT_MILLISECONDS)) {
+		// processing thread completed.
+		fWaitingForLoggingTrigger = false;
+		delete fLoggingTriggerEvent;
+		fLoggingTriggerEvent = NULL;
+		fState = STOPPED;
+	} else {
+		CONSOLEPRINT("FrameCopier::HARD STOP!!\n");
+		assert(fState==STOPPED || fState==KILLED);
+
+		if (fState==STOPPED) {
+			CONSOLEPRINT("FrameCopier: Copier could not finish processing. %d frames were unlogged.\n", fmp->matlabQueue->size());
+		}
 	}
 }
 
@@ -288,22 +254,37 @@ FrameCopier::getFramesMissed(void) const
 }
 
 
+void
+FrameCopier::triggerLogging(void)
+{
+	assert(fState==RUNNING);
+
+	atomicExchange(fLoggingTriggerRequested,1);
+}
+
+bool
+FrameCopier::isWaitingForLoggingTrigger(void) const
+{
+	return fWaitingForLoggingTrigger;
+}
+
 void
 FrameCopier::kill(void)
 {  
-	DWORD threadExitCode = 0; // Used to store exit code for proper call of Terminate Thread.
-//	BOOL returnValue;
-
-	SetEvent(fKillEvent); // nonblocking termination of processing thread
-//	returnValue = GetExitCodeThread(fThread, (LPDWORD) threadExitCode); // get Exit code for fThread from Windows.
-//	CONSOLEPRINT("GetExitCodeThread status: %d, error code: %d\n",returnValue, GetLastError());
-//	returnValue = TerminateThread(fThread,threadExitCode); // Forcibly terminate thread using threadExitCode.
-//	CONSOLEPRINT("TerminateThread status: %d, error code: %d\n",returnValue, GetLastError());
-	CloseHandle(fThread); // Does not forcibly terminate thread, only releases handle. Close handle for cleanup.
-	fThread = 0;
+	// nonblocking termination of processing thread: it exits at its next
+	// check of the stop flag. Detaching does not terminate it.
+	stopAcquisition();
+	safeStopProcessing();
+	fThread.detach();
 	fState = KILLED;
 }
 
+double
+FrameCopier::getProcessingThreadCpuSeconds(void) const
+{
+	return fThread.cpuSeconds();
+}
+
 void
 FrameCopier::debugString(std::string &s) const
 {
@@ -312,8 +293,8 @@ FrameCopier::debugString(std::string &s) const
 	oss << "State Processing FramesSeen FramesMissed: " 
 		<< fState << " " << fProcessing << " " << fFramesSeen << " " 
 		<< fFramesMissed << std::endl;
-	oss << "MLCBI.enable MatlabDecimationFactor: "
-		<< fmp->callbackEnabled << " " 
+	oss << "FrameEvents MatlabDecimationFactor: "
+		<< (fmp->frameEvents!=NULL) << " " 
 		<< fMatlabDecimationFactor << std::endl;
 	s.append(oss.str());
 }
@@ -324,20 +305,18 @@ FrameCopier::safeStartProcessing(void)
 	CONSOLETRACE();
 	CONSOLEPRINT("Safe start processing\n");
 
-	EnterCriticalSection(&fProcessFrameCS); 
+	Platform::Mutex::Lock lock(fProcessFrameMutex);
 	fFramesSeen = 0;
 	fFramesMissed = 0;
 	fLastFrameTagCopied = -1;
 	fProcessing = 1;
-	LeaveCriticalSection(&fProcessFrameCS);
 }
 
 void
 FrameCopier::safeStopProcessing(void)
 {
-	EnterCriticalSection(&fProcessFrameCS); 
+	Platform::Mutex::Lock lock(fProcessFrameMutex);
 	fProcessing = 0;
-	LeaveCriticalSection(&fProcessFrameCS);
 }
 
 void FrameCopier::stopAcquisition(){
@@ -356,11 +335,11 @@ FrameCopier::trueFree(void * fMem)
 //
 // Some TFC state accessed by the processing thread cannot change
 // while threadFcn (or downstream calls) accesses it, due to
-// constraints provided by the state model. Examples are fInputBuffer, fOutputQs.
+// constraints provided by the state model. Examples are fInputBuffer, fmp.
 // 
 // The only TFC state that is truly shared by the processing thread
-// and controller thread are the Events, fProcessing, fFramesSeen,
-// fFramesMissed. These are protected with fProcessFrameCS.
+// and controller thread are fProcessing, fFramesSeen, fFramesMissed.
+// These are protected with fProcessFrameMutex.
 //
 // At the moment, no state changes (changes to fState) can originate
 // in the processing thread (within threadFnc). For example, if
@@ -374,22 +353,190 @@ FrameCopier::trueFree(void * fMem)
 // potential modification to fState) will need to be protected with
 // critical_sections or the like.
 
-unsigned int 
-WINAPI FrameCopier::threadFcn(LPVOID userData)
+// Called by the processing thread for each frame read, in FIFO layout.
+// The frame is written once, into a slot of the shared frameQueue: raw
+// for single-channel frames, deinterlaced for multi-channel frames.
+// frameSlot is a slot already reserved by the caller, or NULL to reserve
+// one here; a single-channel frame may already have been read into it.
+// If the ring is full we fall back to the local buffers and let
+// push_back record the drop.
+void
+FrameCopier::storeFrame(const char *frame, char *frameSlot)
+{
+	if (frameSlot==NULL)
+		frameSlot = static_cast<char*>(fmp->frameQueue->reserve_back());
+
+	int64_t t0 = fmp->stats->start();
+	const char* storedFrame = frame;
+	if (fmp->isMultiChannel)
+	{
+		char* deinterlaceBuf = frameSlot!=NULL ? frameSlot : fDeinterlaceBuffer;
+		FrameKernels::deinterleave4(reinterpret_cast<const int16_t*>(frame),
+			reinterpret_cast<int16_t*>(deinterlaceBuf),fmp->frameSizePixels);
+		if (fmp->frameTagging)
+		{
+			size_t tagIdx = (fmp->frameSizeBytes-fmp->tagSizeBytes)/2;
+			const int16_t* sourceArray = reinterpret_cast<const int16_t*>(frame);
+			int16_t* destinationArray = reinterpret_cast<int16_t*>(deinterlaceBuf);
+			destinationArray[tagIdx]   = sourceArray[tagIdx];
+			destinationArray[tagIdx+1] = sourceArray[tagIdx+1];
+			destinationArray[tagIdx+2] = sourceArray[tagIdx+2];
+			destinationArray[tagIdx+3] = sourceArray[tagIdx+3];
+		}
+		storedFrame = deinterlaceBuf;
+	}
+	else if (frameSlot!=NULL && frameSlot!=frame)
+	{
+		memcpy(frameSlot,frame,fmp->frameSizeBytes);
+	}
+	fmp->stats->record(PipelineStats::DEINTERLEAVE,t0);
+	// The display reader transposes into MATLAB's column-major
+	// layout as it copies the frame out (see GET_FRAME), so only
+	// the frames actually displayed pay for the transpose.
+
+	// Statistics are of every frame stored, whether or not the queue had
+	// room for it; the planes are still in cache from the deinterleave.
+	if (fmp->frameStatsEnabled)
+		recordFrameStats(storedFrame);
+
+	// While logging waits for its trigger, frames go to the history. The
+	// frame that finds the trigger is the first the logging reader sees:
+	// it is enabled here, before the frame is pushed, with its cursor at
+	// this frame's slot, and the history stops at the frame before.
+	if (fWaitingForLoggingTrigger && !checkLoggingTrigger())
+		fmp->frameHistory->push(storedFrame);
+
+	// With display averaging, every frame goes into the average (whether
+	// or not the queue had room for it), and Matlab hears only about
+	// averaged frames.
+	bool averagedFrameDue = false;
+	if (fDisplayAverager.isEnabled())
+		averagedFrameDue = fDisplayAverager.addFrame(reinterpret_cast<const int16_t*>(storedFrame));
+
+	// push it to the shared queue, then signal event to matlab to
+	// read queue and display image.
+	bool pushed;
+	if (frameSlot!=NULL) {
+		fmp->frameQueue->commit_back();
+		pushed = true;
+	} else
+		pushed = fmp->frameQueue->push_back(storedFrame);
+
+	// No console output on a drop: it would serialize this thread on
+	// the console lock.
+	if (!pushed)
+		TRACE_EVENT(TRACE_EVENTS,TRACE_QUEUE_FULL,fmp->frameQueue->num_dropped_push_back(),0,0);
+	TRACE_EVENT(TRACE_FRAMES,TRACE_FRAME_STORED,fmp->frameQueue->total_num_push_back(),pushed,fmp->loggingQueue->size());
+
+	if (averagedFrameDue)
+		publishAveragedFrame(storedFrame);
+	else if (pushed && !fDisplayAverager.isEnabled())
+		postFrameEvent();
+}
+
+// Called by the processing thread for each frame stored. The ring never
+// blocks: a reader that falls behind loses the oldest records.
+void
+FrameCopier::recordFrameStats(const char *frame)
+{
+	int64_t t0 = fmp->stats->start();
+	FrameStatsRecord& record = fmp->frameStats->beginWrite();
+	record.frameTag = 0;
+	if (fmp->frameTagging)
+	{
+		// The FPGA's count of acquired records, in the tag's last two words.
+		size_t tagIdx = (fmp->frameSizeBytes-fmp->tagSizeBytes)/2;
+		const int16_t* tag = reinterpret_cast<const int16_t*>(frame)+tagIdx;
+		record.frameTag = (unsigned long) (uint16_t) tag[2]*65536UL + (unsigned long) (uint16_t) tag[3];
+	}
+	record.numChannels = fmp->isMultiChannel ? 4 : 1;
+	record.pixelsPerChannel = (unsigned long) fmp->frameSizePixels;
+	const int16_t* plane = reinterpret_cast<const int16_t*>(frame);
+	for (unsigned long chan=0;chan<record.numChannels;chan++,plane+=fmp->frameSizePixels)
+		FrameKernels::pixelStats(plane,fmp->frameSizePixels,fmp->adcBitDepth,record.channels[chan]);
+	fmp->frameStats->commitWrite();
+	fmp->stats->record(PipelineStats::FRAME_STATS,t0);
+}
+
+// Called by the processing thread, between frames. The producer (this
+// thread) may enable a reader between pushes; see
+// FrameQueueReader::setEnabled. The logger does not read the queue
+// until it sees the history triggered in any case.
+bool
+FrameCopier::checkLoggingTrigger(void)
+{
+	bool triggered = atomicExchange(fLoggingTriggerRequested,0)!=0;
+	if (!triggered && fLoggingTriggerEvent!=NULL)
+		triggered = fLoggingTriggerEvent->wait(0);
+	if (!triggered)
+		return false;
+
+	fmp->loggingQueue->setEnabled(true);
+	fmp->frameHistory->trigger();
+	fWaitingForLoggingTrigger = false;
+	TRACE_EVENT(TRACE_EVENTS,TRACE_LOGGING_TRIGGERED,fmp->frameHistory->size(),0,0);
+	CONSOLEPRINT("FrameCopier: logging triggered, %lu frames from before the trigger\n",fmp->frameHistory->size());
+	return true;
+}
+
+// Called by the processing thread. latestFrame is the frame just added
+// to the average; it is still intact, as the producer (this thread) is
+// the only one that reuses slots.
+void
+FrameCopier::publishAveragedFrame(const char *latestFrame)
+{
+	// The reader is DROP_OLDEST, so there is room unless Matlab holds the
+	// oldest slot.
+	char* slot = static_cast<char*>(fmp->averagedFrameQueue->reserve_back());
+	if (slot==NULL)
+	{
+		TRACE_EVENT(TRACE_EVENTS,TRACE_AVERAGED_QUEUE_FULL,0,0,0);
+		return;
+	}
+
+	fDisplayAverager.computeAverage(reinterpret_cast<int16_t*>(slot));
+	// The averaged frame carries the tag of the newest frame in it.
+	if (fmp->frameTagging)
+	{
+		size_t tagOffset = fmp->frameSizeBytes-fmp->tagSizeBytes;
+		memcpy(slot+tagOffset,latestFrame+tagOffset,fmp->tagSizeBytes);
+	}
+	fmp->averagedFrameQueue->commit_back();
+	postFrameEvent();
+}
+
+// Called by the processing thread. The callback latency (getStats) runs
+// from here.
+void
+FrameCopier::postFrameEvent(void)
+{
+	if (fmp->frameEvents==NULL)
+		return;
+	fmp->stats->notePosted();
+	fmp->frameEvents->frameAvailable();
+}
+
+void
+FrameCopier::threadFcn(void *userData)
 {
 #ifdef CONSOLEDEBUG
-	NIFPGAMexDebugger::getInstance()->setConsoleAttribsForThread(FOREGROUND_GREEN|FOREGROUND_INTENSITY);
+	NIFPGAMexDebugger::getInstance()->setConsoleColorForThread(Platform::CONSOLE_GREEN);
 #endif
 	//CONSOLETRACE();
 	FrameCopier *obj = static_cast<FrameCopier*>(userData);
 	
-	HANDLE evtArray[3];
-	evtArray[0] = obj->fKillEvent;
-	evtArray[1] = obj->fStartAcqEvent;
-	evtArray[2] = obj->fNewFrameEvent;
-	
-	//Instantiate the MatlabParams singleton.	
-	MatlabParams* fmpThread = MatlabParams::getInstance();
+	//The copier's params.
+	PipelineParams* fmpThread = obj->fmp;
+
+	//Frame layout for the frame source. Acquisition parameters cannot change while the thread runs.
+	FrameFormat frameFormat;
+	frameFormat.isMultiChannel = fmpThread->isMultiChannel;
+	frameFormat.linesPerFrame = fmpThread->linesPerFrame;
+	frameFormat.pixelsPerLine = fmpThread->pixelsPerLine;
+	frameFormat.frameSizeBytes = fmpThread->frameSizeBytes;
+	frameFormat.frameSizeFifoElements = fmpThread->frameSizeFifoElements;
+	frameFormat.frameTagging = fmpThread->frameTagging;
+	frameFormat.tagSizeBytes = fmpThread->tagSizeBytes;
 
 	//Instantiate and initialize local copy of frameSizeBytes & frameQueueCapacity
 	size_t localframeSizeBytes = -1;
@@ -398,17 +545,20 @@ WINAPI FrameCopier::threadFcn(LPVOID userData)
 	//mem allocation
 	size_t* elementsRemaining = (size_t*) calloc(1,sizeof(size_t));
 	
-	int count = 0;
-	int deinterlaceCount = 0;
+	//Batched zero-copy reads, if requested and the source can do them.
+	bool batchedReads = fmpThread->fifoBatchedReads && obj->fFrameSource->supportsBatchedReads();
+	size_t maxFramesPerBatch = fmpThread->fifoMaxFramesPerBatch>0 ? fmpThread->fifoMaxFramesPerBatch : 1;
+	CONSOLEPRINT("FrameCopier: reading from %s frame source%s\n",obj->fFrameSource->name(),batchedReads ? " in batches" : "");
+
+	//Frame-boundary checks on the frame tag; see FrameSync.
+	FrameSync frameSync;
+	frameSync.reset(frameFormat);
+	size_t elementsToDiscard = 0;
+	fmpThread->numDroppedFramesCopier = 0;
+	fmpThread->numResyncsCopier = 0;
+	fmpThread->lastCopierTag = 0;
+
 	bool isInitialized = false;
-	bool pushbackOK = false;
-	int16_t* sourceArray;
-	int16_t* destinationArray;
-	size_t smallOffset      = 4;
-	size_t frameTwoOffset   = fmpThread->frameSizePixels;
-	size_t frameThreeOffset = fmpThread->frameSizePixels*2;
-	size_t frameFourOffset  = fmpThread->frameSizePixels*3;
-    unsigned long simulatedFrameCount = 0;
 
 	while(true){
 		//check for stop signal
@@ -422,17 +572,13 @@ WINAPI FrameCopier::threadFcn(LPVOID userData)
 			break;
 		}
 
-		//Initialize FPGA context in this thread - does this /need/ to be in the while loop??
+		//Open the frame source in this thread (for the FIFO source, this initializes the FPGA context).
 		if (!isInitialized) {
 			assert(obj->fProcessing == 0);
-			fmpThread->fpgaStatus = NiFpga_Initialize();
-            if (!fmpThread->simulated)
-                fmpThread->fpgaStatus = NiFpga_Initialize();
-            else
-                fmpThread->fpgaStatus = NiFpga_Status_Success;
-
-			if(fmpThread->fpgaStatus != NiFpga_Status_Success){
-				CONSOLEPRINT("Error initializing FPGA interface context. Got Status: %d\n",fmpThread->fpgaStatus);
+			fmpThread->fpgaStatus = obj->fFrameSource->open(frameFormat);
+
+			if(fmpThread->fpgaStatus != FrameSource::SUCCESS){
+				CONSOLEPRINT("Error opening %s frame source. Got Status: %d\n",obj->fFrameSource->name(),fmpThread->fpgaStatus);
 			}else
                 isInitialized = true;
 		}
@@ -444,181 +590,118 @@ WINAPI FrameCopier::threadFcn(LPVOID userData)
 			assert(obj->fProcessing == 0);
 			CONSOLEPRINT("Resizing fInputBuffer to %d bytes\n", fmpThread->frameSizeBytes);
 
-			// Recompute offsets for de-interlacing
-			frameTwoOffset   = fmpThread->frameSizePixels;
-			frameThreeOffset = fmpThread->frameSizePixels*2;
-			frameFourOffset  = fmpThread->frameSizePixels*3;
-
 			// Set local copies of lpp and ppl to the new values.
 			localframeSizeBytes = fmpThread->frameSizeBytes;
 
 			// Free the old memory associated with the fInputBuffer.
 			obj->fInputBuffer = (char*) obj->trueFree(obj->fInputBuffer);
 			obj->fDeinterlaceBuffer = (char*) obj->trueFree(obj->fDeinterlaceBuffer);
-			obj->fOutputBuffer = (char*) obj->trueFree(obj->fOutputBuffer);
 
 			// Resize input buffer
 			obj->fInputBuffer = (char*) calloc(localframeSizeBytes, sizeof(char));
             obj->fDeinterlaceBuffer = (char*) calloc(localframeSizeBytes, sizeof(char));
-			obj->fOutputBuffer = (char*) calloc(localframeSizeBytes, sizeof(char));
 
 			CONSOLEPRINT("Resized fmpThread->frameSize: %d\n",(int) fmpThread->frameSizeBytes,localframeSizeBytes);
 		}
 
 		if (obj->isProcessing())
 		{
-			count++;
-			//Polling for frames via NiFpga_ReadFIFO. This blocks automatically when there are no frames.
-            if(!fmpThread->simulated)
+			// If the last read was not on a frame boundary, skip to the next one first.
+			if (elementsToDiscard>0)
 			{
-                if(fmpThread->isMultiChannel){
-                    fmpThread->fpgaStatus = NiFpga_ReadFifoI64(fmpThread->fpgaSession, fmpThread->fpgaFifoNumberMultiChan, (int64_t*)obj->fInputBuffer, fmpThread->frameSizeFifoElements, FRAME_WAIT_TIMEOUT,  elementsRemaining);
-                    //CONSOLEPRINT("NiFpga_ReadFifoI64. Session: %d,  Frame Size: %d, Elements Remaining: %d\n", (NiFpga_Session)fmpThread->fpgaSession,  (int) fmpThread->frameSizeFifoElements, (int) *elementsRemaining);            
-                }
-                else
-                {
-                    fmpThread->fpgaStatus = NiFpga_ReadFifoI16(fmpThread->fpgaSession, fmpThread->fpgaFifoNumberSingleChan, (int16_t*)obj->fInputBuffer, fmpThread->frameSizeFifoElements, FRAME_WAIT_TIMEOUT, elementsRemaining);
-                    //CONSOLEPRINT("NiFpga_ReadFifoI16. Session: %d, FIFO number: %d, Frame Size: %d, Elements Remaining: %d\n", (NiFpga_Session)fmpThread->fpgaSession, fmpThread->fpgaFifoNumberSingleChan, (int) fmpThread->frameSizeFifoElements, (int) *elementsRemaining);            
-                }
-            }
-			else
+				TRACE_EVENT(TRACE_EVENTS,TRACE_FIFO_RESYNC,elementsToDiscard,frameSync.framesLost(),0);
+				fmpThread->fpgaStatus = obj->fFrameSource->discardElements(elementsToDiscard, FRAME_WAIT_TIMEOUT);
+				if (fmpThread->fpgaStatus == FrameSource::FIFO_TIMEOUT)
+					continue;
+				if (fmpThread->fpgaStatus != FrameSource::SUCCESS)
+					CONSOLEPRINT("Error discarding FIFO elements to resynchronize. Got Status: %d\n", fmpThread->fpgaStatus);
+				elementsToDiscard = 0;
+			}
+
+			// Each frame is written once, straight into a slot of the shared
+			// frameQueue, which both the display and logging readers then read
+			// in place (see storeFrame). In batched mode, every whole frame
+			// already waiting in the DMA host buffer is acquired in place and
+			// stored from there, then all are released together.
+			const char* frames = NULL;
+			size_t numFrames = 0;
+			char* frameSlot = NULL;
+			int64_t t0 = fmpThread->stats->start();
+
+			if (batchedReads)
 			{
-                //***********************************************************************************
-                //BEGIN SIMULATED INPUT CODE
-                //***********************************************************************************
-                fmpThread->fpgaStatus = NiFpga_Status_Success; // always simulate NiFpga Success to 0.
-                *elementsRemaining = 0; // always elementsRemaining is zero.
-
-                //Create gradient on all channels.
-                int tCount = 0;
-                int channelCount = 0;
-                int xiter,yiter = 0;
-                int16_t* myArray;
-                if(fmpThread->isMultiChannel){
-                    tCount = 0;
-                    myArray = reinterpret_cast<int16_t*> (obj->fInputBuffer);
-                    for (channelCount=0;channelCount<4;channelCount++)
-                        for (yiter=0; yiter < fmpThread->linesPerFrame; yiter++)
-                            for (xiter=0; xiter < fmpThread->pixelsPerLine; xiter++)
-                                myArray[tCount++] = (int16_t) xiter;
-                }
-                else
-                {
-                    tCount = 0;
-                    myArray = reinterpret_cast<int16_t*> (obj->fInputBuffer);
-                    for (yiter=0; yiter < fmpThread->linesPerFrame; yiter++)
-                        for (xiter=0; xiter < fmpThread->pixelsPerLine; xiter++)
-                            myArray[tCount++] = (int16_t) xiter;
-                }
-                //Add Simulated Frame Tag (if tagging enabled.)
-                if (fmpThread->frameTagging)
-                {
-                    myArray[(fmpThread->frameSizeBytes-fmpThread->tagSizeBytes)/2] = -32768;
-                    myArray[(fmpThread->frameSizeBytes-fmpThread->tagSizeBytes)/2+1] = 0;
-                    myArray[(fmpThread->frameSizeBytes-fmpThread->tagSizeBytes)/2+2] = (int16_t) (simulatedFrameCount / 65536);
-                    myArray[(fmpThread->frameSizeBytes-fmpThread->tagSizeBytes)/2+3] = (int16_t) simulatedFrameCount & 0xFFFF;
-                         simulatedFrameCount++;
-                }
-                Sleep(50);
-                //***********************************************************************************
-                //END SIMULATED INPUT CODE
-                //***********************************************************************************
+				fmpThread->fpgaStatus = obj->fFrameSource->acquireFrames(maxFramesPerBatch, FRAME_WAIT_TIMEOUT, &frames, &numFrames, elementsRemaining);
 			}
-			if (count % 100 == 0) {
-				CONSOLEPRINT("FrameCopier count %d -- Session: %d,  Frame Size in Elements: %d, Elements Remaining: %d\n", count, (NiFpga_Session)fmpThread->fpgaSession,  fmpThread->frameSizeFifoElements, (int) *elementsRemaining);			
+			else
+			{
+				// Single-channel frames are stored raw, so the FIFO can be read
+				// into the slot directly. A reserved slot that gets no frame (eg
+				// FIFO timeout) is given back below, so that the display reader
+				// keeps the oldest frame it holds.
+				frameSlot = static_cast<char*>(fmpThread->frameQueue->reserve_back());
+				char* inputBuf = obj->fInputBuffer;
+				if (frameSlot!=NULL && !fmpThread->isMultiChannel)
+					inputBuf = frameSlot;
+
+				//Polling for frames from the frame source (FPGA FIFO, or a synthetic/replayed stream in
+				//simulated mode). This blocks until a frame arrives or FRAME_WAIT_TIMEOUT passes.
+				fmpThread->fpgaStatus = obj->fFrameSource->readFrame(inputBuf, FRAME_WAIT_TIMEOUT, elementsRemaining);
+				frames = inputBuf;
+				numFrames = 1;
 			}
-
-			if(fmpThread->fpgaStatus == NiFpga_Status_FifoTimeout)
+			if (frameSlot!=NULL && fmpThread->fpgaStatus != FrameSource::SUCCESS)
+				fmpThread->frameQueue->cancel_back();
+			if(fmpThread->fpgaStatus == FrameSource::FIFO_TIMEOUT)
 			{
-				//threadSafePrint("FIFO timeout. Retrying.");
-				CONSOLEPRINT("Read FIFO timeout. Retrying...\n");
+				TRACE_EVENT(TRACE_EVENTS,TRACE_FIFO_TIMEOUT,*elementsRemaining,0,0);
 				continue;
-			} else if(fmpThread->fpgaStatus != NiFpga_Status_Success)
+			} else if(fmpThread->fpgaStatus != FrameSource::SUCCESS)
 			{
+				TRACE_EVENT(TRACE_EVENTS,TRACE_FIFO_ERROR,fmpThread->fpgaStatus,0,0);
 				CONSOLEPRINT("Error reading from FIFO. Got Status: %d\n", fmpThread->fpgaStatus);		
 				//break;
-			} else if(fmpThread->fpgaStatus == NiFpga_Status_Success)
+			} else if(fmpThread->fpgaStatus == FrameSource::SUCCESS)
 			{
-				//Got a frame!
-				//If we are capturing multiple channels, then de-interlace the input buffer here:
-				if (fmpThread->isMultiChannel)
+				fmpThread->stats->record(PipelineStats::FIFO_READ,t0);
+				TRACE_EVENT(TRACE_FRAMES,TRACE_FIFO_READ,numFrames,*elementsRemaining,0);
+
+				//Got a frame (or a batch of them)! Frames that are not whole (the
+				//FIFO lost elements) are dropped, as is the rest of their batch,
+				//which is misaligned the same way.
+				for (size_t i=0; i<numFrames; i++)
 				{
-					deinterlaceCount = 0;
-					sourceArray = reinterpret_cast<int16_t*>(obj->fInputBuffer);
-					destinationArray  = reinterpret_cast<int16_t*>(obj->fDeinterlaceBuffer);
-					while (deinterlaceCount < fmpThread->frameSizePixels)
-					{
-						*destinationArray                      = *(sourceArray++);
-						*(destinationArray + frameTwoOffset)   = *(sourceArray++);
-						*(destinationArray + frameThreeOffset) = *(sourceArray++);
-						*(destinationArray + frameFourOffset)  = *(sourceArray++);
-						destinationArray++;
-						deinterlaceCount++;
-					}
-					if (fmpThread->frameTagging)
+					const char* frame = frames + i*fmpThread->frameSizeBytes;
+					if (!frameSync.checkFrame(frame, &elementsToDiscard))
 					{
-						//CONSOLEPRINT("TAG RAW VALUE B : %u %u %u %d \n",(uint16_t) *sourceArray,(uint16_t) *(sourceArray+1),(uint16_t) *(sourceArray+2),(int16_t) *(sourceArray+3));
-						sourceArray = reinterpret_cast<int16_t*>(obj->fInputBuffer);
-						destinationArray  = reinterpret_cast<int16_t*>(obj->fDeinterlaceBuffer);
-						destinationArray[(fmpThread->frameSizeBytes-fmpThread->tagSizeBytes)/2] = sourceArray[(fmpThread->frameSizeBytes-fmpThread->tagSizeBytes)/2];
-						destinationArray[(fmpThread->frameSizeBytes-fmpThread->tagSizeBytes)/2+1] = sourceArray[(fmpThread->frameSizeBytes-fmpThread->tagSizeBytes)/2+1];
-						destinationArray[(fmpThread->frameSizeBytes-fmpThread->tagSizeBytes)/2+2] = sourceArray[(fmpThread->frameSizeBytes-fmpThread->tagSizeBytes)/2+2];
-						destinationArray[(fmpThread->frameSizeBytes-fmpThread->tagSizeBytes)/2+3] = sourceArray[(fmpThread->frameSizeBytes-fmpThread->tagSizeBytes)/2+3];
+						if (frameSlot!=NULL)
+							fmpThread->frameQueue->cancel_back();
+						break;
 					}
+					obj->storeFrame(frame, frameSlot);
 				}
-                int xiter, yiter;
-				int transposeCount = 0;
-				if (fmpThread->isMultiChannel)
-				{
-					sourceArray = reinterpret_cast<int16_t*>(obj->fDeinterlaceBuffer);
-					destinationArray  = reinterpret_cast<int16_t*>(obj->fOutputBuffer);
-					//Transpose data here.
-					for (yiter=0;yiter < fmpThread->pixelsPerLine;yiter++)
-						for (xiter=0;xiter < fmpThread->linesPerFrame;xiter++)
-						{
-							destinationArray[transposeCount]                  = sourceArray[yiter + (xiter * fmpThread->pixelsPerLine)];
-							destinationArray[transposeCount+frameTwoOffset]   = sourceArray[frameTwoOffset + yiter + (xiter * fmpThread->pixelsPerLine)];
-							destinationArray[transposeCount+frameThreeOffset] = sourceArray[frameThreeOffset + yiter + (xiter * fmpThread->pixelsPerLine)];
-							destinationArray[transposeCount+frameFourOffset]  = sourceArray[frameFourOffset + yiter + (xiter * fmpThread->pixelsPerLine)];
-							transposeCount++;
-						}
-				}
-				else
-				{
-					sourceArray = reinterpret_cast<int16_t*>(obj->fInputBuffer);
-					destinationArray  = reinterpret_cast<int16_t*>(obj->fOutputBuffer);
-					for (yiter=0;yiter < fmpThread->pixelsPerLine;yiter++)
-						for (xiter=0;xiter < fmpThread->linesPerFrame;xiter++)
-							destinationArray[transposeCount++] = sourceArray[yiter + (xiter * fmpThread->pixelsPerLine)];
-				}
+				if (batchedReads)
+					obj->fFrameSource->releaseFrames();
 
-				//push it to Matlab queue and logging queue
-				//push back fInputBuffer (or fDeinterlaceBuffer) into matlab queue for processing.
-				// Now that we have the frame, signal event to matlab to read queue and display image.
-				if(fmpThread->matlabQueue->push_back(obj->fOutputBuffer))
-					AsyncMex_postEventMessage(fmpThread->asyncMex,0);
-				// Insert call to logger here...
-				if (fmpThread->loggingEnabled)
-					if (fmpThread->isMultiChannel){
-						if (!fmpThread->loggingQueue->push_back(obj->fDeinterlaceBuffer))
-							CONSOLEPRINT("Problem pushing frame back into logging queue...\n");
-					}
-					else{
-						if (!fmpThread->loggingQueue->push_back(obj->fInputBuffer))
-							CONSOLEPRINT("Problem pushing frame back into logging queue...\n");
-					}
+				fmpThread->numDroppedFramesCopier = (long) frameSync.framesLost();
+				fmpThread->numResyncsCopier = frameSync.numResyncs();
+				fmpThread->lastCopierTag = frameSync.lastTag();
 			}
 		}
 		// Relinquish Control of Thread
-		Sleep(0); 
+		Platform::sleepMs(0);
 	}
 
+	if (isInitialized)
+		obj->fFrameSource->close();
+
+	if (frameSync.framesLost()>0 || frameSync.numResyncs()>0)
+		CONSOLEPRINT("FrameCopier: %lu frames lost, %lu resyncs, last frame tag %lu\n",
+			frameSync.framesLost(),frameSync.numResyncs(),frameSync.lastTag());
+
 	//mem deallocation
 	obj->fInputBuffer = (char*) obj->trueFree(obj->fInputBuffer);
 	obj->fDeinterlaceBuffer = (char*) obj->trueFree(obj->fDeinterlaceBuffer);
-	obj->fOutputBuffer = (char*) obj->trueFree(obj->fOutputBuffer);
 	elementsRemaining = (size_t*) obj->trueFree(elementsRemaining);
 
 	//normal exit
-	return 0;
 }
\ No newline at end of file
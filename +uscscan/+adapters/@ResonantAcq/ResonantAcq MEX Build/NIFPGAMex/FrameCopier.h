@@ -1,7 +1,10 @@
 #pragma once
 
-#include "stdafx.h"
-#include "MatlabParams.h"
+#include <string>
+#include <vector>
+#include "StateModelObject.h"
+#include "PipelineParams.h"
+#include "DisplayAverager.h"
 
 /*
 FrameCopier
@@ -9,11 +12,26 @@ FrameCopier
 Responsibilities.
 * Has a worker thread that listens to the FPGA FIFO queue for
 when frames appear.
-* When a frame appears in the FPGA queue, add it to the logging
-queue and to the Matlab access queue.
-* Signal Matlab that a new frame is available after pushing onto
-Matlab-access queue, using AsyncMex. Code for the actual callback 
-and frame retrieval live in NIFPGAMex.
+* When a frame appears in the FPGA queue, add it (once) to the
+shared frame queue, which the logger and Matlab each read through
+their own reader.
+* Tell the frame event sink (PipelineParams::frameEvents) that a new
+frame is available after pushing onto the frame queue. In the MEX the
+sink is MatlabParams, which signals Matlab using AsyncMex; code for the
+actual callback and frame retrieval live in NIFPGAMex.
+* With display averaging on (displayAveragingMode), average the
+frames for display, and hand Matlab only the averaged frames, through
+their own queue (averagedFrameQueue), at the averager's cadence.
+* With frame statistics on (frameStatsEnabled), compute each frame's
+per-channel statistics and put them in the frame stats ring
+(frameStats), which Matlab polls.
+
+All settings and shared objects come from the PipelineParams given at
+construction, so FrameCopier has no Matlab in it.
+* With a logging trigger (loggingWaitForTrigger), keep the most recent
+frames in the frame history (frameHistory) until the trigger comes,
+then enable the logging reader and hand the history to the logger,
+which logs it ahead of the live frames.
 
 In the abstract, FrameCopier is a class that
 responds to a frame-arrival event by copying a frame off a buffer
@@ -26,8 +44,8 @@ a thread (the 'processing thread') to perform its duties, but this
 thread is not publicly accessible. Public API calls are thread-safe
 with respect to the processing thread. However, public API calls
 made from more than a single controller thread are probably unsafe.
-Note that technically there is a third thread involved (spawned by
-/AsyncMex), which triggers the next frame event.
+Note that technically there is a third thread involved (in the MEX,
+spawned by AsyncMex), which triggers the next frame event.
 
 State model.
 * CONSTRUCTED. A newly constructed FrameCopier is not in a
@@ -48,41 +66,25 @@ renders the TFC useless.
 */
 
 //forward declarations
-class MatlabParams;
-class FrameQueue;
+class FrameSource;
 
 class FrameCopier : public StateModelObject {
 
 public:
 	static const unsigned int FRAME_TAG_SIZE_BYTES = sizeof(long); // size of frame tag in bytes
 
-	FrameCopier(void);
+	// params is not owned, and must outlive the copier. Its settings
+	// cannot change while processing.
+	FrameCopier(PipelineParams* params);
 	~FrameCopier(void);
 
 	/// Initialization methods (setup/config)
 	/// These methods cannot be called on a TFC at state ARMED or above.
 
-	// Get the new-frame event. Set/Signal this event to notify a TFC
-	// that a new frame has arrived on the input buffer.
-	HANDLE getNewFrameEvent(void) const;
-
-	// Configure the Matlab callback. To enable the callback, specify a
-	// nonNULL asm and valid scannerID. To disable the callback, pass in
-	// NULL for asm.
-	//
-	// TFC does not take ownership of the asm.
-	void configureMatlabCallback(AsyncMex* asyncMex);
-
-	void setMatlabCallbackEnable(bool enable);
-
-	// Specify the output queues. For now, this is just the logging
-	// queue, as the processed-data queue (Matlab queue) has its own
-	// set method. TFC will push frames onto these queues as they show
-	// up. The ordering of queues in the vector is irrelevant.
-	void setOutputQueues(const std::vector<FrameQueue*> &outputQs);
-
-	// Specify Matlab output queue.
-	void setMatlabQueue(FrameQueue* q);
+	// Specify where frames come from: the FPGA FIFO, or a synthetic or
+	// replayed stream in simulated mode. The TFC takes ownership of src
+	// and deletes any previous source. Cannot be called while running.
+	void setFrameSource(FrameSource* src);
 
 	// Specify a decimation factor for the processed data queue and
 	// Matlab callback (default=1). A decimation factor of 0 or 1 indicates no
@@ -169,6 +171,19 @@ public:
 	unsigned int getFramesMissed(void) const;
 
 
+	/// Logging trigger
+
+	// Start logging at the next frame, if logging is waiting for its
+	// trigger. Frames up to that one come from the frame history. The
+	// named event loggingTriggerEventName, when given, does the same.
+	//
+	// Precondition: RUNNING
+	void triggerLogging(void);
+
+	// Logging waits for a trigger that has not come yet.
+	bool isWaitingForLoggingTrigger(void) const;
+
+
 	/// Misc
 
 	// Killing a TFC exits its processing thread as soon as possible and
@@ -180,6 +195,10 @@ public:
 	// Postcondition: KILLED
 	void kill(void);
 
+	// CPU time used by the processing thread, in seconds: the running
+	// thread's, or once it has stopped, the last one's.
+	double getProcessingThreadCpuSeconds(void) const;
+
 	// Append debug info to s.
 	void debugString(std::string &s) const;
 
@@ -187,7 +206,7 @@ private:
 	void safeStartProcessing(void);
 	void safeStopProcessing(void);
 
-	static unsigned int WINAPI threadFcn(LPVOID);
+	static void threadFcn(void *userData);
 
 	// Process the current contents of the input buffer in case where frame tagging is enabled.
 	// Returns true if a Thor error occurred.
@@ -196,57 +215,67 @@ private:
 	// Process a single Thor frame & generate Matlab event. Returns true if a Thor error occurred.
 	bool processFrame(void);
 
+	// Store one frame read from the frame source in the shared frame queue
+	// and notify Matlab. See FrameCopier.cpp.
+	void storeFrame(const char* frame, char* frameSlot);
+
+	// Write the current display average to the averaged-frame queue, with
+	// the frame tag of latestFrame, and notify Matlab.
+	void publishAveragedFrame(const char* latestFrame);
+
+	// Tell the frame event sink, if any, of a frame for display.
+	void postFrameEvent(void);
+
+	// Put the statistics of each plane of frame, as stored, in the frame
+	// stats ring.
+	void recordFrameStats(const char* frame);
+
+	// Called by the processing thread for each frame while logging waits
+	// for its trigger. Returns true if the trigger has come: then logging
+	// starts with the frame in hand, and the history holds the ones before.
+	bool checkLoggingTrigger(void);
+
 	// Extract specified channels from input buffer, and append frameTag if supplied, creating filteredInputBuffer. 
 	// Returns pointer to either original input buffer or filtered input buffer, as appropriate. 
 	char * filterInputBufferChannels(char* filteredInputBuffer, std::vector<int> &chanVec, int numChans, bool contiguousChans, int firstChan, long frameTag);
 
 	// Subtract offset values from buffer of input data
-	void FrameCopier::subtractInputOffsets(char* inputBuf, std::vector<int> &chanVec);
+	void subtractInputOffsets(char* inputBuf, std::vector<int> &chanVec);
 
-	void startAcq(void);
 	void stopAcquisition();
 	bool fStopAcquisition;
 
 	void* trueFree(void*);
 
 private:
-	MatlabParams* fmp;
+	PipelineParams* fmp;
+	FrameSource* fFrameSource; // owned
 
-	static const DWORD STOP_TIMEOUT_MILLISECONDS = 5000; // 5 seconds
+	static const unsigned long STOP_TIMEOUT_MILLISECONDS = 5000; // 5 seconds
 	static const uint32_t FRAME_WAIT_TIMEOUT = 250; // milliseconds
 	
 	//frame info
 	char* fInputBuffer;
 	char* fDeinterlaceBuffer;
-	char* fOutputBuffer;
 	char* fMatlabFilteredInputBuf;
 	char* fOutputDataFilteredInputBuf;  
 
 	static const unsigned int THREADFCN_WAIT_TIMEOUT = 200; // milliseconds
 
-	HANDLE fThread;
-	HANDLE fStartAcqEvent;
-	HANDLE fNewFrameEvent;
-	HANDLE fKillEvent;
+	Platform::Thread fThread;
 
-	CRITICAL_SECTION fProcessFrameCS; // CS that makes the entire operation of processing a frame "atomic"; used when stopping/pausing
-	LONG fProcessing;
+	Platform::Mutex fProcessFrameMutex; // makes the entire operation of processing a frame "atomic"; used when stopping/pausing
+	long fProcessing;
 	unsigned int fFramesSeen;
 	unsigned int fFramesMissed; // This tries to count the number of missed frames by mismatch of Thor index and number of copies, but this is not authoratative -- e.g. CopyAcquisitions could 'succeed' in returning a previously supplied frame
 	long fLastFrameTagCopied;
 
 	bool fFrameTagEnable; // if true, an extra long word is copied with each source Thor frame, indicating the frame's index value
 
-	FrameQueue* fMatlabQ;
 	unsigned int fMatlabDecimationFactor;
-	std::vector<FrameQueue*> fOutputQs;
-	std::vector<int> fOutputQsEnabled; //Vector of boolean-valued ints indicating which, if any, of the output Qs are enabled for copy-to
-
-	//asyncMex related
-	struct MatlabCallbackInfo {
-		AsyncMex* asyncMex;
-		int scannerID;
-		bool enable;
-	};
-	MatlabCallbackInfo fMatlabCallbackInfo;
+	DisplayAverager fDisplayAverager;
+
+	bool volatile fWaitingForLoggingTrigger;
+	volatile long fLoggingTriggerRequested;
+	Platform::Event* fLoggingTriggerEvent; // named, loggingTriggerEventName; NULL if none
 };
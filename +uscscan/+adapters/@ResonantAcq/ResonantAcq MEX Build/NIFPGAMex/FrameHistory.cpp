@@ -0,0 +1,137 @@
+#include "FrameHistory.h"
+#include <sstream>
+#include <string.h>
+#include "Misc.h"
+#include "Atomics.h"
+
+FrameHistory::FrameHistory(void) :
+  fRecordSize(0),
+  fCapacity(0),
+  fBlockBytes(0),
+  fBlock(NULL),
+  fLocked(false),
+  fNumPushes(0),
+  fTriggered(0)
+{
+}
+
+FrameHistory::~FrameHistory(void)
+{
+  release();
+}
+
+bool
+FrameHistory::init(size_t recordSz, unsigned long capacity)
+{
+  size_t blockBytes = recordSz*capacity;
+  if (blockBytes!=fBlockBytes || (blockBytes>0 && fBlock==NULL)) {
+    release();
+    if (blockBytes>0) {
+      fBlock = static_cast<char*>(Platform::allocPages(blockBytes));
+      if (fBlock==NULL) {
+        CONSOLEPRINT("FrameHistory: could not allocate %lu MB for %lu frames.\n",
+                     (unsigned long) (blockBytes>>20),capacity);
+        fRecordSize = recordSz;
+        fCapacity = 0;
+        reset();
+        return false;
+      }
+      fBlockBytes = blockBytes;
+      fLocked = Platform::lockPages(fBlock,blockBytes);
+      if (!fLocked) {
+        CONSOLEPRINT("FrameHistory: could not lock %lu MB in memory (error %lu); using it unlocked.\n",
+                     (unsigned long) (blockBytes>>20),Platform::lastError());
+      }
+    }
+  }
+  fRecordSize = recordSz;
+  fCapacity = capacity;
+  reset();
+  return true;
+}
+
+void
+FrameHistory::release(void)
+{
+  if (fBlock!=NULL) {
+    if (fLocked) {
+      Platform::unlockPages(fBlock,fBlockBytes);
+    }
+    Platform::freePages(fBlock,fBlockBytes);
+    fBlock = NULL;
+  }
+  fBlockBytes = 0;
+  fLocked = false;
+}
+
+void
+FrameHistory::reset(void)
+{
+  fNumPushes = 0;
+  fTriggered = 0;
+  fullBarrier();
+}
+
+unsigned long
+FrameHistory::capacityForBytes(size_t recordSz, uint64_t maxBytes)
+{
+  if (recordSz==0) {
+    return 0;
+  }
+  uint64_t n = maxBytes/recordSz;
+  return n>0xFFFFFFFFUL ? 0xFFFFFFFFUL : (unsigned long) n;
+}
+
+void
+FrameHistory::push(const void *record)
+{
+  if (fTriggered) {
+    return;
+  }
+  if (fCapacity>0) {
+    memcpy(fBlock+(fNumPushes%fCapacity)*fRecordSize,record,fRecordSize);
+  }
+  fNumPushes++;
+}
+
+void
+FrameHistory::trigger(void)
+{
+  // The exchange is a full barrier: the consumer that sees the trigger
+  // sees every record pushed before it.
+  atomicExchange(fTriggered,1);
+}
+
+bool
+FrameHistory::isTriggered(void) const
+{
+  bool triggered = fTriggered!=0;
+  fullBarrier();
+  return triggered;
+}
+
+unsigned long
+FrameHistory::size(void) const
+{
+  return fNumPushes<fCapacity ? fNumPushes : fCapacity;
+}
+
+const void*
+FrameHistory::at(unsigned long i) const
+{
+  assert(fTriggered);
+  assert(i<size());
+  unsigned long oldest = fNumPushes-size();
+  return fBlock+((oldest+i)%fCapacity)*fRecordSize;
+}
+
+void
+FrameHistory::debugString(std::string &s) const
+{
+  std::ostringstream oss;
+  oss << "--FrameHistory--" << std::endl;
+  oss << "Capacity RecordSize Locked Pushes Triggered: "
+      << fCapacity << " " << fRecordSize << " " << fLocked << " "
+      << fNumPushes << " " << fTriggered << std::endl;
+  s.append(oss.str());
+}
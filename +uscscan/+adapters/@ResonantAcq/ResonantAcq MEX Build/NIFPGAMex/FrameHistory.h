@@ -0,0 +1,81 @@
+#pragma once
+
+#include <string>
+#include "Platform.h"
+
+// The most recent frames acquired while logging waits for its trigger,
+// so that a triggered log can start in the past.
+//
+// A ring of fixed-size records in one block, allocated up front and
+// locked in physical memory (Platform::lockPages), so that keeping the history
+// costs neither allocations nor page faults while frames stream in.
+//
+// Threading. The producer (the FrameCopier thread) pushes every frame
+// until it sees the logging trigger, then calls trigger(). From then on
+// the ring is frozen: push() does nothing, and the frames held belong to
+// the consumer (the FrameLogger thread), which writes them out, oldest
+// first, ahead of the live frames. The controller calls
+// init/reset while both threads are idle.
+//
+// A history of capacity 0 holds no frames, but still carries the
+// trigger.
+class FrameHistory {
+
+ public:
+
+  FrameHistory(void);
+
+  ~FrameHistory(void);
+
+  // Allocate room for capacity records of recordSz bytes, lock it, and
+  // reset. The existing block is kept if it is the same size. Returns
+  // false if the memory cannot be allocated, leaving a capacity of 0. If
+  // the block cannot be locked it is used as is; see isLocked().
+  bool init(size_t recordSz, unsigned long capacity);
+
+  // Empty the ring and wait for the next trigger.
+  void reset(void);
+
+  // Number of records of recordSz bytes that fit in maxBytes.
+  static unsigned long capacityForBytes(size_t recordSz, uint64_t maxBytes);
+
+  // Called by producer. Copy record into the ring, overwriting the
+  // oldest record if it is full. No-op once triggered.
+  void push(const void *record);
+
+  // Called by producer. Freeze the ring and hand it to the consumer.
+  void trigger(void);
+
+  bool isTriggered(void) const;
+
+  // Called by consumer once triggered. Number of records held, and
+  // record i of them, 0 being the oldest.
+  unsigned long size(void) const;
+  const void* at(unsigned long i) const;
+
+  unsigned long capacity(void) const { return fCapacity; }
+  std::size_t recordSize(void) const { return fRecordSize; }
+  bool isLocked(void) const { return fLocked; }
+
+  // Records pushed since the last reset, including those overwritten.
+  unsigned long total_num_push(void) const { return fNumPushes; }
+
+  // Append debug info to s.
+  void debugString(std::string &s) const;
+
+ private:
+  FrameHistory(const FrameHistory&);
+  FrameHistory& operator=(const FrameHistory&);
+
+  void release(void);
+
+ private:
+  size_t fRecordSize; // in bytes
+  unsigned long fCapacity;
+  size_t fBlockBytes;
+  char *fBlock;
+  bool fLocked;
+
+  unsigned long fNumPushes; // producer-owned until triggered
+  volatile long fTriggered;
+};
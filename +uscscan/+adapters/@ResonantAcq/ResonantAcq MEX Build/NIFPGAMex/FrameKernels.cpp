@@ -0,0 +1,658 @@
+#ifdef _MSC_VER
+#include <intrin.h>    // __cpuid
+#else
+#include <cpuid.h>     // __get_cpuid
+#endif
+#include <emmintrin.h> // SSE2
+#include <string.h>
+#include "FrameKernels.h"
+
+namespace
+{
+  // Side of the square tiles the transpose works through. A 64x64 int16
+  // tile is 8KB, so a source tile and a destination tile sit in L1
+  // together.
+  const std::size_t TRANSPOSE_TILE = 64;
+
+  bool cpuHasSSE2(void)
+  {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info,1);
+    return (info[3] & (1<<26))!=0; // EDX bit 26
+#else
+    unsigned int eax, ebx, ecx, edx;
+    return __get_cpuid(1,&eax,&ebx,&ecx,&edx) && (edx & (1u<<26))!=0;
+#endif
+  }
+
+  // Written once at load time; read-only afterwards apart from
+  // setSIMDEnable, which is for tests.
+  const bool gCPUHasSSE2 = cpuHasSSE2();
+  bool gUseSSE2 = gCPUHasSSE2;
+
+  void deinterleave4SSE2(const int16_t *src, int16_t *dst, std::size_t numPixels)
+  {
+    int16_t *dst0 = dst;
+    int16_t *dst1 = dst+numPixels;
+    int16_t *dst2 = dst+2*numPixels;
+    int16_t *dst3 = dst+3*numPixels;
+
+    // 8 pixels (32 int16) per iteration. Names: pPcC is pixel P, channel C.
+    std::size_t i = 0;
+    for (;i+8<=numPixels;i+=8) {
+      const __m128i *s = reinterpret_cast<const __m128i*>(src+4*i);
+      __m128i a = _mm_loadu_si128(s);   // p0c0..p0c3 p1c0..p1c3
+      __m128i b = _mm_loadu_si128(s+1); // p2, p3
+      __m128i c = _mm_loadu_si128(s+2); // p4, p5
+      __m128i d = _mm_loadu_si128(s+3); // p6, p7
+
+      __m128i t0 = _mm_unpacklo_epi16(a,b); // p0c0 p2c0 p0c1 p2c1 p0c2 p2c2 p0c3 p2c3
+      __m128i t1 = _mm_unpackhi_epi16(a,b); // same for p1, p3
+      __m128i t2 = _mm_unpacklo_epi16(c,d); // p4, p6
+      __m128i t3 = _mm_unpackhi_epi16(c,d); // p5, p7
+
+      __m128i u0 = _mm_unpacklo_epi16(t0,t1); // p0..p3 c0, p0..p3 c1
+      __m128i u1 = _mm_unpackhi_epi16(t0,t1); // p0..p3 c2, p0..p3 c3
+      __m128i u2 = _mm_unpacklo_epi16(t2,t3); // p4..p7 c0, p4..p7 c1
+      __m128i u3 = _mm_unpackhi_epi16(t2,t3); // p4..p7 c2, p4..p7 c3
+
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(dst0+i),_mm_unpacklo_epi64(u0,u2));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(dst1+i),_mm_unpackhi_epi64(u0,u2));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(dst2+i),_mm_unpacklo_epi64(u1,u3));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(dst3+i),_mm_unpackhi_epi64(u1,u3));
+    }
+    for (;i<numPixels;i++) {
+      dst0[i] = src[4*i];
+      dst1[i] = src[4*i+1];
+      dst2[i] = src[4*i+2];
+      dst3[i] = src[4*i+3];
+    }
+  }
+
+  // Transpose the 8x8 block at src (row stride srcStride) into dst (row
+  // stride dstStride).
+  inline void transpose8x8SSE2(const int16_t *src, std::size_t srcStride,
+			       int16_t *dst, std::size_t dstStride)
+  {
+    __m128i a0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+    __m128i a1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src+srcStride));
+    __m128i a2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src+2*srcStride));
+    __m128i a3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src+3*srcStride));
+    __m128i a4 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src+4*srcStride));
+    __m128i a5 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src+5*srcStride));
+    __m128i a6 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src+6*srcStride));
+    __m128i a7 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src+7*srcStride));
+
+    __m128i b0 = _mm_unpacklo_epi16(a0,a1);
+    __m128i b1 = _mm_unpackhi_epi16(a0,a1);
+    __m128i b2 = _mm_unpacklo_epi16(a2,a3);
+    __m128i b3 = _mm_unpackhi_epi16(a2,a3);
+    __m128i b4 = _mm_unpacklo_epi16(a4,a5);
+    __m128i b5 = _mm_unpackhi_epi16(a4,a5);
+    __m128i b6 = _mm_unpacklo_epi16(a6,a7);
+    __m128i b7 = _mm_unpackhi_epi16(a6,a7);
+
+    __m128i c0 = _mm_unpacklo_epi32(b0,b2); // cols 0,1 of rows 0-3
+    __m128i c1 = _mm_unpackhi_epi32(b0,b2); // cols 2,3
+    __m128i c2 = _mm_unpacklo_epi32(b1,b3); // cols 4,5
+    __m128i c3 = _mm_unpackhi_epi32(b1,b3); // cols 6,7
+    __m128i c4 = _mm_unpacklo_epi32(b4,b6); // same, rows 4-7
+    __m128i c5 = _mm_unpackhi_epi32(b4,b6);
+    __m128i c6 = _mm_unpacklo_epi32(b5,b7);
+    __m128i c7 = _mm_unpackhi_epi32(b5,b7);
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst),_mm_unpacklo_epi64(c0,c4));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst+dstStride),_mm_unpackhi_epi64(c0,c4));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst+2*dstStride),_mm_unpacklo_epi64(c1,c5));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst+3*dstStride),_mm_unpackhi_epi64(c1,c5));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst+4*dstStride),_mm_unpacklo_epi64(c2,c6));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst+5*dstStride),_mm_unpackhi_epi64(c2,c6));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst+6*dstStride),_mm_unpacklo_epi64(c3,c7));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst+7*dstStride),_mm_unpackhi_epi64(c3,c7));
+  }
+
+  void transposeSSE2(const int16_t *src, int16_t *dst, std::size_t rows, std::size_t cols)
+  {
+    std::size_t rows8 = rows & ~static_cast<std::size_t>(7);
+    std::size_t cols8 = cols & ~static_cast<std::size_t>(7);
+
+    for (std::size_t rt=0;rt<rows8;rt+=TRANSPOSE_TILE) {
+      std::size_t rEnd = (rt+TRANSPOSE_TILE<rows8) ? rt+TRANSPOSE_TILE : rows8;
+      for (std::size_t ct=0;ct<cols8;ct+=TRANSPOSE_TILE) {
+	std::size_t cEnd = (ct+TRANSPOSE_TILE<cols8) ? ct+TRANSPOSE_TILE : cols8;
+	for (std::size_t c=ct;c<cEnd;c+=8) {
+	  for (std::size_t r=rt;r<rEnd;r+=8) {
+	    transpose8x8SSE2(src+r*cols+c,cols,dst+c*rows+r,rows);
+	  }
+	}
+      }
+    }
+
+    // Ragged edges: columns past cols8 (all rows), then rows past
+    // rows8 (the remaining columns).
+    for (std::size_t c=cols8;c<cols;c++) {
+      for (std::size_t r=0;r<rows;r++) {
+	dst[c*rows+r] = src[r*cols+c];
+      }
+    }
+    for (std::size_t c=0;c<cols8;c++) {
+      for (std::size_t r=rows8;r<rows;r++) {
+	dst[c*rows+r] = src[r*cols+c];
+      }
+    }
+  }
+
+  // Sign- or zero-extend 8 pixels to two vectors of 4 int32 and add them
+  // to acc.
+  inline void addWidened(__m128i lo, __m128i hi, int32_t *acc)
+  {
+    __m128i *a = reinterpret_cast<__m128i*>(acc);
+    _mm_storeu_si128(a,_mm_add_epi32(_mm_loadu_si128(a),lo));
+    _mm_storeu_si128(a+1,_mm_add_epi32(_mm_loadu_si128(a+1),hi));
+  }
+
+  void accumulateSSE2(const int16_t *src, int32_t *acc, std::size_t numPixels)
+  {
+    std::size_t i = 0;
+    for (;i+8<=numPixels;i+=8) {
+      __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src+i));
+      // Each pixel into the top half of an int32, then shifted down
+      // arithmetically.
+      addWidened(_mm_srai_epi32(_mm_unpacklo_epi16(x,x),16),
+		 _mm_srai_epi32(_mm_unpackhi_epi16(x,x),16),acc+i);
+    }
+    for (;i<numPixels;i++) {
+      acc[i] += src[i];
+    }
+  }
+
+  void accumulateSSE2(const uint16_t *src, int32_t *acc, std::size_t numPixels)
+  {
+    const __m128i zero = _mm_setzero_si128();
+    std::size_t i = 0;
+    for (;i+8<=numPixels;i+=8) {
+      __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src+i));
+      addWidened(_mm_unpacklo_epi16(x,zero),_mm_unpackhi_epi16(x,zero),acc+i);
+    }
+    for (;i<numPixels;i++) {
+      acc[i] += src[i];
+    }
+  }
+
+  // Returns k if divisor==2^k, else -1.
+  int log2IfPowerOfTwo(unsigned int divisor)
+  {
+    if (divisor==0 || (divisor & (divisor-1))!=0) {
+      return -1;
+    }
+    int k = 0;
+    while ((1u<<k)!=divisor) {
+      k++;
+    }
+    return k;
+  }
+
+  // Quotients of 4 int32 sums, truncated toward zero. Shift when
+  // shift>=0 (biasing negative sums by divisor-1 so the shift truncates
+  // toward zero rather than down); otherwise divide in double, which is
+  // exact for int32 operands, and convert with truncation.
+  inline __m128i quotient4(__m128i a, int shift, __m128i shiftCount, __m128i bias, __m128d divisor)
+  {
+    if (shift>=0) {
+      a = _mm_add_epi32(a,_mm_and_si128(_mm_srai_epi32(a,31),bias));
+      return _mm_sra_epi32(a,shiftCount);
+    }
+    __m128i q0 = _mm_cvttpd_epi32(_mm_div_pd(_mm_cvtepi32_pd(a),divisor));
+    __m128i q1 = _mm_cvttpd_epi32(_mm_div_pd(_mm_cvtepi32_pd(_mm_srli_si128(a,8)),divisor));
+    return _mm_unpacklo_epi64(q0,q1);
+  }
+
+  template <bool UNSIGNED_OUT>
+  void divideNarrowSSE2(const int32_t *acc, int16_t *dst, std::size_t numPixels, unsigned int divisor)
+  {
+    int shift = log2IfPowerOfTwo(divisor);
+    const __m128i shiftCount = _mm_cvtsi32_si128(shift);
+    const __m128i bias = _mm_set1_epi32((int) divisor-1);
+    const __m128d divisorPD = _mm_set1_pd((double) divisor);
+    // SSE2 has no unsigned saturating 32->16 pack: offset the quotients
+    // into int16 range, pack signed, and flip the top bit back.
+    const __m128i offset32 = _mm_set1_epi32(32768);
+    const __m128i offset16 = _mm_set1_epi16((short) 0x8000);
+
+    std::size_t i = 0;
+    for (;i+8<=numPixels;i+=8) {
+      const __m128i *a = reinterpret_cast<const __m128i*>(acc+i);
+      __m128i lo = quotient4(_mm_loadu_si128(a),shift,shiftCount,bias,divisorPD);
+      __m128i hi = quotient4(_mm_loadu_si128(a+1),shift,shiftCount,bias,divisorPD);
+      __m128i packed;
+      if (UNSIGNED_OUT) {
+	packed = _mm_xor_si128(_mm_packs_epi32(_mm_sub_epi32(lo,offset32),_mm_sub_epi32(hi,offset32)),offset16);
+      } else {
+	packed = _mm_packs_epi32(lo,hi);
+      }
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(dst+i),packed);
+    }
+    for (;i<numPixels;i++) {
+      dst[i] = (int16_t) (acc[i]/(int32_t) divisor);
+    }
+  }
+
+  // Sign-extend 8 int16 to two vectors of 4 int32.
+  inline void widen(__m128i x, __m128i *lo, __m128i *hi)
+  {
+    *lo = _mm_srai_epi32(_mm_unpacklo_epi16(x,x),16);
+    *hi = _mm_srai_epi32(_mm_unpackhi_epi16(x,x),16);
+  }
+
+  void slideSSE2(const int16_t *add, const int16_t *drop, int32_t *acc, std::size_t numPixels)
+  {
+    std::size_t i = 0;
+    for (;i+8<=numPixels;i+=8) {
+      __m128i addLo, addHi, dropLo, dropHi;
+      widen(_mm_loadu_si128(reinterpret_cast<const __m128i*>(add+i)),&addLo,&addHi);
+      widen(_mm_loadu_si128(reinterpret_cast<const __m128i*>(drop+i)),&dropLo,&dropHi);
+      addWidened(_mm_sub_epi32(addLo,dropLo),_mm_sub_epi32(addHi,dropHi),acc+i);
+    }
+    for (;i<numPixels;i++) {
+      acc[i] += add[i]-drop[i];
+    }
+  }
+
+  inline void exponentialStep4(__m128i x, float *avg, __m128 weight)
+  {
+    __m128 a = _mm_loadu_ps(avg);
+    __m128 d = _mm_sub_ps(_mm_cvtepi32_ps(x),a);
+    _mm_storeu_ps(avg,_mm_add_ps(a,_mm_mul_ps(weight,d)));
+  }
+
+  void exponentialAverageSSE2(const int16_t *src, float *avg, std::size_t numPixels, float weight)
+  {
+    const __m128 w = _mm_set1_ps(weight);
+    std::size_t i = 0;
+    for (;i+8<=numPixels;i+=8) {
+      __m128i lo, hi;
+      widen(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src+i)),&lo,&hi);
+      exponentialStep4(lo,avg+i,w);
+      exponentialStep4(hi,avg+i+4,w);
+    }
+    for (;i<numPixels;i++) {
+      avg[i] += weight*((float) src[i]-avg[i]);
+    }
+  }
+
+  // Add +-0.5, matching the sign of x, and truncate.
+  inline __m128i round4(__m128 x)
+  {
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    const __m128 half = _mm_set1_ps(0.5f);
+    __m128 h = _mm_or_ps(half,_mm_and_ps(x,signMask));
+    return _mm_cvttps_epi32(_mm_add_ps(x,h));
+  }
+
+  inline int16_t roundNarrowOne(float x)
+  {
+    int32_t v = (int32_t) (x + (x<0.0f ? -0.5f : 0.5f));
+    return (int16_t) (v>32767 ? 32767 : v<-32768 ? -32768 : v);
+  }
+
+  void roundNarrowSSE2(const float *src, int16_t *dst, std::size_t numPixels)
+  {
+    std::size_t i = 0;
+    for (;i+8<=numPixels;i+=8) {
+      __m128i lo = round4(_mm_loadu_ps(src+i));
+      __m128i hi = round4(_mm_loadu_ps(src+i+4));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(dst+i),_mm_packs_epi32(lo,hi));
+    }
+    for (;i<numPixels;i++) {
+      dst[i] = roundNarrowOne(src[i]);
+    }
+  }
+
+  // The range of a bitDepth-bit ADC, and the shift that takes a pixel,
+  // offset to start at 0, to its histogram bin.
+  struct AdcRange
+  {
+    int lo;
+    int hi;
+    int binShift;
+  };
+
+  AdcRange adcRange(unsigned int bitDepth)
+  {
+    if (bitDepth<8) {
+      bitDepth = 8;
+    } else if (bitDepth>16) {
+      bitDepth = 16;
+    }
+    AdcRange range;
+    range.lo = -(1<<(bitDepth-1));
+    range.hi = (1<<(bitDepth-1))-1;
+    range.binShift = bitDepth-8;
+    return range;
+  }
+
+  // Add pixel v to stats, whose min and max are already set, counting
+  // it in histogram.
+  inline void addPixel(int16_t v, const AdcRange &range, unsigned long *histogram,
+		       FrameKernels::PixelStats &stats)
+  {
+    if (v<stats.min) {
+      stats.min = v;
+    }
+    if (v>stats.max) {
+      stats.max = v;
+    }
+    stats.sum += v;
+    stats.sumSquares += (uint64_t) ((int32_t) v*v);
+    int c = v<range.lo ? range.lo : v>range.hi ? range.hi : v;
+    if (c==range.lo || c==range.hi) {
+      stats.numSaturated++;
+    }
+    histogram[(unsigned int) (c-range.lo) >> range.binShift]++;
+  }
+
+  // Pixels per block of pixelStatsSSE2. Its int32 sums and int16
+  // saturation counts are added to the totals after each block, long
+  // before they could overflow.
+  const std::size_t STATS_BLOCK = 65536;
+
+  // One pass: min, max, sum and sum of squares in registers. SSE2 has no
+  // scatter, so the histogram takes the bins computed 8 at a time and
+  // counts them one by one, into four histograms in turn so that a run
+  // of pixels in one bin does not wait on each increment.
+  void pixelStatsSSE2(const int16_t *src, std::size_t numPixels, unsigned int bitDepth,
+		      FrameKernels::PixelStats &stats)
+  {
+    memset(&stats,0,sizeof(stats));
+    if (numPixels==0) {
+      return;
+    }
+
+    const AdcRange range = adcRange(bitDepth);
+    const __m128i lo = _mm_set1_epi16((int16_t) range.lo);
+    const __m128i hi = _mm_set1_epi16((int16_t) range.hi);
+    const __m128i ones = _mm_set1_epi16(1);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i binShift = _mm_cvtsi32_si128(range.binShift);
+
+    unsigned long hist[4][256];
+    memset(hist,0,sizeof(hist));
+    uint16_t bins[8];
+
+    __m128i vmin = _mm_set1_epi16(32767);
+    __m128i vmax = _mm_set1_epi16(-32768);
+    __m128i sumSquares = zero; // two uint64
+    std::size_t i = 0;
+    while (i+8<=numPixels) {
+      std::size_t blockEnd = numPixels-i>STATS_BLOCK ? i+STATS_BLOCK : numPixels;
+      __m128i sum = zero;       // four int32
+      __m128i saturated = zero; // eight int16
+      for (;i+8<=blockEnd;i+=8) {
+	__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src+i));
+	vmin = _mm_min_epi16(vmin,v);
+	vmax = _mm_max_epi16(vmax,v);
+	sum = _mm_add_epi32(sum,_mm_madd_epi16(v,ones));
+	// Pairs of squares, as uint32: at most 2*32768^2 = 2^31.
+	__m128i sq = _mm_madd_epi16(v,v);
+	sumSquares = _mm_add_epi64(sumSquares,_mm_unpacklo_epi32(sq,zero));
+	sumSquares = _mm_add_epi64(sumSquares,_mm_unpackhi_epi32(sq,zero));
+
+	__m128i c = _mm_min_epi16(_mm_max_epi16(v,lo),hi);
+	saturated = _mm_sub_epi16(saturated,_mm_or_si128(_mm_cmpeq_epi16(c,lo),_mm_cmpeq_epi16(c,hi)));
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(bins),_mm_srl_epi16(_mm_sub_epi16(c,lo),binShift));
+	hist[0][bins[0]]++;
+	hist[1][bins[1]]++;
+	hist[2][bins[2]]++;
+	hist[3][bins[3]]++;
+	hist[0][bins[4]]++;
+	hist[1][bins[5]]++;
+	hist[2][bins[6]]++;
+	hist[3][bins[7]]++;
+      }
+      int32_t lanes[4];
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes),sum);
+      stats.sum += (int64_t) lanes[0]+lanes[1]+lanes[2]+lanes[3];
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes),_mm_madd_epi16(saturated,ones));
+      stats.numSaturated += (unsigned long) (lanes[0]+lanes[1]+lanes[2]+lanes[3]);
+    }
+
+    int16_t mins[8];
+    int16_t maxs[8];
+    uint64_t squares[2];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(mins),vmin);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(maxs),vmax);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(squares),sumSquares);
+    stats.min = 32767;
+    stats.max = -32768;
+    for (int k=0;k<8;k++) {
+      if (mins[k]<stats.min) {
+	stats.min = mins[k];
+      }
+      if (maxs[k]>stats.max) {
+	stats.max = maxs[k];
+      }
+    }
+    stats.sumSquares = squares[0]+squares[1];
+
+    for (;i<numPixels;i++) {
+      addPixel(src[i],range,hist[0],stats);
+    }
+    for (int b=0;b<256;b++) {
+      stats.histogram[b] = hist[0][b]+hist[1][b]+hist[2][b]+hist[3][b];
+    }
+  }
+}
+
+bool
+FrameKernels::simdEnabled(void)
+{
+  return gUseSSE2;
+}
+
+void
+FrameKernels::setSIMDEnable(bool enable)
+{
+  gUseSSE2 = enable && gCPUHasSSE2;
+}
+
+void
+FrameKernels::deinterleave4(const int16_t *src, int16_t *dst, std::size_t numPixels)
+{
+  if (gUseSSE2) {
+    deinterleave4SSE2(src,dst,numPixels);
+  } else {
+    deinterleave4Scalar(src,dst,numPixels);
+  }
+}
+
+void
+FrameKernels::transpose(const int16_t *src, int16_t *dst, std::size_t rows, std::size_t cols)
+{
+  if (gUseSSE2) {
+    transposeSSE2(src,dst,rows,cols);
+  } else {
+    transposeScalar(src,dst,rows,cols);
+  }
+}
+
+void
+FrameKernels::accumulate(const int16_t *src, int32_t *acc, std::size_t numPixels)
+{
+  if (gUseSSE2) {
+    accumulateSSE2(src,acc,numPixels);
+  } else {
+    accumulateScalar(src,acc,numPixels);
+  }
+}
+
+void
+FrameKernels::accumulate(const uint16_t *src, int32_t *acc, std::size_t numPixels)
+{
+  if (gUseSSE2) {
+    accumulateSSE2(src,acc,numPixels);
+  } else {
+    accumulateScalar(src,acc,numPixels);
+  }
+}
+
+void
+FrameKernels::divideNarrow(const int32_t *acc, int16_t *dst, std::size_t numPixels, unsigned int divisor)
+{
+  if (gUseSSE2) {
+    divideNarrowSSE2<false>(acc,dst,numPixels,divisor);
+  } else {
+    divideNarrowScalar(acc,dst,numPixels,divisor);
+  }
+}
+
+void
+FrameKernels::divideNarrow(const int32_t *acc, uint16_t *dst, std::size_t numPixels, unsigned int divisor)
+{
+  if (gUseSSE2) {
+    // Same bits either way; the tail loop's int16 cast of a quotient in
+    // [0,65535] wraps to the right uint16.
+    divideNarrowSSE2<true>(acc,reinterpret_cast<int16_t*>(dst),numPixels,divisor);
+  } else {
+    divideNarrowScalar(acc,dst,numPixels,divisor);
+  }
+}
+
+void
+FrameKernels::slide(const int16_t *add, const int16_t *drop, int32_t *acc, std::size_t numPixels)
+{
+  if (gUseSSE2) {
+    slideSSE2(add,drop,acc,numPixels);
+  } else {
+    slideScalar(add,drop,acc,numPixels);
+  }
+}
+
+void
+FrameKernels::exponentialAverage(const int16_t *src, float *avg, std::size_t numPixels, float weight)
+{
+  if (gUseSSE2) {
+    exponentialAverageSSE2(src,avg,numPixels,weight);
+  } else {
+    exponentialAverageScalar(src,avg,numPixels,weight);
+  }
+}
+
+void
+FrameKernels::roundNarrow(const float *src, int16_t *dst, std::size_t numPixels)
+{
+  if (gUseSSE2) {
+    roundNarrowSSE2(src,dst,numPixels);
+  } else {
+    roundNarrowScalar(src,dst,numPixels);
+  }
+}
+
+void
+FrameKernels::pixelStats(const int16_t *src, std::size_t numPixels, unsigned int bitDepth, PixelStats &stats)
+{
+  if (gUseSSE2) {
+    pixelStatsSSE2(src,numPixels,bitDepth,stats);
+  } else {
+    pixelStatsScalar(src,numPixels,bitDepth,stats);
+  }
+}
+
+void
+FrameKernels::deinterleave4Scalar(const int16_t *src, int16_t *dst, std::size_t numPixels)
+{
+  int16_t *destinationArray = dst;
+  for (std::size_t i=0;i<numPixels;i++) {
+    *destinationArray               = *(src++);
+    *(destinationArray+numPixels)   = *(src++);
+    *(destinationArray+2*numPixels) = *(src++);
+    *(destinationArray+3*numPixels) = *(src++);
+    destinationArray++;
+  }
+}
+
+void
+FrameKernels::transposeScalar(const int16_t *src, int16_t *dst, std::size_t rows, std::size_t cols)
+{
+  std::size_t transposeCount = 0;
+  for (std::size_t yiter=0;yiter<cols;yiter++) {
+    for (std::size_t xiter=0;xiter<rows;xiter++) {
+      dst[transposeCount++] = src[yiter + (xiter * cols)];
+    }
+  }
+}
+
+void
+FrameKernels::accumulateScalar(const int16_t *src, int32_t *acc, std::size_t numPixels)
+{
+  for (std::size_t i=0;i<numPixels;i++) {
+    acc[i] += src[i];
+  }
+}
+
+void
+FrameKernels::accumulateScalar(const uint16_t *src, int32_t *acc, std::size_t numPixels)
+{
+  for (std::size_t i=0;i<numPixels;i++) {
+    acc[i] += src[i];
+  }
+}
+
+void
+FrameKernels::divideNarrowScalar(const int32_t *acc, int16_t *dst, std::size_t numPixels, unsigned int divisor)
+{
+  // Double division is exact for int32 operands, and quicker than
+  // integer division.
+  double d = (double) divisor;
+  for (std::size_t i=0;i<numPixels;i++) {
+    dst[i] = (int16_t) (int32_t) (acc[i]/d);
+  }
+}
+
+void
+FrameKernels::divideNarrowScalar(const int32_t *acc, uint16_t *dst, std::size_t numPixels, unsigned int divisor)
+{
+  double d = (double) divisor;
+  for (std::size_t i=0;i<numPixels;i++) {
+    dst[i] = (uint16_t) (int32_t) (acc[i]/d);
+  }
+}
+
+void
+FrameKernels::slideScalar(const int16_t *add, const int16_t *drop, int32_t *acc, std::size_t numPixels)
+{
+  for (std::size_t i=0;i<numPixels;i++) {
+    acc[i] += add[i]-drop[i];
+  }
+}
+
+void
+FrameKernels::exponentialAverageScalar(const int16_t *src, float *avg, std::size_t numPixels, float weight)
+{
+  for (std::size_t i=0;i<numPixels;i++) {
+    avg[i] += weight*((float) src[i]-avg[i]);
+  }
+}
+
+void
+FrameKernels::roundNarrowScalar(const float *src, int16_t *dst, std::size_t numPixels)
+{
+  for (std::size_t i=0;i<numPixels;i++) {
+    dst[i] = roundNarrowOne(src[i]);
+  }
+}
+
+void
+FrameKernels::pixelStatsScalar(const int16_t *src, std::size_t numPixels, unsigned int bitDepth, PixelStats &stats)
+{
+  memset(&stats,0,sizeof(stats));
+  if (numPixels==0) {
+    return;
+  }
+  const AdcRange range = adcRange(bitDepth);
+  stats.min = src[0];
+  stats.max = src[0];
+  for (std::size_t i=0;i<numPixels;i++) {
+    addPixel(src[i],range,stats.histogram,stats);
+  }
+}
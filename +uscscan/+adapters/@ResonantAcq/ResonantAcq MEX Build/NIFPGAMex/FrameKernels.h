@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstddef>
+#include "Platform.h" // for int16_t
+
+// Per-pixel kernels used on every frame: deinterleaving the
+// multi-channel FIFO data, transposing channel planes into MATLAB's
+// column-major order, frame averaging for logging and display, and
+// per-frame statistics. Each kernel has an SSE2 implementation and a
+// scalar reference implementation (the loops the copier and GET_FRAME
+// used originally); the SSE2 one is used when the CPU supports it. Both
+// produce bit-identical output.
+namespace FrameKernels
+{
+  // Statistics of a plane of pixels, as pixelStats computes them. All
+  // 0 for no pixels.
+  struct PixelStats
+  {
+    int16_t min;
+    int16_t max;
+    int64_t sum;
+    uint64_t sumSquares;
+    unsigned long numSaturated;   // pixels at either end of the ADC range
+    unsigned long histogram[256]; // the ADC range in 256 equal bins
+  };
+
+  // True if the SSE2 kernels are in use. The CPU is checked once.
+  bool simdEnabled(void);
+
+  // Force the scalar kernels (enable=false), eg for testing and
+  // benchmarking. Enabling has no effect on a CPU without SSE2.
+  void setSIMDEnable(bool enable);
+
+  // Deinterleave numPixels 4-channel pixels (4 consecutive int16 each,
+  // as read from the multi-channel FIFO) into 4 planes. Plane k starts
+  // at dst+k*numPixels. src and dst must not overlap.
+  void deinterleave4(const int16_t *src, int16_t *dst, std::size_t numPixels);
+
+  // Transpose a rows x cols row-major plane, so that dst holds src in
+  // column-major order (dst[c*rows+r] = src[r*cols+c]). For a frame,
+  // rows=linesPerFrame and cols=pixelsPerLine. Cache-blocked. src and
+  // dst must not overlap.
+  void transpose(const int16_t *src, int16_t *dst, std::size_t rows, std::size_t cols);
+
+  // Add numPixels 16-bit pixels to int32 running sums (acc[i] += src[i]).
+  void accumulate(const int16_t *src, int32_t *acc, std::size_t numPixels);
+  void accumulate(const uint16_t *src, int32_t *acc, std::size_t numPixels);
+
+  // dst[i] = acc[i]/divisor, truncated toward zero and narrowed to 16
+  // bits. Every quotient must fit in the destination type, as it does
+  // when acc holds the sum of divisor pixels. A power-of-two divisor is
+  // done with a shift.
+  void divideNarrow(const int32_t *acc, int16_t *dst, std::size_t numPixels, unsigned int divisor);
+  void divideNarrow(const int32_t *acc, uint16_t *dst, std::size_t numPixels, unsigned int divisor);
+
+  // acc[i] += add[i]-drop[i]: move a running sum of frames on by one
+  // frame.
+  void slide(const int16_t *add, const int16_t *drop, int32_t *acc, std::size_t numPixels);
+
+  // avg[i] += weight*(src[i]-avg[i]): one step of an exponential moving
+  // average.
+  void exponentialAverage(const int16_t *src, float *avg, std::size_t numPixels, float weight);
+
+  // dst[i] = src[i] rounded to the nearest integer (halves away from
+  // zero) and saturated to int16.
+  void roundNarrow(const float *src, int16_t *dst, std::size_t numPixels);
+
+  // Statistics of numPixels pixels from an ADC of bitDepth bits (8 to
+  // 16), whose range is [-2^(bitDepth-1), 2^(bitDepth-1)-1]. A pixel
+  // at either end of the range counts as saturated. Histogram bin b
+  // holds the pixels v with (v+2^(bitDepth-1)) >> (bitDepth-8) == b;
+  // pixels outside the range count in the end bins, and as saturated.
+  void pixelStats(const int16_t *src, std::size_t numPixels, unsigned int bitDepth, PixelStats &stats);
+
+  // Scalar reference kernels.
+  void deinterleave4Scalar(const int16_t *src, int16_t *dst, std::size_t numPixels);
+  void transposeScalar(const int16_t *src, int16_t *dst, std::size_t rows, std::size_t cols);
+  void accumulateScalar(const int16_t *src, int32_t *acc, std::size_t numPixels);
+  void accumulateScalar(const uint16_t *src, int32_t *acc, std::size_t numPixels);
+  void divideNarrowScalar(const int32_t *acc, int16_t *dst, std::size_t numPixels, unsigned int divisor);
+  void divideNarrowScalar(const int32_t *acc, uint16_t *dst, std::size_t numPixels, unsigned int divisor);
+  void slideScalar(const int16_t *add, const int16_t *drop, int32_t *acc, std::size_t numPixels);
+  void exponentialAverageScalar(const int16_t *src, float *avg, std::size_t numPixels, float weight);
+  void roundNarrowScalar(const float *src, int16_t *dst, std::size_t numPixels);
+  void pixelStatsScalar(const int16_t *src, std::size_t numPixels, unsigned int bitDepth, PixelStats &stats);
+}
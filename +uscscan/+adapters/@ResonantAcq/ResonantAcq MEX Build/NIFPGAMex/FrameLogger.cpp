@@ -1,52 +1,61 @@
-#include "stdafx.h"
 #include "FrameLogger.h"
 #include <sstream>
-#include <process.h>
+#include <string.h>
+#include "Misc.h"
+#include "MulticastFrameQueue.h"
+#include "FrameHistory.h"
+#include "PipelineStats.h"
+#include "PipelineTrace.h"
 
 //const char *FrameLogger::FRAME_TAG_FORMAT_STRING = "Frame Tag = %08d\n";
-const char *FrameLogger::FRAME_TAG_FORMAT_STRING = "Frame Tag = %16lu\n";
+const char *FrameLogger::FRAME_TAG_FORMAT_STRING = FrameTag::FORMAT_STRING;
 
-FrameLogger::FrameLogger(void) : 
-fThread(0),
+FrameLogger::FrameLogger(PipelineParams *params) : 
 //fFrameQueue(NULL),
 fTifWriter(new TifWriter()),
+fRawWriter(new RawFrameWriter()),
+fWriter(fTifWriter),
 fAverageFactor(1),
-fAveragingBuf(NULL),
 fAveragingResultBuf(NULL),
 fKillLoggingFlag(false),
 fHaltLoggingFlag(false),
+fWaitForTrigger(false),
+fHistoryFrames(0),
+fHistoryFramesLogged(0),
 fFramesLogged(0),
 //fFrameTagEnable(false),
-fmp(MatlabParams::getInstance())
+fmp(params)
 //fFrameDelay(0)
 {
 	CONSOLEPRINT("FrameLogger::FrameLogger...\n");
 	CONSOLEPRINT("FrameLogger::fState: %d\n", fState);
 	assert(fTifWriter!=NULL);
+	assert(fRawWriter!=NULL);
 
 	fState = CONSTRUCTED;
-
-	InitializeCriticalSection(&fLogfileRolloverCS);
 }
 
 FrameLogger::~FrameLogger(void)
 {
 	CONSOLEPRINT("FrameLogger::~FrameLogger...\n");
 	CONSOLEPRINT("FrameLogger::fState: %d\n", fState);
-	if (fThread!=0) {
+	if (fThread.isStarted()) {
 		stopLoggingImmediately();
 		// Could go stronger and use something like TerminateThread here.
 	}
 
 	//fFrameQueue = NULL; // FrameQueue not owned by this obj  
+	fWriter = NULL;
 	if (fTifWriter!=NULL) {
 		delete fTifWriter;
 		fTifWriter = NULL;
 	}
+	if (fRawWriter!=NULL) {
+		delete fRawWriter;
+		fRawWriter = NULL;
+	}
 
 	deleteAveragingBuffers();
-
-	DeleteCriticalSection(&fLogfileRolloverCS); // no way to check if this has been initted
 }
 
 //bool
@@ -77,7 +86,7 @@ FrameLogger::configureImage(unsigned int averagingFactor,
 
 	//fImageParams = ip;
 	// ip.numChannelsAvailable, ip.numChannelsActive are not used in FrameLogger.
-	assert(!fTifWriter->isTifFileOpen());
+	assert(!fWriter->isFileOpen());
 
 	//Handle frame tag case, if applicable -- prepend frame tag, pad image description
 	std::string imageDescStr = imageDesc;
@@ -94,17 +103,19 @@ FrameLogger::configureImage(unsigned int averagingFactor,
 
 	//fTifWriter->configureImage(ip.imageWidth,ip.imageHeight,ip.bytesPerPixel,
 	//	ip.numLoggingChannels,ip.signedData,imageDescStr.c_str());
-	fTifWriter->configureImage((unsigned short) fmp->pixelsPerLine, (unsigned short) fmp->linesPerFrame,fmp->pixelSizeBytes,fmp->numLoggingChannels,fmp->signedData,imageDescStr.c_str());
+	fWriter->configureImage((unsigned short) fmp->pixelsPerLine, (unsigned short) fmp->linesPerFrame,fmp->pixelSizeBytes,fmp->numLoggingChannels,fmp->signedData,imageDescStr.c_str());
 	fConfiguredImageDescLength = (unsigned int) imageDescStr.length();
 
 	fAverageFactor = averagingFactor;
 	this->deleteAveragingBuffers();
 
 	if (fAverageFactor > 1) {
-		//CONSOLEPRINT("fImP.fnp: %d. faB: %p. sizeof fab: %d\n",fImageParams.frameNumPixels,fAveragingBuf,(sizeof fAveragingBuf));
-		fAveragingBuf = new double[fmp->frameSizePixels * fmp->numLoggingChannels]();
-		fAveragingResultBuf = new char[fmp->frameSizePixels * fmp->numLoggingChannels](); 
-		assert(fAveragingBuf!=NULL);
+		// The FIFO delivers int16 whatever signedData says (that only sets
+		// the TIFF SampleFormat), and the logger has always averaged it as
+		// signed; keep doing so.
+		fAverager.configure(fmp->frameSizePixels * fmp->numLoggingChannels,fmp->pixelSizeBytes,true,fAverageFactor);
+		// Sized to what writeFramesForAllChannels reads from it.
+		fAveragingResultBuf = new char[fmp->frameSizeBytes * fmp->numLoggingChannels](); 
 		assert(fAveragingResultBuf!=NULL);
 		zeroAveragingBuffers();
 	}
@@ -158,11 +169,11 @@ FrameLogger::configureImage(unsigned int averagingFactor,
 //}
 
 void 
-FrameLogger::configureFile(const char *filename, const char *fileModeStr)
+FrameLogger::configureFile(const char *filename, const char *fileModeStr, bool bigTiff)
 {
 	CONSOLEPRINT("FrameLogger::configureFile...\n");
 	CONSOLEPRINT("FrameLogger::fState: %d\n", fState);
-	CONSOLEPRINT("Filename: %s, fileModeStr: %s\n",filename,fileModeStr);
+	CONSOLEPRINT("Filename: %s, fileModeStr: %s, bigTiff: %d\n",filename,fileModeStr,(int) bigTiff);
 	CONSOLETRACE();
 	assert(fState<ARMED);
 
@@ -174,7 +185,7 @@ FrameLogger::configureFile(const char *filename, const char *fileModeStr)
 	//
 	// We treat this call as a reset of the logfilenotes.
 	fLogfileNotes.clear();
-	LogFileNote lfn(filename,fileModeStr,1);
+	LogFileNote lfn(filename,fileModeStr,1,bigTiff);
 	fLogfileNotes.push_front(lfn);
 }  
 
@@ -194,16 +205,16 @@ FrameLogger::arm(void)
 	// modify any state here.
 
 	assert(fState==CONSTRUCTED || fState==ARMED);
-	assert(fThread==0);
+	assert(!fThread.isStarted());
 
 	bool tfSuccess = true;
 
 	if (fmp->loggingQueue==NULL) { tfSuccess = false; }
-	if (fTifWriter==NULL) { tfSuccess = false; }
-	assert(!fTifWriter->isTifFileOpen());
+	if (fWriter==NULL) { tfSuccess = false; }
+	assert(!fWriter->isFileOpen());
 	if (fmp->loggingQueue->recordSize()!=fmp->frameSizeBytes) { tfSuccess = false; }
 	// assume fImageParams and fTifWriter agree
-	if (fAverageFactor>1 && (fAveragingBuf==NULL || fAveragingResultBuf==NULL)) {
+	if (fAverageFactor>1 && (!fAverager.isConfigured() || fAveragingResultBuf==NULL)) {
 		tfSuccess = false;
 	}
 	if ( !(fLogfileNotes.size()==1 && fLogfileNotes.front().frameIdx==1) ) { 
@@ -222,7 +233,7 @@ FrameLogger::disarm(void)
 	CONSOLEPRINT("FrameLogger::disarm...\n");
 	CONSOLEPRINT("FrameLogger::fState: %d\n", fState);
 	assert(fState==ARMED || fState==STOPPED);
-	assert(fThread==0);
+	assert(!fThread.isStarted());
 	fState = CONSTRUCTED;
 }
 
@@ -234,13 +245,16 @@ FrameLogger::startLogging(void)
 	CONSOLEPRINT("FrameLogger::fState: %d\n", fState);
 	CONSOLETRACE();
 	assert(fState==ARMED);
-	assert(fThread==0);
+	assert(!fThread.isStarted());
 
 	// pre-start state initializations
 	//fFrameDelay = frameDelay;
 	fKillLoggingFlag = false;
 	fHaltLoggingFlag = false;
 	fFramesLogged = 0; 
+	fWaitForTrigger = fmp->loggingWaitForTrigger;
+	fHistoryFrames = 0;
+	fHistoryFramesLogged = 0;
 
 	if (fAverageFactor > 1) {    
 		zeroAveragingBuffers();
@@ -263,8 +277,9 @@ FrameLogger::startLogging(void)
 	//	// 	    fFrameQueue->size());
 	//	// MessageBox(NULL,str,"Warning",MB_OK);
 	//}
-	fThread = (HANDLE)_beginthreadex(NULL,0,FrameLogger::loggingThreadFcn,(LPVOID)this,0,NULL);
-	assert(fThread!=0);
+	bool started = fThread.start(FrameLogger::loggingThreadFcn,this);
+	assert(started);
+	(void) started;
 	fState = RUNNING;
 }
 
@@ -284,32 +299,20 @@ FrameLogger::stopLogging(void)
 	CONSOLETRACE();
 	assert(fState==RUNNING);
 	CONSOLEPRINT("FrameLogger: fState is RUNNING \n");
-	assert(fThread!=0);
+	assert(fThread.isStarted());
 	CONSOLEPRINT("FrameLogger: fthread != 0\n");
 
 	fHaltLoggingFlag = true; 
 
 	// Stop signal sent. Now wait for logging thread to terminate.
 
-	DWORD retval = WaitForSingleObject(fThread,STOP_LOGGING_TIMEOUT_MILLISECONDS);
-	switch (retval) {
-	  case WAIT_OBJECT_0:
-		  CONSOLEPRINT("FrameLogger::stopLogging WAIT_OBJECT_0...\n");
-		  // logging thread completed.
-		  {
-			  BOOL b = CloseHandle(fThread);
-			  assert(b!=0);
-			  fThread = 0;
-			  // other runtime state can remain as-is in STOPPED state. to start,
-			  // will have to disarm + arm + startLogging.
-		  }
+	if (fThread.join(STOP_LOGGING_TIMEOUT_MILLISECONDS)) {
+		  CONSOLEPRINT("FrameLogger::stopLogging joined...\n");
+		  // logging thread completed. other runtime state can remain
+		  // as-is in STOPPED state. to start, will have to disarm + arm +
+		  // startLogging.
 		  fState = STOPPED;
-		  break;
-
-	  case WAIT_TIMEOUT:
-	  case WAIT_ABANDONED:
-	  case WAIT_FAILED:
-	  default:
+	} else {
 		  CONSOLEPRINT("FrameLogger::stopLogging HARD STOP!!\n");
 		  // Try harder to stop logging.
 		  stopLoggingImmediately(); 
@@ -324,8 +327,6 @@ FrameLogger::stopLogging(void)
 			  //sprintf_s(str,256,"FrameLogger: Logger could not finish processing. %d frames were unlogged.\n", fmp->loggingQueue->size());
 			  //MessageBox(NULL,str,"Warning",MB_OK);
 		  }
-
-		  break;
 	}
 }
 
@@ -336,26 +337,14 @@ FrameLogger::stopLoggingImmediately(void)
 	CONSOLEPRINT("FrameLogger::fState: %d\n", fState);
 	CONSOLETRACE();
 	assert(fState==RUNNING);
-	assert(fThread!=0);
+	assert(fThread.isStarted());
 
 	fKillLoggingFlag = true; 
 
-	DWORD retval = WaitForSingleObject(fThread, STOP_LOGGING_TIMEOUT_MILLISECONDS);
-	switch (retval) {
-		case WAIT_OBJECT_0:
+	if (fThread.join(STOP_LOGGING_TIMEOUT_MILLISECONDS)) {
 			// logging thread stopped.
-			{
-				BOOL b = CloseHandle(fThread);
-				assert(b!=0);
-				fThread = 0;
-			}
 			fState = STOPPED;
-			break;
-
-		case WAIT_TIMEOUT:
-		case WAIT_ABANDONED:
-		case WAIT_FAILED:
-		default:
+	} else {
 			// stop immediately failed; we are hosed
 			{
 				CONSOLEPRINT("FrameLogger: Unable to stop logger. Please report this error to the ScanImage team.\n");
@@ -364,8 +353,7 @@ FrameLogger::stopLoggingImmediately(void)
 				//MessageBox(NULL,str,"Error",MB_OK);
 			}
 			fState = KILLED; // FrameLogger will be unusable in this state
-			break;
-		}
+	}
 }
 
 void
@@ -374,15 +362,13 @@ FrameLogger::addLogfileRolloverNote(const LogFileNote &lfn)
 	CONSOLEPRINT("FrameLogger::fState: %d\n", fState);
 	assert(fState==ARMED || fState==RUNNING || fState == STOPPED);
 
-	EnterCriticalSection(&fLogfileRolloverCS);
+	Platform::Mutex::Lock lock(fLogfileRolloverMutex);
 
 	if (!fLogfileNotes.empty()) {
 		// enforce strict monotonicity
 		assert(fLogfileNotes.back().frameIdx < lfn.frameIdx);
 	}
 	fLogfileNotes.push_back(lfn);
-
-	LeaveCriticalSection(&fLogfileRolloverCS);
 }
 
 unsigned long
@@ -392,19 +378,29 @@ FrameLogger::getFramesLogged(void) const
 	return fFramesLogged;
 }
 
+double
+FrameLogger::getLoggingThreadCpuSeconds(void) const
+{
+	return fThread.cpuSeconds();
+}
+
 void
 FrameLogger::debugString(std::string &s) const
 {
 	std::ostringstream oss;
 	oss << "--FrameLogger--" << std::endl;
-	oss << "State Thread TifWriterFileOpen fAvFactor: " 
-		<< fState << " " << fThread << " " 
-		<< fTifWriter->isTifFileOpen() << " " 
+	oss << "State Thread WriterFileOpen fAvFactor: " 
+		<< fState << " " << fThread.isStarted() << " " 
+		<< fWriter->isFileOpen() << " " 
 		<< fAverageFactor << std::endl;
 	oss << "KillLoggingFlag HaltLoggingFlag FramesLogged: "
 		<< fKillLoggingFlag << " "
 		<< fHaltLoggingFlag << " " 
 		<< fFramesLogged << std::endl;
+	oss << "WaitForTrigger HistoryFrames HistoryFramesLogged: "
+		<< fWaitForTrigger << " "
+		<< fHistoryFrames << " "
+		<< fHistoryFramesLogged << std::endl;
 
 	s.append(oss.str());  
 	//fImageParams.debugString(s);
@@ -420,16 +416,16 @@ FrameLogger::debugString(std::string &s) const
 	s.append(oss.str());
 }
 
-//unsigned int WINAPI FrameLogger::loggingThreadFcn(LPVOID userData)
-unsigned __stdcall FrameLogger::loggingThreadFcn( void* userData )
+void
+FrameLogger::loggingThreadFcn(void *userData)
 {
 	CONSOLEPRINT("FrameLogger::loggingThreadFcn...\n");
 	FrameLogger *obj = static_cast<FrameLogger*>(userData);
 
-	unsigned long localFrameTag;
+	unsigned long localFrameTag = 0;
 
-	//Instantiate the MatlabParams singleton.	
-	MatlabParams* fmpThread = MatlabParams::getInstance();
+	//The logger's params.
+	PipelineParams* fmpThread = obj->fmp;
 	const int16_t* sourceArray;
 	int16_t  fpgaTagIdentifier;
 	uint16_t fpgaPlaceHolder;
@@ -441,14 +437,30 @@ unsigned __stdcall FrameLogger::loggingThreadFcn( void* userData )
 			CONSOLEPRINT("KILL LOGGING FLAG: %d\n",obj->fKillLoggingFlag);
 			break;
 		}
-		if (obj->fHaltLoggingFlag && fmpThread->loggingQueue->isEmpty()) {
+		if (obj->fHaltLoggingFlag && fmpThread->loggingQueue->isEmpty() && obj->fHistoryFramesLogged==obj->fHistoryFrames) {
 			CONSOLEPRINT("HALT LOGGING FLAG: %d, LOGGING QUEUE EMPTY? %d\n",obj->fHaltLoggingFlag,(int) fmpThread->loggingQueue->isEmpty());
 			break;
 		}
 
+		// Nothing is opened or written until the copier sees the trigger.
+		// From then on the history is ours, and its frames go first.
+		if (obj->fWaitForTrigger) {
+			if (!fmpThread->frameHistory->isTriggered()) {
+				if (obj->fHaltLoggingFlag) {
+					CONSOLEPRINT("FrameLogger: stopped before the logging trigger.\n");
+					break;
+				}
+				Platform::sleepMs(1);
+				continue;
+			}
+			obj->fWaitForTrigger = false;
+			obj->fHistoryFrames = fmpThread->frameHistory->size();
+			CONSOLEPRINT("FrameLogger: triggered, logging %lu frames from before the trigger first.\n",obj->fHistoryFrames);
+		}
+
 		//TODO: Log File Notes
 		/// Roll over file if appropriate
-		EnterCriticalSection(&obj->fLogfileRolloverCS);
+		obj->fLogfileRolloverMutex.lock();
 		//CONSOLETRACE();
 		if (!obj->fLogfileNotes.empty()) {
 		 
@@ -462,16 +474,18 @@ unsigned __stdcall FrameLogger::loggingThreadFcn( void* userData )
 
 			} else if (framesLoggedPlus1 == lfn.frameIdx) { 
 				CONSOLEPRINT("FrameLogger: rolling over file (fname frameIdx %s %d).\n",lfn.filename.c_str(),lfn.frameIdx);
-				if (obj->fTifWriter->isTifFileOpen()) {
-					obj->fTifWriter->closeTifFile();
+				TRACE_EVENT(TRACE_EVENTS,TRACE_LOG_ROLLOVER,lfn.frameIdx,0,0);
+				if (obj->fWriter->isFileOpen()) {
+					obj->fWriter->closeFile();
 				}
-				if (!obj->fTifWriter->openTifFile(lfn.filename.c_str(),lfn.modeStr.c_str())) {
+				if (!obj->fWriter->openFile(lfn.filename.c_str(),lfn.modeStr.c_str(),lfn.bigTiff)) {
 				    CONSOLEPRINT("FrameLogger: Error opening file %s. Aborting logging.\n",lfn.filename.c_str());
 					//char str[256];
 					//sprintf_s(str,256,"FrameLogger: Error opening file %s. Aborting logging.\n",lfn.filename.c_str());
 					//MessageBox(NULL,str,"Error",MB_OK);
 					// This break will exit loggingThreadFcn. Subsequent calls
 					// to stopLogging or stopLoggingImmediately will "succeed".
+					obj->fLogfileRolloverMutex.unlock();
 					break; 
 				}       
 				CONSOLETRACE();
@@ -490,14 +504,20 @@ unsigned __stdcall FrameLogger::loggingThreadFcn( void* userData )
 							//MessageBox(NULL,str,"Error",MB_OK);
 							// This break will exit loggingThreadFcn. Subsequent calls
 							// to stopLogging or stopLoggingImmediately will "succeed".
+							obj->fLogfileRolloverMutex.unlock();
 							break; 
 						}
-						obj->fTifWriter->modifyImageDescription(FRAME_TAG_STRING_LENGTH,imd.c_str(),obj->fConfiguredImageDescLength+1);
+						obj->fWriter->modifyImageDescription(FRAME_TAG_STRING_LENGTH,imd.c_str(),obj->fConfiguredImageDescLength+1);
 					} else {
-						obj->fTifWriter->replaceImageDescription(lfn.imageDesc.c_str());
+						obj->fWriter->replaceImageDescription(lfn.imageDesc.c_str());
 					}          
 				}
 
+				// Frame layout is now fixed; reserve the file's space.
+				if (fmpThread->loggingPreallocateFrames>0) {
+					obj->fWriter->preallocate(fmpThread->loggingPreallocateFrames);
+				}
+
 				obj->fLogfileNotes.pop_front();
 
 			} else {
@@ -505,18 +525,37 @@ unsigned __stdcall FrameLogger::loggingThreadFcn( void* userData )
 			}
 		}
 
-		LeaveCriticalSection(&obj->fLogfileRolloverCS);
+		obj->fLogfileRolloverMutex.unlock();
 		//CONSOLETRACE();
 
-		// Write frame to TIF file
-		if (fmpThread->loggingQueue->size() >= (unsigned int) (fmpThread->frameDelay + 1) || (obj->fHaltLoggingFlag && !fmpThread->loggingQueue->isEmpty())) {
+		// Write frame to TIF file: the history's frames, then the queue's.
+		bool fromHistory = obj->fHistoryFramesLogged < obj->fHistoryFrames;
+		if (fromHistory || fmpThread->loggingQueue->size() >= (unsigned int) (fmpThread->frameDelay + 1) || (obj->fHaltLoggingFlag && !fmpThread->loggingQueue->isEmpty())) {
 //			CONSOLEPRINT("Framelogger: Writing frame to TIF file...\n");
 //		    CONSOLETRACE();
-		assert(obj->fTifWriter->isTifFileOpen());
+		assert(obj->fWriter->isFileOpen());
+
+		// loggingQueue is this thread's reader of the copier's
+		// multicast frame queue; the MATLAB exec thread acts as the
+		// controller. acquire_front sets the reader's ACQUIRED bit with
+		// a CAS on its cursor, after which the producer will neither
+		// overwrite the slot nor skip the reader past it (the reader is
+		// NEVER_DROP anyway). So the front slot is ours until
+		// release_front and we read it in place; the copier is never
+		// held up by the TIFF write below, other readers only by a full
+		// ring.
+		// History frames are read in place too; the copier no longer
+		// writes to the history once it is triggered.
+		const void *framePtr = fromHistory ? fmpThread->frameHistory->at(obj->fHistoryFramesLogged) :
+			fmpThread->loggingQueue->acquire_front();
+		const char *charFramePtr = static_cast<const char*>(framePtr);
+		if (!fromHistory)
+			fmpThread->stats->record(PipelineStats::LOGGING_QUEUE_DWELL,fmpThread->loggingQueue->acquired_ticks());
+		int64_t t0 = fmpThread->stats->start();
 
 		// update local tag if tagging is enabled.
 		if (fmpThread->frameTagging) {
-			sourceArray = static_cast<const int16_t*>(fmpThread->loggingQueue->front_unsafe());
+			sourceArray = static_cast<const int16_t*>(framePtr);
 			fpgaTagIdentifier = (int16_t) sourceArray[(fmpThread->frameSizeBytes - fmpThread->tagSizeBytes)/2];
 			fpgaPlaceHolder = (uint16_t) sourceArray[(fmpThread->frameSizeBytes - fmpThread->tagSizeBytes)/2 + 1];
 			fpgaTotalAcquiredRecordsA = (uint16_t) sourceArray[(fmpThread->frameSizeBytes - fmpThread->tagSizeBytes)/2 + 2];
@@ -525,17 +564,6 @@ unsigned __stdcall FrameLogger::loggingThreadFcn( void* userData )
 			//CONSOLEPRINT("localFrameTag: %lu\n",localFrameTag);
 		}
 
-		// Three threads access fFrameQueue: this thread (the logging
-		// thread), the ThorFrameCopier thread (doing pushes only), and
-		// the MATLAB exec thread (acting as the controller). Use
-		// front_checkout/checkin to protect against controller eg
-		// initting the queue while we read (unlikely but conceivable).
-
-		//CONSOLETRACE();
-		const void *framePtr = fmpThread->loggingQueue->front_checkout();
-
-		const char *charFramePtr = static_cast<const char*>(framePtr);
-
 		if (obj->fAverageFactor==1) {
 			// no averaging.
 
@@ -552,14 +580,9 @@ unsigned __stdcall FrameLogger::loggingThreadFcn( void* userData )
 			}
 			//CONSOLETRACE();
 
-			// If this hangs/throws, front_checkin will never be called
-			// and we will lock up.
 		//	CONSOLETRACE();
-			obj->fTifWriter->writeFramesForAllChannels(charFramePtr,(unsigned int) fmpThread->frameSizeBytes * fmpThread->numLoggingChannels);
+			obj->fWriter->writeFramesForAllChannels(charFramePtr,(unsigned int) fmpThread->frameSizeBytes * fmpThread->numLoggingChannels);
 		//	CONSOLETRACE();
-
-
-			fmpThread->loggingQueue->front_checkin();
 		} else {
 
 			int modVal = obj->fFramesLogged % obj->fAverageFactor;
@@ -568,7 +591,7 @@ unsigned __stdcall FrameLogger::loggingThreadFcn( void* userData )
 			}
 			bool computeAverageTF = (modVal + 1 == obj->fAverageFactor);
 
-			obj->addToAveragingBuffer(framePtr);
+			obj->fAverager.add(framePtr);
 
 			if (fmpThread->frameTagging && computeAverageTF) {
 				if (!obj->updateFrameTag(charFramePtr,localFrameTag)) {
@@ -578,30 +601,32 @@ unsigned __stdcall FrameLogger::loggingThreadFcn( void* userData )
 				}      
 			}
 
-			fmpThread->loggingQueue->front_checkin();
 			framePtr = NULL;
 
 			if (computeAverageTF) {
-				obj->computeAverageResult();
+				obj->fAverager.computeAverage(obj->fAveragingResultBuf);
 
-				obj->fTifWriter->writeFramesForAllChannels(obj->fAveragingResultBuf,(unsigned int) fmpThread->frameSizeBytes * fmpThread->numLoggingChannels);
+				obj->fWriter->writeFramesForAllChannels(obj->fAveragingResultBuf,(unsigned int) fmpThread->frameSizeBytes * fmpThread->numLoggingChannels);
 			}
 		}
 
-		fmpThread->loggingQueue->pop_front();
+		fmpThread->stats->record(PipelineStats::LOGGER_WRITE,t0);
+		TRACE_EVENT(TRACE_FRAMES,TRACE_FRAME_LOGGED,localFrameTag,obj->fFramesLogged+1,fmpThread->loggingQueue->size());
+		if (fromHistory)
+			obj->fHistoryFramesLogged++;
+		else
+			fmpThread->loggingQueue->release_front();
 		obj->fFramesLogged++;
 		}
 
-		Sleep(0); //relinquish thread
+		Platform::sleepMs(0); //relinquish thread
 	}
 
 	CONSOLEPRINT("FrameLogger: exiting logging thread.\n");
 
-	if (obj->fTifWriter->isTifFileOpen()) {
-		obj->fTifWriter->closeTifFile();
+	if (obj->fWriter->isFileOpen()) {
+		obj->fWriter->closeFile();
 	}
-
-	return 0;
 }
 
 bool
@@ -623,12 +648,11 @@ FrameLogger::updateFrameTag(const char *framePtr)
 	//int numWritten = sprintf_s(frameTagStr,FRAME_TAG_STRING_LENGTH+1,"Frame Tag = %08d",frameTag);  
 
 	if (numWritten == FRAME_TAG_STRING_LENGTH) {
-		fTifWriter->modifyImageDescription(0,frameTagStr,FRAME_TAG_STRING_LENGTH);
+		fWriter->setFrameTag(frameTag);
+		fWriter->modifyImageDescription(0,frameTagStr,FRAME_TAG_STRING_LENGTH);
 		return true;
 	} else {
-		char str[256];
-		sprintf_s(str,256,"FrameLogger: Error writing frame tag. Wrote %d chars to make string: %s. (should have written %d). Aborting logging.\n",numWritten,frameTagStr,FRAME_TAG_STRING_LENGTH);
-		MessageBox(NULL,str,"Error",MB_OK);
+		CONSOLEPRINT("FrameLogger: Error writing frame tag. Wrote %d chars to make string: %s. (should have written %d). Aborting logging.\n",numWritten,frameTagStr,FRAME_TAG_STRING_LENGTH);
 		return false;
 	}
 }
@@ -654,79 +678,27 @@ FrameLogger::updateFrameTag(const char *framePtr, unsigned long frameTag)
 	//int numWritten = sprintf_s(frameTagStr,FRAME_TAG_STRING_LENGTH+1,"Frame Tag = %08d",frameTag);  
 
 	if (numWritten == FRAME_TAG_STRING_LENGTH) {
-		fTifWriter->modifyImageDescription(0,frameTagStr,FRAME_TAG_STRING_LENGTH);
+		fWriter->setFrameTag(frameTag);
+		fWriter->modifyImageDescription(0,frameTagStr,FRAME_TAG_STRING_LENGTH);
 //		CONSOLEPRINT("FRAME TAG STRING: %s, FRAME TAG STRING LENGTH: %d\n",frameTagStr, FRAME_TAG_STRING_LENGTH);
 		return true;
 	} else {
-		char str[256];
-		sprintf_s(str,256,"FrameLogger: Error writing frame tag. Wrote %d chars to make string: %s. (should have written %d). Aborting logging.\n",numWritten,frameTagStr,FRAME_TAG_STRING_LENGTH);
-		MessageBox(NULL,str,"Error",MB_OK);
+		CONSOLEPRINT("FrameLogger: Error writing frame tag. Wrote %d chars to make string: %s. (should have written %d). Aborting logging.\n",numWritten,frameTagStr,FRAME_TAG_STRING_LENGTH);
 		return false;
 	}
 }
 
 void FrameLogger::zeroAveragingBuffers(void)
 {
-	assert(fAveragingBuf!=NULL);
-	for (size_t i=0;i<(fmp->frameSizePixels * fmp->numLoggingChannels);i++) {
-		fAveragingBuf[i] = 0.0;
-	}
+	fAverager.reset();
 	assert(fAveragingResultBuf!=NULL);
-	for (size_t i=0;i<(fmp->frameSizeBytes * fmp->numLoggingChannels);i++) {
-		fAveragingResultBuf[i] = 0; // unnnecessary, defensive programming
-	}
-}
-
-void FrameLogger::addToAveragingBuffer(const void *p)
-{
-	assert(fAveragingBuf!=NULL);
-	assert(sizeof(short)==2);
-	assert(sizeof(long)==4);
-
-	for (int i=0;i<(fmp->frameSizePixels*fmp->numLoggingChannels);i++) {
-		switch (fmp->pixelSizeBytes) {
-	case 1:
-		fAveragingBuf[i] += (double) (*((char*)p + i)); // ((char*)p)[i]
-		break;
-	case 2:
-		fAveragingBuf[i] += (double) (*((short*)p + i)); // etc
-		break;
-	case 4:
-		fAveragingBuf[i] += (double) (*((long*)p + i));
-		break;
-	default:
-		assert(false);
-		}
-	}
-}
-
-void FrameLogger::computeAverageResult(void)
-{
-	for (int i=0;i<(fmp->frameSizePixels * fmp->numLoggingChannels);++i) {
-		double avVal = fAveragingBuf[i] / (double)fAverageFactor;
-		switch (fmp->pixelSizeBytes) {
-	case 1:
-		((char *)fAveragingResultBuf)[i] = (char)avVal;
-		break;
-	case 2:				
-		((short *)fAveragingResultBuf)[i] = (short)avVal;
-		break;
-	case 4:
-		((long *)fAveragingResultBuf)[i] = (long)avVal;
-		break;
-	default:
-		assert(false);
-		}
-	}
+	memset(fAveragingResultBuf,0,fmp->frameSizeBytes * fmp->numLoggingChannels); // unnnecessary, defensive programming
 }
 
 void
 FrameLogger::deleteAveragingBuffers(void) 
 {
-	if (fAveragingBuf!=NULL) {
-		delete[] fAveragingBuf;
-		fAveragingBuf = NULL;
-	}
+	fAverager.clear();
 	if (fAveragingResultBuf!=NULL) {
 		delete[] fAveragingResultBuf;
 		fAveragingResultBuf = NULL;
@@ -747,10 +719,19 @@ FrameLogger::configureLogFile(void)
 
 	CONSOLEPRINT("FrameLogger::configureLogFile - ensuring disarmed...\n");
 	ensureDisarmed();
+	if (strcmp(fmp->loggingFormat,"raw")==0) {
+		fWriter = fRawWriter;
+		fRawWriter->configureChunks(fmp->loggingRawFramesPerChunk);
+	} else {
+		fWriter = fTifWriter;
+		fTifWriter->configureCompression(StripCompressor::codecFromString(fmp->loggingCompression),fmp->loggingCompressionLevel,
+			fmp->loggingCompressionPredictor,fmp->loggingCompressionThreads);
+	}
+	fWriter->configureAsyncIO(fmp->loggingAsyncWrites,fmp->loggingWriteBufferMB*1024*1024,fmp->loggingWritesInFlight);
 	CONSOLEPRINT("FrameLogger::configureLogFile - calling configureImage...\n");
 	configureImage((unsigned int) fmp->loggingAverageFactor,fmp->loggingHeaderString);
 	CONSOLEPRINT("FrameLogger::configureLogFile - calling configureFile...\n");
-	configureFile(fmp->loggingFullFileName,fmp->loggingOpenModeString);  
+	configureFile(fmp->loggingFullFileName,fmp->loggingOpenModeString,fmp->loggingBigTiff);  
 }
 
 // See note for thorFrameCopierEnsureDisarmed.
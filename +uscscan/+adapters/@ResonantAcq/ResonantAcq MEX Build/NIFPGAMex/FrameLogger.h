@@ -4,25 +4,27 @@
 #include "StateModelObject.h"
 #include "AbstractConsumerQueue.h"
 #include "TifWriter.h"
-#include "MatlabParams.h"
+#include "RawFrameWriter.h"
+#include "FrameTag.h"
+#include "FrameAverager.h"
+#include "PipelineParams.h"
 
 //forward declarations
-class MatlabParams;
-class FrameQueue;
 
 class LogFileNote {
 
 public:  
 
-	LogFileNote(void) : frameIdx(1) { }
+	LogFileNote(void) : frameIdx(1), bigTiff(false) { }
 
-	LogFileNote(const char *fname, const char *modestr, unsigned long frmidx) :
-	filename(fname), modeStr(modestr), frameIdx(frmidx) { }
+	LogFileNote(const char *fname, const char *modestr, unsigned long frmidx, bool bigtiff = false) :
+	filename(fname), modeStr(modestr), frameIdx(frmidx), bigTiff(bigtiff) { }
 
 	std::string filename;
 	std::string modeStr;
 	std::string imageDesc;
 	unsigned long frameIdx;
+	bool bigTiff; // write the file as BigTIFF
 };
 
 /*
@@ -34,7 +36,14 @@ processing thread.
 
 Responsibilities.
 * Logging-level averaging
-* Streaming to disk
+* Streaming to disk, as TIFF (TifWriter) or as a raw log
+(RawFrameWriter), per PipelineParams::loggingFormat
+* With a logging trigger (loggingWaitForTrigger), waiting for the
+FrameCopier to see the trigger, then logging the frames from before it
+(PipelineParams::frameHistory) ahead of the input queue
+
+All settings and shared objects come from the PipelineParams given at
+construction, so FrameLogger has no Matlab in it.
 
 Thread-safety.  
 The threading model is similar to ThorFrameCopier. The usage model
@@ -58,7 +67,9 @@ class FrameLogger : public StateModelObject {
 
 public:
 
-	FrameLogger(void);
+	// params is not owned, and must outlive the logger. Its settings
+	// are read at configureLogFile and startLogging.
+	FrameLogger(PipelineParams* params);
 
 	~FrameLogger(void);
 
@@ -78,9 +89,10 @@ public:
 	//      const char *imageDesc);
 	void configureImage(unsigned int averagingFactor, const char *imageDesc);
 
-	// Set the filename/modestr for the logging file. Note that this
-	// call resets the current queue of LogFileNotes. 
-	void configureFile(const char *filename,const char *modestr);
+	// Set the filename/modestr for the logging file, and whether it is
+	// written as BigTIFF. Note that this call resets the current queue
+	// of LogFileNotes. 
+	void configureFile(const char *filename,const char *modestr,bool bigTiff = false);
 
 	// not implemented
 	// void setHeaderString(const char *str);
@@ -102,7 +114,8 @@ public:
 	/// Start/stop logging. 
 
 	// Resets counters and logging will begin when data is put into
-	// frame queue.
+	// frame queue. With loggingWaitForTrigger, no file is opened until
+	// the trigger.
 	// 
 	// Precondition: ARMED 
 	// Postcondition: RUNNING
@@ -146,6 +159,12 @@ public:
 	// This can be called in any state.
 	unsigned long getFramesLogged(void) const;
 
+	// CPU time used by the logging thread, in seconds: the running
+	// thread's, or once it has stopped, the last one's.
+	//
+	// This can be called in any state.
+	double getLoggingThreadCpuSeconds(void) const;
+
 
 	/// Misc
 
@@ -156,46 +175,47 @@ public:
     void ensureDisarmed(void);
 
 private:
-	MatlabParams* fmp;
-	static unsigned int WINAPI loggingThreadFcn(LPVOID);
+	PipelineParams* fmp;
+	static void loggingThreadFcn(void *userData);
 
 	void zeroAveragingBuffers(void);
-	// add fPixelsPerFrame pixels, each of size fBytesPerPixel, to fAveragingBuf
-	void addToAveragingBuffer(const void *p);
-	// compute average of fAveragingBuf; place result in fAveragingResultBuf
-	void computeAverageResult(void);
 	void deleteAveragingBuffers(void);
 
 	bool updateFrameTag(const char *framePtr);
 	bool updateFrameTag(const char *framePtr, unsigned long frameTag);
 
-	FrameQueue* fMatlabQ;
-
 private:
-	static const DWORD STOP_LOGGING_TIMEOUT_MILLISECONDS = 5000; // 5 seconds
-	static const char* FRAME_TAG_FORMAT_STRING; //Allow up to 10 million
+	static const unsigned long STOP_LOGGING_TIMEOUT_MILLISECONDS = 5000; // 5 seconds
+	static const char* FRAME_TAG_FORMAT_STRING; //See FrameTag.h
 //	static const unsigned int FRAME_TAG_STRING_LENGTH = 8 + 13; //Allow for 'Frame Tag = \n' at start
-	static const unsigned int FRAME_TAG_STRING_LENGTH = 16 + 13; //Allow for 'Frame Tag = \n' at start
+	static const unsigned int FRAME_TAG_STRING_LENGTH = FrameTag::STRING_LENGTH;
 	static const unsigned int IMAGE_DESC_DEFAULT_PADDING = 100;
 
-	HANDLE fThread;
+	Platform::Thread fThread;
 
 	// FrameQueue has mutable state, so calls to it probably won't be
 	// optimized away. In particular for example we want isEmpty() not
 	// to be cached.
 	//AbstractConsumerQueue *fFrameQueue;
 	TifWriter *fTifWriter;
+	RawFrameWriter *fRawWriter;
+	FrameWriter *fWriter; // the one logging: fTifWriter or fRawWriter
 
 	//ImageParameters fImageParams;
 	unsigned int fAverageFactor;
-	double *fAveragingBuf; // one double for every pixel in a frame
+	FrameAverager fAverager; // running sums for every pixel in a frame
 	char *fAveragingResultBuf; // one byte/char for every byte in a frame
 
 	// runtime state
 	bool volatile fKillLoggingFlag;
 	bool volatile fHaltLoggingFlag;
 
-	CRITICAL_SECTION fLogfileRolloverCS;
+	// Triggered logging. The history's frames are logged first.
+	bool fWaitForTrigger;
+	unsigned long fHistoryFrames;
+	unsigned long fHistoryFramesLogged;
+
+	Platform::Mutex fLogfileRolloverMutex;
 	std::deque<LogFileNote> fLogfileNotes;
 	unsigned long fFramesLogged;
 
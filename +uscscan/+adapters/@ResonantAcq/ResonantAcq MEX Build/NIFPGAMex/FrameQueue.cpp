@@ -1,26 +1,25 @@
-#include "stdafx.h"
 #include <assert.h>
 #include <sstream>
 #include "FrameQueue.h"
 #include "Misc.h"
+#include "Atomics.h"
 
 FrameQueue::FrameQueue(void) :
   fRecordSize(0),
   fCapacity(0),
-  fNumPushBacks(0),
-  fNumDroppedPushBacks(0),
+  fNumSlots(0),
   fDroppedPushCapacity(0),
   fQ(NULL),
-  fQBegin(0),
-  fQSize(0)
+  fTail(0),
+  fNumPushBacks(0),
+  fNumDroppedPushBacks(0),
+  fHead(0)
 {
-  InitializeCriticalSection(&fCS);
 }
 
-FrameQueue::~FrameQueue(void) 
+FrameQueue::~FrameQueue(void)
 {
   this->deleteBufs();
-  DeleteCriticalSection(&fCS);
 }
 
 void
@@ -44,21 +43,21 @@ FrameQueue::init(size_t recordSz,
   assert(capacity>0);
   assert(droppedPushCapacity>0); // enhancement: allow droppedPushCapacity==0
 
-  EnterCriticalSection(&fCS);
-
   fRecordSize = recordSz;
   fCapacity = capacity;
+  fNumSlots = capacity+1;
   fDroppedPushCapacity = droppedPushCapacity;
   fNumPushBacks = 0;
   fNumDroppedPushBacks = 0;
-  
+
   this->deleteBufs();
+  // Reserved up front so that the producer never reallocates.
   fDroppedPushBackIdxs.reserve(fDroppedPushCapacity);
-  fQ = new char[fCapacity*fRecordSize]();
-  fQBegin = 0;
-  fQSize = 0;
+  fQ = new char[fNumSlots*fRecordSize]();
+  fHead = 0;
+  fTail = 0;
 
-  LeaveCriticalSection(&fCS);
+  fullBarrier();
 }
 
 void
@@ -73,50 +72,39 @@ FrameQueue::push_back(const void *src)
 {
 	//CONSOLETRACE();
 
-	bool retval = true;
+	unsigned long tail = fTail; // producer owns fTail
+	unsigned long next = nextSlot(tail);
 
-	EnterCriticalSection(&fCS);
-	fNumPushBacks++;
-	if (fQSize==fCapacity) {
-		// queue is full; push will be dropped
-		CONSOLEPRINT("QUEUE IS FULL!: fNumPushBacks: %lu, fQSize: %lu, fCapacity: %lu\n", fNumPushBacks, fQSize, fCapacity);
+	unsigned long numPushBacks = fNumPushBacks+1; // producer owns the counters too
+	fNumPushBacks = numPushBacks;
+	if (next==loadAcquire(fHead)) {
+		// queue is full; push will be dropped. No console output here,
+		// since that would serialize the producer on the console lock.
 		if (fDroppedPushBackIdxs.size() < fDroppedPushCapacity) {
-			//fDroppedPushBackIdxs.push_back(fNumPushBacks);
+			// capacity was reserved in init(), so this never reallocates
+			fDroppedPushBackIdxs.push_back(numPushBacks);
 		}
 		fNumDroppedPushBacks++;
-		retval = false;
-	} else {
-		// queue has room; do the push
-		unsigned long onePastEnd = (fQBegin+fQSize) % fCapacity;
-		//CONSOLEPRINT("QUEUE HAS ROOM!: onePastEnd: %lu, fQBegin: %lu, fQSize: %lu, fCapacity: %lu, fRecordSize: %lu\n", onePastEnd, fQBegin, fQSize, fCapacity, fRecordSize);
-		memcpy(fQ+onePastEnd*fRecordSize,src,fRecordSize);
-		fQSize++;
+		return false;
 	}
-	LeaveCriticalSection(&fCS);
 
-	return retval;
+	// queue has room; do the push
+	memcpy(fQ+tail*fRecordSize,src,fRecordSize);
+	storeRelease(fTail,next);
+
+	return true;
 }
 
-unsigned long 
+unsigned long
 FrameQueue::total_num_push_back(void) const
 {
-  // Here and in other simple getters, using CriticalSection methods
-  // might be overkill, but I'm not sure. It's not hurting for now.
-  EnterCriticalSection(&fCS);
-  unsigned long retval = fNumPushBacks;
-  LeaveCriticalSection(&fCS);
-
-  return retval;
+  return fNumPushBacks;
 }
 
-unsigned long 
+unsigned long
 FrameQueue::num_dropped_push_back(void) const
 {
-  EnterCriticalSection(&fCS);
-  unsigned long retval = fNumDroppedPushBacks;
-  LeaveCriticalSection(&fCS);
-
-  return retval;
+  return fNumDroppedPushBacks;
 }
 
 const std::vector<unsigned long> &
@@ -125,94 +113,64 @@ FrameQueue::dropped_push_back(void) const
   return fDroppedPushBackIdxs;
 }
 
-unsigned long 
+unsigned long
 FrameQueue::capacity(void) const
 {
-  EnterCriticalSection(&fCS);
-  unsigned long retval = fCapacity;
-  LeaveCriticalSection(&fCS);
-
-  return retval;
+  return fCapacity;
 }
 
-unsigned long 
+unsigned long
 FrameQueue::dropped_push_capacity(void) const
 {
-  EnterCriticalSection(&fCS);
-  unsigned long retval = fDroppedPushCapacity;
-  LeaveCriticalSection(&fCS);
-
-  return retval;
+  return fDroppedPushCapacity;
 }
 
-std::size_t 
+std::size_t
 FrameQueue::recordSize(void) const
 {
-  EnterCriticalSection(&fCS);
-  std::size_t retval = fRecordSize;
-  LeaveCriticalSection(&fCS);
-  
-  return retval;
+  return fRecordSize;
 }
 
-bool 
+bool
 FrameQueue::isEmpty(void) const
 {
-  EnterCriticalSection(&fCS);
-  bool retval = (fQSize==0);
-  LeaveCriticalSection(&fCS);
-
-  return retval;
+  return loadAcquire(fHead)==loadAcquire(fTail);
 }
 
-unsigned long 
+unsigned long
 FrameQueue::size(void) const
 {
-  EnterCriticalSection(&fCS);
-  unsigned long retval = fQSize;
-  LeaveCriticalSection(&fCS);
-
-  return retval;
+  unsigned long head = loadAcquire(fHead);
+  unsigned long tail = loadAcquire(fTail);
+  return distance(head,tail);
 }
 
-const void* 
+const void*
 FrameQueue::front_unsafe(void) const
 {
-  EnterCriticalSection(&fCS);
-  const void* retval = (fQSize==0) ? NULL : fQ+fQBegin*fRecordSize;
-  LeaveCriticalSection(&fCS);
- 
-  return retval;
+  unsigned long head = fHead; // consumer owns fHead
+  return (head==loadAcquire(fTail)) ? NULL : fQ+head*fRecordSize;
 }
 
 const void*
 FrameQueue::front_checkout(void)
 {
-  EnterCriticalSection(&fCS);
-  const void* retval = (fQSize==0) ? NULL : fQ+fQBegin*fRecordSize;
-  return retval;
+  return front_unsafe();
 }
 
-// consider protecting front_checkout/checkin to protect against an
-// "unpaired" checkin
 void
 FrameQueue::front_checkin(void)
 {
-  LeaveCriticalSection(&fCS);
 }
 
-void 
+void
 FrameQueue::pop_front(void)
 {
   //CONSOLETRACE();
 
-  EnterCriticalSection(&fCS);
-  assert(fQSize>0);
-  fQBegin = (fQBegin+1) % fCapacity;
-  fQSize--;
-  if (fQSize > 0) 
-	  CONSOLEPRINT("fQSize: %lu\n", fQSize);
-  LeaveCriticalSection(&fCS);
+  unsigned long head = fHead;
+  assert(head!=loadAcquire(fTail));
+  storeRelease(fHead,nextSlot(head));
 }
 
 void
@@ -221,13 +179,10 @@ FrameQueue::debugString(std::string &s) const
   std::ostringstream oss;
   oss << "--FrameQueue--" << std::endl;
   oss << "RecordSz Cap DroppedPushCap NumPushBacks NumDroppedPushBacks: ";
-
-  EnterCriticalSection(&fCS);
   oss << fRecordSize << " " << fCapacity << " " << fDroppedPushCapacity << " "
       << fNumPushBacks << " " << fNumDroppedPushBacks << std::endl;
-  oss << "Q Size: " << fQSize << " " 
+  oss << "Q Size: " << size() << " "
       << "DroppedPushBackIdxs.size: " << fDroppedPushBackIdxs.size() << std::endl;
-  LeaveCriticalSection(&fCS);
 
   s.append(oss.str());
 }
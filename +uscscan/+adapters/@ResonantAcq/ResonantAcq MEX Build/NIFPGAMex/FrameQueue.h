@@ -1,28 +1,36 @@
 #pragma once
 
 #include <vector>
-#include <windows.h>
+#include <string>
+#include "Platform.h"
 #include "AbstractConsumerQueue.h"
 
-// The queue is threadsafe except as noted in the comments. The
+// Single-producer/single-consumer ring of fixed-size records. The
 // typical/envisioned usage involves up to three threads: a producer who
 // pushes records, a consumer who uses and pops records, and a
 // controller who initializes/configures/clears.
-// 
+//
+// push_back/pop_front and the getters are lock-free: the producer only
+// ever writes fTail and the consumer only ever writes fHead, so neither
+// side can block the other. This is only safe for ONE producer thread
+// and ONE consumer thread per queue. init()/reinit() are NOT safe with
+// respect to a concurrent producer or consumer; the controller must
+// call them while both are idle.
+//
 // Overflow pushes are dropped, but noted. Overflow pushes are dropped
 // in order to maintain the relative temporal ordering of records as
 // seen by the consumer.
 class FrameQueue : public AbstractConsumerQueue {
 
  public:
-  
+
   FrameQueue(void);
-  
+
   ~FrameQueue(void);
 
   // Allocates memory and prepares queue for use. init() can be called
-  // repeatedly at runtime to reset/clear and resize a FrameQueue. 
-  void init(size_t recordSz, unsigned long capacity, 
+  // repeatedly at runtime to reset/clear and resize a FrameQueue.
+  void init(size_t recordSz, unsigned long capacity,
 	    unsigned long droppedPushCapacity);
 
   // Like init(), but uses existing parameters. Simply resets/clears the queue.
@@ -30,7 +38,8 @@ class FrameQueue : public AbstractConsumerQueue {
 
   // Called by producer. Attempt to push a record onto the back of the queue. If
   // the queue is full, this will fail and a dropped push will be recorded.
-  // 
+  // Never blocks.
+  //
   // Return value is true if push was successful, false otherwise.
   bool push_back(const void *src);
 
@@ -50,25 +59,26 @@ class FrameQueue : public AbstractConsumerQueue {
 
   bool isEmpty(void) const;
 
-  // Return number of elements currently in queue.
+  // Return number of elements currently in queue. From any thread other
+  // than the producer/consumer this is a snapshot and may be stale.
   unsigned long size(void) const;
 
-  // Called by consumer. Return address i) points to queue front. 
-  // Returns NULL if size()==0.
+  // Called by consumer. Return address points to queue front.
+  // Returns NULL if size()==0. The record stays valid (the producer
+  // will not overwrite it) until the consumer calls pop_front.
   //
-  // WARNING: this is thread-unsafe, eg with respect to a
-  // concurrent pop_front or init. (A concurrent push_back is okay at
-  // the moment since the push drops if the queue is full.)
+  // WARNING: this is thread-unsafe with respect to a concurrent init.
   const void* front_unsafe(void) const;
 
-  // Thread-safe way to peek at front. Call front_checkin when done peeking.
+  // Called by consumer. Equivalent to front_unsafe; kept for
+  // AbstractConsumerQueue clients. No lock is taken, so the producer
+  // keeps pushing while the consumer reads the front record.
   const void* front_checkout(void);
 
-  // If this is called without a preceding front_checkout call, the
-  // results are indeterminate.
+  // Pairs with front_checkout. Currently a no-op.
   void front_checkin(void);
 
-  // Asserts that the queue is nonempty.
+  // Called by consumer. Asserts that the queue is nonempty.
   void pop_front(void);
 
   unsigned long capacity(void) const;
@@ -84,20 +94,39 @@ class FrameQueue : public AbstractConsumerQueue {
  private:
   void deleteBufs(void);
 
+  // Number of records from slot head up to (not including) slot tail.
+  unsigned long distance(unsigned long head, unsigned long tail) const {
+    return (tail >= head) ? tail-head : tail+fNumSlots-head;
+  }
+
+  unsigned long nextSlot(unsigned long idx) const {
+    return (idx+1==fNumSlots) ? 0 : idx+1;
+  }
+
  private:
+  static const unsigned int CACHE_LINE_SIZE = 64;
+
+  // Configuration; written only by init().
   size_t fRecordSize; // in bytes
   unsigned long fCapacity; // max num records in queue
+  unsigned long fNumSlots; // fCapacity+1; one slot is always left empty
   unsigned long fDroppedPushCapacity;
-  unsigned long fNumPushBacks;
-  unsigned long fNumDroppedPushBacks;
   std::vector<unsigned long> fDroppedPushBackIdxs;
 
-  // impl note: fQBegin, fQSize are idxs into fQ. if fQSize>0, then 
-  // fQ[fQBegin] has the front of the queue. (fQBegin+fQSize) % fCapacity points
-  // immediately after the end of the queue.
+  // impl note: fHead, fTail are slot idxs into fQ. if fHead!=fTail, then
+  // fQ[fHead] has the front of the queue and fQ[fTail] is the slot the
+  // next push will fill. The queue is full when nextSlot(fTail)==fHead.
   char *fQ;
-  unsigned long fQBegin;
-  unsigned long fQSize; // number of records in Q
-  
-  mutable CRITICAL_SECTION fCS;
+
+  // Producer-owned. Padded so that producer and consumer writes never
+  // share a cache line.
+  char fProducerPad[CACHE_LINE_SIZE];
+  volatile unsigned long fTail;
+  volatile unsigned long fNumPushBacks;
+  volatile unsigned long fNumDroppedPushBacks;
+
+  // Consumer-owned.
+  char fConsumerPad[CACHE_LINE_SIZE];
+  volatile unsigned long fHead;
+  char fEndPad[CACHE_LINE_SIZE];
 };
@@ -0,0 +1,62 @@
+#include "FrameSource.h"
+
+FrameRatePacer::FrameRatePacer(void) :
+  fPeriod(0.0),
+  fStartTime(0.0),
+  fTicksPerSecond(1.0),
+  fFramesDelivered(0)
+{
+}
+
+double
+FrameRatePacer::now(void) const
+{
+  return (double) Platform::perfCounter() / fTicksPerSecond;
+}
+
+void
+FrameRatePacer::start(double framesPerSecond)
+{
+  fTicksPerSecond = (double) Platform::perfFrequency();
+
+  fPeriod = (framesPerSecond>0.0) ? 1.0/framesPerSecond : 0.0;
+  fStartTime = now();
+  fFramesDelivered = 0;
+}
+
+bool
+FrameRatePacer::waitForFrame(uint32_t timeoutMs, unsigned long *framesBehind)
+{
+  *framesBehind = 0;
+  if (fPeriod==0.0) {
+    fFramesDelivered++;
+    return true;
+  }
+
+  // Frame n is due at fStartTime + n*fPeriod.
+  double due = fStartTime + fFramesDelivered*fPeriod;
+  double t = now();
+  double deadline = t + timeoutMs/1000.0;
+  while (true) {
+    if (t>=due) {
+      fFramesDelivered++;
+      unsigned long framesDue = (unsigned long) ((t-fStartTime)/fPeriod) + 1;
+      if (framesDue>fFramesDelivered) {
+	*framesBehind = framesDue-fFramesDelivered;
+      }
+      return true;
+    }
+    if (t>=deadline) {
+      return false;
+    }
+
+    // Sleeping is only good to a millisecond or so; yield for the last bit.
+    double wait = ((due<deadline) ? due : deadline) - t;
+    if (wait>0.002) {
+      Platform::sleepMs((unsigned long) ((wait-0.001)*1000.0));
+    } else {
+      Platform::sleepMs(0);
+    }
+    t = now();
+  }
+}
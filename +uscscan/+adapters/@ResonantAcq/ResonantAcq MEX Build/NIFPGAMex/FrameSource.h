@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cstddef>
+#include "Platform.h"
+
+// Shape of the frames a FrameSource delivers, exactly as the FPGA FIFO
+// delivers them: single-channel frames are int16 pixels, multi-channel
+// frames are 4 interleaved int16 channels per pixel (one U64 FIFO
+// element). If tagging is on, the last tagSizeBytes of each frame hold
+// the frame tag.
+struct FrameFormat {
+  bool isMultiChannel;
+  std::size_t linesPerFrame;
+  std::size_t pixelsPerLine;
+  std::size_t frameSizeBytes;        // including tag
+  std::size_t frameSizeFifoElements; // including tag
+  bool frameTagging;
+  std::size_t tagSizeBytes;
+
+  FrameFormat(void) :
+    isMultiChannel(false),
+    linesPerFrame(0),
+    pixelsPerLine(0),
+    frameSizeBytes(0),
+    frameSizeFifoElements(0),
+    frameTagging(false),
+    tagSizeBytes(0)
+  {
+  }
+
+  // Index (in int16 words) of the first tag word within a frame.
+  std::size_t tagWordIndex(void) const {
+    return (frameSizeBytes-tagSizeBytes)/2;
+  }
+};
+
+// Where FrameCopier gets its frames. The NiFpga FIFO in normal
+// operation; a synthetic or replayed stream in simulated mode, so that
+// the copier->queue->logger pipeline can be exercised without a FlexRIO.
+//
+// All calls are made from the copier's processing thread: open() once
+// at the start of each acquisition, then readFrame() repeatedly, then
+// close().
+class FrameSource {
+
+ public:
+
+  // Status of a source call. The codes are NiFpga_Status codes, so that
+  // NiFpgaFifoSource passes the FIFO's status through as is; negative
+  // codes are errors, positive ones warnings.
+  typedef int32_t Status;
+  static const Status SUCCESS = 0;
+  static const Status FIFO_TIMEOUT = -50400;
+  static const Status SOFTWARE_FAULT = -52003;
+  static const Status INVALID_PARAMETER = -52005;
+  static const Status RESOURCE_NOT_FOUND = -52006;
+  static const Status RESOURCE_NOT_INITIALIZED = -52010;
+  static const Status FEATURE_NOT_SUPPORTED = -63193;
+
+  static bool isError(Status status) { return status<0; }
+
+  virtual ~FrameSource(void) {}
+
+  // Prepare to deliver frames of the given format.
+  virtual Status open(const FrameFormat &fmt) = 0;
+
+  // Read the next frame (fmt.frameSizeBytes) into dst, waiting up to
+  // timeoutMs for it. Returns SUCCESS, FIFO_TIMEOUT if no frame is
+  // available yet, or an error. On return *elementsRemaining holds the
+  // number of FIFO elements still waiting to be read.
+  virtual Status readFrame(void *dst, uint32_t timeoutMs,
+			   std::size_t *elementsRemaining) = 0;
+
+  // Drop numElements FIFO elements from the stream, waiting up to
+  // timeoutMs for them; used to get back onto a frame boundary (see
+  // FrameSync). Sources that cannot lose alignment need not support it.
+  virtual Status discardElements(std::size_t numElements, uint32_t timeoutMs) {
+    return FEATURE_NOT_SUPPORTED;
+  }
+
+  // Batched zero-copy reads, for sources that support them (see
+  // supportsBatchedReads()). acquireFrames() waits up to timeoutMs for
+  // at least one frame, then exposes up to maxFrames complete frames
+  // that are already waiting as one contiguous block: *frames points at
+  // the first, *numFrames of them follow every fmt.frameSizeBytes. The
+  // block stays valid until releaseFrames(), which must be called
+  // before the next acquireFrames() or close(). Return values are as
+  // for readFrame().
+  virtual bool supportsBatchedReads(void) const { return false; }
+
+  virtual Status acquireFrames(std::size_t maxFrames, uint32_t timeoutMs,
+			       const char **frames, std::size_t *numFrames,
+			       std::size_t *elementsRemaining) {
+    *numFrames = 0;
+    *elementsRemaining = 0;
+    return FEATURE_NOT_SUPPORTED;
+  }
+
+  virtual void releaseFrames(void) {}
+
+  virtual void close(void) {}
+
+  // For console/debug output.
+  virtual const char* name(void) const = 0;
+};
+
+// Paces a simulated source at a target frame rate. Frames are due on a
+// fixed schedule from start(); a reader that falls behind gets the
+// overdue frames back-to-back, like a FIFO that has filled up.
+class FrameRatePacer {
+
+ public:
+
+  FrameRatePacer(void);
+
+  // framesPerSecond<=0 means no pacing; every frame is due immediately.
+  void start(double framesPerSecond);
+
+  // Wait until the next frame is due, or until timeoutMs passes. Returns
+  // true if a frame is due (and counts it), false on timeout.
+  // *framesBehind is set to the number of further frames already due.
+  bool waitForFrame(uint32_t timeoutMs, unsigned long *framesBehind);
+
+ private:
+  double now(void) const;
+
+ private:
+  double fPeriod; // seconds, 0 for no pacing
+  double fStartTime;
+  double fTicksPerSecond;
+  unsigned long fFramesDelivered;
+};
@@ -0,0 +1,84 @@
+#include <string.h>
+#include "FrameStatsRing.h"
+#include "Atomics.h"
+
+FrameStatsRing::FrameStatsRing(void) :
+  fNumWritten(0)
+{
+  fSlots = new Slot[CAPACITY];
+  memset(fSlots,0,CAPACITY*sizeof(Slot));
+}
+
+FrameStatsRing::~FrameStatsRing(void)
+{
+  delete[] fSlots;
+}
+
+void
+FrameStatsRing::reset(void)
+{
+  // Clearing the numbers keeps readers from taking the last run's
+  // records for this run's.
+  for (unsigned long i=0;i<CAPACITY;i++) {
+    fSlots[i].record.frameNumber = 0;
+  }
+  storeRelease(fNumWritten,0UL);
+}
+
+FrameStatsRecord&
+FrameStatsRing::beginWrite(void)
+{
+  Slot &slot = fSlots[fNumWritten & (CAPACITY-1)];
+  atomicIncrement(slot.sequence); // odd; a full barrier
+  slot.record.frameNumber = fNumWritten+1;
+  return slot.record;
+}
+
+void
+FrameStatsRing::commitWrite(void)
+{
+  unsigned long n = fNumWritten;
+  atomicIncrement(fSlots[n & (CAPACITY-1)].sequence); // even again
+  storeRelease(fNumWritten,n+1);
+}
+
+unsigned long
+FrameStatsRing::numWritten(void) const
+{
+  return loadAcquire(fNumWritten);
+}
+
+std::size_t
+FrameStatsRing::readAfter(unsigned long afterFrame, std::size_t maxRecords,
+			  std::vector<FrameStatsRecord> &out) const
+{
+  unsigned long newest = loadAcquire(fNumWritten);
+  unsigned long first = afterFrame+1;
+  if (newest>=CAPACITY && first<newest-CAPACITY+1) {
+    first = newest-CAPACITY+1;
+  }
+  if (maxRecords==0 || first>newest) {
+    return 0;
+  }
+  if (newest-first+1>maxRecords) {
+    first = newest-(unsigned long) maxRecords+1;
+  }
+
+  std::size_t numRead = 0;
+  FrameStatsRecord record;
+  for (unsigned long n=first;n<=newest;n++) {
+    const Slot &slot = fSlots[(n-1) & (CAPACITY-1)];
+    long seq = loadAcquire(slot.sequence);
+    if (seq & 1) {
+      continue;
+    }
+    memcpy(&record,&slot.record,sizeof(record));
+    fullBarrier();
+    if (slot.sequence!=seq || record.frameNumber!=n) {
+      continue;
+    }
+    out.push_back(record);
+    numRead++;
+  }
+  return numRead;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <vector>
+#include "Platform.h"
+#include "FrameKernels.h"
+
+// Per-channel statistics of one frame, as the copier stores it.
+struct FrameStatsRecord {
+  static const int MAX_CHANNELS = 4;
+
+  unsigned long frameNumber;      // frames with statistics since the ring was reset, 1-based
+  unsigned long frameTag;         // 0 without frame tagging
+  unsigned long numChannels;      // frame planes; channels[0..numChannels-1] are valid
+  unsigned long pixelsPerChannel;
+  FrameKernels::PixelStats channels[MAX_CHANNELS];
+};
+
+// Fixed ring of the most recent FrameStatsRecords, written by the
+// copier's thread and polled by MATLAB, lock-free in both directions.
+// The writer never waits: once the ring is full it overwrites the
+// oldest record. Each slot carries a sequence count, odd while the
+// slot is being written, so a reader copies a record and then checks
+// that the count did not change; a record overwritten while it was
+// being read is skipped rather than returned torn.
+//
+// Threading: one writer thread (beginWrite/commitWrite), any number of
+// reader threads, and a controller that calls reset while the writer
+// is idle.
+class FrameStatsRing {
+
+ public:
+
+  static const unsigned long CAPACITY = 64; // power of 2
+
+  FrameStatsRing(void);
+  ~FrameStatsRing(void);
+
+  // Forget every record; numbering restarts at 1.
+  void reset(void);
+
+  // Writer: the record to fill in for the next frame, with frameNumber
+  // set. Call commitWrite once it is filled in.
+  FrameStatsRecord& beginWrite(void);
+  void commitWrite(void);
+
+  // Records written since reset.
+  unsigned long numWritten(void) const;
+
+  // Any thread: append to out the records numbered after afterFrame
+  // that are still in the ring, oldest first; at most maxRecords, the
+  // newest. Returns the number appended.
+  std::size_t readAfter(unsigned long afterFrame, std::size_t maxRecords,
+			std::vector<FrameStatsRecord> &out) const;
+
+ private:
+  FrameStatsRing(const FrameStatsRing&);
+  FrameStatsRing& operator=(const FrameStatsRing&);
+
+  struct Slot {
+    volatile long sequence; // odd while being written
+    FrameStatsRecord record;
+  };
+
+  Slot *fSlots;
+  volatile unsigned long fNumWritten; // writer-owned
+};
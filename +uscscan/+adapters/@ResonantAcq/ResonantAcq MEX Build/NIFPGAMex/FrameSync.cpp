@@ -0,0 +1,129 @@
+#include "FrameSync.h"
+#include "Misc.h"
+
+static const int16_t TAG_IDENTIFIER = -32768;
+
+FrameSync::FrameSync(void)
+{
+  reset(FrameFormat());
+}
+
+void
+FrameSync::reset(const FrameFormat &fmt)
+{
+  fEnabled = fmt.frameTagging && fmt.tagSizeBytes>=8 && fmt.frameSizeFifoElements>0;
+  fFrameWords = fmt.frameSizeBytes/2;
+  fTagWordIdx = fmt.tagWordIndex();
+  fWordsPerElement = fmt.frameSizeFifoElements>0 ? fFrameWords/fmt.frameSizeFifoElements : 1;
+  fTagElements = fmt.tagSizeBytes/2/(fWordsPerElement>0 ? fWordsPerElement : 1);
+
+  fHaveTag = false;
+  fInSync = true;
+  fFramesUnsynced = 0;
+  fLastTag = 0;
+  fFramesLost = 0;
+  fNumResyncs = 0;
+}
+
+bool
+FrameSync::tagAt(const int16_t *words, std::size_t idx, unsigned long *tag) const
+{
+  if (words[idx]!=TAG_IDENTIFIER) {
+    return false;
+  }
+  *tag = (unsigned long) (uint16_t) words[idx+2] * 65536 + (uint16_t) words[idx+3];
+  return true;
+}
+
+bool
+FrameSync::plausibleNext(unsigned long tag) const
+{
+  // Unsigned difference, so the 32-bit counter may wrap.
+  unsigned long step = tag - fLastTag;
+  return !fHaveTag || (step>=1 && step<=MAX_TAG_GAP);
+}
+
+void
+FrameSync::acceptTag(unsigned long tag)
+{
+  if (fHaveTag && tag-fLastTag!=1) {
+    unsigned long lost = tag-fLastTag-1;
+    fFramesLost += lost;
+    CONSOLEPRINT("FrameSync: frame tag jumped from %lu to %lu (%lu frames lost)\n",fLastTag,tag,lost);
+  }
+  fLastTag = tag;
+  fHaveTag = true;
+}
+
+bool
+FrameSync::checkFrame(const char *frame, std::size_t *elementsToDiscard)
+{
+  *elementsToDiscard = 0;
+  if (!fEnabled) {
+    return true;
+  }
+
+  const int16_t *words = reinterpret_cast<const int16_t*>(frame);
+  unsigned long tag;
+
+  // The usual case: the tag is where it belongs.
+  if (tagAt(words,fTagWordIdx,&tag) && plausibleNext(tag)) {
+    if (!fInSync) {
+      CONSOLEPRINT("FrameSync: back in sync at frame tag %lu\n",tag);
+      fInSync = true;
+      fFramesUnsynced = 0;
+    }
+    acceptTag(tag);
+    return true;
+  }
+
+  if (fInSync) {
+    CONSOLEPRINT("FrameSync: lost frame alignment after frame tag %lu; resynchronizing\n",fLastTag);
+    fInSync = false;
+    fNumResyncs++;
+  }
+
+  // If nothing follows on from the last tag for a while (the counter was
+  // reset, or the last tag was a chance match), take any tag.
+  if (++fFramesUnsynced > MAX_UNSYNCED_FRAMES) {
+    fHaveTag = false;
+  }
+
+  // Find the tag ending the frame that is really in the stream. Tags
+  // are FIFO-element aligned. The frame it ends started in an earlier
+  // read, so it is dropped. So is the frame after it, which starts in
+  // this read; discarding the rest of that one puts the next read on a
+  // boundary (it is counted lost when the next tag is seen).
+  for (std::size_t idx=0;idx+4<=fFrameWords;idx+=fWordsPerElement) {
+    if (idx==fTagWordIdx) {
+      continue;
+    }
+    if (tagAt(words,idx,&tag) && plausibleNext(tag)) {
+      *elementsToDiscard = idx/fWordsPerElement + fTagElements;
+      CONSOLEPRINT("FrameSync: found frame tag %lu at element %u; discarding %u elements\n",
+		   tag,(unsigned int) (idx/fWordsPerElement),(unsigned int) *elementsToDiscard);
+      acceptTag(tag);
+      fFramesLost++;
+      return false;
+    }
+  }
+  return false;
+}
+
+unsigned long
+FrameSync::framesLost(void) const
+{
+  return fFramesLost;
+}
+
+unsigned long
+FrameSync::numResyncs(void) const
+{
+  return fNumResyncs;
+}
+
+unsigned long
+FrameSync::lastTag(void) const
+{
+  return fLastTag;
+}
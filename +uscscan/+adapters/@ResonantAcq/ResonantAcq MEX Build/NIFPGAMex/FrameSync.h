@@ -0,0 +1,77 @@
+#pragma once
+
+#include "FrameSource.h"
+
+// Keeps the copier's reads on frame boundaries, using the frame tag the
+// FPGA appends to every frame: the identifier word (-32768), a
+// placeholder word, then the 32-bit record counter
+// (fpgaTotalAcquiredRecordsA:B).
+//
+// Each frame-sized read is checked for a tag in its last tagSizeBytes
+// whose counter follows on from the previous frame's. If the FIFO lost
+// elements (eg a host buffer overflow), every later read is shifted
+// and fails the check; the frame is then scanned for the tag that ends
+// the frame actually in the stream, and the caller is told how many
+// elements to discard so that its next read starts on a frame
+// boundary. Tag counter jumps between good frames are reported as
+// lost frames.
+//
+// Without frame tagging there is nothing to sync on and every frame is
+// accepted.
+class FrameSync {
+
+ public:
+
+  // Largest counter jump still taken as a genuine gap in the FPGA's
+  // record count, rather than a chance match in pixel data.
+  static const unsigned long MAX_TAG_GAP = 65536;
+
+  // Out-of-sync frames after which the last good tag is no longer used
+  // to vet candidate tags.
+  static const unsigned long MAX_UNSYNCED_FRAMES = 2;
+
+  FrameSync(void);
+
+  // Start a new acquisition with the given frame format.
+  void reset(const FrameFormat &fmt);
+
+  // Check a frame just read (fmt.frameSizeBytes, FIFO layout). Returns
+  // true if it is a whole frame. Otherwise returns false, and sets
+  // *elementsToDiscard to the number of FIFO elements to drop from the
+  // stream so that the next read begins a frame, or 0 if no frame
+  // boundary was found (keep reading and checking).
+  bool checkFrame(const char *frame, std::size_t *elementsToDiscard);
+
+  // Frames missing between good frames, by tag count, since reset().
+  unsigned long framesLost(void) const;
+
+  // Number of times alignment was lost since reset().
+  unsigned long numResyncs(void) const;
+
+  // Counter value of the last good frame's tag.
+  unsigned long lastTag(void) const;
+
+ private:
+  // If a tag starts at word index idx, set *tag to its counter and
+  // return true.
+  bool tagAt(const int16_t *words, std::size_t idx, unsigned long *tag) const;
+
+  // True if tag could follow the last good tag.
+  bool plausibleNext(unsigned long tag) const;
+
+  void acceptTag(unsigned long tag);
+
+ private:
+  bool fEnabled;
+  std::size_t fFrameWords;
+  std::size_t fTagWordIdx;
+  std::size_t fWordsPerElement;
+  std::size_t fTagElements;
+
+  bool fHaveTag;
+  bool fInSync;
+  unsigned long fFramesUnsynced;
+  unsigned long fLastTag;
+  unsigned long fFramesLost;
+  unsigned long fNumResyncs;
+};
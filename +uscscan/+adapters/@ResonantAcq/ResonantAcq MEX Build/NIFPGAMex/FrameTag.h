@@ -0,0 +1,11 @@
+#pragma once
+
+// Logged frames carry their FPGA frame tag at the start of the image
+// description, written with FORMAT_STRING in exactly STRING_LENGTH
+// characters. Shared by FrameLogger, which writes it, and
+// RawFrameReader, which puts it back when converting a raw log to TIFF.
+namespace FrameTag
+{
+  const char FORMAT_STRING[] = "Frame Tag = %16lu\n"; //Allow up to 10 million
+  const unsigned int STRING_LENGTH = 16 + 13; //Allow for 'Frame Tag = \n' at start
+}
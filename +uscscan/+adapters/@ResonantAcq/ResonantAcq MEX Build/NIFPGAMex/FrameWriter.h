@@ -0,0 +1,55 @@
+#pragma once
+
+#include "AsyncFileWriter.h"
+
+// What FrameLogger needs from a log file writer. TifWriter writes TIFFs;
+// RawFrameWriter writes a raw chunked container with a frame index,
+// which RawFrameReader can convert to TIFF afterwards.
+//
+// Call sequence: configure*, openFile, then any number of
+// writeFramesForAllChannels (with modifyImageDescription/setFrameTag
+// between them), closeFile. Writers are used from one thread at a time.
+class FrameWriter {
+
+public:
+
+	virtual ~FrameWriter() { }
+
+	virtual bool isFileOpen(void) const = 0;
+
+	// Closes an existing file if one is open. bigTiff only applies to TIFF writers.
+	virtual bool openFile(const char *fname, const char *modestr, bool bigTiff) = 0;
+
+	virtual void closeFile(void) = 0;
+
+	// Write files opened for writing ('w' modes) through an AsyncFileWriter. Takes effect from
+	// the next openFile.
+	virtual void configureAsyncIO(bool enable,
+		unsigned int bufferBytes = AsyncFileWriter::DEFAULT_BUFFER_BYTES,
+		unsigned int numBuffers = AsyncFileWriter::DEFAULT_NUM_BUFFERS) = 0;
+
+	// Frame layout, all channels. Call before writing.
+	virtual void configureImage(unsigned short imWidth,
+		unsigned short imLength,
+		unsigned short bytesPerPixel,
+		unsigned short numChannels,
+		bool signedData = false,
+		const char *imageDescription = NULL,
+		unsigned int targetBytesPerFullStrip = 8192) = 0;
+
+	// Overwrite len chars of the image description from loc, without changing its length.
+	virtual void modifyImageDescription(unsigned int loc, const char *buf, unsigned int len) = 0;
+
+	virtual void replaceImageDescription(const char *imageDescription) = 0;
+
+	// Frame tag of the next frame written. Writers that keep the tag only in the image
+	// description (see FrameTag.h) ignore this.
+	virtual void setFrameTag(unsigned long frameTag) { }
+
+	// Write one frame for each channel, back to back in buf.
+	virtual void writeFramesForAllChannels(const char *buf, unsigned int sz) = 0;
+
+	// Reserve disk space for numFrames frames (all channels). Call after openFile and
+	// configureImage.
+	virtual bool preallocate(unsigned long numFrames) = 0;
+};
@@ -11,31 +11,57 @@ MatlabParams* MatlabParams::getInstance(){
 }
 
 MatlabParams::MatlabParams(){
-	//simulated operation.
-	simulated = false;
-
-	//most values are set in readPropsFromMatlab
+	//the pipeline defaults are PipelineParams'; most values are set in readPropsFromMatlab
+	resonantAcqObject = NULL;
+	NIFPGAObject = NULL;
+	asyncMex = NULL;
 	callbackFuncHandle = NULL;
-	pixelsPerLine = 0;
-	linesPerFrame = 0;
-
-	//TODO: Figure out what to do with these...do we need them in MATLAB?
-    pixelSizeBytes = 2;
-    numLoggingChannels = 1;
-    signedData = false;
-	frameDelay = 0;
-	frameTagOneBased = true;
-	loggingAverageFactor = 1;
-
-	//Instrumentation vars
-	numDroppedFramesCopier = 0;
-	lastCopierTag = 0;
+	callbackEnabled = false;
+	frameEventCoalescing = false;
+	frameEventMaxRate = 0.0;
+	frameEventData = false;
+
+	//the copier tells us of each frame for display
+	frameEvents = this;
 }
 
 MatlabParams::~MatlabParams(){
 	//fill in later
 }
 
+void MatlabParams::frameAvailable(void){
+	if (asyncMex==NULL)
+		return;
+	if (frameEventCoalescing)
+		AsyncMex_postCoalescedEvent(asyncMex);
+	else
+		AsyncMex_postEventMessage(asyncMex,0);
+}
+
+//Copy the first rows (up to maxRows) of a numeric matrix property with cols
+//columns into dst, row by row. Returns false, leaving dst alone, if the
+//property is absent or has the wrong number of columns.
+static bool readMatrixProp(const mxArray* obj, const char* name, double* dst, size_t maxRows, size_t cols){
+	mxArray* propVal = mxGetProperty(obj,0,name);
+	if (propVal==NULL)
+		return false;
+	bool ok = mxIsDouble(propVal) && mxGetN(propVal)==cols;
+	if (ok) {
+		size_t rows = mxGetM(propVal);
+		const double* pr = mxGetPr(propVal);
+		for (size_t i=0;i<rows && i<maxRows;i++)
+			for (size_t j=0;j<cols;j++)
+				dst[i*cols+j] = pr[i+j*rows];
+	}
+	mxDestroyArray(propVal);
+	return ok;
+}
+
+void MatlabParams::readDisplayPrepLevels(){
+	if (!readMatrixProp(resonantAcqObject,"displayPrepLevels",&displayPrepLevels[0][0],MAX_DISPLAY_CHANNELS,2))
+		CONSOLEPRINT("displayPrepLevels: absent or not N x 2; keeping the levels\n");
+}
+
 void MatlabParams::readPropsFromMatlab(){
 	//Reads the value of each property from the Matlab NiFpga class.
 	//Note that Matlab's NiFpga class is dynamic; many properties don't
@@ -50,6 +76,33 @@ void MatlabParams::readPropsFromMatlab(){
 
 	CONSOLEPRINT("simulated mode: %d\n",simulated);
 
+	//simulated frame source. These are optional; keep the defaults if absent.
+	propVal = mxGetProperty(resonantAcqObject,0,"simulatedFrameRate");
+	if (propVal!=NULL) {
+		simulatedFrameRate = mxGetScalar(propVal);
+		mxDestroyArray(propVal);
+	}
+
+	propVal = mxGetProperty(resonantAcqObject,0,"simulatedPattern");
+	if (propVal!=NULL) {
+		mxGetString(propVal,simulatedPattern,sizeof(simulatedPattern));
+		mxDestroyArray(propVal);
+	}
+
+	propVal = mxGetProperty(resonantAcqObject,0,"simulatedReplayFile");
+	if (propVal!=NULL) {
+		if (mxGetString(propVal,simulatedReplayFile,MAXFILENAMESIZE)!=0)
+			simulatedReplayFile[0] = '\0';
+		mxDestroyArray(propVal);
+	}
+
+	if (simulated) {
+		if (strlen(simulatedReplayFile)>0)
+			CONSOLEPRINT("simulated source: replay '%s' at %g fps\n",simulatedReplayFile,simulatedFrameRate);
+		else
+			CONSOLEPRINT("simulated source: '%s' pattern at %g fps\n",simulatedPattern,simulatedFrameRate);
+	}
+
 	//acquisition-specific parameters
 	propVal = mxGetProperty(resonantAcqObject,0,"pixelsPerLine");
 	pixelsPerLine = (size_t) mxGetScalar(propVal);
@@ -121,6 +174,21 @@ void MatlabParams::readPropsFromMatlab(){
 
 		CONSOLEPRINT("frameQueueCapacity: %d\n",frameQueueCapacity);
 
+	//batched FIFO reads. Optional; keep the defaults if absent.
+	propVal = mxGetProperty(resonantAcqObject,0,"fifoBatchedReads");
+	if (propVal!=NULL) {
+		fifoBatchedReads = (bool) mxGetScalar(propVal);
+		mxDestroyArray(propVal);
+	}
+
+	propVal = mxGetProperty(resonantAcqObject,0,"fifoMaxFramesPerBatch");
+	if (propVal!=NULL) {
+		fifoMaxFramesPerBatch = (unsigned int) mxGetScalar(propVal);
+		mxDestroyArray(propVal);
+	}
+
+		CONSOLEPRINT("fifoBatchedReads: %d (max %u frames)\n",fifoBatchedReads,fifoMaxFramesPerBatch);
+
 	//TODO: Put resize of fInputBuffer in here.
 
 	propVal = mxGetProperty(resonantAcqObject,0,"loggingEnable");
@@ -144,7 +212,7 @@ void MatlabParams::readPropsFromMatlab(){
 		CONSOLEPRINT("WARNING! configureLogFile: mxGetProperty 'loggingFullFileName' returned NULL!");
 	}
 	strcpy_s(loggingFullFileName,fileNameBuf);
-	CONSOLEDEBUG("'loggingFullFileName' set to:%s\n",loggingFullFileName);
+	CONSOLEPRINT("'loggingFullFileName' set to:%s\n",loggingFullFileName);
 
 	// fileMode
 	char fileModeStrBuf[8] = "wbn";
@@ -158,7 +226,7 @@ void MatlabParams::readPropsFromMatlab(){
 		CONSOLEPRINT("WARNING! configureLogFile: mxGetProperty 'loggingOpenModeString' returned NULL!");
 	}
 	strcpy_s(loggingOpenModeString,fileModeStrBuf);
-	CONSOLEDEBUG("'loggingOpenModeString' set to:%s\n",loggingOpenModeString);
+	CONSOLEPRINT("'loggingOpenModeString' set to:%s\n",loggingOpenModeString);
 
 	// header
 	char headerStrArray[MAXIMAGEHEADERSIZE] = "Default header str";
@@ -172,7 +240,236 @@ void MatlabParams::readPropsFromMatlab(){
 		CONSOLEPRINT("WARNING! configureLogFile: mxGetProperty 'loggingHeaderString' returned NULL!");
 	}
 	strcpy_s(loggingHeaderString,headerStrArray);
-	CONSOLEDEBUG("'loggingHeaderString' set to:%s\n",loggingHeaderString);
+	CONSOLEPRINT("'loggingHeaderString' set to:%s\n",loggingHeaderString);
+
+	//BigTIFF, preallocation and async TIFF writes. Optional; keep the defaults if absent.
+	propVal = mxGetProperty(resonantAcqObject,0,"loggingBigTiff");
+	if (propVal!=NULL) {
+		loggingBigTiff = (bool) mxGetScalar(propVal);
+		mxDestroyArray(propVal);
+	}
+
+	propVal = mxGetProperty(resonantAcqObject,0,"loggingPreallocateFrames");
+	if (propVal!=NULL) {
+		loggingPreallocateFrames = (unsigned long) mxGetScalar(propVal);
+		mxDestroyArray(propVal);
+	}
+
+	propVal = mxGetProperty(resonantAcqObject,0,"loggingAsyncWrites");
+	if (propVal!=NULL) {
+		loggingAsyncWrites = (bool) mxGetScalar(propVal);
+		mxDestroyArray(propVal);
+	}
+
+	propVal = mxGetProperty(resonantAcqObject,0,"loggingWriteBufferMB");
+	if (propVal!=NULL) {
+		loggingWriteBufferMB = (unsigned int) mxGetScalar(propVal);
+		mxDestroyArray(propVal);
+	}
+
+	propVal = mxGetProperty(resonantAcqObject,0,"loggingWritesInFlight");
+	if (propVal!=NULL) {
+		loggingWritesInFlight = (unsigned int) mxGetScalar(propVal);
+		mxDestroyArray(propVal);
+	}
+
+	CONSOLEPRINT("loggingAsyncWrites: %d (%u x %u MB)\n",loggingAsyncWrites,loggingWritesInFlight,loggingWriteBufferMB);
+
+	propVal = mxGetProperty(resonantAcqObject,0,"loggingCompression");
+	if (propVal!=NULL) {
+		if (mxGetString(propVal,loggingCompression,sizeof(loggingCompression))!=0)
+			strcpy_s(loggingCompression,"none");
+		mxDestroyArray(propVal);
+	}
+
+	propVal = mxGetProperty(resonantAcqObject,0,"loggingCompressionLevel");
+	if (propVal!=NULL) {
+		loggingCompressionLevel = (int) mxGetScalar(propVal);
+		mxDestroyArray(propVal);
+	}
+
+	propVal = mxGetProperty(resonantAcqObject,0,"loggingCompressionPredictor");
+	if (propVal!=NULL) {
+		loggingCompressionPredictor = (bool) mxGetScalar(propVal);
+		mxDestroyArray(propVal);
+	}
+
+	propVal = mxGetProperty(resonantAcqObject,0,"loggingCompressionThreads");
+	if (propVal!=NULL) {
+		loggingCompressionThreads = (unsigned int) mxGetScalar(propVal);
+		mxDestroyArray(propVal);
+	}
+
+	CONSOLEPRINT("loggingCompression: '%s' (level %d, predictor %d, %u threads)\n",loggingCompression,
+		loggingCompressionLevel,loggingCompressionPredictor,loggingCompressionThreads);
+
+	propVal = mxGetProperty(resonantAcqObject,0,"loggingFormat");
+	if (propVal!=NULL) {
+		if (mxGetString(propVal,loggingFormat,sizeof(loggingFormat))!=0)
+			strcpy_s(loggingFormat,"tiff");
+		mxDestroyArray(propVal);
+	}
+
+	propVal = mxGetProperty(resonantAcqObject,0,"loggingRawFramesPerChunk");
+	if (propVal!=NULL) {
+		loggingRawFramesPerChunk = (unsigned int) mxGetScalar(propVal);
+		mxDestroyArray(propVal);
+	}
+
+	CONSOLEPRINT("loggingFormat: '%s' (%u frames per chunk)\n",loggingFormat,loggingRawFramesPerChunk);
+
+	//triggered logging and pre-trigger history. Optional; keep the defaults if absent.
+	propVal = mxGetProperty(resonantAcqObject,0,"loggingWaitForTrigger");
+	if (propVal!=NULL) {
+		loggingWaitForTrigger = (bool) mxGetScalar(propVal);
+		mxDestroyArray(propVal);
+	}
+
+	propVal = mxGetProperty(resonantAcqObject,0,"loggingTriggerEventName");
+	if (propVal!=NULL) {
+		if (mxGetString(propVal,loggingTriggerEventName,sizeof(loggingTriggerEventName))!=0)
+			loggingTriggerEventName[0] = '\0';
+		mxDestroyArray(propVal);
+	}
+
+	propVal = mxGetProperty(resonantAcqObject,0,"loggingPreTriggerFrames");
+	if (propVal!=NULL) {
+		loggingPreTriggerFrames = (unsigned long) mxGetScalar(propVal);
+		mxDestroyArray(propVal);
+	}
+
+	propVal = mxGetProperty(resonantAcqObject,0,"loggingPreTriggerMB");
+	if (propVal!=NULL) {
+		loggingPreTriggerMB = mxGetScalar(propVal);
+		mxDestroyArray(propVal);
+	}
+
+	CONSOLEPRINT("loggingWaitForTrigger: %d (event '%s', %lu frames or %g MB before it)\n",loggingWaitForTrigger,
+		loggingTriggerEventName,loggingPreTriggerFrames,loggingPreTriggerMB);
+
+	//display averaging. Optional; keep the defaults if absent.
+	propVal = mxGetProperty(resonantAcqObject,0,"displayAveragingMode");
+	if (propVal!=NULL) {
+		if (mxGetString(propVal,displayAveragingMode,sizeof(displayAveragingMode))!=0)
+			strcpy_s(displayAveragingMode,"none");
+		mxDestroyArray(propVal);
+	}
+
+	propVal = mxGetProperty(resonantAcqObject,0,"displayAveragingFrames");
+	if (propVal!=NULL) {
+		displayAveragingFrames = (unsigned int) mxGetScalar(propVal);
+		mxDestroyArray(propVal);
+	}
+
+	propVal = mxGetProperty(resonantAcqObject,0,"displayAveragingWeight");
+	if (propVal!=NULL) {
+		displayAveragingWeight = mxGetScalar(propVal);
+		mxDestroyArray(propVal);
+	}
+
+	propVal = mxGetProperty(resonantAcqObject,0,"displayAveragingInterval");
+	if (propVal!=NULL) {
+		displayAveragingInterval = (unsigned int) mxGetScalar(propVal);
+		mxDestroyArray(propVal);
+	}
+
+	CONSOLEPRINT("displayAveraging: '%s' (%u frames, weight %g, interval %u)\n",displayAveragingMode,
+		displayAveragingFrames,displayAveragingWeight,displayAveragingInterval);
+
+	//display prep. Optional; keep the defaults if absent.
+	propVal = mxGetProperty(resonantAcqObject,0,"displayPrepEnable");
+	if (propVal!=NULL) {
+		displayPrepEnabled = (bool) mxGetScalar(propVal);
+		mxDestroyArray(propVal);
+	}
+
+	propVal = mxGetProperty(resonantAcqObject,0,"displayPrepBinFactor");
+	if (propVal!=NULL) {
+		displayPrepBinFactor = (unsigned int) mxGetScalar(propVal);
+		mxDestroyArray(propVal);
+	}
+
+	propVal = mxGetProperty(resonantAcqObject,0,"displayPrepChannels");
+	if (propVal!=NULL) {
+		//1-based in Matlab
+		size_t numChannels = mxGetNumberOfElements(propVal);
+		displayPrepNumChannels = 0;
+		for (size_t i=0;i<numChannels && i<MAX_DISPLAY_CHANNELS;i++)
+			displayPrepChannels[displayPrepNumChannels++] = (int) mxGetPr(propVal)[i] - 1;
+		mxDestroyArray(propVal);
+	}
+
+	propVal = mxGetProperty(resonantAcqObject,0,"displayPrepMerge");
+	if (propVal!=NULL) {
+		displayPrepMerge = (bool) mxGetScalar(propVal);
+		mxDestroyArray(propVal);
+	}
+
+	readDisplayPrepLevels();
+	readMatrixProp(resonantAcqObject,"displayPrepColors",&displayPrepColors[0][0],MAX_DISPLAY_CHANNELS,3);
+
+	CONSOLEPRINT("displayPrep: %d (bin %u, %u channels (0 = all), merge %d)\n",displayPrepEnabled,
+		displayPrepBinFactor,displayPrepNumChannels,displayPrepMerge);
+
+	//frame statistics. Optional; keep the defaults if absent. bitDepth is
+	//empty until the adapter module is detected.
+	propVal = mxGetProperty(resonantAcqObject,0,"frameStatsEnable");
+	if (propVal!=NULL) {
+		frameStatsEnabled = (bool) mxGetScalar(propVal);
+		mxDestroyArray(propVal);
+	}
+
+	propVal = mxGetProperty(resonantAcqObject,0,"bitDepth");
+	if (propVal!=NULL) {
+		if (!mxIsEmpty(propVal))
+			adcBitDepth = (unsigned int) mxGetScalar(propVal);
+		mxDestroyArray(propVal);
+	}
+
+	CONSOLEPRINT("frameStats: %d (%u-bit ADC)\n",frameStatsEnabled,adcBitDepth);
+
+	//instrumentation. Optional; keep the default if absent.
+	propVal = mxGetProperty(resonantAcqObject,0,"statsEnabled");
+	if (propVal!=NULL) {
+		statsEnabled = (bool) mxGetScalar(propVal);
+		mxDestroyArray(propVal);
+	}
+
+	propVal = mxGetProperty(resonantAcqObject,0,"traceLevel");
+	if (propVal!=NULL) {
+		traceLevel = (int) mxGetScalar(propVal);
+		mxDestroyArray(propVal);
+	}
+
+	propVal = mxGetProperty(resonantAcqObject,0,"traceFile");
+	if (propVal!=NULL) {
+		if (mxGetString(propVal,traceFile,sizeof(traceFile))!=0)
+			traceFile[0] = '\0';
+		mxDestroyArray(propVal);
+	}
+
+	CONSOLEPRINT("statsEnabled: %d, traceLevel: %d (file '%s')\n",statsEnabled,traceLevel,traceFile);
+
+	//frame event delivery. Optional; keep the default if absent.
+	propVal = mxGetProperty(resonantAcqObject,0,"frameEventCoalescing");
+	if (propVal!=NULL) {
+		frameEventCoalescing = (bool) mxGetScalar(propVal);
+		mxDestroyArray(propVal);
+	}
+
+	propVal = mxGetProperty(resonantAcqObject,0,"frameEventMaxRate");
+	if (propVal!=NULL) {
+		frameEventMaxRate = mxGetScalar(propVal);
+		mxDestroyArray(propVal);
+	}
+
+	propVal = mxGetProperty(resonantAcqObject,0,"frameEventData");
+	if (propVal!=NULL) {
+		frameEventData = (bool) mxGetScalar(propVal);
+		mxDestroyArray(propVal);
+	}
+
+	CONSOLEPRINT("frameEventCoalescing: %d, frameEventMaxRate: %g, frameEventData: %d\n",frameEventCoalescing,frameEventMaxRate,frameEventData);
 }
 
 //void MatlabParams::setIsMultiChannel(int value){
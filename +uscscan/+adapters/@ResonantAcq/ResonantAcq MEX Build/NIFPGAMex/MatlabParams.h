@@ -5,53 +5,20 @@
 #include "stdafx.h"
 #include "AsyncMex.h"
 #include "mex.h"
-#include "FrameCopier.h"
-#include "FrameLogger.h"
-
-class MatlabParams
+#include "FrameHistory.h"
+#include "PipelineStats.h"
+#include "PipelineParams.h"
+
+// The MEX's PipelineParams: read from the ResonantAcq object, plus the
+// MATLAB side of the frame event (AsyncMex and the frameAcquiredFcn
+// callback).
+class MatlabParams : public PipelineParams, public FrameEventSink
 {
 	//Leaving most of the member variables public for now, because
 	//this is being refactored from a struct. May make private later.
 public:
 	//constants
     static const char *DEFAULT_LOG_FILENAME;
-	static const unsigned int MAXFILENAMESIZE = 256;
-	static const unsigned int MAXIMAGEHEADERSIZE = 8194; 
-    
-	//simulated operation.
-	bool simulated;
-
-	//image and acquisition parameters
-	size_t pixelsPerLine;
-	size_t linesPerFrame;
-	bool frameTagging;
-	bool isMultiChannel;
-	unsigned long frameQueueCapacity;
-
-	size_t frameSizePixels;        //Number of Pixels in one frame (not including frame tag)
-    size_t frameSizeBytes;         //Number of Bytes in one frame (frame + optional frame tag)
-    size_t frameSizeFifoElements;  //Number of FIFO elements for one frame (frame + optional frame tag)
-	size_t tagSizeBytes;           //Tag Size in Bytes (0 for frameTagging == 0)
-    size_t tagSizeFifoElements;    //Number of FIFO elements for the tag (0 for frameTagging == 0)
-
-	//used for frameLogger only.
-	bool loggingEnabled;
-	unsigned short pixelSizeBytes;
-	unsigned short numLoggingChannels;
-    bool frameTagOneBased;
-	bool signedData;
-	int frameDelay;
-	unsigned int loggingAverageFactor;
-	char loggingFullFileName[MAXFILENAMESIZE];
-	char loggingOpenModeString[8];
-	char loggingHeaderString[MAXIMAGEHEADERSIZE];
-
-	//fpga parameters
-	NiFpga_Status fpgaStatus;
-	NiFpga_Session fpgaSession;
-	uint32_t fpgaFifoNumberSingleChan;
-	uint32_t fpgaFifoNumberMultiChan;
-	size_t* fpgaElementsRemaining;
 
 	//matlab 
 	mxArray* resonantAcqObject;
@@ -59,14 +26,9 @@ public:
 	AsyncMex* asyncMex;
 	mxArray* callbackFuncHandle;
 	bool callbackEnabled;
-
-	//C++ objects
-	FrameQueue* matlabQueue;
-	FrameQueue* loggingQueue;
-
-	//Instrumentation data
-	long numDroppedFramesCopier;
-	unsigned long lastCopierTag;
+	bool frameEventCoalescing;             //at most one frame event waiting in Matlab; the callback gets a count
+	double frameEventMaxRate;              //coalesced callbacks/s at most (eg display refresh rate); 0 = no limit
+	bool frameEventData;                   //the callback's evnt carries the frames, so it needn't read them
 
 public:
 	static MatlabParams* getInstance();
@@ -77,6 +39,12 @@ public:
 	//void setSession(NiFpga_Session sessionID);
 	void MatlabParams::readPropsFromMatlab();
 	void MatlabParams::setCallback(mxArray* mxCbk);
+	//Just the displayPrepLevels property, which can change during an acquisition.
+	void readDisplayPrepLevels();
+
+	//FrameEventSink: post the AsyncMex message that runs the callback,
+	//or with frameEventCoalescing, a coalesced one.
+	void frameAvailable(void);
 
 private:
 	MatlabParams();
@@ -0,0 +1,43 @@
+#include "stdafx.h"
+#include "mex.h"
+#include "MexMisc.h"
+
+void
+CFAEMisc::requestLockMutex(HANDLE h) 
+{
+  WaitForSingleObject(h, INFINITE);
+}
+
+void 
+CFAEMisc::releaseLockMutex(HANDLE h) 
+{
+  ReleaseMutex(h);
+}
+
+int 
+CFAEMisc::getIntScalarPropFromMX(const mxArray *a,const char *pname)
+{
+  assert(a!=NULL);
+  mxArray *tmp = mxGetProperty(a,0,pname);
+  assert(tmp!=NULL);
+  int retval = (int)mxGetScalar(tmp);
+  mxDestroyArray(tmp);
+  return retval;
+}
+
+void 
+CFAEMisc::mexAssert(bool cond,const char *msg)
+{
+  if (!cond) {
+    mexErrMsgTxt(msg);
+  }
+}
+
+void
+CFAEMisc::closeHandleAndSetToNULL(HANDLE& h)
+{
+  if (h!=NULL) {
+    CloseHandle(h);
+    h = NULL;
+  }
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <windows.h>
+#include <matrix.h>
+
+// Helpers for the MEX side (NIFPGAMex.cpp and the legacy Thor/FPGALSM
+// code), which uses the mx API and Win32 handles directly. The pipeline
+// core uses Misc.h and Platform.h instead.
+namespace CFAEMisc 
+{
+  void requestLockMutex(HANDLE h);
+  void releaseLockMutex(HANDLE h);
+
+  // Get a scalar-integer-valued property off a scalar object.
+  int getIntScalarPropFromMX(const mxArray *obj, const char *propname);
+
+  // Assertion using mexErrMsgTxt.
+  void mexAssert(bool cond,const char *msg);
+
+  void closeHandleAndSetToNULL(HANDLE &h);
+}
@@ -1,7 +1,6 @@
-#include "stdafx.h"
-#include <windows.h>
-#include "mex.h"
 #include "Misc.h"
+#include <stdarg.h>
+#include <stdio.h>
 
 NIFPGAMexDebugger * NIFPGAMexDebugger::getInstance(void)
 {
@@ -14,92 +13,49 @@ NIFPGAMexDebugger * NIFPGAMexDebugger::getInstance(void)
 }
 
 void
-NIFPGAMexDebugger::setConsoleAttribsForThread(WORD wAttribs)
+NIFPGAMexDebugger::setConsoleColorForThread(Platform::ConsoleColor color)
 {
-  DWORD threadID = GetCurrentThreadId();
-  fThreadID2ConsoleAttribs[threadID] = wAttribs;
+  unsigned long threadID = Platform::currentThreadId();
+  Platform::Mutex::Lock lock(fConsoleWriteMutex);
+  fThreadID2ConsoleColor[threadID] = color;
 }
 
 void
-NIFPGAMexDebugger::preConsolePrint(void)
+NIFPGAMexDebugger::print(const char *fmt, ...)
 {
-  DWORD threadID = GetCurrentThreadId();
-  WORD attribs = getConsoleAttribsForThread(threadID);
-  EnterCriticalSection(&fConsoleWriteCS);
-  SetConsoleTextAttribute(fConsoleScreenBuffer,attribs); 
-}
+  char text[MAX_PRINT_LENGTH];
+  va_list args;
+  va_start(args,fmt);
+#ifdef _MSC_VER
+  _vsnprintf_s(text,sizeof(text),_TRUNCATE,fmt,args);
+#else
+  vsnprintf(text,sizeof(text),fmt,args);
+#endif
+  va_end(args);
 
-void
-NIFPGAMexDebugger::postConsolePrint(void)
-{
-  LeaveCriticalSection(&fConsoleWriteCS);
+  unsigned long threadID = Platform::currentThreadId();
+  Platform::Mutex::Lock lock(fConsoleWriteMutex);
+  Platform::writeConsole(text,getConsoleColorForThread(threadID));
 }
 
 NIFPGAMexDebugger::NIFPGAMexDebugger(void) 
 {
-  BOOL ret = AllocConsole();
-  assert(ret);
-  fConsoleScreenBuffer = GetStdHandle(STD_OUTPUT_HANDLE);
-  InitializeCriticalSection(&fConsoleWriteCS);
+  Platform::openConsole();
 }
 
 NIFPGAMexDebugger::~NIFPGAMexDebugger(void)
 {
-  DeleteCriticalSection(&fConsoleWriteCS);
-  CloseHandle(fConsoleScreenBuffer);
 }
 
-WORD 
-NIFPGAMexDebugger::getConsoleAttribsForThread(DWORD threadID)
+// Called with fConsoleWriteMutex held.
+Platform::ConsoleColor 
+NIFPGAMexDebugger::getConsoleColorForThread(unsigned long threadID)
 {
-  std::map<DWORD,WORD>::iterator it = 
-    fThreadID2ConsoleAttribs.find(threadID);
-  if (it!=fThreadID2ConsoleAttribs.end()) {
+  std::map<unsigned long,Platform::ConsoleColor>::iterator it = 
+    fThreadID2ConsoleColor.find(threadID);
+  if (it!=fThreadID2ConsoleColor.end()) {
     return it->second;
   } else {
-    return FOREGROUND_RED|FOREGROUND_INTENSITY; // default attribs
+    return Platform::CONSOLE_RED; // default color
   } 
 }
-
-
-void
-CFAEMisc::requestLockMutex(HANDLE h) 
-{
-  WaitForSingleObject(h, INFINITE);
-}
-
-void 
-CFAEMisc::releaseLockMutex(HANDLE h) 
-{
-  ReleaseMutex(h);
-}
-
-int 
-CFAEMisc::getIntScalarPropFromMX(const mxArray *a,const char *pname)
-{
-  assert(a!=NULL);
-  mxArray *tmp = mxGetProperty(a,0,pname);
-  assert(tmp!=NULL);
-  int retval = (int)mxGetScalar(tmp);
-  mxDestroyArray(tmp);
-  return retval;
-}
-
-void 
-CFAEMisc::mexAssert(bool cond,const char *msg)
-{
-  if (!cond) {
-    mexErrMsgTxt(msg);
-  }
-}
-
-void
-CFAEMisc::closeHandleAndSetToNULL(HANDLE& h)
-{
-  if (h!=NULL) {
-    CloseHandle(h);
-    h = NULL;
-  }
-}
-
- 
@@ -1,19 +1,17 @@
 #pragma once
 
-#include <windows.h>
 #include <map>
-#include "stdafx.h"
+#include <assert.h>
+#include "Platform.h"
 
+// Console output (CONSOLEPRINT etc) is for Debug builds, or any build
+// with CONSOLEDEBUG defined in the project; otherwise it compiles away.
+#if defined(_DEBUG) && !defined(CONSOLEDEBUG)
 #define CONSOLEDEBUG
+#endif
 
 #ifdef CONSOLEDEBUG
-// Might be able to simplify this, the only reason this isn't a function is wrapping cprintf.
-#define CONSOLEPRINT(...)					   \
-  do {                                                             \
-    NIFPGAMexDebugger::getInstance()->preConsolePrint();		   \
-    _cprintf(__VA_ARGS__);					   \
-    NIFPGAMexDebugger::getInstance()->postConsolePrint();	   \
-  } while (0)
+#define CONSOLEPRINT(...) NIFPGAMexDebugger::getInstance()->print(__VA_ARGS__)
 #define CONSOLETRACE(...) CONSOLEPRINT("NIFpgaMEX. %s: line %d\n",__FUNCTION__,__LINE__)
 #define CFAEASSERT(tf,...)			\
   if (!(tf)) {					\
@@ -37,13 +35,12 @@ class NIFPGAMexDebugger
   
   static NIFPGAMexDebugger *getInstance(void);
 
-  // Sets console text attributes for the calling thread.
-  void setConsoleAttribsForThread(WORD wAttribs);
+  // Sets the console text color for the calling thread.
+  void setConsoleColorForThread(Platform::ConsoleColor color);
 
-  // See CONSOLEPRINT() Macro, these are public only b/c I don't want
-  // to figure out how to wrap _cprintf.
-  void preConsolePrint(void);
-  void postConsolePrint(void);  
+  // printf to the console, in the calling thread's color. See
+  // CONSOLEPRINT.
+  void print(const char *fmt, ...);
 
  private:
 
@@ -51,25 +48,11 @@ class NIFPGAMexDebugger
 
   ~NIFPGAMexDebugger(void);
 
-  WORD getConsoleAttribsForThread(DWORD threadID);
+  Platform::ConsoleColor getConsoleColorForThread(unsigned long threadID);
 
  private:
-   std::map<DWORD,WORD> fThreadID2ConsoleAttribs;
-   CRITICAL_SECTION fConsoleWriteCS;
-   HANDLE fConsoleScreenBuffer;
-};
-
-namespace CFAEMisc 
-{
-  void requestLockMutex(HANDLE h);
-  void releaseLockMutex(HANDLE h);
+   static const std::size_t MAX_PRINT_LENGTH = 1024;
 
-  // Get a scalar-integer-valued property off a scalar object.
-  int getIntScalarPropFromMX(const mxArray *obj, const char *propname);
-
-  // Assertion using mexErrMsgTxt.
-  void mexAssert(bool cond,const char *msg);
-
-  void closeHandleAndSetToNULL(HANDLE &h);
-}
-  
\ No newline at end of file
+   std::map<unsigned long,Platform::ConsoleColor> fThreadID2ConsoleColor;
+   Platform::Mutex fConsoleWriteMutex; // the console, and the map
+};
@@ -0,0 +1,438 @@
+#include <assert.h>
+#include <sstream>
+#include "MulticastFrameQueue.h"
+#include "Misc.h"
+#include "Atomics.h"
+
+// Reader states are the one place where two threads write the same
+// word; those writes go through atomicCompareExchange64.
+
+// Reader states and the tail are 64-bit words that are read and written
+// whole (see loadAcquire), which takes a 64-bit target.
+typedef char MulticastFrameQueueNeedsA64BitTarget[sizeof(void*)==8 ? 1 : -1];
+
+///////////////////////////////////////////////////////////////////////////
+// MulticastFrameQueue
+
+MulticastFrameQueue::MulticastFrameQueue(void) :
+  fRecordSize(0),
+  fCapacity(0),
+  fDroppedPushCapacity(0),
+  fQ(NULL),
+  fTimestamping(false),
+  fTail(0),
+  fReserved(false),
+  fNumPushBacks(0),
+  fNumDroppedPushBacks(0)
+{
+}
+
+MulticastFrameQueue::~MulticastFrameQueue(void)
+{
+  this->deleteBufs();
+  for (std::size_t i=0;i<fReaders.size();i++) {
+    delete fReaders[i];
+  }
+  fReaders.clear();
+}
+
+void
+MulticastFrameQueue::deleteBufs(void)
+{
+  fDroppedPushBackIdxs.clear();
+  if (fQ!=NULL) {
+    delete[] fQ;
+    fQ = NULL;
+  }
+}
+
+void
+MulticastFrameQueue::init(size_t recordSz,
+			  unsigned long capacity,
+			  unsigned long droppedPushCapacity)
+{
+  assert(recordSz>0);
+  assert(capacity>0);
+  assert(droppedPushCapacity>0);
+
+  fRecordSize = recordSz;
+  fCapacity = capacity;
+  fDroppedPushCapacity = droppedPushCapacity;
+  fNumPushBacks = 0;
+  fNumDroppedPushBacks = 0;
+
+  this->deleteBufs();
+  // Reserved up front so that the producer never reallocates.
+  fDroppedPushBackIdxs.reserve(fDroppedPushCapacity);
+  fQ = new char[fCapacity*fRecordSize]();
+  fPushTicks.assign(fCapacity,0);
+  fTail = 0;
+  fReserved = false;
+  for (std::size_t i=0;i<fReaders.size();i++) {
+    fReaders[i]->reset();
+  }
+
+  fullBarrier();
+}
+
+void
+MulticastFrameQueue::reinit(void)
+{
+  CONSOLETRACE();
+  init(fRecordSize,fCapacity,fDroppedPushCapacity);
+}
+
+FrameQueueReader*
+MulticastFrameQueue::addReader(OverflowPolicy policy)
+{
+  FrameQueueReader *r = new FrameQueueReader(this,policy);
+  fReaders.push_back(r);
+  return r;
+}
+
+void
+MulticastFrameQueue::setTimestamping(bool enable)
+{
+  fTimestamping = enable;
+  fullBarrier();
+}
+
+void
+MulticastFrameQueue::stamp(uint64_t seq)
+{
+  fPushTicks[seq % fCapacity] = Platform::perfCounter();
+}
+
+bool
+MulticastFrameQueue::claimOldest(uint64_t tail)
+{
+  if (tail<fCapacity) {
+    return true; // ring has never wrapped
+  }
+  uint64_t oldest = tail-fCapacity; // seq number that slot(tail) holds now
+  std::size_t numReaders = fReaders.size();
+
+  // Reader cursors never trail oldest. Any reader still at oldest is
+  // holding the slot; see whether all of them can be skipped ahead.
+  // Nothing is changed until every reader has agreed, so that a failed
+  // push costs no reader a record.
+  for (std::size_t i=0;i<numReaders;i++) {
+    FrameQueueReader *r = fReaders[i];
+    if (!r->fEnabled) {
+      continue;
+    }
+    int64_t s = loadAcquire(r->fState);
+    if (FrameQueueReader::cursorOf(s)!=oldest) {
+      continue;
+    }
+    if (r->fPolicy==NEVER_DROP || (s & FrameQueueReader::ACQUIRED)) {
+      return false;
+    }
+  }
+
+  // Claim the DROP_OLDEST readers at oldest, which keeps their consumers
+  // from acquiring the slot. A claim fails if the reader acquired the
+  // slot since the check above; then the push is dropped after all.
+  // The claimed readers are skipped ahead once the new record is
+  // published.
+  bool ok = true;
+  for (std::size_t i=0;i<numReaders && ok;i++) {
+    FrameQueueReader *r = fReaders[i];
+    if (!r->fEnabled) {
+      continue;
+    }
+    int64_t s = r->fState;
+    if (FrameQueueReader::cursorOf(s)!=oldest) {
+      continue;
+    }
+    ok = !(s & FrameQueueReader::ACQUIRED) &&
+      atomicCompareExchange64(r->fState,s|FrameQueueReader::CLAIMED,s)==s;
+  }
+  if (!ok) {
+    releaseClaims(false);
+  }
+  return ok;
+}
+
+void
+MulticastFrameQueue::releaseClaims(bool skip)
+{
+  for (std::size_t i=0;i<fReaders.size();i++) {
+    FrameQueueReader *r = fReaders[i];
+    int64_t s = r->fState; // only we write a claimed state
+    if (!(s & FrameQueueReader::CLAIMED)) {
+      continue;
+    }
+    if (skip) {
+      storeRelease(r->fState,FrameQueueReader::stateOf(FrameQueueReader::cursorOf(s)+1));
+      r->fNumDroppedOldest = r->fNumDroppedOldest+1;
+    } else {
+      storeRelease(r->fState,s & ~FrameQueueReader::CLAIMED);
+    }
+  }
+}
+
+bool
+MulticastFrameQueue::push_back(const void *src)
+{
+  assert(!fReserved);
+  uint64_t tail = fTail; // producer owns fTail
+
+  unsigned long numPushBacks = fNumPushBacks+1; // producer owns the counters too
+  fNumPushBacks = numPushBacks;
+  if (!claimOldest(tail)) {
+    // ring is full; push is dropped for all readers
+    if (fDroppedPushBackIdxs.size() < fDroppedPushCapacity) {
+      fDroppedPushBackIdxs.push_back(numPushBacks);
+    }
+    fNumDroppedPushBacks++;
+    return false;
+  }
+
+  memcpy(slot(tail),src,fRecordSize);
+  releaseClaims(true);
+  if (fTimestamping) {
+    stamp(tail);
+  }
+  storeRelease(fTail,tail+1);
+
+  return true;
+}
+
+void*
+MulticastFrameQueue::reserve_back(void)
+{
+  uint64_t tail = fTail;
+  if (!fReserved) {
+    fReserved = claimOldest(tail);
+  }
+  return fReserved ? slot(tail) : NULL;
+}
+
+void
+MulticastFrameQueue::commit_back(void)
+{
+  // The readers that held the slot are claimed, and the others only ever
+  // move forward, so the slot is still ours.
+  assert(fReserved);
+  uint64_t tail = fTail;
+
+  releaseClaims(true);
+  fReserved = false;
+  fNumPushBacks = fNumPushBacks+1;
+  if (fTimestamping) {
+    stamp(tail);
+  }
+  storeRelease(fTail,tail+1);
+}
+
+void
+MulticastFrameQueue::cancel_back(void)
+{
+  if (fReserved) {
+    releaseClaims(false);
+    fReserved = false;
+  }
+}
+
+unsigned long
+MulticastFrameQueue::total_num_push_back(void) const
+{
+  return fNumPushBacks;
+}
+
+unsigned long
+MulticastFrameQueue::num_dropped_push_back(void) const
+{
+  return fNumDroppedPushBacks;
+}
+
+const std::vector<unsigned long> &
+MulticastFrameQueue::dropped_push_back(void) const
+{
+  return fDroppedPushBackIdxs;
+}
+
+unsigned long
+MulticastFrameQueue::capacity(void) const
+{
+  return fCapacity;
+}
+
+unsigned long
+MulticastFrameQueue::dropped_push_capacity(void) const
+{
+  return fDroppedPushCapacity;
+}
+
+std::size_t
+MulticastFrameQueue::recordSize(void) const
+{
+  return fRecordSize;
+}
+
+void
+MulticastFrameQueue::debugString(std::string &s) const
+{
+  std::ostringstream oss;
+  oss << "--MulticastFrameQueue--" << std::endl;
+  oss << "RecordSz Cap DroppedPushCap NumPushBacks NumDroppedPushBacks: ";
+  oss << fRecordSize << " " << fCapacity << " " << fDroppedPushCapacity << " "
+      << fNumPushBacks << " " << fNumDroppedPushBacks << std::endl;
+  for (std::size_t i=0;i<fReaders.size();i++) {
+    const FrameQueueReader *r = fReaders[i];
+    oss << "Reader " << i << " Policy Enabled Size NumDroppedOldest: "
+	<< r->policy() << " " << r->isEnabled() << " " << r->size() << " "
+	<< r->num_dropped_oldest() << std::endl;
+  }
+
+  s.append(oss.str());
+}
+
+///////////////////////////////////////////////////////////////////////////
+// FrameQueueReader
+
+FrameQueueReader::FrameQueueReader(MulticastFrameQueue *q,
+				   MulticastFrameQueue::OverflowPolicy policy) :
+  fQueue(q),
+  fPolicy(policy),
+  fEnabled(true),
+  fState(0),
+  fNumDroppedOldest(0)
+{
+  reset();
+}
+
+void
+FrameQueueReader::reset(void)
+{
+  // Start at the producer's current position.
+  fState = stateOf(fQueue->fTail);
+  fNumDroppedOldest = 0;
+}
+
+MulticastFrameQueue::OverflowPolicy
+FrameQueueReader::policy(void) const
+{
+  return fPolicy;
+}
+
+void
+FrameQueueReader::setEnabled(bool enable)
+{
+  if (enable) {
+    reset();
+    storeRelease(fEnabled,true);
+  } else {
+    fEnabled = false;
+    reset();
+    fullBarrier();
+  }
+}
+
+bool
+FrameQueueReader::isEnabled(void) const
+{
+  return fEnabled;
+}
+
+unsigned long
+FrameQueueReader::num_dropped_oldest(void) const
+{
+  return fNumDroppedOldest;
+}
+
+std::size_t
+FrameQueueReader::recordSize(void) const
+{
+  return fQueue->recordSize();
+}
+
+bool
+FrameQueueReader::isEmpty(void) const
+{
+  return size()==0;
+}
+
+unsigned long
+FrameQueueReader::size(void) const
+{
+  if (!loadAcquire(fEnabled)) {
+    return 0;
+  }
+  uint64_t cursor = cursorOf(loadAcquire(fState));
+  return static_cast<unsigned long>(loadAcquire(fQueue->fTail)-cursor);
+}
+
+const void*
+FrameQueueReader::acquire_front(void)
+{
+  if (!loadAcquire(fEnabled)) {
+    return NULL;
+  }
+  while (true) {
+    int64_t s = loadAcquire(fState);
+    uint64_t cursor = cursorOf(s);
+    if (s & ACQUIRED) {
+      return fQueue->slot(cursor);
+    }
+    if (cursor==loadAcquire(fQueue->fTail)) {
+      return NULL;
+    }
+    if (s & CLAIMED) {
+      // The producer is writing a new record into our front slot, which
+      // may take it as long as a FIFO read; the record there is as good
+      // as gone.
+      return NULL;
+    }
+    if (atomicCompareExchange64(fState,s|ACQUIRED,s)==s) {
+      return fQueue->slot(cursor);
+    }
+    // The producer claimed or skipped us in the meantime; try again.
+  }
+}
+
+void
+FrameQueueReader::release_front(void)
+{
+  int64_t s = fState; // the producer leaves an acquired state alone
+  assert(s & ACQUIRED);
+  storeRelease(fState,stateOf(cursorOf(s)+1));
+}
+
+const void*
+FrameQueueReader::front_unsafe(void) const
+{
+  return isEmpty() ? NULL : fQueue->slot(cursorOf(fState));
+}
+
+int64_t
+FrameQueueReader::acquired_ticks(void) const
+{
+  int64_t s = fState;
+  if (!(s & ACQUIRED) || !fQueue->fTimestamping) {
+    return 0;
+  }
+  return fQueue->fPushTicks[cursorOf(s) % fQueue->fCapacity];
+}
+
+const void*
+FrameQueueReader::front_checkout(void)
+{
+  return acquire_front();
+}
+
+void
+FrameQueueReader::front_checkin(void)
+{
+}
+
+void
+FrameQueueReader::pop_front(void)
+{
+  if (!(fState & ACQUIRED)) {
+    const void *front = acquire_front();
+    assert(front!=NULL);
+  }
+  release_front();
+}
@@ -0,0 +1,240 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include "Platform.h"
+#include "AbstractConsumerQueue.h"
+
+class FrameQueueReader;
+
+// Single-producer, multiple-consumer ring of fixed-size records. The
+// producer writes each record once; every registered consumer
+// (FrameQueueReader) walks the ring with its own read cursor, and a
+// slot is reclaimed only when every enabled reader is done with it. So
+// memory and copy bandwidth do not grow as consumers are added.
+//
+// Each reader has an overflow policy, which decides what happens when
+// the ring is full and that reader is the one holding up the oldest
+// slot:
+// * NEVER_DROP: the reader is never skipped ahead. The incoming push is
+// dropped (and noted) instead, exactly as in FrameQueue. Used for
+// logging, where every frame that enters the ring must reach disk.
+// * DROP_OLDEST: the producer advances the reader past its oldest
+// unread record, which is then lost to that reader only. Used for
+// display, which only cares about recent frames. A slot that a reader
+// has acquired is never taken from it; if the oldest slot is acquired,
+// the push is dropped. A dropped push leaves every reader where it was,
+// and so does a reservation that is cancelled (see reserve_back).
+//
+// Threading is as in FrameQueue: one producer thread, one thread per
+// reader, and a controller who does init/reinit/addReader/setEnabled
+// while all of those are idle. The one exception is that the producer
+// may enable a disabled reader between pushes (see setEnabled).
+// Sequence numbers restart at init/reinit. They are 64-bit, so they do
+// not wrap in any realistic run, and the queue needs a 64-bit target,
+// where 64-bit words are read and written whole.
+class MulticastFrameQueue {
+
+ public:
+
+  enum OverflowPolicy { NEVER_DROP = 0, DROP_OLDEST };
+
+  MulticastFrameQueue(void);
+
+  // Deletes all readers.
+  ~MulticastFrameQueue(void);
+
+  // Allocates memory and prepares queue for use. Can be called
+  // repeatedly to reset/clear and resize; registered readers are kept,
+  // and their cursors reset.
+  void init(size_t recordSz, unsigned long capacity,
+	    unsigned long droppedPushCapacity);
+
+  // Like init(), but uses existing parameters.
+  void reinit(void);
+
+  // Register a new consumer. The queue owns the returned reader. New
+  // readers are enabled.
+  FrameQueueReader* addReader(OverflowPolicy policy);
+
+  // Stamp each record with Platform::perfCounter ticks as it is
+  // pushed, for readers' dwell times (see
+  // FrameQueueReader::acquired_ticks). Off by default. Controller only.
+  void setTimestamping(bool enable);
+
+  // Called by producer. Copy a record into the ring. Returns false, and
+  // notes the drop, if the ring is full (see OverflowPolicy). Never
+  // blocks.
+  bool push_back(const void *src);
+
+  // Called by producer. Zero-copy alternative to push_back: returns the
+  // slot the next push will fill, for the producer to write a record
+  // straight into, or NULL if the ring is full. Reserving again before
+  // commit_back or cancel_back returns the same slot. DROP_OLDEST
+  // readers whose oldest record is in that slot are held back from it
+  // (acquire_front returns NULL for them) while it is reserved, but are
+  // not skipped past it until commit_back.
+  void* reserve_back(void);
+
+  // Called by producer. Publishes the reserved slot and counts it as a
+  // push; readers held back by the reservation lose their oldest record.
+  // Asserts that a slot is reserved.
+  void commit_back(void);
+
+  // Called by producer. Gives up the reserved slot, if any (eg the frame
+  // for it never came); readers held back by it keep their records.
+  void cancel_back(void);
+
+  unsigned long total_num_push_back(void) const;
+  unsigned long num_dropped_push_back(void) const;
+  const std::vector<unsigned long> & dropped_push_back(void) const;
+
+  unsigned long capacity(void) const;
+  unsigned long dropped_push_capacity(void) const;
+  std::size_t recordSize(void) const;
+
+  // Append debug info to s, including per-reader info.
+  void debugString(std::string &s) const;
+
+ private:
+  friend class FrameQueueReader;
+
+  void deleteBufs(void);
+
+  // Called by producer. Make room for the record at sequence number
+  // tail: claim the DROP_OLDEST readers that are still at the record
+  // that slot holds, which keeps them from acquiring it. Returns false,
+  // claiming no reader, if the ring stays full.
+  bool claimOldest(uint64_t tail);
+
+  // Called by producer. Skip the claimed readers past their oldest
+  // record, or hand them back as they were.
+  void releaseClaims(bool skip);
+
+  char* slot(uint64_t seq) const {
+    return fQ + (seq % fCapacity)*fRecordSize;
+  }
+
+  void stamp(uint64_t seq);
+
+ private:
+  static const unsigned int CACHE_LINE_SIZE = 64;
+
+  // Configuration; written only by the controller.
+  size_t fRecordSize; // in bytes
+  unsigned long fCapacity; // max num records in queue
+  unsigned long fDroppedPushCapacity;
+  std::vector<unsigned long> fDroppedPushBackIdxs;
+  std::vector<FrameQueueReader*> fReaders;
+  char *fQ;
+  bool fTimestamping;
+  std::vector<int64_t> fPushTicks; // per slot, when fTimestamping
+
+  // Producer-owned. fTail is the sequence number of the next push.
+  char fProducerPad[CACHE_LINE_SIZE];
+  volatile uint64_t fTail;
+  bool fReserved; // slot(fTail) is reserved
+  volatile unsigned long fNumPushBacks;
+  volatile unsigned long fNumDroppedPushBacks;
+  char fEndPad[CACHE_LINE_SIZE];
+};
+
+// One consumer's view of a MulticastFrameQueue. Behaves like a
+// FrameQueue to its (single) consumer thread.
+class FrameQueueReader : public AbstractConsumerQueue {
+
+ public:
+
+  MulticastFrameQueue::OverflowPolicy policy(void) const;
+
+  // A disabled reader sees no records and never holds up the
+  // producer; eg the logging reader when logging is off. Called by the
+  // controller while the producer is idle, or, to enable a disabled
+  // reader, by the producer between pushes (eg when logging is
+  // triggered). The reader's cursor is published before the flag, so
+  // a consumer polling a reader as it is enabled starts at the
+  // producer's position.
+  void setEnabled(bool enable);
+  bool isEnabled(void) const;
+
+  // Number of records the producer skipped this reader past since the
+  // last init (DROP_OLDEST only).
+  unsigned long num_dropped_oldest(void) const;
+
+  std::size_t recordSize(void) const;
+
+  bool isEmpty(void) const;
+
+  // Number of records this reader has yet to consume.
+  unsigned long size(void) const;
+
+  // Called by consumer. Returns the front record, in place in its slot,
+  // or NULL if there is none, or if the producer has reserved its slot
+  // for a new record (see MulticastFrameQueue::reserve_back). The slot belongs to this reader (the
+  // producer will neither overwrite it nor skip past it) until
+  // release_front. Calling again before release_front returns the same
+  // record.
+  const void* acquire_front(void);
+
+  // Called by consumer. Done with the acquired record; asserts that
+  // one was acquired.
+  void release_front(void);
+
+  // Peek at the front record without acquiring it. For DROP_OLDEST
+  // readers the record may be overwritten at any time.
+  const void* front_unsafe(void) const;
+
+  // Platform::perfCounter ticks at which the acquired record was
+  // pushed; 0 if none is acquired or the queue is not timestamping.
+  int64_t acquired_ticks(void) const;
+
+  // Equivalent to acquire_front.
+  const void* front_checkout(void);
+
+  // Currently a no-op; the record stays acquired until pop_front.
+  void front_checkin(void);
+
+  // Acquire (if need be) and release the front record. Asserts that
+  // the queue is nonempty.
+  void pop_front(void);
+
+ private:
+  friend class MulticastFrameQueue;
+
+  FrameQueueReader(MulticastFrameQueue *q,
+		   MulticastFrameQueue::OverflowPolicy policy);
+
+  void reset(void);
+
+  // fState packs the cursor (the sequence number of this reader's next
+  // record) with an ACQUIRED bit, so that the producer's skip-ahead and
+  // the consumer's acquire can be arbitrated with a single CAS. The
+  // producer sets CLAIMED from the time it takes the reader's oldest
+  // slot for a new record until it publishes the record (skipping the
+  // reader ahead) or gives the slot up; a claimed reader cannot
+  // acquire, and only the producer writes its state while it is
+  // claimed.
+  static const int64_t ACQUIRED = 1;
+  static const int64_t CLAIMED = 2;
+
+  static uint64_t cursorOf(int64_t state) {
+    return static_cast<uint64_t>(state) >> 2;
+  }
+
+  static int64_t stateOf(uint64_t cursor) {
+    return static_cast<int64_t>(cursor << 2);
+  }
+
+ private:
+  static const unsigned int CACHE_LINE_SIZE = 64;
+
+  MulticastFrameQueue *fQueue;
+  MulticastFrameQueue::OverflowPolicy fPolicy;
+  volatile bool fEnabled; // see setEnabled
+
+  // Written by consumer, and by the producer when skipping ahead.
+  char fStatePad[CACHE_LINE_SIZE];
+  volatile int64_t fState;
+  volatile unsigned long fNumDroppedOldest; // producer-owned
+  char fEndPad[CACHE_LINE_SIZE];
+};
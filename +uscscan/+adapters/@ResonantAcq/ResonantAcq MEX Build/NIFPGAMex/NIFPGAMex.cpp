@@ -1,12 +1,21 @@
 #include <process.h>    /* _beginthread, _endthread */
+#include <math.h>
 #include <string>
 #include <map>
 
 #include "stdafx.h"
 #include "MatlabParams.h"
-#include "FrameQueue.h"
 #include "FrameCopier.h"
 #include "FrameLogger.h"
+#include "DisplayPreparer.h"
+#include "FrameStatsRing.h"
+#include "FrameKernels.h"
+#include "PipelineTrace.h"
+#include "RawFrameReader.h"
+#include "TifStackReader.h"
+#include "NiFpgaFifoSource.h"
+#include "ReplayFrameSource.h"
+#include "SyntheticFrameSource.h"
 
 #define MAX_LSM_COMMAND_LEN 32
 #define MAXCALLBACKNAMELENGTH 256
@@ -18,6 +27,9 @@ MatlabParams* fmp;
 //FrameQueue* matlabQueue;
 FrameCopier* frameCopier;
 FrameLogger* frameLogger;
+DisplayPreparer* displayPreparer;
+mxArray* frameEvent = NULL; // frameAcquiredFcn's evnt, reused; see asyncMexMATLABCallback
+unsigned long frameStatsPolled = 0; // newest frame stats record getFrameStats has returned
 static bool mexInitted = false;
 
 // Called at mex unload/exit
@@ -34,6 +46,13 @@ void uninitMEX(void)
 	//Stop Frame Copier.
 	CONSOLEPRINT("STOPPING FRAME COPIER...\n");
 	frameCopier->stopProcessing();
+	if (displayPreparer->isRunning())
+		displayPreparer->stop();
+	PipelineTrace::getInstance()->close();
+	if (frameEvent!=NULL) {
+		mxDestroyArray(frameEvent);
+		frameEvent = NULL;
+	}
 	//************************************************
 	mexUnlock();
 	mexInitted = false;
@@ -41,13 +60,151 @@ void uninitMEX(void)
 
 void initMEX(void) {
 #ifdef CONSOLEDEBUG
-	NIFPGAMexDebugger::getInstance()->setConsoleAttribsForThread(FOREGROUND_BLUE|FOREGROUND_GREEN|FOREGROUND_INTENSITY);
+	NIFPGAMexDebugger::getInstance()->setConsoleColorForThread(Platform::CONSOLE_CYAN);
 	CONSOLETRACE();
 #endif
 	mexLock();
 	mexAtExit(uninitMEX);
 }
 
+// Frame source for the current acquisition: the FPGA FIFO, or in simulated
+// mode a replayed FIFO dump if one is set and synthetic frames otherwise.
+FrameSource*
+createFrameSource(void)
+{
+	if (!fmp->simulated)
+		return new NiFpgaFifoSource(fmp->fpgaSession,fmp->fpgaFifoNumberSingleChan,fmp->fpgaFifoNumberMultiChan);
+	if (strlen(fmp->simulatedReplayFile)>0)
+		return new ReplayFrameSource(fmp->simulatedReplayFile,fmp->simulatedFrameRate,true);
+	return new SyntheticFrameSource(SyntheticFrameSource::patternFromString(fmp->simulatedPattern),fmp->simulatedFrameRate);
+}
+
+// Frame tag of a frame in the display queue (frameTagging only): the
+// FPGA's count of acquired records, in the tag's last two words.
+unsigned long
+displayFrameTag(const int16_t* frame)
+{
+	size_t tagIdx = (fmp->frameSizeBytes - fmp->tagSizeBytes)/2;
+	uint16_t fpgaTotalAcquiredRecordsA = (uint16_t) frame[tagIdx + 2];
+	uint16_t fpgaTotalAcquiredRecordsB = (uint16_t) frame[tagIdx + 3];
+	return (unsigned long) fpgaTotalAcquiredRecordsA * (unsigned long) 65536 + (unsigned long) fpgaTotalAcquiredRecordsB;
+}
+
+// Take up to maxFrames frames from the display queue, oldest first, into a new
+// linesPerFrame x pixelsPerLine x channels x numFrames int16 array (as getFrame's
+// matrices; numFrames may be 0), transposing each straight out of its queue slot: one
+// copy per frame. Their tags go in a new numFrames x 1 array, *tags.
+static const size_t ALL_DISPLAY_FRAMES = (size_t) -1;
+mxArray*
+readDisplayFrames(size_t maxFrames, mxArray** tags)
+{
+	//Called on the MATLAB thread, the display queue's only consumer, so the frames there
+	//now stay there (the copier may drop the oldest, but replaces it).
+	size_t numFrames = fmp->displayQueue->size();
+	if (maxFrames < numFrames)
+		numFrames = maxFrames;
+
+	int numChans = fmp->isMultiChannel ? 4 : 1;
+	mwSize dims[4] = {fmp->linesPerFrame, fmp->pixelsPerLine, numChans, numFrames};
+	mxArray* frames = mxCreateNumericArray(4,dims,mxINT16_CLASS,mxREAL);
+	int16_t* dst = static_cast<int16_t*>(mxGetData(frames));
+	*tags = mxCreateDoubleMatrix(numFrames,1,mxREAL);
+	double* tagData = mxGetPr(*tags);
+
+	size_t numCopied = 0;
+	while (numCopied < numFrames) {
+		const int16_t* src = static_cast<const int16_t*>(fmp->displayQueue->acquire_front());
+		if (src == NULL)
+			break;
+		fmp->stats->record(PipelineStats::DISPLAY_QUEUE_DWELL,fmp->displayQueue->acquired_ticks());
+		unsigned long tagVal = fmp->frameTagging ? displayFrameTag(src) : 0;
+
+		LONGLONG t0 = fmp->stats->start();
+		for (int chan=0;chan<numChans;chan++) {
+			FrameKernels::transpose(src + chan*fmp->frameSizePixels,dst,fmp->linesPerFrame,fmp->pixelsPerLine);
+			dst += fmp->frameSizePixels;
+		}
+		fmp->stats->record(PipelineStats::TRANSPOSE,t0);
+		TRACE_EVENT(TRACE_FRAMES,TRACE_GET_FRAME,tagVal,fmp->displayQueue->size(),0);
+
+		fmp->displayQueue->release_front();
+		tagData[numCopied++] = (double) tagVal;
+	}
+	if (numCopied < numFrames) {
+		dims[3] = numCopied;
+		mxSetDimensions(frames,dims,4);
+		mxSetM(*tags,numCopied);
+	}
+	return frames;
+}
+
+// The reader MATLAB takes display frames from: the prepared frames with display prep
+// on, else the display queue.
+FrameQueueReader*
+matlabDisplayReader(void)
+{
+	return fmp->displayPrepEnabled ? fmp->preparedQueue : fmp->displayQueue;
+}
+
+// As readDisplayFrames, from the prepared frames (display prep on): a new uint8
+// outputLines x outputPixels x outputPlanes x numFrames array, where the planes are the
+// channels shown or, merged, R, G and B (see DisplayPrep). DisplayPreparer has already put
+// each frame in MATLAB's order, so it is one memcpy.
+mxArray*
+readPreparedFrames(size_t maxFrames, mxArray** tags)
+{
+	const DisplayPrep& prep = displayPreparer->prep();
+	size_t numFrames = fmp->preparedQueue->size();
+	if (maxFrames < numFrames)
+		numFrames = maxFrames;
+
+	mwSize dims[4] = {prep.outputLines(), prep.outputPixels(), prep.outputPlanes(), numFrames};
+	mxArray* frames = mxCreateNumericArray(4,dims,mxUINT8_CLASS,mxREAL);
+	uint8_t* dst = static_cast<uint8_t*>(mxGetData(frames));
+	*tags = mxCreateDoubleMatrix(numFrames,1,mxREAL);
+	double* tagData = mxGetPr(*tags);
+
+	size_t numCopied = 0;
+	while (numCopied < numFrames) {
+		const char* src = static_cast<const char*>(fmp->preparedQueue->acquire_front());
+		if (src == NULL)
+			break;
+		unsigned long tagVal;
+		memcpy(&tagVal,src,sizeof(tagVal));
+		memcpy(dst,src+DisplayPreparer::TAG_BYTES,prep.outputBytes());
+		dst += prep.outputBytes();
+		TRACE_EVENT(TRACE_FRAMES,TRACE_GET_FRAME,tagVal,fmp->preparedQueue->size(),0);
+
+		fmp->preparedQueue->release_front();
+		tagData[numCopied++] = (double) tagVal;
+	}
+	if (numCopied < numFrames) {
+		dims[3] = numCopied;
+		mxSetDimensions(frames,dims,4);
+		mxSetM(*tags,numCopied);
+	}
+	return frames;
+}
+
+// Display frames for MATLAB: readDisplayFrames, or with display prep, readPreparedFrames.
+mxArray*
+readMatlabFrames(size_t maxFrames, mxArray** tags)
+{
+	return fmp->displayPrepEnabled ? readPreparedFrames(maxFrames,tags) : readDisplayFrames(maxFrames,tags);
+}
+
+// Set a field of the persistent frameEvent struct, destroying the value it replaces. The
+// values are new each callback, so a callback may keep them.
+void
+setFrameEventField(const char* name, mxArray* value)
+{
+	mxArray* oldValue = mxGetField(frameEvent,0,name);
+	if (oldValue!=NULL)
+		mxDestroyArray(oldValue);
+	mexMakeArrayPersistent(value);
+	mxSetField(frameEvent,0,name,value);
+}
+
 void
 asyncMexMATLABCallback(LPARAM lParam, void* fpgaMexParams)
 {
@@ -58,6 +215,7 @@ asyncMexMATLABCallback(LPARAM lParam, void* fpgaMexParams)
 	rhs[0] = fmp->callbackFuncHandle;
 	rhs[1] = fmp->resonantAcqObject;
 	rhs[2] = NULL;
+	int nrhs = 2;
 	
 	//TODO: Maybe prevent C callback altogether if Matlab callback is empty
 	if (mxIsEmpty(rhs[0])) {
@@ -66,7 +224,40 @@ asyncMexMATLABCallback(LPARAM lParam, void* fpgaMexParams)
 	}		
 	// MATLAB syntax for defining callbackFuncHandle:
 	// callbackFuncHandle = @(src,evnt)disp('hello')
-	mxArray* mException = mexCallMATLABWithTrap(0,NULL,2,rhs,"feval");
+	TRACE_EVENT(TRACE_FRAMES,TRACE_CALLBACK,lParam,0,0);
+
+	LONGLONG t0 = fmp->stats->record(PipelineStats::CALLBACK_LATENCY,fmp->stats->takePosted());
+	if (t0==0)
+		t0 = fmp->stats->start();
+
+	// With frameEventCoalescing or frameEventData the callback gets evnt: framesNotified, the
+	// frames announced since the last callback (lParam when coalescing, else 1);
+	// framesAvailable, the frames it can read now; and with frameEventData, the frames
+	// themselves (the next one, or when coalescing all of them, as readFrames returns them;
+	// prepared frames with display prep),
+	// their tags and the drop counters, which saves the callback a getFrame(s) call. The struct
+	// is kept between callbacks; its field values are new each time.
+	if (fmp->frameEventCoalescing || fmp->frameEventData) {
+		if (frameEvent==NULL) {
+			const char* fieldNames[] = {"framesNotified","framesAvailable","frames","tags","framesLostFifo","displayDropped"};
+			frameEvent = mxCreateStructMatrix(1,1,6,fieldNames);
+			mexMakeArrayPersistent(frameEvent);
+		}
+		setFrameEventField("framesNotified",mxCreateDoubleScalar(fmp->frameEventCoalescing ? (double) lParam : 1.0));
+		if (fmp->frameEventData) {
+			mxArray* tags;
+			setFrameEventField("frames",readMatlabFrames(fmp->frameEventCoalescing ? ALL_DISPLAY_FRAMES : 1,&tags));
+			setFrameEventField("tags",tags);
+			setFrameEventField("framesLostFifo",mxCreateDoubleScalar((double) fmp->numDroppedFramesCopier));
+			setFrameEventField("displayDropped",mxCreateDoubleScalar((double) matlabDisplayReader()->num_dropped_oldest()));
+		}
+		setFrameEventField("framesAvailable",mxCreateDoubleScalar((double) matlabDisplayReader()->size()));
+		rhs[2] = frameEvent;
+		nrhs = 3;
+	}
+
+	mxArray* mException = mexCallMATLABWithTrap(0,NULL,nrhs,rhs,"feval");
+	fmp->stats->record(PipelineStats::CALLBACK_DURATION,t0);
 
 	if (mException!=NULL) {
 		char* errorString = (char*)mxCalloc(256,sizeof(char));
@@ -79,6 +270,95 @@ asyncMexMATLABCallback(LPARAM lParam, void* fpgaMexParams)
 	}
 }
 
+// getStats struct for one pipeline stage. Times are in microseconds;
+// histogramUs has a row [lowerUs upperUs count] per nonempty bucket.
+mxArray*
+createStageStats(PipelineStats::Stage stage)
+{
+	const char* fieldNames[] = {"count","ratePerSecond","meanUs","maxUs","p50Us","p90Us","p99Us","p999Us","histogramUs"};
+	mxArray* s = mxCreateStructMatrix(1,1,9,fieldNames);
+	const LatencyHistogram& h = fmp->stats->histogram(stage);
+	mxSetField(s,0,"count",mxCreateDoubleScalar((double) h.count()));
+	mxSetField(s,0,"ratePerSecond",mxCreateDoubleScalar(fmp->stats->rate(stage)));
+	mxSetField(s,0,"meanUs",mxCreateDoubleScalar(h.mean()/1000));
+	mxSetField(s,0,"maxUs",mxCreateDoubleScalar(h.maxValue()/1000.0));
+	mxSetField(s,0,"p50Us",mxCreateDoubleScalar(h.percentile(0.5)/1000.0));
+	mxSetField(s,0,"p90Us",mxCreateDoubleScalar(h.percentile(0.9)/1000.0));
+	mxSetField(s,0,"p99Us",mxCreateDoubleScalar(h.percentile(0.99)/1000.0));
+	mxSetField(s,0,"p999Us",mxCreateDoubleScalar(h.percentile(0.999)/1000.0));
+
+	std::vector<unsigned int> buckets;
+	for (unsigned int b=0;b<LatencyHistogram::NUM_BUCKETS;b++)
+		if (h.bucketCount(b)>0)
+			buckets.push_back(b);
+	mxArray* hist = mxCreateDoubleMatrix(buckets.size(),3,mxREAL);
+	double* histData = mxGetPr(hist);
+	size_t numRows = buckets.size();
+	for (size_t i=0;i<numRows;i++)
+	{
+		histData[i] = LatencyHistogram::bucketLowerBound(buckets[i])/1000.0;
+		histData[numRows+i] = LatencyHistogram::bucketUpperBound(buckets[i])/1000.0;
+		histData[2*numRows+i] = h.bucketCount(buckets[i]);
+	}
+	mxSetField(s,0,"histogramUs",hist);
+	return s;
+}
+
+// getFrameStats struct for records, all from one acquisition: a column per
+// frame. min, max, mean, std and numSaturated are channels x frames, and
+// histogram is 256 x channels x frames. mean and std (the population
+// standard deviation) come from the sums the copier keeps.
+mxArray*
+createFrameStats(const std::vector<FrameStatsRecord>& records)
+{
+	const char* fieldNames[] = {"frameNumber","frameTag","min","max","mean","std","numSaturated","histogram"};
+	mxArray* s = mxCreateStructMatrix(1,1,8,fieldNames);
+	mwSize numFrames = records.size();
+	mwSize numChannels = numFrames>0 ? records[0].numChannels : 0;
+	mxArray* frameNumber = mxCreateDoubleMatrix(1,numFrames,mxREAL);
+	mxArray* frameTag = mxCreateDoubleMatrix(1,numFrames,mxREAL);
+	mxArray* minVal = mxCreateDoubleMatrix(numChannels,numFrames,mxREAL);
+	mxArray* maxVal = mxCreateDoubleMatrix(numChannels,numFrames,mxREAL);
+	mxArray* mean = mxCreateDoubleMatrix(numChannels,numFrames,mxREAL);
+	mxArray* std = mxCreateDoubleMatrix(numChannels,numFrames,mxREAL);
+	mxArray* numSaturated = mxCreateDoubleMatrix(numChannels,numFrames,mxREAL);
+	mwSize histDims[3] = {256, numChannels, numFrames};
+	mxArray* histogram = mxCreateNumericArray(3,histDims,mxDOUBLE_CLASS,mxREAL);
+
+	for (mwSize f=0;f<numFrames;f++)
+	{
+		const FrameStatsRecord& record = records[f];
+		mxGetPr(frameNumber)[f] = record.frameNumber;
+		mxGetPr(frameTag)[f] = record.frameTag;
+		double numPixels = record.pixelsPerChannel>0 ? (double) record.pixelsPerChannel : 1.0;
+		for (mwSize c=0;c<numChannels && c<record.numChannels;c++)
+		{
+			const FrameKernels::PixelStats& p = record.channels[c];
+			mwSize idx = f*numChannels+c;
+			double m = (double) p.sum/numPixels;
+			double variance = (double) p.sumSquares/numPixels - m*m;
+			mxGetPr(minVal)[idx] = p.min;
+			mxGetPr(maxVal)[idx] = p.max;
+			mxGetPr(mean)[idx] = m;
+			mxGetPr(std)[idx] = sqrt(variance>0 ? variance : 0.0);
+			mxGetPr(numSaturated)[idx] = p.numSaturated;
+			double* hist = mxGetPr(histogram) + idx*256;
+			for (int b=0;b<256;b++)
+				hist[b] = p.histogram[b];
+		}
+	}
+
+	mxSetField(s,0,"frameNumber",frameNumber);
+	mxSetField(s,0,"frameTag",frameTag);
+	mxSetField(s,0,"min",minVal);
+	mxSetField(s,0,"max",maxVal);
+	mxSetField(s,0,"mean",mean);
+	mxSetField(s,0,"std",std);
+	mxSetField(s,0,"numSaturated",numSaturated);
+	mxSetField(s,0,"histogram",histogram);
+	return s;
+}
+
 enum LSMCommandType { INITIALIZE = 0,
 SET_SESSION,
 SET_FIFO_NUMBER,
@@ -87,9 +367,16 @@ CREATE_CALLBACK,
 RESIZE_ACQUISITION,
 REGISTER_FRAMEACQ_CALLBACK,
 GET_FRAME,
+GET_FRAMES,
 START_ACQ,
 STOP_ACQ,
 DELETE_SELF,
+CONVERT_RAW_LOG,
+READ_LOGGED_FRAMES,
+TRIGGER_LOGGING,
+GET_STATS,
+UPDATE_DISPLAY_LEVELS,
+GET_FRAME_STATS,
 UNKNOWN_CMD
 };
 
@@ -104,9 +391,16 @@ LSMCommandType getLSMCommand(const char* str) {
 	else if(strcmp(str, "resizeAcquisition") == 0) { return RESIZE_ACQUISITION; } 
 	else if(strcmp(str, "registerFrameAcqFcn") == 0) { return REGISTER_FRAMEACQ_CALLBACK; }
 	else if(strcmp(str, "getFrame") == 0) { return GET_FRAME; } 
+	else if(strcmp(str, "getFrames") == 0) { return GET_FRAMES; }
 	else if(strcmp(str, "startAcq") == 0) { return START_ACQ; } 
 	else if(strcmp(str, "stopAcq") == 0) { return STOP_ACQ; } 
 	else if(strcmp(str, "delete") == 0) { return DELETE_SELF; } 
+	else if(strcmp(str, "convertRawLog") == 0) { return CONVERT_RAW_LOG; }
+	else if(strcmp(str, "readLoggedFrames") == 0) { return READ_LOGGED_FRAMES; }
+	else if(strcmp(str, "triggerLogging") == 0) { return TRIGGER_LOGGING; }
+	else if(strcmp(str, "getStats") == 0) { return GET_STATS; }
+	else if(strcmp(str, "updateDisplayLevels") == 0) { return UPDATE_DISPLAY_LEVELS; }
+	else if(strcmp(str, "getFrameStats") == 0) { return GET_FRAME_STATS; }
 
 	return UNKNOWN_CMD;
 }
@@ -119,10 +413,20 @@ mexFunction(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[]) {
 
 		//create our core objects
 		fmp = MatlabParams::getInstance();
-		fmp->matlabQueue = new FrameQueue();
-		fmp->loggingQueue = new FrameQueue();
-		frameCopier = new FrameCopier();
-		frameLogger = new FrameLogger();
+		fmp->frameQueue = new MulticastFrameQueue();
+		fmp->matlabQueue = fmp->frameQueue->addReader(MulticastFrameQueue::DROP_OLDEST);
+		fmp->loggingQueue = fmp->frameQueue->addReader(MulticastFrameQueue::NEVER_DROP);
+		fmp->averagedFrameQueue = new MulticastFrameQueue();
+		fmp->averagedQueue = fmp->averagedFrameQueue->addReader(MulticastFrameQueue::DROP_OLDEST);
+		fmp->displayQueue = fmp->matlabQueue;
+		fmp->preparedFrameQueue = new MulticastFrameQueue();
+		fmp->preparedQueue = fmp->preparedFrameQueue->addReader(MulticastFrameQueue::DROP_OLDEST);
+		fmp->frameHistory = new FrameHistory();
+		fmp->stats = new PipelineStats();
+		fmp->frameStats = new FrameStatsRing();
+		frameCopier = new FrameCopier(fmp);
+		frameLogger = new FrameLogger(fmp);
+		displayPreparer = new DisplayPreparer(fmp);
 		static bool mexInitted = false;
 	}
 
@@ -222,8 +526,19 @@ mexFunction(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[]) {
 	 {
 		 //CONSOLETRACE();
 		 fmp->readPropsFromMatlab();
-         fmp->matlabQueue->init(fmp->frameSizeBytes, fmp->frameQueueCapacity, fmp->frameQueueCapacity);
-         fmp->loggingQueue->init(fmp->frameSizeBytes, fmp->frameQueueCapacity, fmp->frameQueueCapacity);
+         fmp->frameQueue->init(fmp->frameSizeBytes, fmp->frameQueueCapacity, fmp->frameQueueCapacity);
+		 //Averaged display frames; only a token ring if display averaging is off.
+		 unsigned long averagedCapacity = (DisplayAverager::modeFromString(fmp->displayAveragingMode)==DisplayAverager::NONE) ? 1 : MatlabParams::AVERAGED_QUEUE_CAPACITY;
+		 fmp->averagedFrameQueue->init(fmp->frameSizeBytes, averagedCapacity, averagedCapacity);
+		 //Prepared display frames; only a token ring if display prep is off. They are small, so as many as the frame queue.
+		 unsigned long preparedCapacity = fmp->displayPrepEnabled ? fmp->frameQueueCapacity : 1;
+		 fmp->preparedFrameQueue->init(DisplayPreparer::recordSize(fmp), preparedCapacity, preparedCapacity);
+		 //Frames kept from before the logging trigger, sized in frames or MB. Allocated (and locked) here, not at the trigger.
+		 unsigned long historyCapacity = 0;
+		 if (fmp->loggingEnabled && fmp->loggingWaitForTrigger)
+			 historyCapacity = fmp->loggingPreTriggerFrames>0 ? fmp->loggingPreTriggerFrames :
+				 FrameHistory::capacityForBytes(fmp->frameSizeBytes,(unsigned __int64) (fmp->loggingPreTriggerMB*1024*1024));
+		 fmp->frameHistory->init(fmp->frameSizeBytes, historyCapacity);
 	 }
 	 break;
 
@@ -239,9 +554,30 @@ mexFunction(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[]) {
  case START_ACQ:
 	 {
 		 //CONSOLEPRINT("matlabQueue: %d",fmp->matlabQueue);
+		 //A disabled logging reader must not hold frames in the queue. With a
+		 //logging trigger, the copier enables it when the trigger comes.
+		 fmp->loggingQueue->setEnabled(fmp->loggingEnabled && !fmp->loggingWaitForTrigger);
+		 PipelineTrace::getInstance()->configure(fmp->traceLevel,fmp->traceFile);
+		 //Coalesced frame events may be capped, eg at the display refresh rate.
+		 if (fmp->asyncMex!=NULL)
+			 AsyncMex_setMinEventInterval(fmp->asyncMex,(fmp->frameEventCoalescing && fmp->frameEventMaxRate>0) ? 1.0/fmp->frameEventMaxRate : 0.0);
+		 TRACE_EVENT(TRACE_EVENTS,TRACE_ACQ_START,fmp->frameSizeBytes,fmp->isMultiChannel,fmp->loggingEnabled);
+		 //With display prep, the copier's frame events go to the display preparer, which tells us
+		 //of each prepared frame.
+		 fmp->frameEvents = fmp->displayPrepEnabled ? static_cast<FrameEventSink*>(displayPreparer) : fmp;
+		 //The copier numbers frame stats afresh.
+		 frameStatsPolled = 0;
 		 //Start Frame Copier.
 		 CONSOLEPRINT("STARTING FRAME COPIER...\n");
+		 frameCopier->setFrameSource(createFrameSource());
 		 frameCopier->startProcessing();		 
+		 //Start the display preparer, now the copier has chosen the display queue. Any events the
+		 //copier posted meanwhile are waiting for it. If it cannot start, display full frames.
+		 if (fmp->displayPrepEnabled && !displayPreparer->start(fmp))
+		 {
+			 fmp->displayPrepEnabled = false;
+			 fmp->frameEvents = fmp;
+		 }
          //Start Frame Logger.
 		 if (fmp->loggingEnabled)
 		 {
@@ -263,105 +599,62 @@ mexFunction(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[]) {
 		 //Stop Frame Copier.
 		 CONSOLEPRINT("STOPPING FRAME COPIER...\n");
 		 frameCopier->stopProcessing();
+		 if (displayPreparer->isRunning())
+			 displayPreparer->stop();
+		 //Announce any frames the rate cap held back.
+		 if (fmp->frameEventCoalescing && fmp->asyncMex!=NULL)
+			 AsyncMex_flushCoalescedEvents(fmp->asyncMex);
+		 TRACE_EVENT(TRACE_EVENTS,TRACE_ACQ_STOP,fmp->frameQueue->total_num_push_back(),fmp->frameQueue->num_dropped_push_back(),0);
+		 PipelineTrace::getInstance()->flush();
 	 }
 	 break;
 
  case GET_FRAME: 
 	 {
-         mwSize frameDims[1];
-		 mxArray* data;
-         mxArray* dataTransposed;
-		 mxArray* dataMatrix;
+		 if (fmp->displayPrepEnabled) {
+			 mexErrMsgTxt("getFrame: with displayPrepEnable, read the prepared frames with getFrames.");
+		 }
 		 mxArray* tag;
 		 mxArray* dataCellArray;
 		 mxArray* elremaining;
-		 //The following vars are used for de-interlacing multichannel images.
-         const int16_t* sourceArray;
-         int16_t* destinationArray;
-		 int16_t* dataTransposedArray;
-		 int16_t* rawData;
-
-		 //Tag variables.
-         int16_t  fpgaTagIdentifier;
-         uint16_t fpgaPlaceHolder;
-         uint16_t fpgaTotalAcquiredRecordsA;
-         uint16_t fpgaTotalAcquiredRecordsB;
-
-		 size_t frameTwoOffset   = fmp->frameSizePixels;
-		 size_t frameThreeOffset = fmp->frameSizePixels*2;
-		 size_t frameFourOffset  = fmp->frameSizePixels*3;
+		 const int16_t* sourceArray;
+
          unsigned long tagVal = 0;
 
-		 if (!fmp->matlabQueue->isEmpty())
-		 {
-			 //TODO: Remove any redundant memcpys and extra copies of frame data
-			 //TODO: Account for the possibility of frame sizes that do not divide evenly into the FIFO, which requires two reads from the FIFO (first part of data, then second part)
-			 frameDims[0] = fmp->frameSizeFifoElements;
-			 if (fmp->isMultiChannel){
-				 data = mxCreateNumericArray(1,frameDims,mxINT64_CLASS,mxREAL);
-				 dataTransposed = mxCreateNumericArray(1,frameDims,mxINT64_CLASS,mxREAL);
-			 }
-			 else
-			 {
-				 data = mxCreateNumericArray(1,frameDims,mxINT16_CLASS,mxREAL);
-				 dataTransposed = mxCreateNumericArray(1,frameDims,mxINT16_CLASS,mxREAL);
-			 }
+		 //Create a 2D cell array of dimension 4x1. Each cell contains a channel frame to send to MATLAB.
+		 dataCellArray = mxCreateCellMatrix(4,1);
 
-			 //Start the process by getting the memory location of the front of the frame queue and store in sourceArray.
-			 sourceArray = static_cast<const int16_t*>(fmp->matlabQueue->front_unsafe());
-			 destinationArray  = static_cast<int16_t*>(mxGetData(data));
-			 dataTransposedArray = static_cast<int16_t*>(mxGetData(dataTransposed));
+		 //Read the front frame in place in the display queue (the shared frame queue, or the
+		 //averaged-frame queue). The slot is ours until release_front.
+		 sourceArray = static_cast<const int16_t*>(fmp->displayQueue->acquire_front());
+		 if (sourceArray!=NULL)
+		 {
+			 fmp->stats->record(PipelineStats::DISPLAY_QUEUE_DWELL,fmp->displayQueue->acquired_ticks());
 
 			 // If frameTagging is enabled, then store the frame tag.
 			 if (fmp->frameTagging) {
-				 fpgaTagIdentifier         = (int16_t)  sourceArray[(fmp->frameSizeBytes - fmp->tagSizeBytes)/2];
-				 fpgaPlaceHolder           = (uint16_t) sourceArray[(fmp->frameSizeBytes - fmp->tagSizeBytes)/2 + 1];
-				 fpgaTotalAcquiredRecordsA = (uint16_t) sourceArray[(fmp->frameSizeBytes - fmp->tagSizeBytes)/2 + 2];
-				 fpgaTotalAcquiredRecordsB = (uint16_t) sourceArray[(fmp->frameSizeBytes - fmp->tagSizeBytes)/2 + 3];
-				 tagVal = (unsigned long) fpgaTotalAcquiredRecordsA * (unsigned long) 65536 + (unsigned long) fpgaTotalAcquiredRecordsB;
-
-				 //if (tagVal != fmp->lastCopierTag+1) {
-					// fmp->numDroppedFramesCopier = fmp->numDroppedFramesCopier + (tagVal - fmp->lastCopierTag + 1);
-					// CONSOLEPRINT("FRAMECOPIER dropped %u frames...\n",fmp->numDroppedFramesCopier);
-				 //}
-				 //fmp->lastCopierTag = tagVal;
+				 tagVal = displayFrameTag(sourceArray);
 			 }
 
-			 memcpy(destinationArray,sourceArray,fmp->frameSizeBytes);
-
-			 //reset pointer to destinationArray so that it points to the beginning of our data.
-			 destinationArray  = static_cast<int16_t*>(mxGetData(data));
-			 //Once we are done using the sourceArray pointer, we can pop the front off the frame queue.
-			 fmp->matlabQueue->pop_front();
-			 //Create a 2D cell array of dimension 4x1. Each cell contains a channel frame to send to MATLAB.
-			 dataCellArray = mxCreateCellMatrix(4,1);
-			 //Create the 2D MATLAB array that will contain the data we just copied into rawData.
-			 dataMatrix = mxCreateNumericMatrix(fmp->linesPerFrame,fmp->pixelsPerLine,mxINT16_CLASS,mxREAL);
-             //rawData holds pointer to the data stored in dataMatrix.
-			 rawData = static_cast<int16_t*>(mxGetData(dataMatrix));
-			 //Perform the 1D array transpose. Store the resulting transposed value into dataTransposedArray.
-			 //The following may be friendlier for the compiler to optimize.
-			 if  (fmp->isMultiChannel)
+			 //The queue holds frames line by line, one channel after another (as logged). Transpose
+			 //each channel straight into its linesPerFrame x pixelsPerLine (column-major) MATLAB matrix.
+			 int numChans = fmp->isMultiChannel ? 4 : 1;
+			 LONGLONG t0 = fmp->stats->start();
+			 for (int chan=0;chan<numChans;chan++)
 			 {
-				 memcpy(rawData,(int16_t *) destinationArray,fmp->frameSizePixels*2);
-				 mxSetCell(dataCellArray,0,mxDuplicateArray(dataMatrix));
-				 memcpy(rawData,(int16_t *) destinationArray+frameTwoOffset,fmp->frameSizePixels*2);
-				 mxSetCell(dataCellArray,1,mxDuplicateArray(dataMatrix));
-				 memcpy(rawData,(int16_t *) destinationArray+frameThreeOffset,fmp->frameSizePixels*2);
-				 mxSetCell(dataCellArray,2,mxDuplicateArray(dataMatrix));
-				 memcpy(rawData,(int16_t *) destinationArray+frameFourOffset,fmp->frameSizePixels*2);
-				 mxSetCell(dataCellArray,3,mxDuplicateArray(dataMatrix));
-			 }
-			 else
-			 {
-				 memcpy(rawData,(int16_t *) destinationArray,fmp->frameSizePixels*2);
-				 mxSetCell(dataCellArray,0,mxDuplicateArray(dataMatrix));
+				 mxArray* dataMatrix = mxCreateNumericMatrix(fmp->linesPerFrame,fmp->pixelsPerLine,mxINT16_CLASS,mxREAL);
+				 int16_t* rawData = static_cast<int16_t*>(mxGetData(dataMatrix));
+				 FrameKernels::transpose(sourceArray + chan*fmp->frameSizePixels,rawData,fmp->linesPerFrame,fmp->pixelsPerLine);
+				 mxSetCell(dataCellArray,chan,dataMatrix);
 			 }
+			 fmp->stats->record(PipelineStats::TRANSPOSE,t0);
+			 TRACE_EVENT(TRACE_FRAMES,TRACE_GET_FRAME,tagVal,fmp->displayQueue->size(),0);
+
+			 //Once we are done using the sourceArray pointer, we can release the frame.
+			 fmp->displayQueue->release_front();
 		 }
 		 else{
 			 mexPrintf("attempting to get frame from empty queue!\n");
-			 //Create a 2D cell array of dimension 4x1. Each cell contains a channel frame to send to MATLAB.
-			 dataCellArray = mxCreateCellMatrix(4,1);
 			 mxSetCell(dataCellArray,0,mxCreateNumericMatrix(1,1,mxINT16_CLASS,mxREAL));
 			 mxSetCell(dataCellArray,1,mxCreateNumericMatrix(1,1,mxINT16_CLASS,mxREAL));
 			 mxSetCell(dataCellArray,2,mxCreateNumericMatrix(1,1,mxINT16_CLASS,mxREAL));
@@ -378,10 +671,47 @@ mexFunction(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[]) {
 			 plhs[1] = tag;
 			 plhs[2] = elremaining;
 		 }
-		 //Free memory from heap.
-		 mxDestroyArray(dataMatrix);
-		 mxDestroyArray(dataTransposed);
-		 mxDestroyArray(data);
+	 }
+	 break;
+
+ case GET_FRAMES:
+	 {
+		 //[frames,tags,framesRemaining] = ResonantAcqMex(obj,'getFrames',n)
+		 //Up to n frames (Inf for all) from the display queue, oldest first. frames is linesPerFrame x
+		 //pixelsPerLine x channels x numFrames, as getFrame's matrices, and may have no frames. Each
+		 //frame is transposed straight out of its queue slot into frames: one copy per frame.
+		 //framesRemaining is the number still queued. With display prep, the frames are the
+		 //prepared uint8 ones instead (see readPreparedFrames).
+		 if (nrhs < 3) {
+			 mexErrMsgTxt("getFrames: expected the number of frames.");
+		 }
+		 double numFramesArg = mxGetScalar(prhs[2]);
+		 if (numFramesArg < 0) {
+			 mexErrMsgTxt("getFrames: the number of frames must not be negative.");
+		 }
+		 size_t maxFrames = mxIsInf(numFramesArg) ? ALL_DISPLAY_FRAMES : (size_t) numFramesArg;
+		 mxArray* tags;
+		 mxArray* frames = readMatlabFrames(maxFrames,&tags);
+
+		 plhs[0] = frames;
+		 if (nlhs >= 2) {
+			 plhs[1] = tags;
+		 } else {
+			 mxDestroyArray(tags);
+		 }
+		 if (nlhs >= 3) {
+			 plhs[2] = mxCreateDoubleScalar((double) matlabDisplayReader()->size());
+		 }
+	 }
+	 break;
+
+ case UPDATE_DISPLAY_LEVELS:
+	 {
+		 //New displayPrepLevels, taken up by the display preparer before its next frame if it is running.
+		 fmp->readDisplayPrepLevels();
+		 if (displayPreparer->isRunning()) {
+			 displayPreparer->setLevels(fmp->displayPrepLevels);
+		 }
 	 }
 	 break;
 
@@ -399,13 +729,203 @@ mexFunction(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[]) {
 			 delete frameLogger;
 		 }
 
+		 if (displayPreparer != NULL) {
+			 delete displayPreparer;
+		 }
+
 		 if (&fmp->asyncMex != NULL) {
 			 AsyncMex_destroy(&fmp->asyncMex);
 		 }
 
 		 if (fmp != NULL) {
+			 delete fmp->frameHistory;
+			 delete fmp->stats;
+			 delete fmp->frameStats;
 			 delete fmp;
 		 }
+
+		 if (frameEvent != NULL) {
+			 mxDestroyArray(frameEvent);
+			 frameEvent = NULL;
+		 }
+
+		 PipelineTrace::getInstance()->close();
+	 }
+	 break;
+
+ case CONVERT_RAW_LOG:
+	 {
+		 //numFrames = ResonantAcqMex(obj,'convertRawLog',rawFile,tifFile[,bigTiff])
+		 if (nrhs < 4 || !mxIsChar(prhs[2]) || !mxIsChar(prhs[3])) {
+			 mexErrMsgTxt("convertRawLog: expected raw and TIFF file names.");
+		 }
+		 char* rawFile = mxArrayToString(prhs[2]);
+		 char* tifFile = mxArrayToString(prhs[3]);
+		 bool bigTiff = (nrhs >= 5) && mxGetScalar(prhs[4]) != 0;
+
+		 unsigned __int64 numFrames = 0;
+		 bool ok = RawFrameReader::convertToTif(rawFile,tifFile,bigTiff,&numFrames);
+		 mxFree(rawFile);
+		 mxFree(tifFile);
+		 if (!ok) {
+			 mexErrMsgTxt("convertRawLog: conversion failed; see the console for details.");
+		 }
+		 plhs[0] = mxCreateDoubleScalar((double) numFrames);
+	 }
+	 break;
+
+ case READ_LOGGED_FRAMES:
+	 {
+		 //[frames,tags] = ResonantAcqMex(obj,'readLoggedFrames',fileName,firstFrame,numFrames,channels,numChannels)
+		 //firstFrame and channels are 1-based; numFrames Inf reads to the end, channels [] reads all.
+		 //frames is linesPerFrame x pixelsPerLine x numel(channels) x numFrames, as getFrame's matrices.
+		 if (nrhs < 7 || !mxIsChar(prhs[2])) {
+			 mexErrMsgTxt("readLoggedFrames: expected fileName, firstFrame, numFrames, channels, numChannels.");
+		 }
+		 char* fileName = mxArrayToString(prhs[2]);
+		 TifStackReader reader;
+		 bool opened = reader.open(fileName,(unsigned short) mxGetScalar(prhs[6]));
+		 mxFree(fileName);
+		 if (!opened) {
+			 mexErrMsgTxt("readLoggedFrames: could not open the file; see the console for details.");
+		 }
+		 if (reader.bytesPerPixel() != 2) {
+			 reader.close(); //mexErrMsgTxt does not return
+			 mexErrMsgTxt("readLoggedFrames: only 16-bit files are supported.");
+		 }
+
+		 double firstFrameArg = mxGetScalar(prhs[3]);
+		 double numFramesArg = mxGetScalar(prhs[4]);
+		 if (firstFrameArg < 1 || firstFrameArg > (double) reader.numFrames() + 1) {
+			 reader.close();
+			 mexErrMsgTxt("readLoggedFrames: firstFrame is out of range.");
+		 }
+		 unsigned __int64 firstFrame = (unsigned __int64) firstFrameArg - 1;
+		 unsigned __int64 numFrames = reader.numFrames() - firstFrame;
+		 if (!mxIsInf(numFramesArg)) {
+			 if (numFramesArg < 0 || numFramesArg > (double) numFrames) {
+				 reader.close();
+				 mexErrMsgTxt("readLoggedFrames: numFrames runs past the end of the file.");
+			 }
+			 numFrames = (unsigned __int64) numFramesArg;
+		 }
+
+		 std::vector<unsigned short> channels;
+		 const mxArray* channelsArg = prhs[5];
+		 if (!mxIsDouble(channelsArg) || mxIsComplex(channelsArg)) {
+			 reader.close();
+			 mexErrMsgTxt("readLoggedFrames: channels must be a real double array.");
+		 }
+		 for (size_t i = 0; i < mxGetNumberOfElements(channelsArg); i++) {
+			 double c = mxGetPr(channelsArg)[i];
+			 if (c < 1 || c > reader.numChannels()) {
+				 reader.close();
+				 mexErrMsgTxt("readLoggedFrames: channel out of range.");
+			 }
+			 channels.push_back((unsigned short) c - 1);
+		 }
+		 if (channels.empty()) {
+			 for (unsigned short c = 0; c < reader.numChannels(); c++) {
+				 channels.push_back(c);
+			 }
+		 }
+
+		 mwSize dims[4] = {reader.imageLength(), reader.imageWidth(), channels.size(), (mwSize) numFrames};
+		 plhs[0] = mxCreateNumericArray(4,dims,reader.signedData() ? mxINT16_CLASS : mxUINT16_CLASS,mxREAL);
+		 int16_t* dst = static_cast<int16_t*>(mxGetData(plhs[0]));
+		 double* tags = NULL;
+		 if (nlhs >= 2) {
+			 plhs[1] = mxCreateDoubleMatrix((mwSize) numFrames,1,mxREAL);
+			 tags = mxGetPr(plhs[1]);
+		 }
+
+		 //Transpose each image straight from the mapped file; compressed images are inflated first.
+		 std::vector<char> inflated;
+		 size_t pixelsPerImage = (size_t) reader.imageWidth()*reader.imageLength();
+		 for (unsigned __int64 f = 0; f < numFrames; f++) {
+			 for (size_t c = 0; c < channels.size(); c++) {
+				 const char* src = reader.frameData(firstFrame+f,channels[c]);
+				 if (src == NULL) {
+					 inflated.resize(reader.getBytesPerImage());
+					 if (!reader.copyFrames(firstFrame+f,1,&channels[c],1,&inflated[0])) {
+						 reader.close();
+						 mexErrMsgTxt("readLoggedFrames: could not read a frame; see the console for details.");
+					 }
+					 src = &inflated[0];
+				 }
+				 FrameKernels::transpose(reinterpret_cast<const int16_t*>(src),dst,reader.imageLength(),reader.imageWidth());
+				 dst += pixelsPerImage;
+			 }
+			 if (tags != NULL) {
+				 tags[f] = (double) reader.frameTag(firstFrame+f);
+			 }
+		 }
+	 }
+	 break;
+
+ case TRIGGER_LOGGING:
+	 {
+		 //Logging starts at the next frame, after the frames kept from before it.
+		 if (!frameCopier->isWaitingForLoggingTrigger()) {
+			 mexErrMsgTxt("triggerLogging: logging is not waiting for a trigger. Set loggingEnable and loggingWaitForTrigger before starting the acquisition.");
+		 }
+		 frameCopier->triggerLogging();
+	 }
+	 break;
+
+ case GET_STATS:
+	 {
+		 //stats = ResonantAcqMex(obj,'getStats'): a struct with a field per pipeline stage
+		 //(see createStageStats) and the frame counters, since the acquisition started.
+		 const char* fieldNames[PipelineStats::NUM_STAGES+3];
+		 fieldNames[0] = "enabled";
+		 fieldNames[1] = "elapsedSeconds";
+		 for (int i=0;i<PipelineStats::NUM_STAGES;i++)
+			 fieldNames[2+i] = PipelineStats::stageName((PipelineStats::Stage) i);
+		 fieldNames[PipelineStats::NUM_STAGES+2] = "counters";
+		 mxArray* stats = mxCreateStructMatrix(1,1,PipelineStats::NUM_STAGES+3,fieldNames);
+		 mxSetField(stats,0,"enabled",mxCreateLogicalScalar(fmp->stats->isEnabled()));
+		 mxSetField(stats,0,"elapsedSeconds",mxCreateDoubleScalar(fmp->stats->elapsedSeconds()));
+		 for (int i=0;i<PipelineStats::NUM_STAGES;i++)
+			 mxSetField(stats,0,fieldNames[2+i],createStageStats((PipelineStats::Stage) i));
+
+		 const char* counterNames[] = {"framesPushed","droppedPushes","framesLostFifo","resyncs",
+			 "framesLogged","displayDropped","loggingQueueSize","displayQueueSize","framesPrepared","preparedDropped"};
+		 mxArray* counters = mxCreateStructMatrix(1,1,10,counterNames);
+		 mxSetField(counters,0,"framesPushed",mxCreateDoubleScalar(fmp->frameQueue->total_num_push_back()));
+		 mxSetField(counters,0,"droppedPushes",mxCreateDoubleScalar(fmp->frameQueue->num_dropped_push_back()));
+		 mxSetField(counters,0,"framesLostFifo",mxCreateDoubleScalar(fmp->numDroppedFramesCopier));
+		 mxSetField(counters,0,"resyncs",mxCreateDoubleScalar(fmp->numResyncsCopier));
+		 mxSetField(counters,0,"framesLogged",mxCreateDoubleScalar(frameLogger->getFramesLogged()));
+		 mxSetField(counters,0,"displayDropped",mxCreateDoubleScalar(fmp->displayQueue->num_dropped_oldest()));
+		 mxSetField(counters,0,"loggingQueueSize",mxCreateDoubleScalar(fmp->loggingQueue->size()));
+		 mxSetField(counters,0,"displayQueueSize",mxCreateDoubleScalar(fmp->displayQueue->size()));
+		 mxSetField(counters,0,"framesPrepared",mxCreateDoubleScalar(displayPreparer->framesPrepared()));
+		 mxSetField(counters,0,"preparedDropped",mxCreateDoubleScalar(displayPreparer->framesDropped()+fmp->preparedQueue->num_dropped_oldest()));
+		 mxSetField(stats,0,"counters",counters);
+		 plhs[0] = stats;
+	 }
+	 break;
+
+ case GET_FRAME_STATS:
+	 {
+		 //stats = ResonantAcqMex(obj,'getFrameStats',n): the statistics of up to n (Inf for all) of the
+		 //frames stored since the previous call, the newest, oldest first (see createFrameStats). The
+		 //ring holds the last FrameStatsRing::CAPACITY frames; older ones are lost. No frames are read.
+		 if (nrhs < 3) {
+			 mexErrMsgTxt("getFrameStats: expected the number of frames.");
+		 }
+		 double numFramesArg = mxGetScalar(prhs[2]);
+		 if (numFramesArg < 0) {
+			 mexErrMsgTxt("getFrameStats: the number of frames must not be negative.");
+		 }
+		 size_t maxRecords = mxIsInf(numFramesArg) ? FrameStatsRing::CAPACITY : (size_t) numFramesArg;
+		 std::vector<FrameStatsRecord> records;
+		 fmp->frameStats->readAfter(frameStatsPolled,maxRecords,records);
+		 if (!records.empty()) {
+			 frameStatsPolled = records.back().frameNumber;
+		 }
+		 plhs[0] = createFrameStats(records);
 	 }
 	 break;
 
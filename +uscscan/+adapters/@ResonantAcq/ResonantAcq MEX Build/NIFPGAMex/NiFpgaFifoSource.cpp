@@ -0,0 +1,232 @@
+#include "stdafx.h"
+#include <string.h>
+#include "NiFpgaFifoSource.h"
+
+// FrameSource::Status codes are the NiFpga ones.
+typedef char FrameSourceStatusIsNiFpgaStatus[
+  (FrameSource::SUCCESS==NiFpga_Status_Success &&
+   FrameSource::FIFO_TIMEOUT==NiFpga_Status_FifoTimeout &&
+   FrameSource::SOFTWARE_FAULT==NiFpga_Status_SoftwareFault &&
+   FrameSource::INVALID_PARAMETER==NiFpga_Status_InvalidParameter &&
+   FrameSource::RESOURCE_NOT_FOUND==NiFpga_Status_ResourceNotFound &&
+   FrameSource::RESOURCE_NOT_INITIALIZED==NiFpga_Status_ResourceNotInitialized &&
+   FrameSource::FEATURE_NOT_SUPPORTED==NiFpga_Status_FeatureNotSupported) ? 1 : -1];
+
+NiFpgaFifoSource::NiFpgaFifoSource(NiFpga_Session session,
+				   uint32_t fifoSingleChan,
+				   uint32_t fifoMultiChan) :
+  fSession(session),
+  fFifoSingleChan(fifoSingleChan),
+  fFifoMultiChan(fifoMultiChan),
+  fElementSizeBytes(2),
+  fAcquiredElements(NULL),
+  fNumAcquired(0),
+  fNumAcquiredFrames(0),
+  fLastElementsRemaining(0),
+  fNumStaged(0)
+{
+}
+
+NiFpgaFifoSource::~NiFpgaFifoSource(void)
+{
+  close();
+}
+
+FrameSource::Status
+NiFpgaFifoSource::open(const FrameFormat &fmt)
+{
+  fFormat = fmt;
+  fElementSizeBytes = fmt.isMultiChannel ? sizeof(int64_t) : sizeof(int16_t);
+  assert(fmt.frameSizeBytes==fmt.frameSizeFifoElements*fElementSizeBytes);
+
+  fAcquiredElements = NULL;
+  fNumAcquired = 0;
+  fNumAcquiredFrames = 0;
+  fLastElementsRemaining = 0;
+  fStaging.resize(fmt.frameSizeBytes);
+  fNumStaged = 0;
+
+  // Initializes the FPGA interface context for the calling thread.
+  return NiFpga_Initialize();
+}
+
+NiFpga_Status
+NiFpgaFifoSource::readElements(char *dst, std::size_t numElements, uint32_t timeoutMs,
+			       std::size_t *elementsRemaining)
+{
+  // Blocks until numElements are available, or timeout.
+  if (fFormat.isMultiChannel) {
+    return NiFpga_ReadFifoI64(fSession,fFifoMultiChan,reinterpret_cast<int64_t*>(dst),
+			      numElements,timeoutMs,elementsRemaining);
+  } else {
+    return NiFpga_ReadFifoI16(fSession,fFifoSingleChan,reinterpret_cast<int16_t*>(dst),
+			      numElements,timeoutMs,elementsRemaining);
+  }
+}
+
+NiFpga_Status
+NiFpgaFifoSource::acquireElements(char **elements, std::size_t numElements,
+				  uint32_t timeoutMs, std::size_t *elementsAcquired,
+				  std::size_t *elementsRemaining)
+{
+  if (fFormat.isMultiChannel) {
+    return NiFpga_AcquireFifoReadElementsI64(fSession,fFifoMultiChan,reinterpret_cast<int64_t**>(elements),
+					     numElements,timeoutMs,elementsAcquired,elementsRemaining);
+  } else {
+    return NiFpga_AcquireFifoReadElementsI16(fSession,fFifoSingleChan,reinterpret_cast<int16_t**>(elements),
+					     numElements,timeoutMs,elementsAcquired,elementsRemaining);
+  }
+}
+
+FrameSource::Status
+NiFpgaFifoSource::readFrame(void *dst, uint32_t timeoutMs,
+			    std::size_t *elementsRemaining)
+{
+  return readElements(static_cast<char*>(dst),fFormat.frameSizeFifoElements,timeoutMs,elementsRemaining);
+}
+
+FrameSource::Status
+NiFpgaFifoSource::discardElements(std::size_t numElements, uint32_t timeoutMs)
+{
+  assert(fNumAcquired==0);
+  assert(numElements<=fFormat.frameSizeFifoElements);
+
+  // Staged elements are the front of the stream.
+  std::size_t fromStaging = numElements<fNumStaged ? numElements : fNumStaged;
+  if (fromStaging>0) {
+    memmove(&fStaging[0],&fStaging[fromStaging*fElementSizeBytes],
+	    (fNumStaged-fromStaging)*fElementSizeBytes);
+    fNumStaged -= fromStaging;
+    numElements -= fromStaging;
+  }
+  if (numElements==0) {
+    return NiFpga_Status_Success;
+  }
+
+  // With nothing staged, the staging buffer is free to read into.
+  assert(fNumStaged==0);
+  std::size_t elementsRemaining;
+  return readElements(&fStaging[0],numElements,timeoutMs,&elementsRemaining);
+}
+
+bool
+NiFpgaFifoSource::supportsBatchedReads(void) const
+{
+  return true;
+}
+
+NiFpga_Status
+NiFpgaFifoSource::completeStagedFrame(uint32_t timeoutMs, std::size_t *elementsRemaining)
+{
+  // On timeout nothing is read, so the staged part is kept for next time.
+  NiFpga_Status status = readElements(&fStaging[fNumStaged*fElementSizeBytes],
+				      fFormat.frameSizeFifoElements-fNumStaged,
+				      timeoutMs,elementsRemaining);
+  if (status==NiFpga_Status_Success) {
+    fNumStaged = 0;
+  }
+  return status;
+}
+
+FrameSource::Status
+NiFpgaFifoSource::acquireFrames(std::size_t maxFrames, uint32_t timeoutMs,
+				const char **frames, std::size_t *numFrames,
+				std::size_t *elementsRemaining)
+{
+  assert(fNumAcquired==0);
+  assert(maxFrames>0);
+  const std::size_t frameElements = fFormat.frameSizeFifoElements;
+  *numFrames = 0;
+
+  // A frame split by the wrap last time comes first.
+  if (fNumStaged>0) {
+    NiFpga_Status status = completeStagedFrame(timeoutMs,elementsRemaining);
+    fLastElementsRemaining = *elementsRemaining;
+    if (status==NiFpga_Status_Success) {
+      *frames = &fStaging[0];
+      *numFrames = 1;
+    }
+    return status;
+  }
+
+  // Ask for every whole frame known to be waiting, so the acquire does
+  // not block on frames that have not arrived yet; if none is known to
+  // be waiting, ask for one and wait for it.
+  std::size_t framesRequested = fLastElementsRemaining/frameElements;
+  if (framesRequested<1) {
+    framesRequested = 1;
+  } else if (framesRequested>maxFrames) {
+    framesRequested = maxFrames;
+  }
+
+  char *elements = NULL;
+  std::size_t acquired = 0;
+  NiFpga_Status status = acquireElements(&elements,framesRequested*frameElements,
+					 timeoutMs,&acquired,elementsRemaining);
+  fLastElementsRemaining = *elementsRemaining;
+  if (NiFpga_IsError(status) || acquired==0) {
+    return status==NiFpga_Status_Success ? NiFpga_Status_FifoTimeout : status;
+  }
+
+  fAcquiredElements = elements;
+  fNumAcquired = acquired;
+  fNumAcquiredFrames = acquired/frameElements;
+
+  // The region stops short at the end of the host buffer. If that cuts
+  // the first frame, stage what we have, hand the elements back and
+  // read the rest of the frame from the start of the buffer. (A cut
+  // after whole frames is staged the same way, in releaseFrames().)
+  if (fNumAcquiredFrames==0) {
+    releaseFrames();
+    status = completeStagedFrame(timeoutMs,elementsRemaining);
+    fLastElementsRemaining = *elementsRemaining;
+    if (status==NiFpga_Status_Success) {
+      *frames = &fStaging[0];
+      *numFrames = 1;
+    }
+    return status;
+  }
+
+  *frames = fAcquiredElements;
+  *numFrames = fNumAcquiredFrames;
+  return status;
+}
+
+void
+NiFpgaFifoSource::releaseFrames(void)
+{
+  if (fNumAcquired==0) {
+    return;
+  }
+
+  std::size_t tail = fNumAcquired - fNumAcquiredFrames*fFormat.frameSizeFifoElements;
+  if (tail>0 && fNumStaged==0) {
+    memcpy(&fStaging[0],fAcquiredElements+fNumAcquiredFrames*fFormat.frameSizeBytes,
+	   tail*fElementSizeBytes);
+    fNumStaged = tail;
+  }
+
+  NiFpga_Status status = NiFpga_ReleaseFifoElements(fSession,
+						    fFormat.isMultiChannel ? fFifoMultiChan : fFifoSingleChan,
+						    fNumAcquired);
+  if (status!=NiFpga_Status_Success) {
+    CONSOLEPRINT("NiFpgaFifoSource: error releasing FIFO elements. Got Status: %d\n",status);
+  }
+  fAcquiredElements = NULL;
+  fNumAcquired = 0;
+  fNumAcquiredFrames = 0;
+}
+
+void
+NiFpgaFifoSource::close(void)
+{
+  // All acquired elements must be released before the session closes.
+  releaseFrames();
+  fNumStaged = 0;
+}
+
+const char*
+NiFpgaFifoSource::name(void) const
+{
+  return "NiFpga FIFO";
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <vector>
+#include "NiFpga.h"
+#include "FrameSource.h"
+
+// Reads frames from the FPGA's DMA FIFO: the single-channel I16 FIFO or
+// the multi-channel I64 FIFO, depending on the frame format.
+//
+// readFrame() copies one frame out of the DMA host buffer with
+// NiFpga_ReadFifo*. The batched reads instead acquire every complete
+// frame already in the host buffer (up to maxFrames) in place with
+// NiFpga_AcquireFifoReadElements*, and release them together. A frame
+// that straddles the end of the circular host buffer cannot be exposed
+// in place; it is assembled in a staging buffer and delivered on its
+// own.
+class NiFpgaFifoSource : public FrameSource {
+
+ public:
+
+  NiFpgaFifoSource(NiFpga_Session session, uint32_t fifoSingleChan,
+		   uint32_t fifoMultiChan);
+
+  ~NiFpgaFifoSource(void);
+
+  // The FIFO's NiFpga_Status is returned as is (see FrameSource::Status).
+  Status open(const FrameFormat &fmt);
+
+  Status readFrame(void *dst, uint32_t timeoutMs,
+		   std::size_t *elementsRemaining);
+
+  Status discardElements(std::size_t numElements, uint32_t timeoutMs);
+
+  bool supportsBatchedReads(void) const;
+
+  Status acquireFrames(std::size_t maxFrames, uint32_t timeoutMs,
+		       const char **frames, std::size_t *numFrames,
+		       std::size_t *elementsRemaining);
+
+  void releaseFrames(void);
+
+  void close(void);
+
+  const char* name(void) const;
+
+ private:
+  // Typed wrappers for the I16 (single-channel) and I64 (multi-channel)
+  // FIFO calls. Counts are in FIFO elements.
+  NiFpga_Status readElements(char *dst, std::size_t numElements, uint32_t timeoutMs,
+			     std::size_t *elementsRemaining);
+  NiFpga_Status acquireElements(char **elements, std::size_t numElements,
+				uint32_t timeoutMs, std::size_t *elementsAcquired,
+				std::size_t *elementsRemaining);
+
+  // Finish the frame partly held in fStaging by reading the rest of it.
+  NiFpga_Status completeStagedFrame(uint32_t timeoutMs, std::size_t *elementsRemaining);
+
+ private:
+  NiFpga_Session fSession;
+  uint32_t fFifoSingleChan;
+  uint32_t fFifoMultiChan;
+  FrameFormat fFormat;
+  std::size_t fElementSizeBytes;
+
+  // Batched-read state.
+  char *fAcquiredElements;          // start of the acquired region
+  std::size_t fNumAcquired;         // elements held, 0 if none
+  std::size_t fNumAcquiredFrames;   // whole frames exposed from the region
+  std::size_t fLastElementsRemaining;
+  std::vector<char> fStaging;       // a frame split by the host buffer's wrap
+  std::size_t fNumStaged;           // elements of it already copied
+};
@@ -0,0 +1,105 @@
+#include "PipelineParams.h"
+#include "FrameSource.h"
+#include "RawFrameWriter.h"
+
+PipelineParams::PipelineParams(void){
+	//simulated operation.
+	simulated = false;
+	simulatedFrameRate = 20.0;
+	strcpy_s(simulatedPattern,"ramp");
+	simulatedReplayFile[0] = '\0';
+
+	//frame geometry; set by the owner
+	pixelsPerLine = 0;
+	linesPerFrame = 0;
+	frameTagging = false;
+	isMultiChannel = false;
+	frameQueueCapacity = 0;
+	frameSizePixels = 0;
+	frameSizeBytes = 0;
+	frameSizeFifoElements = 0;
+	tagSizeBytes = 0;
+	tagSizeFifoElements = 0;
+
+	loggingEnabled = false;
+
+	//TODO: Figure out what to do with these...do we need them in MATLAB?
+	pixelSizeBytes = 2;
+	numLoggingChannels = 1;
+	signedData = false;
+	frameDelay = 0;
+	frameTagOneBased = true;
+	loggingAverageFactor = 1;
+	loggingFullFileName[0] = '\0';
+	loggingOpenModeString[0] = '\0';
+	loggingHeaderString[0] = '\0';
+	loggingBigTiff = false;
+	loggingPreallocateFrames = 0;
+	loggingAsyncWrites = true;
+	loggingWriteBufferMB = 8;
+	loggingWritesInFlight = 4;
+	strcpy_s(loggingCompression,"none");
+	loggingCompressionLevel = 1;
+	loggingCompressionPredictor = true;
+	loggingCompressionThreads = 2;
+	strcpy_s(loggingFormat,"tiff");
+	loggingRawFramesPerChunk = RawFrameWriter::DEFAULT_FRAMES_PER_CHUNK;
+	loggingWaitForTrigger = false;
+	loggingTriggerEventName[0] = '\0';
+	loggingPreTriggerFrames = 0;
+	loggingPreTriggerMB = 0.0;
+
+	strcpy_s(displayAveragingMode,"none");
+	displayAveragingFrames = 4;
+	displayAveragingWeight = 0.25;
+	displayAveragingInterval = 0;
+
+	displayPrepEnabled = false;
+	displayPrepBinFactor = 1;
+	displayPrepNumChannels = 0;
+	displayPrepMerge = false;
+	for (int chan=0;chan<MAX_DISPLAY_CHANNELS;chan++) {
+		displayPrepChannels[chan] = chan;
+		displayPrepLevels[chan][0] = 0;
+		displayPrepLevels[chan][1] = 32767;
+		for (int k=0;k<3;k++)
+			displayPrepColors[chan][k] = 0.0;
+	}
+	displayPrepColors[0][1] = 1.0; //green, red, blue, white
+	displayPrepColors[1][0] = 1.0;
+	displayPrepColors[2][2] = 1.0;
+	displayPrepColors[3][0] = displayPrepColors[3][1] = displayPrepColors[3][2] = 1.0;
+
+	frameStatsEnabled = false;
+	adcBitDepth = 16;
+
+	statsEnabled = true;
+	traceLevel = 0;
+	traceFile[0] = '\0';
+
+	fpgaStatus = FrameSource::SUCCESS;
+	fpgaSession = 0;
+	fpgaFifoNumberSingleChan = 0;
+	fpgaFifoNumberMultiChan = 0;
+	fifoBatchedReads = false;
+	fifoMaxFramesPerBatch = 8;
+	fpgaElementsRemaining = NULL;
+
+	frameQueue = NULL;
+	matlabQueue = NULL;
+	loggingQueue = NULL;
+	averagedFrameQueue = NULL;
+	averagedQueue = NULL;
+	displayQueue = NULL;
+	preparedFrameQueue = NULL;
+	preparedQueue = NULL;
+	frameHistory = NULL;
+	stats = NULL;
+	frameStats = NULL;
+	frameEvents = NULL;
+
+	//Instrumentation vars
+	numDroppedFramesCopier = 0;
+	numResyncsCopier = 0;
+	lastCopierTag = 0;
+}
@@ -0,0 +1,156 @@
+//Acquisition, logging and instrumentation settings, and the shared
+//objects, of the frame pipeline (FrameCopier and FrameLogger). Plain
+//data with no MATLAB in it: MatlabParams fills it in from the
+//ResonantAcq object for the MEX; a console program can fill it in
+//directly.
+#pragma once
+
+#include "Platform.h"
+
+//forward declarations
+class MulticastFrameQueue;
+class FrameQueueReader;
+class FrameHistory;
+class PipelineStats;
+class FrameStatsRing;
+
+/*
+FrameEventSink
+
+Told by the FrameCopier each time a frame is ready for display (a raw
+frame in displayQueue, or an averaged one). frameAvailable is called on
+the copier's processing thread, once per frame, so it must not block:
+the MEX adapter (MatlabParams) posts an AsyncMex message.
+*/
+class FrameEventSink {
+
+public:
+	virtual ~FrameEventSink(void) { }
+
+	virtual void frameAvailable(void) = 0;
+};
+
+struct PipelineParams
+{
+	//constants
+	static const unsigned int MAXFILENAMESIZE = 256;
+	static const unsigned int MAXIMAGEHEADERSIZE = 8194;
+	static const unsigned long AVERAGED_QUEUE_CAPACITY = 4; //averaged display frames held for display
+
+	//Defaults for everything but the frame geometry, which the owner
+	//sets before each acquisition.
+	PipelineParams(void);
+
+	//simulated operation.
+	bool simulated;
+	double simulatedFrameRate;                   //frames/s; 0 = as fast as frames are consumed
+	char simulatedPattern[16];                   //'ramp', 'noise' or 'counter'
+	char simulatedReplayFile[MAXFILENAMESIZE];   //raw FIFO dump to replay; empty = synthesize frames
+
+	//image and acquisition parameters
+	size_t pixelsPerLine;
+	size_t linesPerFrame;
+	bool frameTagging;
+	bool isMultiChannel;
+	unsigned long frameQueueCapacity;
+
+	size_t frameSizePixels;        //Number of Pixels in one frame (not including frame tag)
+	size_t frameSizeBytes;         //Number of Bytes in one frame (frame + optional frame tag)
+	size_t frameSizeFifoElements;  //Number of FIFO elements for one frame (frame + optional frame tag)
+	size_t tagSizeBytes;           //Tag Size in Bytes (0 for frameTagging == 0)
+	size_t tagSizeFifoElements;    //Number of FIFO elements for the tag (0 for frameTagging == 0)
+
+	//used for frameLogger only.
+	bool loggingEnabled;
+	unsigned short pixelSizeBytes;
+	unsigned short numLoggingChannels;
+	bool frameTagOneBased;
+	bool signedData;
+	int frameDelay;
+	unsigned int loggingAverageFactor;
+	char loggingFullFileName[MAXFILENAMESIZE];
+	char loggingOpenModeString[8];
+	char loggingHeaderString[MAXIMAGEHEADERSIZE];
+	bool loggingBigTiff;                   //write BigTIFF (64-bit offsets) rather than classic TIFF (4 GB limit)
+	unsigned long loggingPreallocateFrames; //frames to reserve disk space for in each log file; 0 = none
+	bool loggingAsyncWrites;               //write TIFFs with overlapped, unbuffered I/O ('w' modes only)
+	unsigned int loggingWriteBufferMB;     //size of each async write
+	unsigned int loggingWritesInFlight;    //number of async write buffers
+	char loggingCompression[16];           //'none', 'deflate' (TIFF) or 'lz4' (.lz4s container)
+	int loggingCompressionLevel;           //deflate level, 1-9
+	bool loggingCompressionPredictor;      //horizontal differencing before compression
+	unsigned int loggingCompressionThreads; //compression threads besides the logger thread
+	char loggingFormat[16];                //'tiff', or 'raw' (RawFrameWriter; convert with RawFrameReader::convertToTif)
+	unsigned int loggingRawFramesPerChunk; //raw logs: frames between index checkpoints
+	bool loggingWaitForTrigger;            //logging starts at a trigger (triggerLogging, or the event below), not at startAcq
+	char loggingTriggerEventName[MAXFILENAMESIZE]; //named Win32 event that triggers logging; empty = none
+	unsigned long loggingPreTriggerFrames; //frames before the trigger to log, from frameHistory
+	double loggingPreTriggerMB;            //or, if loggingPreTriggerFrames is 0, as many frames as fit in this many MB
+
+	//display averaging (see DisplayAverager)
+	char displayAveragingMode[16];         //'none', 'boxcar' or 'exponential'
+	unsigned int displayAveragingFrames;   //boxcar window, in frames
+	double displayAveragingWeight;         //exponential: weight of each new frame, in (0,1]
+	unsigned int displayAveragingInterval; //frames per averaged frame for display; 0 = automatic
+
+	//native display prep (see DisplayPrep, DisplayPreparer)
+	static const int MAX_DISPLAY_CHANNELS = 4;
+	bool displayPrepEnabled;               //MATLAB gets binned, contrasted uint8 display frames
+	unsigned int displayPrepBinFactor;     //pixels binned along each axis
+	unsigned int displayPrepNumChannels;   //frame planes shown; 0 = all
+	int displayPrepChannels[MAX_DISPLAY_CHANNELS];       //0-based frame planes shown, in output order
+	double displayPrepLevels[MAX_DISPLAY_CHANNELS][2];   //[black white] of each frame plane, in pixel values
+	bool displayPrepMerge;                 //merge the planes shown into one RGB image
+	double displayPrepColors[MAX_DISPLAY_CHANNELS][3];   //RGB, in [0,1], of each frame plane in the merge
+
+	//per-frame statistics (see FrameStatsRing)
+	bool frameStatsEnabled;                //copier computes each frame's per-channel statistics
+	unsigned int adcBitDepth;              //ADC resolution: sets the saturation level and histogram range
+
+	//instrumentation
+	bool statsEnabled;                     //time pipeline stages (see PipelineStats)
+	int traceLevel;                        //PipelineTrace level: 0 off, 1 events, 2 every frame
+	char traceFile[MAXFILENAMESIZE];       //binary trace file; empty = no trace
+
+	//fpga parameters
+	int32_t fpgaStatus;                    //FrameSource::Status of the last FIFO call
+	uint32_t fpgaSession;                  //NiFpga_Session, for the MEX's NiFpgaFifoSource
+	uint32_t fpgaFifoNumberSingleChan;
+	uint32_t fpgaFifoNumberMultiChan;
+	bool fifoBatchedReads;                 //acquire all waiting frames in place instead of one copying read per frame
+	unsigned int fifoMaxFramesPerBatch;
+	size_t* fpgaElementsRemaining;
+
+	//C++ objects, owned by whoever owns the params
+	// The copier writes each frame once into frameQueue; display and
+	// logging each read it through their own reader.
+	MulticastFrameQueue* frameQueue;
+	FrameQueueReader* matlabQueue;  // DROP_OLDEST
+	FrameQueueReader* loggingQueue; // NEVER_DROP
+	// With display averaging on, the copier writes averaged frames to
+	// averagedFrameQueue instead, and matlabQueue is disabled.
+	MulticastFrameQueue* averagedFrameQueue;
+	FrameQueueReader* averagedQueue; // DROP_OLDEST
+	// The one the display reads: matlabQueue or averagedQueue. Set by the
+	// copier at start.
+	FrameQueueReader* displayQueue;
+	// With display prep on, DisplayPreparer writes the prepared frames
+	// here, and MATLAB reads them instead of displayQueue.
+	MulticastFrameQueue* preparedFrameQueue;
+	FrameQueueReader* preparedQueue; // DROP_OLDEST
+	// Frames held while logging waits for its trigger; logged first once
+	// it comes.
+	FrameHistory* frameHistory;
+	// Per-stage latency histograms.
+	PipelineStats* stats;
+	// Per-channel statistics of the most recent frames, with
+	// frameStatsEnabled.
+	FrameStatsRing* frameStats;
+	// Told of each frame for display; NULL = nobody.
+	FrameEventSink* frameEvents;
+
+	//Instrumentation data
+	long numDroppedFramesCopier;   //frames missing by frame tag count
+	unsigned long numResyncsCopier; //times the copier lost and regained frame alignment
+	unsigned long lastCopierTag;
+};
@@ -0,0 +1,243 @@
+#include "PipelineStats.h"
+#include <sstream>
+#include <string.h>
+#include "Atomics.h"
+
+namespace {
+  // 64-bit loads are not atomic on Win32.
+  int64_t load64(volatile int64_t &x)
+  {
+    return atomicCompareExchange64(x,0,0);
+  }
+
+  // Index of the highest set bit of v, v>0.
+  unsigned int highestBit(uint64_t v)
+  {
+    unsigned int n = 0;
+    if (v>=((uint64_t) 1 << 32)) { v >>= 32; n += 32; }
+    if (v>=((uint64_t) 1 << 16)) { v >>= 16; n += 16; }
+    if (v>=((uint64_t) 1 << 8)) { v >>= 8; n += 8; }
+    if (v>=((uint64_t) 1 << 4)) { v >>= 4; n += 4; }
+    if (v>=((uint64_t) 1 << 2)) { v >>= 2; n += 2; }
+    if (v>=((uint64_t) 1 << 1)) { n += 1; }
+    return n;
+  }
+
+  const char *STAGE_NAMES[PipelineStats::NUM_STAGES] = {
+    "fifoRead",
+    "deinterleave",
+    "transpose",
+    "loggingQueueDwell",
+    "displayQueueDwell",
+    "loggerWrite",
+    "callbackLatency",
+    "callbackDuration",
+    "displayPrep",
+    "frameStats"
+  };
+}
+
+LatencyHistogram::LatencyHistogram(void)
+{
+  reset();
+}
+
+void
+LatencyHistogram::reset(void)
+{
+  fCount = 0;
+  fSum = 0;
+  fMax = 0;
+  memset((void*) fBuckets,0,sizeof(fBuckets));
+  fullBarrier();
+}
+
+unsigned int
+LatencyHistogram::bucketOf(uint64_t ns)
+{
+  if (ns<SUB_BUCKETS) {
+    return (unsigned int) ns;
+  }
+  unsigned int msb = highestBit(ns);
+  if (msb>=MAX_VALUE_BITS) {
+    return NUM_BUCKETS-1;
+  }
+  unsigned int octave = msb-SUB_BUCKET_BITS+1;
+  return octave*SUB_BUCKETS + (unsigned int) ((ns >> (msb-SUB_BUCKET_BITS)) & (SUB_BUCKETS-1));
+}
+
+uint64_t
+LatencyHistogram::bucketLowerBound(unsigned int bucket)
+{
+  if (bucket<SUB_BUCKETS) {
+    return bucket;
+  }
+  unsigned int octave = bucket/SUB_BUCKETS;
+  unsigned int sub = bucket%SUB_BUCKETS;
+  return (uint64_t) (SUB_BUCKETS+sub) << (octave-1);
+}
+
+uint64_t
+LatencyHistogram::bucketUpperBound(unsigned int bucket)
+{
+  if (bucket<SUB_BUCKETS) {
+    return bucket;
+  }
+  unsigned int octave = bucket/SUB_BUCKETS;
+  return bucketLowerBound(bucket) + ((uint64_t) 1 << (octave-1)) - 1;
+}
+
+void
+LatencyHistogram::record(uint64_t ns)
+{
+  atomicIncrement(fBuckets[bucketOf(ns)]);
+  atomicAdd64(fSum,(int64_t) ns);
+  atomicIncrement64(fCount);
+  int64_t m = fMax;
+  while ((int64_t) ns>m) {
+    int64_t prev = atomicCompareExchange64(fMax,(int64_t) ns,m);
+    if (prev==m) {
+      break;
+    }
+    m = prev;
+  }
+}
+
+uint64_t
+LatencyHistogram::count(void) const
+{
+  return (uint64_t) load64(const_cast<volatile int64_t&>(fCount));
+}
+
+double
+LatencyHistogram::mean(void) const
+{
+  uint64_t n = count();
+  return n>0 ? (double) load64(const_cast<volatile int64_t&>(fSum))/n : 0.0;
+}
+
+uint64_t
+LatencyHistogram::percentile(double fraction) const
+{
+  // Counted from the buckets, which may be a record ahead of fCount.
+  uint64_t total = 0;
+  for (unsigned int b=0;b<NUM_BUCKETS;b++) {
+    total += (unsigned long) fBuckets[b];
+  }
+  if (total==0) {
+    return 0;
+  }
+  double target = fraction*total;
+  uint64_t seen = 0;
+  for (unsigned int b=0;b<NUM_BUCKETS;b++) {
+    seen += (unsigned long) fBuckets[b];
+    if (seen>0 && seen>=target) {
+      return bucketUpperBound(b);
+    }
+  }
+  return bucketUpperBound(NUM_BUCKETS-1);
+}
+
+PipelineStats::PipelineStats(void) :
+  fEnabled(false),
+  fNsPerTick(1.0),
+  fTicksPerSecond(1),
+  fResetTicks(0),
+  fPostedTicks(0)
+{
+  int64_t freq = Platform::perfFrequency();
+  if (freq>0) {
+    fTicksPerSecond = freq;
+    fNsPerTick = 1e9/freq;
+  }
+  reset();
+}
+
+const char*
+PipelineStats::stageName(Stage stage)
+{
+  return STAGE_NAMES[stage];
+}
+
+void
+PipelineStats::setEnabled(bool enable)
+{
+  fEnabled = enable;
+  fullBarrier();
+}
+
+void
+PipelineStats::reset(void)
+{
+  for (int s=0;s<NUM_STAGES;s++) {
+    fStages[s].histogram.reset();
+  }
+  fPostedTicks = 0;
+  fResetTicks = Platform::perfCounter();
+  fullBarrier();
+}
+
+int64_t
+PipelineStats::start(void) const
+{
+  if (!fEnabled) {
+    return 0;
+  }
+  return Platform::perfCounter();
+}
+
+int64_t
+PipelineStats::record(Stage stage, int64_t startTicks)
+{
+  if (startTicks==0) {
+    return 0;
+  }
+  int64_t now = Platform::perfCounter();
+  int64_t elapsed = now-startTicks;
+  fStages[stage].histogram.record(elapsed>0 ? (uint64_t) (elapsed*fNsPerTick) : 0);
+  return now;
+}
+
+void
+PipelineStats::notePosted(void)
+{
+  int64_t now = start();
+  if (now!=0) {
+    atomicExchange64(fPostedTicks,now);
+  }
+}
+
+int64_t
+PipelineStats::takePosted(void)
+{
+  return atomicExchange64(fPostedTicks,0);
+}
+
+double
+PipelineStats::elapsedSeconds(void) const
+{
+  return (double) (Platform::perfCounter()-fResetTicks)/fTicksPerSecond;
+}
+
+double
+PipelineStats::rate(Stage stage) const
+{
+  double elapsed = elapsedSeconds();
+  return elapsed>0 ? histogram(stage).count()/elapsed : 0.0;
+}
+
+void
+PipelineStats::debugString(std::string &s) const
+{
+  std::ostringstream oss;
+  oss << "--PipelineStats--" << std::endl;
+  oss << "Enabled ElapsedSeconds: " << fEnabled << " " << elapsedSeconds() << std::endl;
+  for (int i=0;i<NUM_STAGES;i++) {
+    const LatencyHistogram &h = fStages[i].histogram;
+    oss << STAGE_NAMES[i] << " count meanUs p50Us p99Us maxUs: "
+        << (unsigned long) h.count() << " " << h.mean()/1000 << " "
+        << h.percentile(0.5)/1000.0 << " " << h.percentile(0.99)/1000.0 << " "
+        << h.maxValue()/1000.0 << std::endl;
+  }
+  s.append(oss.str());
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <string>
+#include "Platform.h"
+
+// Latency histogram with log-linear buckets, in the manner of
+// HdrHistogram: values below 2^SUB_BUCKET_BITS have a bucket each, and
+// each octave above that is split into 2^SUB_BUCKET_BITS buckets, so
+// every bucket is within 1/16 (6%) of the values in it. Values are
+// nanoseconds, up to 2^MAX_VALUE_BITS (about 18 minutes); larger ones
+// go in the last bucket.
+//
+// record() is lock-free and may be called from any thread; readers see
+// counts that may be a record or two apart from each other while
+// records are going on.
+class LatencyHistogram {
+
+ public:
+
+  static const unsigned int SUB_BUCKET_BITS = 4;
+  static const unsigned int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+  static const unsigned int MAX_VALUE_BITS = 40;
+  static const unsigned int NUM_BUCKETS = (MAX_VALUE_BITS-SUB_BUCKET_BITS+1)*SUB_BUCKETS;
+
+  LatencyHistogram(void);
+
+  void reset(void);
+
+  void record(uint64_t ns);
+
+  uint64_t count(void) const;
+  uint64_t maxValue(void) const { return (uint64_t) fMax; }
+  double mean(void) const;
+
+  // Upper bound of the bucket holding the value below which fraction
+  // (0 to 1) of the values lie; 0 if there are none.
+  uint64_t percentile(double fraction) const;
+
+  // Buckets, and the range of values in each.
+  unsigned long bucketCount(unsigned int bucket) const { return (unsigned long) fBuckets[bucket]; }
+  static unsigned int bucketOf(uint64_t ns);
+  static uint64_t bucketLowerBound(unsigned int bucket);
+  static uint64_t bucketUpperBound(unsigned int bucket);
+
+ private:
+  volatile int64_t fCount;
+  volatile int64_t fSum;
+  volatile int64_t fMax;
+  volatile long fBuckets[NUM_BUCKETS];
+};
+
+// Per-stage timing of the acquisition pipeline, for getStats: a
+// LatencyHistogram per stage, timed with Platform::perfCounter.
+//
+// A stage is timed with
+//
+//   int64_t t0 = stats->start();
+//   ... stage ...
+//   stats->record(PipelineStats::STAGE,t0);
+//
+// or, for a span that started elsewhere (eg when a record entered a
+// queue), with record() on the start ticks saved then. start() returns 0
+// while stats are disabled, and record() ignores a start of 0, so a
+// disabled stage costs a branch.
+//
+// The controller calls setEnabled/reset while the pipeline threads are
+// idle; the rest may be called from any thread.
+class PipelineStats {
+
+ public:
+
+  enum Stage {
+    FIFO_READ = 0,       // FrameSource read of a frame or batch, including any wait for it
+    DEINTERLEAVE,        // copier: deinterleave or copy of a frame into the frame queue
+    TRANSPOSE,           // GET_FRAME: transpose of a frame into MATLAB arrays
+    LOGGING_QUEUE_DWELL, // frame queue push to logger acquire
+    DISPLAY_QUEUE_DWELL, // display queue push to GET_FRAME (or display prep) acquire
+    LOGGER_WRITE,        // logger: frame tag update, averaging and write of a frame
+    CALLBACK_LATENCY,    // copier posting the frame event to the MATLAB callback starting
+    CALLBACK_DURATION,   // MATLAB callback (frameAcquiredFcn) run time
+    DISPLAY_PREP,        // DisplayPreparer: bin, contrast and merge of a display frame
+    FRAME_STATS,         // copier: per-channel statistics of a frame, into the frame stats ring
+    NUM_STAGES
+  };
+
+  PipelineStats(void);
+
+  // Field name for a stage in the getStats struct, eg "fifoRead".
+  static const char* stageName(Stage stage);
+
+  void setEnabled(bool enable);
+  bool isEnabled(void) const { return fEnabled; }
+
+  // Clear every stage and restart the elapsed time.
+  void reset(void);
+
+  // Current Platform::perfCounter ticks, or 0 while disabled.
+  int64_t start(void) const;
+
+  // Record the time from startTicks to now for stage, and return now.
+  // Does nothing, and returns 0, if startTicks is 0.
+  int64_t record(Stage stage, int64_t startTicks);
+
+  // Note a frame event posted to MATLAB; the callback that follows takes
+  // it with takePosted() for CALLBACK_LATENCY. If several posts are
+  // coalesced into one callback, the latest counts.
+  void notePosted(void);
+  int64_t takePosted(void);
+
+  const LatencyHistogram& histogram(Stage stage) const { return fStages[stage].histogram; }
+
+  // Seconds since the last reset.
+  double elapsedSeconds(void) const;
+
+  // Records per second for a stage since the last reset.
+  double rate(Stage stage) const;
+
+  // Append debug info to s.
+  void debugString(std::string &s) const;
+
+ private:
+  PipelineStats(const PipelineStats&);
+  PipelineStats& operator=(const PipelineStats&);
+
+  static const unsigned int CACHE_LINE_SIZE = 64;
+
+  // Each stage is mostly written by one thread; keep them apart.
+  struct StageStats {
+    LatencyHistogram histogram;
+    char pad[CACHE_LINE_SIZE];
+  };
+
+ private:
+  bool fEnabled;
+  double fNsPerTick;
+  int64_t fTicksPerSecond;
+  int64_t fResetTicks;
+  volatile int64_t fPostedTicks;
+  StageStats fStages[NUM_STAGES];
+};
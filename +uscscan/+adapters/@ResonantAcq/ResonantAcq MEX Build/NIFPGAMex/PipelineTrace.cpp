@@ -0,0 +1,286 @@
+#include "PipelineTrace.h"
+#include <sstream>
+#include <string.h>
+#include "Misc.h"
+#include "Atomics.h"
+
+namespace {
+  const char *EVENT_NAMES[NUM_TRACE_EVENTS] = {
+    "",
+    "acqStart",
+    "acqStop",
+    "fifoRead",
+    "fifoTimeout",
+    "fifoError",
+    "fifoResync",
+    "frameStored",
+    "queueFull",
+    "averagedQueueFull",
+    "loggingTriggered",
+    "frameLogged",
+    "logRollover",
+    "getFrame",
+    "callback",
+    "preparedQueueFull"
+  };
+}
+
+// One thread's records: a single-producer (the owning thread),
+// single-consumer (the drain, under fBuffersMutex) ring.
+class TraceBuffer {
+
+ public:
+
+  TraceBuffer(void) :
+    fHead(0),
+    fTail(0),
+    fSequence(0),
+    fThreadId(0),
+    fThreadWatch(NULL),
+    fNumDropped(0)
+  {
+    fRecords = new TraceRecord[PipelineTrace::RECORDS_PER_THREAD];
+  }
+
+  ~TraceBuffer(void)
+  {
+    delete[] fRecords;
+    delete fThreadWatch;
+  }
+
+  // Called with fBuffersMutex held, by the thread that will own the buffer.
+  void claim(void)
+  {
+    delete fThreadWatch;
+    fThreadId = Platform::currentThreadId();
+    fThreadWatch = new Platform::ThreadExitWatch();
+    fSequence = 0;
+  }
+
+  // Called with fBuffersMutex held. Free to claim: its thread has exited
+  // and everything it recorded has been drained.
+  bool isReusable(void) const
+  {
+    return fThreadWatch!=NULL && fThreadWatch->hasExited() &&
+      loadAcquire(fHead)==loadAcquire(fTail);
+  }
+
+  // Called by the owning thread.
+  void push(int level, TraceEvent event, long a0, long a1, long a2)
+  {
+    unsigned long seq = fSequence++;
+    unsigned long tail = fTail;
+    if (tail-loadAcquire(fHead)>=PipelineTrace::RECORDS_PER_THREAD) {
+      fNumDropped++;
+      return;
+    }
+    TraceRecord &r = fRecords[tail & (PipelineTrace::RECORDS_PER_THREAD-1)];
+    r.ticks = Platform::perfCounter();
+    r.threadId = (uint32_t) fThreadId;
+    r.sequence = (uint32_t) seq;
+    r.event = (unsigned short) event;
+    r.level = (unsigned short) level;
+    r.args[0] = (int32_t) a0;
+    r.args[1] = (int32_t) a1;
+    r.args[2] = (int32_t) a2;
+    storeRelease(fTail,tail+1);
+  }
+
+  // Called by the drain. Write out the records waiting, in at most two
+  // runs (the ring may wrap). Returns the number written; records that
+  // cannot be written are discarded.
+  unsigned long drainTo(FILE *file)
+  {
+    unsigned long head = fHead;
+    unsigned long tail = loadAcquire(fTail);
+    unsigned long written = 0;
+    while (head!=tail) {
+      unsigned long idx = head & (PipelineTrace::RECORDS_PER_THREAD-1);
+      unsigned long run = PipelineTrace::RECORDS_PER_THREAD-idx;
+      if (run>tail-head) {
+        run = tail-head;
+      }
+      if (file!=NULL) {
+        written += (unsigned long) fwrite(&fRecords[idx],sizeof(TraceRecord),run,file);
+      }
+      head += run;
+    }
+    storeRelease(fHead,head);
+    return written;
+  }
+
+  unsigned long threadId(void) const { return fThreadId; }
+  unsigned long numDropped(void) const { return fNumDropped; }
+
+ private:
+  TraceBuffer(const TraceBuffer&);
+  TraceBuffer& operator=(const TraceBuffer&);
+
+ private:
+  TraceRecord *fRecords;
+  volatile unsigned long fHead; // consumer-owned
+  volatile unsigned long fTail; // producer-owned
+  unsigned long fSequence;      // producer-owned
+  unsigned long fThreadId;
+  Platform::ThreadExitWatch *fThreadWatch; // of the owning thread
+  unsigned long fNumDropped;
+};
+
+volatile long PipelineTrace::fLevel = TRACE_OFF;
+
+PipelineTrace*
+PipelineTrace::getInstance(void)
+{
+  static PipelineTrace *trace = NULL;
+  if (trace==NULL) {
+    trace = new PipelineTrace();
+    assert(trace!=NULL);
+  }
+  return trace;
+}
+
+PipelineTrace::PipelineTrace(void) :
+  fFile(NULL),
+  fRecordsWritten(0)
+{
+}
+
+PipelineTrace::~PipelineTrace(void)
+{
+  close();
+  for (size_t i=0;i<fBuffers.size();i++) {
+    delete fBuffers[i];
+  }
+}
+
+bool
+PipelineTrace::configure(int level, const char *filename)
+{
+  if (level<=TRACE_OFF || filename==NULL || filename[0]=='\0') {
+    close();
+    return true;
+  }
+  if (fFile!=NULL && fFilename==filename) {
+    atomicExchange(fLevel,level);
+    return true;
+  }
+  close();
+
+  int err = fopen_s(&fFile,filename,"wb");
+  if (err!=0) {
+    fFile = NULL;
+    CONSOLEPRINT("PipelineTrace: could not open trace file %s (error %d).\n",filename,err);
+    return false;
+  }
+  TraceFileHeader header;
+  memset(&header,0,sizeof(header));
+  memcpy(header.magic,"NIFTRACE",8);
+  header.version = FILE_VERSION;
+  header.recordSize = sizeof(TraceRecord);
+  header.ticksPerSecond = Platform::perfFrequency();
+  fwrite(&header,sizeof(header),1,fFile);
+
+  fFilename = filename;
+  fRecordsWritten = 0;
+  fStopDrainEvent.reset();
+  fDrainThread.start(PipelineTrace::drainThreadFcn,this);
+  atomicExchange(fLevel,level);
+  CONSOLEPRINT("PipelineTrace: tracing at level %d to %s\n",level,filename);
+  return true;
+}
+
+void
+PipelineTrace::record(int level, TraceEvent event, long a0, long a1, long a2)
+{
+  TraceBuffer *buf = static_cast<TraceBuffer*>(fThreadBuffer.get());
+  if (buf==NULL) {
+    buf = bufferForThisThread();
+  }
+  buf->push(level,event,a0,a1,a2);
+}
+
+// First record on this thread: claim the ring of a thread that has
+// exited, or make a new one.
+TraceBuffer*
+PipelineTrace::bufferForThisThread(void)
+{
+  TraceBuffer *buf = NULL;
+  {
+    Platform::Mutex::Lock lock(fBuffersMutex);
+    for (size_t i=0;i<fBuffers.size() && buf==NULL;i++) {
+      if (fBuffers[i]->isReusable()) {
+	buf = fBuffers[i];
+      }
+    }
+    if (buf==NULL) {
+      buf = new TraceBuffer();
+      fBuffers.push_back(buf);
+    }
+    buf->claim();
+  }
+  fThreadBuffer.set(buf);
+  return buf;
+}
+
+void
+PipelineTrace::drain(void)
+{
+  Platform::Mutex::Lock lock(fBuffersMutex);
+  for (size_t i=0;i<fBuffers.size();i++) {
+    fRecordsWritten += fBuffers[i]->drainTo(fFile);
+  }
+}
+
+void
+PipelineTrace::flush(void)
+{
+  if (fFile!=NULL) {
+    drain();
+    fflush(fFile);
+  }
+}
+
+void
+PipelineTrace::close(void)
+{
+  atomicExchange(fLevel,TRACE_OFF);
+  if (fDrainThread.isStarted()) {
+    fStopDrainEvent.set();
+    fDrainThread.join(Platform::Event::WAIT_FOREVER);
+  }
+  if (fFile!=NULL) {
+    drain();
+    fclose(fFile);
+    fFile = NULL;
+    CONSOLEPRINT("PipelineTrace: wrote %lu records to %s\n",(unsigned long) fRecordsWritten,fFilename.c_str());
+  }
+  fFilename.clear();
+}
+
+void
+PipelineTrace::drainThreadFcn(void *userData)
+{
+  PipelineTrace *obj = static_cast<PipelineTrace*>(userData);
+  while (!obj->fStopDrainEvent.wait(DRAIN_INTERVAL_MS)) {
+    obj->drain();
+  }
+}
+
+const char*
+PipelineTrace::eventName(int event)
+{
+  return (event>0 && event<NUM_TRACE_EVENTS) ? EVENT_NAMES[event] : "unknown";
+}
+
+void
+PipelineTrace::debugString(std::string &s) const
+{
+  std::ostringstream oss;
+  oss << "--PipelineTrace--" << std::endl;
+  oss << "Level File RecordsWritten: " << fLevel << " " << fFilename << " "
+      << (unsigned long) fRecordsWritten << std::endl;
+  for (size_t i=0;i<fBuffers.size();i++) {
+    oss << "Thread " << fBuffers[i]->threadId() << " dropped: " << fBuffers[i]->numDropped() << std::endl;
+  }
+  s.append(oss.str());
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include "Platform.h"
+
+// Define NO_PIPELINE_TRACE for the build to compile every TRACE_EVENT
+// to nothing.
+#ifndef NO_PIPELINE_TRACE
+#define PIPELINE_TRACE
+#endif
+
+#ifdef PIPELINE_TRACE
+// Record event with three integer args if the trace level is at least
+// level. Costs a load and a branch when it is not.
+#define TRACE_EVENT(level,event,a0,a1,a2)				\
+  do {									\
+    if (PipelineTrace::isTracing(level))				\
+      PipelineTrace::getInstance()->record(level,event,(long) (a0),(long) (a1),(long) (a2)); \
+  } while (0)
+#else
+#define TRACE_EVENT(level,event,a0,a1,a2) do {} while (0)
+#endif
+
+// Trace levels. A level includes those below it.
+enum TraceLevel {
+  TRACE_OFF = 0,
+  TRACE_EVENTS,   // acquisition start/stop, triggers, drops, errors
+  TRACE_FRAMES    // every frame, at each stage
+};
+
+// Trace events. Append only: the ids are in trace files.
+enum TraceEvent {
+  TRACE_ACQ_START = 1,     // args: frame size (bytes), multichannel, logging
+  TRACE_ACQ_STOP,          // args: frames pushed, dropped pushes
+  TRACE_FIFO_READ,         // args: frames read, elements remaining
+  TRACE_FIFO_TIMEOUT,      // args: elements remaining
+  TRACE_FIFO_ERROR,        // args: status
+  TRACE_FIFO_RESYNC,       // args: elements to discard, frames lost so far
+  TRACE_FRAME_STORED,      // args: frames pushed so far, pushed, logging queue size
+  TRACE_QUEUE_FULL,        // args: dropped pushes so far
+  TRACE_AVERAGED_QUEUE_FULL,
+  TRACE_LOGGING_TRIGGERED, // args: frames from before the trigger
+  TRACE_FRAME_LOGGED,      // args: frame tag, frames logged, logging queue size
+  TRACE_LOG_ROLLOVER,      // args: frame index
+  TRACE_GET_FRAME,         // args: frame tag, display queue size
+  TRACE_CALLBACK,          // args: coalesced frame events (0 if not coalescing)
+  TRACE_PREPARED_QUEUE_FULL, // args: prepared display frames dropped so far
+  NUM_TRACE_EVENTS
+};
+
+// One trace record, as written to the trace file. Fixed-width fields,
+// so that the layout is the same on every platform.
+struct TraceRecord {
+  int64_t ticks;           // Platform::perfCounter
+  uint32_t threadId;
+  uint32_t sequence;       // per thread; a gap means records were dropped
+  unsigned short event;    // TraceEvent
+  unsigned short level;    // TraceLevel
+  int32_t args[3];
+};
+
+// Trace file: this header, then TraceRecords. Each thread's records are
+// in order, but threads' records are interleaved in blocks; sort on
+// ticks for a timeline.
+struct TraceFileHeader {
+  char magic[8];           // "NIFTRACE"
+  uint32_t version;
+  uint32_t recordSize;
+  int64_t ticksPerSecond;
+};
+
+class TraceBuffer;
+
+/*
+  PipelineTrace
+
+  Singleton binary trace, for the pipeline threads, where CONSOLEPRINT
+  would serialize them on the console lock.
+
+  Each thread that records gets its own ring of TraceRecords, which it
+  alone writes, lock-free. A background thread drains the rings to the
+  trace file every DRAIN_INTERVAL_MS. A ring that is full drops the
+  record; the sequence numbers show it. Rings of threads that have
+  exited are reused by new threads once drained.
+
+  The controller calls configure/flush/close; record may be called from
+  any thread.
+ */
+class PipelineTrace {
+
+ public:
+
+  static const unsigned long RECORDS_PER_THREAD = 16384; // power of 2
+  static const unsigned long DRAIN_INTERVAL_MS = 50;
+  static const unsigned long FILE_VERSION = 1;
+
+  static PipelineTrace* getInstance(void);
+
+  static bool isTracing(int level) { return level<=fLevel; }
+
+  // Trace at level to filename, opening it (and truncating it) if it is
+  // not the file open now. Level TRACE_OFF, or an empty filename, stops
+  // tracing and closes the file. Returns false if the file cannot be
+  // opened.
+  bool configure(int level, const char *filename);
+
+  void record(int level, TraceEvent event, long a0, long a1, long a2);
+
+  // Write out everything recorded so far.
+  void flush(void);
+
+  // Stop tracing, drain and close the file.
+  void close(void);
+
+  static const char* eventName(int event);
+
+  // Append debug info to s.
+  void debugString(std::string &s) const;
+
+ private:
+  PipelineTrace(void);
+  ~PipelineTrace(void);
+  PipelineTrace(const PipelineTrace&);
+  PipelineTrace& operator=(const PipelineTrace&);
+
+  TraceBuffer* bufferForThisThread(void);
+  void drain(void);
+
+  static void drainThreadFcn(void *userData);
+
+ private:
+  static volatile long fLevel;
+
+  Platform::ThreadLocal fThreadBuffer; // TraceBuffer*
+  Platform::Mutex fBuffersMutex; // fBuffers, and draining
+  std::vector<TraceBuffer*> fBuffers;
+
+  std::string fFilename;
+  FILE *fFile;
+  Platform::Thread fDrainThread;
+  Platform::Event fStopDrainEvent;
+  uint64_t fRecordsWritten;
+};
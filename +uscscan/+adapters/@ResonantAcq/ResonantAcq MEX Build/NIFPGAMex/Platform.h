@@ -0,0 +1,354 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdio>
+
+// The operating-system services the pipeline core uses: threads, locks,
+// events, sleeping, timing and a few file operations. The core (frame
+// sources, queues, copier, logger, writers and the display stages)
+// includes this header and never windows.h, mex.h or NiFpga.h, so it
+// builds as a plain library. PlatformWin32.cpp implements it for the
+// MEX; PlatformPosix.cpp implements it with pthreads for the standalone
+// (CMake) build. None of the classes here can be copied.
+
+// Fixed-width integer types. VS2008 has no stdint.h; these are the
+// typedefs NiFpga.h makes there (C++ allows the repeat).
+#if defined(_MSC_VER) && _MSC_VER < 1600
+typedef signed char int8_t;
+typedef unsigned char uint8_t;
+typedef short int16_t;
+typedef unsigned short uint16_t;
+typedef int int32_t;
+typedef unsigned int uint32_t;
+typedef __int64 int64_t;
+typedef unsigned __int64 uint64_t;
+#else
+#include <stdint.h>
+#endif
+
+namespace Platform
+{
+  // High-resolution tick counter and its ticks per second
+  // (QueryPerformanceCounter on Windows, CLOCK_MONOTONIC elsewhere).
+  int64_t perfCounter(void);
+  int64_t perfFrequency(void);
+
+  // Sleep for ms milliseconds; 0 gives up the rest of the time slice.
+  void sleepMs(unsigned long ms);
+
+  unsigned long currentThreadId(void);
+
+  // CPU time (user plus kernel) used by the whole process, in seconds.
+  double processCpuSeconds(void);
+
+  // Have the filesystem allocate numBytes for the open file f (like
+  // fallocate with FALLOC_FL_KEEP_SIZE); its size is unchanged. Returns
+  // false on failure, or where it is not supported.
+  bool reserveFileSpace(FILE *f, uint64_t numBytes);
+
+  // Set the size of the open file f, which is flushed first.
+  bool truncateFile(FILE *f, uint64_t numBytes);
+
+  // Page-aligned memory straight from the OS (VirtualAlloc, mmap), eg
+  // for unbuffered I/O. NULL on failure.
+  void* allocPages(std::size_t numBytes);
+  void freePages(void *p, std::size_t numBytes);
+
+  // Lock numBytes at p (from allocPages) in physical memory, so that
+  // touching it never page faults; on Windows the process's working set
+  // is grown to allow it. Returns false if the OS will not.
+  bool lockPages(void *p, std::size_t numBytes);
+  void unlockPages(void *p, std::size_t numBytes);
+
+  // Error code of the last failed OS call on this thread (GetLastError,
+  // errno), for messages.
+  unsigned long lastError(void);
+
+  // Console output for CONSOLEPRINT (see Misc.h). openConsole gives the
+  // process a console window where it has none (the MEX); writeConsole
+  // writes text in one of a few colors, which only Windows shows.
+  enum ConsoleColor { CONSOLE_RED = 0, CONSOLE_GREEN, CONSOLE_CYAN };
+  void openConsole(void);
+  void writeConsole(const char *text, ConsoleColor color);
+
+  // Mutual exclusion within the process. Recursive, like the
+  // CRITICAL_SECTION it is on Windows.
+  class Mutex {
+  public:
+    Mutex(void);
+    ~Mutex(void);
+
+    void lock(void);
+    void unlock(void);
+
+    // Holds the mutex for its lifetime.
+    class Lock {
+    public:
+      explicit Lock(Mutex &m) : fMutex(m) { fMutex.lock(); }
+      ~Lock(void) { fMutex.unlock(); }
+    private:
+      Lock(const Lock&);
+      Lock& operator=(const Lock&);
+      Mutex &fMutex;
+    };
+
+  private:
+    Mutex(const Mutex&);
+    Mutex& operator=(const Mutex&);
+    void *fImpl;
+  };
+
+  // A Win32-style event: auto-reset (a wait consumes the signal and
+  // wakes one waiter) or manual-reset (stays set until reset).
+  class Event {
+  public:
+    static const unsigned long WAIT_FOREVER = 0xFFFFFFFFUL;
+
+    explicit Event(bool manualReset = false);
+    ~Event(void);
+
+    void set(void);
+    void reset(void);
+
+    // Returns true if the event was signalled within timeoutMs (0 polls).
+    bool wait(unsigned long timeoutMs);
+
+    // Opens (creating if need be) the system-wide auto-reset event
+    // called name, through which another process can signal this one.
+    // Returns NULL where there are no named events (anything but
+    // Windows), or on failure. The caller deletes it.
+    static Event* openNamed(const char *name);
+
+  private:
+    Event(void *impl) : fImpl(impl) { }
+    Event(const Event&);
+    Event& operator=(const Event&);
+    void *fImpl;
+  };
+
+  // A thread running fcn(arg). A started thread must be joined or
+  // detached before the Thread is destroyed.
+  class Thread {
+  public:
+    typedef void (*Fcn)(void *arg);
+
+    Thread(void);
+    ~Thread(void);
+
+    // Returns false if the thread could not be created.
+    bool start(Fcn fcn, void *arg);
+
+    bool isStarted(void) const { return fImpl!=NULL; }
+
+    // Wait up to timeoutMs for the thread to exit (Event::WAIT_FOREVER
+    // waits for good). Returns true, and releases the thread, if it did;
+    // otherwise the thread is still this Thread's to join or detach.
+    bool join(unsigned long timeoutMs);
+
+    // Let the thread run on, and finish, by itself.
+    void detach(void);
+
+    // CPU time (user plus kernel) the thread has used, in seconds. Once
+    // joined, the total of the joined thread; 0 if none was started.
+    double cpuSeconds(void) const;
+
+  private:
+    Thread(const Thread&);
+    Thread& operator=(const Thread&);
+    void *fImpl;
+    double fJoinedCpuSeconds;
+  };
+
+  // A file for asynchronous sequential writes that bypass the system
+  // file cache: FILE_FLAG_OVERLAPPED|FILE_FLAG_NO_BUFFERING on Windows,
+  // O_DIRECT (where the filesystem has it) and POSIX aio elsewhere.
+  // Buffers, sizes and offsets must be multiples of SECTOR_ALIGNMENT;
+  // buffers from allocPages are. Used by one thread.
+  class AsyncFile {
+  public:
+    static const unsigned int SECTOR_ALIGNMENT = 4096;
+
+    // One write in flight. A Request must not be reused, or destroyed,
+    // until wait() has collected its write.
+    class Request {
+    public:
+      Request(void);
+      ~Request(void);
+    private:
+      friend class AsyncFile;
+      Request(const Request&);
+      Request& operator=(const Request&);
+      void *fImpl;
+    };
+
+    AsyncFile(void);
+    ~AsyncFile(void); // closes
+
+    // Create (or truncate) name. Returns false on failure.
+    bool create(const char *name);
+    bool isOpen(void) const;
+
+    // Start writing numBytes of buf at offset. Returns false if the
+    // write could not be started.
+    bool write(Request &r, const void *buf, std::size_t numBytes, uint64_t offset);
+
+    // Wait for r's write to finish. Returns false if it failed.
+    bool wait(Request &r);
+
+    // As reserveFileSpace.
+    bool reserveSpace(uint64_t numBytes);
+
+    // Writes in flight must have been waited for.
+    void close(void);
+
+  private:
+    AsyncFile(const AsyncFile&);
+    AsyncFile& operator=(const AsyncFile&);
+    void *fImpl;
+  };
+
+  // Read-only memory mapping of a file (CreateFileMapping, mmap). The
+  // file stays writable by others, so that a file still being logged
+  // can be read.
+  class MappedFile {
+  public:
+    MappedFile(void);
+    ~MappedFile(void); // closes
+
+    // Open name. Returns false if it cannot be opened or mapped.
+    bool open(const char *name);
+    bool isOpen(void) const;
+    void close(void);
+
+    // Size of the file when opened, and its last write time then (in
+    // the OS's units: only for telling whether the file has changed).
+    uint64_t size(void) const;
+    uint64_t writeTime(void) const;
+
+    // Offsets passed to map must be multiples of this.
+    static uint64_t granularity(void);
+
+    // Map numBytes at offset; NULL on failure. Each view is unmapped,
+    // with its numBytes, before close.
+    const char* map(uint64_t offset, uint64_t numBytes);
+    void unmap(const char *view, uint64_t numBytes);
+
+  private:
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+    void *fImpl;
+  };
+
+  // One pointer per thread; each thread starts with NULL.
+  class ThreadLocal {
+  public:
+    ThreadLocal(void);
+    ~ThreadLocal(void);
+
+    void* get(void) const;
+    void set(void *value);
+
+  private:
+    ThreadLocal(const ThreadLocal&);
+    ThreadLocal& operator=(const ThreadLocal&);
+    void *fImpl;
+  };
+
+  // Tells whether the thread that constructed it has exited.
+  class ThreadExitWatch {
+  public:
+    ThreadExitWatch(void);
+    ~ThreadExitWatch(void);
+
+    bool hasExited(void) const;
+
+  private:
+    ThreadExitWatch(const ThreadExitWatch&);
+    ThreadExitWatch& operator=(const ThreadExitWatch&);
+    void *fImpl;
+  };
+}
+
+// The MSVC secure-CRT functions the core uses, for other compilers.
+#ifndef _MSC_VER
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+
+inline int
+sprintf_s(char *buf, std::size_t sz, const char *fmt, ...)
+{
+  va_list args;
+  va_start(args,fmt);
+  int n = vsnprintf(buf,sz,fmt,args);
+  va_end(args);
+  return n;
+}
+
+template <std::size_t N>
+inline int
+sprintf_s(char (&buf)[N], const char *fmt, ...)
+{
+  va_list args;
+  va_start(args,fmt);
+  int n = vsnprintf(buf,N,fmt,args);
+  va_end(args);
+  return n;
+}
+
+template <std::size_t N>
+inline int
+strcpy_s(char (&dst)[N], const char *src)
+{
+  if (strlen(src)>=N) {
+    dst[0] = '\0';
+    return ERANGE;
+  }
+  strcpy(dst,src);
+  return 0;
+}
+
+inline int
+strcpy_s(char *dst, std::size_t sz, const char *src)
+{
+  if (sz==0 || strlen(src)>=sz) {
+    if (sz>0) {
+      dst[0] = '\0';
+    }
+    return ERANGE;
+  }
+  strcpy(dst,src);
+  return 0;
+}
+
+inline int
+fopen_s(FILE **f, const char *name, const char *mode)
+{
+  *f = fopen(name,mode);
+  return *f==NULL ? errno : 0;
+}
+
+// Only for formats without %s, %c or %[, which sscanf_s gives sizes.
+inline int
+sscanf_s(const char *str, const char *fmt, ...)
+{
+  va_list args;
+  va_start(args,fmt);
+  int n = vsscanf(str,fmt,args);
+  va_end(args);
+  return n;
+}
+
+inline int
+_fseeki64(FILE *f, int64_t offset, int origin)
+{
+  return fseeko(f,static_cast<off_t>(offset),origin);
+}
+
+inline int64_t
+_ftelli64(FILE *f)
+{
+  return static_cast<int64_t>(ftello(f));
+}
+#endif
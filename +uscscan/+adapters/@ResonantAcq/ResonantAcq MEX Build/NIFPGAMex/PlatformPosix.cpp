@@ -0,0 +1,728 @@
+// POSIX (pthreads) implementation of Platform.h, for the standalone
+// build of the pipeline core.
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // fallocate
+#endif
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <aio.h>
+#include <string.h>
+#include <assert.h>
+#include <stdio.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <linux/falloc.h>
+#endif
+#include "Platform.h"
+
+namespace {
+
+  double
+  timespecSeconds(const struct timespec &ts)
+  {
+    return ts.tv_sec+ts.tv_nsec*1e-9;
+  }
+
+  double
+  clockSeconds(clockid_t clock)
+  {
+    struct timespec ts;
+    return clock_gettime(clock,&ts)==0 ? timespecSeconds(ts) : 0.0;
+  }
+
+  // Absolute CLOCK_MONOTONIC time timeoutMs from now, for condition
+  // variables set to that clock.
+  struct timespec
+  deadline(unsigned long timeoutMs)
+  {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    ts.tv_sec += timeoutMs/1000;
+    ts.tv_nsec += (long) (timeoutMs%1000)*1000000L;
+    if (ts.tv_nsec>=1000000000L) {
+      ts.tv_sec++;
+      ts.tv_nsec -= 1000000000L;
+    }
+    return ts;
+  }
+
+  void
+  initMonotonicCond(pthread_cond_t *cond)
+  {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr,CLOCK_MONOTONIC);
+    pthread_cond_init(cond,&attr);
+    pthread_condattr_destroy(&attr);
+  }
+
+  struct EventImpl {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    bool manualReset;
+    bool signalled;
+  };
+
+  // Shared by a Thread and its thread, so that either can let go first
+  // (see detach). done, exitCpuSeconds and detached are under mutex.
+  struct ThreadImpl {
+    pthread_t thread;
+    Platform::Thread::Fcn fcn;
+    void *arg;
+    pthread_mutex_t mutex;
+    pthread_cond_t doneCond;
+    bool done;
+    bool detached;
+    double exitCpuSeconds;
+  };
+
+  void
+  deleteThreadImpl(ThreadImpl *t)
+  {
+    pthread_cond_destroy(&t->doneCond);
+    pthread_mutex_destroy(&t->mutex);
+    delete t;
+  }
+
+  void*
+  threadTrampoline(void *userData)
+  {
+    ThreadImpl *t = static_cast<ThreadImpl*>(userData);
+    t->fcn(t->arg);
+
+    double cpu = clockSeconds(CLOCK_THREAD_CPUTIME_ID);
+    pthread_mutex_lock(&t->mutex);
+    t->done = true;
+    t->exitCpuSeconds = cpu;
+    bool detached = t->detached;
+    pthread_cond_broadcast(&t->doneCond);
+    pthread_mutex_unlock(&t->mutex);
+    if (detached) {
+      deleteThreadImpl(t);
+    }
+    return NULL;
+  }
+
+  // One per thread that has made a ThreadExitWatch, held by the thread
+  // (through lifeKey) and by each watch.
+  struct ThreadLife {
+    volatile int exited;
+    volatile int refs;
+  };
+
+  pthread_key_t lifeKey;
+  pthread_once_t lifeKeyOnce = PTHREAD_ONCE_INIT;
+
+  void
+  releaseLife(ThreadLife *life)
+  {
+    if (__sync_sub_and_fetch(&life->refs,1)==0) {
+      delete life;
+    }
+  }
+
+  void
+  threadExiting(void *value)
+  {
+    ThreadLife *life = static_cast<ThreadLife*>(value);
+    __sync_lock_test_and_set(&life->exited,1);
+    releaseLife(life);
+  }
+
+  void
+  makeLifeKey(void)
+  {
+    pthread_key_create(&lifeKey,threadExiting);
+  }
+}
+
+int64_t
+Platform::perfCounter(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return (int64_t) ts.tv_sec*1000000000LL+ts.tv_nsec;
+}
+
+int64_t
+Platform::perfFrequency(void)
+{
+  return 1000000000LL; // perfCounter is in ns
+}
+
+void
+Platform::sleepMs(unsigned long ms)
+{
+  if (ms==0) {
+    sched_yield();
+    return;
+  }
+  struct timespec ts;
+  ts.tv_sec = ms/1000;
+  ts.tv_nsec = (long) (ms%1000)*1000000L;
+  while (nanosleep(&ts,&ts)!=0 && errno==EINTR) {
+  }
+}
+
+unsigned long
+Platform::currentThreadId(void)
+{
+#if defined(__linux__)
+  return (unsigned long) syscall(SYS_gettid);
+#else
+  return (unsigned long) pthread_self();
+#endif
+}
+
+double
+Platform::processCpuSeconds(void)
+{
+  return clockSeconds(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+bool
+Platform::reserveFileSpace(FILE *f, uint64_t numBytes)
+{
+#if defined(__linux__)
+  return fallocate(fileno(f),FALLOC_FL_KEEP_SIZE,0,(off_t) numBytes)==0;
+#else
+  (void) f;
+  (void) numBytes;
+  return false;
+#endif
+}
+
+bool
+Platform::truncateFile(FILE *f, uint64_t numBytes)
+{
+  fflush(f);
+  return ftruncate(fileno(f),(off_t) numBytes)==0;
+}
+
+void*
+Platform::allocPages(std::size_t numBytes)
+{
+  void *p = mmap(NULL,numBytes,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+  return p==MAP_FAILED ? NULL : p;
+}
+
+void
+Platform::freePages(void *p, std::size_t numBytes)
+{
+  if (p!=NULL) {
+    munmap(p,numBytes);
+  }
+}
+
+// Limited by RLIMIT_MEMLOCK for unprivileged processes.
+bool
+Platform::lockPages(void *p, std::size_t numBytes)
+{
+  return mlock(p,numBytes)==0;
+}
+
+void
+Platform::unlockPages(void *p, std::size_t numBytes)
+{
+  munlock(p,numBytes);
+}
+
+unsigned long
+Platform::lastError(void)
+{
+  return (unsigned long) errno;
+}
+
+void
+Platform::openConsole(void)
+{
+}
+
+void
+Platform::writeConsole(const char *text, ConsoleColor)
+{
+  fputs(text,stderr);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Mutex
+
+Platform::Mutex::Mutex(void)
+{
+  pthread_mutex_t *m = new pthread_mutex_t;
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_settype(&attr,PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init(m,&attr);
+  pthread_mutexattr_destroy(&attr);
+  fImpl = m;
+}
+
+Platform::Mutex::~Mutex(void)
+{
+  pthread_mutex_t *m = static_cast<pthread_mutex_t*>(fImpl);
+  pthread_mutex_destroy(m);
+  delete m;
+}
+
+void
+Platform::Mutex::lock(void)
+{
+  pthread_mutex_lock(static_cast<pthread_mutex_t*>(fImpl));
+}
+
+void
+Platform::Mutex::unlock(void)
+{
+  pthread_mutex_unlock(static_cast<pthread_mutex_t*>(fImpl));
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Event
+
+Platform::Event::Event(bool manualReset)
+{
+  EventImpl *e = new EventImpl;
+  pthread_mutex_init(&e->mutex,NULL);
+  initMonotonicCond(&e->cond);
+  e->manualReset = manualReset;
+  e->signalled = false;
+  fImpl = e;
+}
+
+Platform::Event::~Event(void)
+{
+  EventImpl *e = static_cast<EventImpl*>(fImpl);
+  pthread_cond_destroy(&e->cond);
+  pthread_mutex_destroy(&e->mutex);
+  delete e;
+}
+
+void
+Platform::Event::set(void)
+{
+  EventImpl *e = static_cast<EventImpl*>(fImpl);
+  pthread_mutex_lock(&e->mutex);
+  e->signalled = true;
+  if (e->manualReset) {
+    pthread_cond_broadcast(&e->cond);
+  } else {
+    pthread_cond_signal(&e->cond);
+  }
+  pthread_mutex_unlock(&e->mutex);
+}
+
+void
+Platform::Event::reset(void)
+{
+  EventImpl *e = static_cast<EventImpl*>(fImpl);
+  pthread_mutex_lock(&e->mutex);
+  e->signalled = false;
+  pthread_mutex_unlock(&e->mutex);
+}
+
+bool
+Platform::Event::wait(unsigned long timeoutMs)
+{
+  EventImpl *e = static_cast<EventImpl*>(fImpl);
+  struct timespec until = deadline(timeoutMs==WAIT_FOREVER ? 0 : timeoutMs);
+  pthread_mutex_lock(&e->mutex);
+  int rc = 0;
+  while (!e->signalled && rc!=ETIMEDOUT) {
+    if (timeoutMs==WAIT_FOREVER) {
+      pthread_cond_wait(&e->cond,&e->mutex);
+    } else {
+      rc = pthread_cond_timedwait(&e->cond,&e->mutex,&until);
+    }
+  }
+  bool signalled = e->signalled;
+  if (signalled && !e->manualReset) {
+    e->signalled = false;
+  }
+  pthread_mutex_unlock(&e->mutex);
+  return signalled;
+}
+
+Platform::Event*
+Platform::Event::openNamed(const char*)
+{
+  return NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Thread
+
+Platform::Thread::Thread(void) :
+  fImpl(NULL),
+  fJoinedCpuSeconds(0.0)
+{
+}
+
+Platform::Thread::~Thread(void)
+{
+  assert(fImpl==NULL);
+}
+
+bool
+Platform::Thread::start(Fcn fcn, void *arg)
+{
+  assert(fImpl==NULL);
+  ThreadImpl *t = new ThreadImpl;
+  t->fcn = fcn;
+  t->arg = arg;
+  pthread_mutex_init(&t->mutex,NULL);
+  initMonotonicCond(&t->doneCond);
+  t->done = false;
+  t->detached = false;
+  t->exitCpuSeconds = 0.0;
+  if (pthread_create(&t->thread,NULL,threadTrampoline,t)!=0) {
+    deleteThreadImpl(t);
+    return false;
+  }
+  fImpl = t;
+  return true;
+}
+
+bool
+Platform::Thread::join(unsigned long timeoutMs)
+{
+  ThreadImpl *t = static_cast<ThreadImpl*>(fImpl);
+  if (t==NULL) {
+    return true;
+  }
+  struct timespec until = deadline(timeoutMs==Event::WAIT_FOREVER ? 0 : timeoutMs);
+  pthread_mutex_lock(&t->mutex);
+  int rc = 0;
+  while (!t->done && rc!=ETIMEDOUT) {
+    if (timeoutMs==Event::WAIT_FOREVER) {
+      pthread_cond_wait(&t->doneCond,&t->mutex);
+    } else {
+      rc = pthread_cond_timedwait(&t->doneCond,&t->mutex,&until);
+    }
+  }
+  bool done = t->done;
+  pthread_mutex_unlock(&t->mutex);
+  if (!done) {
+    return false;
+  }
+  pthread_join(t->thread,NULL);
+  fJoinedCpuSeconds = t->exitCpuSeconds;
+  deleteThreadImpl(t);
+  fImpl = NULL;
+  return true;
+}
+
+void
+Platform::Thread::detach(void)
+{
+  ThreadImpl *t = static_cast<ThreadImpl*>(fImpl);
+  if (t==NULL) {
+    return;
+  }
+  fImpl = NULL;
+  pthread_detach(t->thread);
+  pthread_mutex_lock(&t->mutex);
+  t->detached = true;
+  bool done = t->done;
+  pthread_mutex_unlock(&t->mutex);
+  if (done) {
+    deleteThreadImpl(t); // else the thread does, as it exits
+  }
+}
+
+double
+Platform::Thread::cpuSeconds(void) const
+{
+  ThreadImpl *t = static_cast<ThreadImpl*>(fImpl);
+  if (t==NULL) {
+    return fJoinedCpuSeconds;
+  }
+  double secs = 0.0;
+  pthread_mutex_lock(&t->mutex);
+  if (t->done) {
+    secs = t->exitCpuSeconds;
+  } else {
+    clockid_t clock;
+    if (pthread_getcpuclockid(t->thread,&clock)==0) {
+      secs = clockSeconds(clock);
+    }
+  }
+  pthread_mutex_unlock(&t->mutex);
+  return secs;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// AsyncFile
+
+namespace {
+  struct AsyncFileImpl {
+    int fd;
+  };
+}
+
+Platform::AsyncFile::Request::Request(void)
+{
+  struct aiocb *cb = new struct aiocb;
+  memset(cb,0,sizeof(*cb));
+  fImpl = cb;
+}
+
+Platform::AsyncFile::Request::~Request(void)
+{
+  delete static_cast<struct aiocb*>(fImpl);
+}
+
+Platform::AsyncFile::AsyncFile(void) :
+  fImpl(NULL)
+{
+}
+
+Platform::AsyncFile::~AsyncFile(void)
+{
+  close();
+}
+
+bool
+Platform::AsyncFile::create(const char *name)
+{
+  close();
+  int flags = O_WRONLY|O_CREAT|O_TRUNC;
+  int fd = -1;
+#ifdef O_DIRECT
+  fd = ::open(name,flags|O_DIRECT,0644);
+  if (fd<0 && errno==EINVAL) {
+    fd = -1; // eg tmpfs, which has no O_DIRECT; write through the cache
+  }
+#endif
+  if (fd<0) {
+    fd = ::open(name,flags,0644);
+  }
+  if (fd<0) {
+    return false;
+  }
+  AsyncFileImpl *f = new AsyncFileImpl;
+  f->fd = fd;
+  fImpl = f;
+  return true;
+}
+
+bool
+Platform::AsyncFile::isOpen(void) const
+{
+  return fImpl!=NULL;
+}
+
+bool
+Platform::AsyncFile::write(Request &r, const void *buf, std::size_t numBytes, uint64_t offset)
+{
+  struct aiocb *cb = static_cast<struct aiocb*>(r.fImpl);
+  memset(cb,0,sizeof(*cb));
+  cb->aio_fildes = static_cast<AsyncFileImpl*>(fImpl)->fd;
+  cb->aio_buf = const_cast<void*>(buf);
+  cb->aio_nbytes = numBytes;
+  cb->aio_offset = (off_t) offset;
+  cb->aio_sigevent.sigev_notify = SIGEV_NONE;
+  return aio_write(cb)==0;
+}
+
+bool
+Platform::AsyncFile::wait(Request &r)
+{
+  struct aiocb *cb = static_cast<struct aiocb*>(r.fImpl);
+  const struct aiocb *list[1] = { cb };
+  int err;
+  while ((err = aio_error(cb))==EINPROGRESS) {
+    aio_suspend(list,1,NULL);
+  }
+  ssize_t written = aio_return(cb);
+  if (err!=0) {
+    errno = err;
+    return false;
+  }
+  return written==(ssize_t) cb->aio_nbytes;
+}
+
+bool
+Platform::AsyncFile::reserveSpace(uint64_t numBytes)
+{
+#if defined(__linux__)
+  return fallocate(static_cast<AsyncFileImpl*>(fImpl)->fd,FALLOC_FL_KEEP_SIZE,0,(off_t) numBytes)==0;
+#else
+  (void) numBytes;
+  return false;
+#endif
+}
+
+void
+Platform::AsyncFile::close(void)
+{
+  AsyncFileImpl *f = static_cast<AsyncFileImpl*>(fImpl);
+  if (f!=NULL) {
+    ::close(f->fd);
+    delete f;
+    fImpl = NULL;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////
+// MappedFile
+
+namespace {
+  struct MappedFileImpl {
+    int fd;
+    uint64_t size;
+    uint64_t writeTime;
+  };
+}
+
+Platform::MappedFile::MappedFile(void) :
+  fImpl(NULL)
+{
+}
+
+Platform::MappedFile::~MappedFile(void)
+{
+  close();
+}
+
+bool
+Platform::MappedFile::open(const char *name)
+{
+  close();
+  int fd = ::open(name,O_RDONLY);
+  if (fd<0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd,&st)!=0) {
+    ::close(fd);
+    return false;
+  }
+  MappedFileImpl *f = new MappedFileImpl;
+  f->fd = fd;
+  f->size = (uint64_t) st.st_size;
+  f->writeTime = (uint64_t) st.st_mtim.tv_sec*1000000000ULL + (uint64_t) st.st_mtim.tv_nsec;
+  fImpl = f;
+  return true;
+}
+
+bool
+Platform::MappedFile::isOpen(void) const
+{
+  return fImpl!=NULL;
+}
+
+void
+Platform::MappedFile::close(void)
+{
+  MappedFileImpl *f = static_cast<MappedFileImpl*>(fImpl);
+  if (f!=NULL) {
+    ::close(f->fd);
+    delete f;
+    fImpl = NULL;
+  }
+}
+
+uint64_t
+Platform::MappedFile::size(void) const
+{
+  return static_cast<MappedFileImpl*>(fImpl)->size;
+}
+
+uint64_t
+Platform::MappedFile::writeTime(void) const
+{
+  return static_cast<MappedFileImpl*>(fImpl)->writeTime;
+}
+
+uint64_t
+Platform::MappedFile::granularity(void)
+{
+  return (uint64_t) sysconf(_SC_PAGESIZE);
+}
+
+const char*
+Platform::MappedFile::map(uint64_t offset, uint64_t numBytes)
+{
+  if (numBytes==0 || numBytes>(uint64_t) (std::size_t) -1) {
+    return NULL;
+  }
+  void *p = mmap(NULL,(std::size_t) numBytes,PROT_READ,MAP_SHARED,
+                 static_cast<MappedFileImpl*>(fImpl)->fd,(off_t) offset);
+  return p==MAP_FAILED ? NULL : static_cast<const char*>(p);
+}
+
+void
+Platform::MappedFile::unmap(const char *view, uint64_t numBytes)
+{
+  munmap(const_cast<char*>(view),(std::size_t) numBytes);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// ThreadLocal
+
+Platform::ThreadLocal::ThreadLocal(void)
+{
+  pthread_key_t *key = new pthread_key_t;
+  int rc = pthread_key_create(key,NULL);
+  assert(rc==0);
+  (void) rc;
+  fImpl = key;
+}
+
+Platform::ThreadLocal::~ThreadLocal(void)
+{
+  pthread_key_t *key = static_cast<pthread_key_t*>(fImpl);
+  pthread_key_delete(*key);
+  delete key;
+}
+
+void*
+Platform::ThreadLocal::get(void) const
+{
+  return pthread_getspecific(*static_cast<pthread_key_t*>(fImpl));
+}
+
+void
+Platform::ThreadLocal::set(void *value)
+{
+  pthread_setspecific(*static_cast<pthread_key_t*>(fImpl),value);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// ThreadExitWatch
+
+Platform::ThreadExitWatch::ThreadExitWatch(void)
+{
+  pthread_once(&lifeKeyOnce,makeLifeKey);
+  ThreadLife *life = static_cast<ThreadLife*>(pthread_getspecific(lifeKey));
+  if (life==NULL) {
+    life = new ThreadLife;
+    life->exited = 0;
+    life->refs = 1; // the thread's
+    pthread_setspecific(lifeKey,life);
+  }
+  __sync_add_and_fetch(&life->refs,1);
+  fImpl = life;
+}
+
+Platform::ThreadExitWatch::~ThreadExitWatch(void)
+{
+  releaseLife(static_cast<ThreadLife*>(fImpl));
+}
+
+bool
+Platform::ThreadExitWatch::hasExited(void) const
+{
+  ThreadLife *life = static_cast<ThreadLife*>(fImpl);
+  __sync_synchronize();
+  return life->exited!=0;
+}
@@ -0,0 +1,563 @@
+// Win32 implementation of Platform.h, for the MEX.
+
+#include "targetver.h"
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <process.h>
+#include <io.h>
+#include <conio.h>
+#include <assert.h>
+#include <string.h>
+#include "Platform.h"
+
+namespace {
+
+  DWORD
+  toWin32Timeout(unsigned long timeoutMs)
+  {
+    return timeoutMs==Platform::Event::WAIT_FOREVER ? INFINITE : (DWORD) timeoutMs;
+  }
+
+  double
+  fileTimeSeconds(const FILETIME &ft)
+  {
+    ULARGE_INTEGER u;
+    u.LowPart = ft.dwLowDateTime;
+    u.HighPart = ft.dwHighDateTime;
+    return u.QuadPart*1e-7; // 100 ns units
+  }
+
+  struct ThreadStart {
+    Platform::Thread::Fcn fcn;
+    void *arg;
+  };
+
+  unsigned int
+  WINAPI threadTrampoline(LPVOID userData)
+  {
+    ThreadStart start = *static_cast<ThreadStart*>(userData);
+    delete static_cast<ThreadStart*>(userData);
+    start.fcn(start.arg);
+    return 0;
+  }
+
+  double
+  threadCpuSeconds(HANDLE h)
+  {
+    FILETIME creation, exit, kernel, user;
+    if (!GetThreadTimes(h,&creation,&exit,&kernel,&user)) {
+      return 0.0;
+    }
+    return fileTimeSeconds(kernel)+fileTimeSeconds(user);
+  }
+
+  HANDLE consoleScreenBuffer = NULL;
+}
+
+int64_t
+Platform::perfCounter(void)
+{
+  LARGE_INTEGER t;
+  QueryPerformanceCounter(&t);
+  return t.QuadPart;
+}
+
+int64_t
+Platform::perfFrequency(void)
+{
+  LARGE_INTEGER freq;
+  QueryPerformanceFrequency(&freq);
+  return freq.QuadPart;
+}
+
+void
+Platform::sleepMs(unsigned long ms)
+{
+  Sleep(ms);
+}
+
+unsigned long
+Platform::currentThreadId(void)
+{
+  return GetCurrentThreadId();
+}
+
+double
+Platform::processCpuSeconds(void)
+{
+  FILETIME creation, exit, kernel, user;
+  if (!GetProcessTimes(GetCurrentProcess(),&creation,&exit,&kernel,&user)) {
+    return 0.0;
+  }
+  return fileTimeSeconds(kernel)+fileTimeSeconds(user);
+}
+
+bool
+Platform::reserveFileSpace(FILE *f, uint64_t numBytes)
+{
+  HANDLE h = (HANDLE) _get_osfhandle(_fileno(f));
+  if (h==INVALID_HANDLE_VALUE) {
+    return false;
+  }
+  FILE_ALLOCATION_INFO info;
+  info.AllocationSize.QuadPart = (LONGLONG) numBytes;
+  return SetFileInformationByHandle(h,FileAllocationInfo,&info,sizeof(info))!=0;
+}
+
+bool
+Platform::truncateFile(FILE *f, uint64_t numBytes)
+{
+  fflush(f);
+  return _chsize_s(_fileno(f),(__int64) numBytes)==0;
+}
+
+void*
+Platform::allocPages(std::size_t numBytes)
+{
+  return VirtualAlloc(NULL,numBytes,MEM_COMMIT|MEM_RESERVE,PAGE_READWRITE);
+}
+
+void
+Platform::freePages(void *p, std::size_t)
+{
+  if (p!=NULL) {
+    VirtualFree(p,0,MEM_RELEASE);
+  }
+}
+
+// A process can only lock as much as its minimum working set allows, so
+// grow that by the block first, and shrink it back after.
+bool
+Platform::lockPages(void *p, std::size_t numBytes)
+{
+  HANDLE process = GetCurrentProcess();
+  SIZE_T minWS = 0, maxWS = 0;
+  if (!GetProcessWorkingSetSize(process,&minWS,&maxWS) ||
+      !SetProcessWorkingSetSize(process,minWS+numBytes,maxWS+numBytes)) {
+    return false;
+  }
+  if (!VirtualLock(p,numBytes)) {
+    DWORD err = GetLastError();
+    SetProcessWorkingSetSize(process,minWS,maxWS);
+    SetLastError(err);
+    return false;
+  }
+  return true;
+}
+
+void
+Platform::unlockPages(void *p, std::size_t numBytes)
+{
+  VirtualUnlock(p,numBytes);
+  HANDLE process = GetCurrentProcess();
+  SIZE_T minWS = 0, maxWS = 0;
+  if (GetProcessWorkingSetSize(process,&minWS,&maxWS) && minWS>numBytes && maxWS>numBytes) {
+    SetProcessWorkingSetSize(process,minWS-numBytes,maxWS-numBytes);
+  }
+}
+
+unsigned long
+Platform::lastError(void)
+{
+  return GetLastError();
+}
+
+void
+Platform::openConsole(void)
+{
+  BOOL ret = AllocConsole();
+  assert(ret);
+  consoleScreenBuffer = GetStdHandle(STD_OUTPUT_HANDLE);
+}
+
+void
+Platform::writeConsole(const char *text, ConsoleColor color)
+{
+  WORD attribs = FOREGROUND_RED|FOREGROUND_INTENSITY;
+  if (color==CONSOLE_GREEN) {
+    attribs = FOREGROUND_GREEN|FOREGROUND_INTENSITY;
+  } else if (color==CONSOLE_CYAN) {
+    attribs = FOREGROUND_GREEN|FOREGROUND_BLUE|FOREGROUND_INTENSITY;
+  }
+  if (consoleScreenBuffer!=NULL) {
+    SetConsoleTextAttribute(consoleScreenBuffer,attribs);
+  }
+  _cputs(text);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Mutex
+
+Platform::Mutex::Mutex(void)
+{
+  CRITICAL_SECTION *cs = new CRITICAL_SECTION;
+  InitializeCriticalSection(cs);
+  fImpl = cs;
+}
+
+Platform::Mutex::~Mutex(void)
+{
+  CRITICAL_SECTION *cs = static_cast<CRITICAL_SECTION*>(fImpl);
+  DeleteCriticalSection(cs);
+  delete cs;
+}
+
+void
+Platform::Mutex::lock(void)
+{
+  EnterCriticalSection(static_cast<CRITICAL_SECTION*>(fImpl));
+}
+
+void
+Platform::Mutex::unlock(void)
+{
+  LeaveCriticalSection(static_cast<CRITICAL_SECTION*>(fImpl));
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Event
+
+Platform::Event::Event(bool manualReset)
+{
+  fImpl = CreateEvent(NULL,manualReset ? TRUE : FALSE,FALSE,NULL);
+  assert(fImpl!=NULL);
+}
+
+Platform::Event::~Event(void)
+{
+  CloseHandle(static_cast<HANDLE>(fImpl));
+}
+
+void
+Platform::Event::set(void)
+{
+  SetEvent(static_cast<HANDLE>(fImpl));
+}
+
+void
+Platform::Event::reset(void)
+{
+  ResetEvent(static_cast<HANDLE>(fImpl));
+}
+
+bool
+Platform::Event::wait(unsigned long timeoutMs)
+{
+  return WaitForSingleObject(static_cast<HANDLE>(fImpl),toWin32Timeout(timeoutMs))==WAIT_OBJECT_0;
+}
+
+Platform::Event*
+Platform::Event::openNamed(const char *name)
+{
+  HANDLE h = CreateEventA(NULL,FALSE,FALSE,name);
+  return h==NULL ? NULL : new Event(static_cast<void*>(h));
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Thread
+
+Platform::Thread::Thread(void) :
+  fImpl(NULL),
+  fJoinedCpuSeconds(0.0)
+{
+}
+
+Platform::Thread::~Thread(void)
+{
+  assert(fImpl==NULL);
+}
+
+bool
+Platform::Thread::start(Fcn fcn, void *arg)
+{
+  assert(fImpl==NULL);
+  ThreadStart *start = new ThreadStart;
+  start->fcn = fcn;
+  start->arg = arg;
+  HANDLE h = (HANDLE) _beginthreadex(NULL,0,threadTrampoline,start,0,NULL);
+  if (h==NULL) {
+    delete start;
+    return false;
+  }
+  fImpl = h;
+  return true;
+}
+
+bool
+Platform::Thread::join(unsigned long timeoutMs)
+{
+  if (fImpl==NULL) {
+    return true;
+  }
+  HANDLE h = static_cast<HANDLE>(fImpl);
+  if (WaitForSingleObject(h,toWin32Timeout(timeoutMs))!=WAIT_OBJECT_0) {
+    return false;
+  }
+  fJoinedCpuSeconds = threadCpuSeconds(h);
+  CloseHandle(h);
+  fImpl = NULL;
+  return true;
+}
+
+void
+Platform::Thread::detach(void)
+{
+  if (fImpl!=NULL) {
+    CloseHandle(static_cast<HANDLE>(fImpl)); // the thread runs on
+    fImpl = NULL;
+  }
+}
+
+double
+Platform::Thread::cpuSeconds(void) const
+{
+  return fImpl==NULL ? fJoinedCpuSeconds : threadCpuSeconds(static_cast<HANDLE>(fImpl));
+}
+
+///////////////////////////////////////////////////////////////////////////
+// AsyncFile
+
+Platform::AsyncFile::Request::Request(void)
+{
+  OVERLAPPED *ov = new OVERLAPPED;
+  memset(ov,0,sizeof(*ov));
+  ov->hEvent = CreateEvent(NULL,TRUE,FALSE,NULL);
+  fImpl = ov;
+}
+
+Platform::AsyncFile::Request::~Request(void)
+{
+  OVERLAPPED *ov = static_cast<OVERLAPPED*>(fImpl);
+  if (ov->hEvent!=NULL) {
+    CloseHandle(ov->hEvent);
+  }
+  delete ov;
+}
+
+Platform::AsyncFile::AsyncFile(void) :
+  fImpl(NULL)
+{
+}
+
+Platform::AsyncFile::~AsyncFile(void)
+{
+  close();
+}
+
+bool
+Platform::AsyncFile::create(const char *name)
+{
+  close();
+  HANDLE h = CreateFileA(name,GENERIC_WRITE,FILE_SHARE_READ,NULL,CREATE_ALWAYS,
+			 FILE_ATTRIBUTE_NORMAL|FILE_FLAG_OVERLAPPED|FILE_FLAG_NO_BUFFERING,NULL);
+  if (h==INVALID_HANDLE_VALUE) {
+    return false;
+  }
+  fImpl = h;
+  return true;
+}
+
+bool
+Platform::AsyncFile::isOpen(void) const
+{
+  return fImpl!=NULL;
+}
+
+bool
+Platform::AsyncFile::write(Request &r, const void *buf, std::size_t numBytes, uint64_t offset)
+{
+  OVERLAPPED *ov = static_cast<OVERLAPPED*>(r.fImpl);
+  if (ov->hEvent==NULL) {
+    return false;
+  }
+  ResetEvent(ov->hEvent);
+  ov->Offset = (DWORD) (offset & 0xFFFFFFFF);
+  ov->OffsetHigh = (DWORD) (offset >> 32);
+  // Completed or pending, the result is collected in wait().
+  return WriteFile(static_cast<HANDLE>(fImpl),buf,(DWORD) numBytes,NULL,ov) ||
+    GetLastError()==ERROR_IO_PENDING;
+}
+
+bool
+Platform::AsyncFile::wait(Request &r)
+{
+  DWORD written = 0;
+  return GetOverlappedResult(static_cast<HANDLE>(fImpl),static_cast<OVERLAPPED*>(r.fImpl),&written,TRUE)!=0;
+}
+
+bool
+Platform::AsyncFile::reserveSpace(uint64_t numBytes)
+{
+  FILE_ALLOCATION_INFO info;
+  info.AllocationSize.QuadPart = (LONGLONG) numBytes;
+  return SetFileInformationByHandle(static_cast<HANDLE>(fImpl),FileAllocationInfo,&info,sizeof(info))!=0;
+}
+
+void
+Platform::AsyncFile::close(void)
+{
+  if (fImpl!=NULL) {
+    CloseHandle(static_cast<HANDLE>(fImpl));
+    fImpl = NULL;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////
+// MappedFile
+
+namespace {
+  struct MappedFileImpl {
+    HANDLE file;
+    HANDLE mapping;
+    uint64_t size;
+    uint64_t writeTime;
+  };
+}
+
+Platform::MappedFile::MappedFile(void) :
+  fImpl(NULL)
+{
+}
+
+Platform::MappedFile::~MappedFile(void)
+{
+  close();
+}
+
+bool
+Platform::MappedFile::open(const char *name)
+{
+  close();
+  HANDLE file = CreateFileA(name,GENERIC_READ,FILE_SHARE_READ|FILE_SHARE_WRITE,NULL,OPEN_EXISTING,FILE_ATTRIBUTE_NORMAL,NULL);
+  if (file==INVALID_HANDLE_VALUE) {
+    return false;
+  }
+  LARGE_INTEGER size;
+  FILETIME writeTime;
+  if (!GetFileSizeEx(file,&size) || !GetFileTime(file,NULL,NULL,&writeTime)) {
+    CloseHandle(file);
+    return false;
+  }
+  // A mapping of an empty file cannot be made; such a file maps nothing.
+  HANDLE mapping = NULL;
+  if (size.QuadPart>0) {
+    mapping = CreateFileMapping(file,NULL,PAGE_READONLY,0,0,NULL);
+    if (mapping==NULL) {
+      CloseHandle(file);
+      return false;
+    }
+  }
+  MappedFileImpl *f = new MappedFileImpl;
+  f->file = file;
+  f->mapping = mapping;
+  f->size = (uint64_t) size.QuadPart;
+  f->writeTime = ((uint64_t) writeTime.dwHighDateTime<<32) | writeTime.dwLowDateTime;
+  fImpl = f;
+  return true;
+}
+
+bool
+Platform::MappedFile::isOpen(void) const
+{
+  return fImpl!=NULL;
+}
+
+void
+Platform::MappedFile::close(void)
+{
+  MappedFileImpl *f = static_cast<MappedFileImpl*>(fImpl);
+  if (f!=NULL) {
+    if (f->mapping!=NULL) {
+      CloseHandle(f->mapping);
+    }
+    CloseHandle(f->file);
+    delete f;
+    fImpl = NULL;
+  }
+}
+
+uint64_t
+Platform::MappedFile::size(void) const
+{
+  return static_cast<MappedFileImpl*>(fImpl)->size;
+}
+
+uint64_t
+Platform::MappedFile::writeTime(void) const
+{
+  return static_cast<MappedFileImpl*>(fImpl)->writeTime;
+}
+
+uint64_t
+Platform::MappedFile::granularity(void)
+{
+  SYSTEM_INFO si;
+  GetSystemInfo(&si);
+  return si.dwAllocationGranularity;
+}
+
+const char*
+Platform::MappedFile::map(uint64_t offset, uint64_t numBytes)
+{
+  MappedFileImpl *f = static_cast<MappedFileImpl*>(fImpl);
+  if (f->mapping==NULL || numBytes==0 || numBytes>(uint64_t) (SIZE_T) -1) {
+    return NULL;
+  }
+  return static_cast<const char*>(MapViewOfFile(f->mapping,FILE_MAP_READ,(DWORD) (offset>>32),(DWORD) offset,(SIZE_T) numBytes));
+}
+
+void
+Platform::MappedFile::unmap(const char *view, uint64_t numBytes)
+{
+  (void) numBytes;
+  UnmapViewOfFile(view);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// ThreadLocal
+
+Platform::ThreadLocal::ThreadLocal(void)
+{
+  DWORD idx = TlsAlloc();
+  assert(idx!=TLS_OUT_OF_INDEXES);
+  fImpl = reinterpret_cast<void*>(static_cast<size_t>(idx));
+}
+
+Platform::ThreadLocal::~ThreadLocal(void)
+{
+  TlsFree(static_cast<DWORD>(reinterpret_cast<size_t>(fImpl)));
+}
+
+void*
+Platform::ThreadLocal::get(void) const
+{
+  return TlsGetValue(static_cast<DWORD>(reinterpret_cast<size_t>(fImpl)));
+}
+
+void
+Platform::ThreadLocal::set(void *value)
+{
+  TlsSetValue(static_cast<DWORD>(reinterpret_cast<size_t>(fImpl)),value);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// ThreadExitWatch
+
+Platform::ThreadExitWatch::ThreadExitWatch(void)
+{
+  fImpl = OpenThread(SYNCHRONIZE,FALSE,GetCurrentThreadId());
+}
+
+Platform::ThreadExitWatch::~ThreadExitWatch(void)
+{
+  if (fImpl!=NULL) {
+    CloseHandle(static_cast<HANDLE>(fImpl));
+  }
+}
+
+// A thread that cannot be opened is never taken to have exited.
+bool
+Platform::ThreadExitWatch::hasExited(void) const
+{
+  return fImpl!=NULL && WaitForSingleObject(static_cast<HANDLE>(fImpl),0)==WAIT_OBJECT_0;
+}
@@ -0,0 +1,239 @@
+#include "RawFrameReader.h"
+#include <string.h>
+#include <algorithm>
+#include "Misc.h"
+#include "TifWriter.h"
+#include "FrameTag.h"
+
+using namespace RawLogFormat;
+
+RawFrameReader::RawFrameReader(void) :
+  fFH(NULL),
+  fImageWidth(0),
+  fImageLength(0),
+  fBytesPerPixel(0),
+  fSampleFormat(1),
+  fNumChannels(0),
+  fHeaderBytes(0),
+  fRecordBytes(0),
+  fFramesPerChunk(0),
+  fFlags(0),
+  fTicksPerSecond(1)
+{
+}
+
+RawFrameReader::~RawFrameReader(void)
+{
+  close();
+}
+
+bool
+RawFrameReader::open(const char *fname)
+{
+  close();
+  if (fopen_s(&fFH,fname,"rb")!=0) {
+    fFH = NULL;
+    CONSOLEPRINT("RawFrameReader: could not open %s.\n",fname);
+    return false;
+  }
+
+  char header[HEADER_FIXED_BYTES];
+  unsigned int version = 0, descriptionBytes = 0;
+  uint64_t headerNumFrames = 0;
+  if (!readAt(0,header,sizeof(header)) || memcmp(header,MAGIC,sizeof(MAGIC))!=0) {
+    CONSOLEPRINT("RawFrameReader: %s is not a raw log.\n",fname);
+    close();
+    return false;
+  }
+  memcpy(&version,header+8,4);
+  memcpy(&fHeaderBytes,header+12,4);
+  memcpy(&fImageWidth,header+16,2);
+  memcpy(&fImageLength,header+18,2);
+  memcpy(&fBytesPerPixel,header+20,2);
+  memcpy(&fSampleFormat,header+22,2);
+  memcpy(&fNumChannels,header+24,2);
+  memcpy(&fRecordBytes,header+28,4);
+  memcpy(&fFramesPerChunk,header+32,4);
+  memcpy(&descriptionBytes,header+36,4);
+  memcpy(&headerNumFrames,header+HEADER_NUMFRAMES_OFFSET,8);
+  memcpy(&fFlags,header+HEADER_FLAGS_OFFSET,4);
+  memcpy(&fTicksPerSecond,header+56,8);
+  if (version!=VERSION || fRecordBytes==0 || fFramesPerChunk==0 || descriptionBytes==0 ||
+      HEADER_FIXED_BYTES+descriptionBytes>fHeaderBytes ||
+      fRecordBytes!=(unsigned int) fNumChannels*fImageWidth*fImageLength*fBytesPerPixel) {
+    CONSOLEPRINT("RawFrameReader: %s has an unsupported or damaged header.\n",fname);
+    close();
+    return false;
+  }
+
+  std::vector<char> description(descriptionBytes);
+  if (!readAt(HEADER_FIXED_BYTES,&description[0],descriptionBytes)) {
+    close();
+    return false;
+  }
+  fImageDescription.assign(&description[0],descriptionBytes-1);
+
+  if (complete()) {
+    if (!readIndex(headerNumFrames)) {
+      CONSOLEPRINT("RawFrameReader: %s has a damaged index.\n",fname);
+      close();
+      return false;
+    }
+  } else {
+    _fseeki64(fFH,0,SEEK_END);
+    recoverIndex((uint64_t) _ftelli64(fFH));
+    CONSOLEPRINT("RawFrameReader: %s was not closed; recovered %lu frames.\n",fname,(unsigned long) numFrames());
+  }
+  return true;
+}
+
+void
+RawFrameReader::close(void)
+{
+  if (fFH!=NULL) {
+    fclose(fFH);
+    fFH = NULL;
+  }
+  fIndex.clear();
+  fImageDescription.clear();
+}
+
+bool
+RawFrameReader::isOpen(void) const
+{
+  return fFH!=NULL;
+}
+
+bool
+RawFrameReader::complete(void) const
+{
+  return (fFlags & COMPLETE)!=0;
+}
+
+bool
+RawFrameReader::tagged(void) const
+{
+  return (fFlags & TAGGED)!=0;
+}
+
+uint64_t
+RawFrameReader::chunkBytes(void) const
+{
+  return (uint64_t) fFramesPerChunk*fRecordBytes + indexBlockBytes(fFramesPerChunk);
+}
+
+uint64_t
+RawFrameReader::recordOffset(uint64_t frame) const
+{
+  return fHeaderBytes + (frame/fFramesPerChunk)*chunkBytes() + (frame%fFramesPerChunk)*fRecordBytes;
+}
+
+bool
+RawFrameReader::readAt(uint64_t offset, void *buf, size_t numBytes)
+{
+  return _fseeki64(fFH,(int64_t) offset,SEEK_SET)==0 && fread(buf,1,numBytes,fFH)==numBytes;
+}
+
+bool
+RawFrameReader::readIndexBlock(uint64_t offset, uint64_t firstFrame, unsigned int numEntries)
+{
+  char header[INDEX_HEADER_BYTES];
+  uint64_t blockFirstFrame = 0;
+  unsigned int blockEntries = 0;
+  if (!readAt(offset,header,sizeof(header)) || memcmp(header,INDEX_MAGIC,sizeof(INDEX_MAGIC))!=0) {
+    return false;
+  }
+  memcpy(&blockFirstFrame,header+8,8);
+  memcpy(&blockEntries,header+16,4);
+  if (blockFirstFrame!=firstFrame || blockEntries!=numEntries) {
+    return false;
+  }
+  return fread(&fIndex[(size_t) firstFrame],sizeof(IndexEntry),numEntries,fFH)==numEntries;
+}
+
+bool
+RawFrameReader::readIndex(uint64_t numFrames)
+{
+  fIndex.resize((size_t) numFrames);
+  for (uint64_t first=0;first<numFrames;first+=fFramesPerChunk) {
+    unsigned int n = (unsigned int) std::min((uint64_t) fFramesPerChunk,numFrames-first);
+    if (!readIndexBlock(recordOffset(first)+(uint64_t) n*fRecordBytes,first,n)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void
+RawFrameReader::recoverIndex(uint64_t fileBytes)
+{
+  IndexEntry none = {0, 0};
+  fIndex.clear();
+  for (uint64_t first=0;;first+=fFramesPerChunk) {
+    uint64_t chunkStart = recordOffset(first);
+    if (chunkStart>=fileBytes) {
+      return;
+    }
+    // Frames of this chunk that made it to disk.
+    uint64_t n = std::min((uint64_t) fFramesPerChunk,(fileBytes-chunkStart)/fRecordBytes);
+    fIndex.resize((size_t) (first+n),none);
+    if (n<fFramesPerChunk || !readIndexBlock(chunkStart+n*fRecordBytes,first,fFramesPerChunk)) {
+      // the chunk the writer was in
+      std::fill(fIndex.begin()+(size_t) first,fIndex.end(),none);
+      return;
+    }
+  }
+}
+
+bool
+RawFrameReader::readFrame(uint64_t frame, char *buf)
+{
+  assert(frame<numFrames());
+  return readAt(recordOffset(frame),buf,fRecordBytes);
+}
+
+bool
+RawFrameReader::convertToTif(const char *rawFile, const char *tifFile, bool bigTiff, uint64_t *numFrames)
+{
+  if (numFrames!=NULL) {
+    *numFrames = 0;
+  }
+  RawFrameReader reader;
+  if (!reader.open(rawFile)) {
+    return false;
+  }
+
+  TifWriter tw;
+  tw.configureAsyncIO(true);
+  tw.configureImage(reader.imageWidth(),reader.imageLength(),reader.bytesPerPixel(),reader.numChannels(),
+                    reader.signedData(),reader.imageDescription().c_str());
+  if (!tw.openTifFile(tifFile,"wbn",bigTiff)) {
+    CONSOLEPRINT("RawFrameReader: could not create %s.\n",tifFile);
+    return false;
+  }
+
+  // FrameLogger keeps each frame's tag at the start of its description.
+  bool tagged = reader.tagged() && reader.imageDescription().length()>=FrameTag::STRING_LENGTH;
+  std::vector<char> buf(reader.getBytesPerRecord());
+  bool ok = true;
+  uint64_t f;
+  for (f=0;f<reader.numFrames();f++) {
+    if (!reader.readFrame(f,&buf[0])) {
+      CONSOLEPRINT("RawFrameReader: error reading frame %lu of %s.\n",(unsigned long) f,rawFile);
+      ok = false;
+      break;
+    }
+    if (tagged) {
+      char frameTagStr[FrameTag::STRING_LENGTH+1];
+      sprintf_s(frameTagStr,sizeof(frameTagStr),FrameTag::FORMAT_STRING,(unsigned long) reader.frameTag(f));
+      tw.modifyImageDescription(0,frameTagStr,FrameTag::STRING_LENGTH);
+    }
+    tw.writeFramesForAllChannels(&buf[0],(unsigned int) buf.size());
+  }
+  tw.closeTifFile();
+
+  if (numFrames!=NULL) {
+    *numFrames = f;
+  }
+  return ok;
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "RawFrameWriter.h"
+
+// Reads the raw log container RawFrameWriter writes, and converts it to
+// the TIFF TifWriter would have logged.
+//
+// A file that was not closed cleanly is recovered as far as it goes:
+// every complete chunk with its index, then any frames after the last
+// index block, with no tags or timestamps.
+class RawFrameReader {
+
+ public:
+
+  RawFrameReader(void);
+
+  ~RawFrameReader(void);
+
+  // Read the header and index. Returns false if fname cannot be opened
+  // or is not a raw log.
+  bool open(const char *fname);
+
+  void close(void);
+
+  bool isOpen(void) const;
+
+  unsigned short imageWidth(void) const { return fImageWidth; }
+  unsigned short imageLength(void) const { return fImageLength; }
+  unsigned short bytesPerPixel(void) const { return fBytesPerPixel; }
+  unsigned short numChannels(void) const { return fNumChannels; }
+  bool signedData(void) const { return fSampleFormat==2; }
+  const std::string& imageDescription(void) const { return fImageDescription; }
+
+  // The file was closed cleanly.
+  bool complete(void) const;
+
+  // Frames carry frame tags.
+  bool tagged(void) const;
+
+  // Timestamps are Platform::perfCounter ticks; this many per second.
+  uint64_t ticksPerSecond(void) const { return fTicksPerSecond; }
+
+  // Bytes of one frame record, all channels: what readFrame reads.
+  unsigned int getBytesPerRecord(void) const { return fRecordBytes; }
+
+  uint64_t numFrames(void) const { return (uint64_t) fIndex.size(); }
+
+  // Frame tag and timestamp of a frame (0-based); 0 for frames logged
+  // after the last index checkpoint of a file that was not closed.
+  uint64_t frameTag(uint64_t frame) const { return fIndex[(size_t) frame].frameTag; }
+  uint64_t timestamp(uint64_t frame) const { return fIndex[(size_t) frame].timestamp; }
+
+  // Read a frame record (all channels) into buf.
+  bool readFrame(uint64_t frame, char *buf);
+
+  // Convert rawFile to a TIFF (BigTIFF if bigTiff) at tifFile, frame tags
+  // and all. numFrames, if not NULL, gets the number of frames written.
+  // Returns false on any error.
+  static bool convertToTif(const char *rawFile, const char *tifFile, bool bigTiff,
+                           uint64_t *numFrames = NULL);
+
+ private:
+  RawFrameReader(const RawFrameReader&);
+  RawFrameReader& operator=(const RawFrameReader&);
+
+  uint64_t chunkBytes(void) const;
+  uint64_t recordOffset(uint64_t frame) const;
+
+  // Read numBytes at offset. False if the file is shorter.
+  bool readAt(uint64_t offset, void *buf, size_t numBytes);
+
+  // Read the index block at offset into fIndex from firstFrame, if it is
+  // one with numEntries entries.
+  bool readIndexBlock(uint64_t offset, uint64_t firstFrame, unsigned int numEntries);
+
+  bool readIndex(uint64_t numFrames);
+  void recoverIndex(uint64_t fileBytes);
+
+ private:
+  FILE *fFH;
+
+  unsigned short fImageWidth;
+  unsigned short fImageLength;
+  unsigned short fBytesPerPixel;
+  unsigned short fSampleFormat;
+  unsigned short fNumChannels;
+  unsigned int fHeaderBytes;
+  unsigned int fRecordBytes;
+  unsigned int fFramesPerChunk;
+  unsigned int fFlags;
+  uint64_t fTicksPerSecond;
+  std::string fImageDescription;
+
+  std::vector<RawLogFormat::IndexEntry> fIndex; // one per frame
+};
@@ -0,0 +1,317 @@
+#include "RawFrameWriter.h"
+#include <string.h>
+#include <algorithm>
+#include "Misc.h"
+
+/*
+RAW LOG CONTAINER
+
+All values little-endian.
+
+Header, padded with zeros to headerBytes (a multiple of 4096):
+  0  "USCRAWF" and a nul
+  8  uint32 version (1)
+  12 uint32 headerBytes
+  16 uint16 imageWidth, imageLength, bytesPerPixel,
+            sampleFormat   TIFF SampleFormat: 1 unsigned, 2 signed
+  24 uint16 numChannels, 0
+  28 uint32 recordBytes    numChannels*imageWidth*imageLength*bytesPerPixel
+  32 uint32 framesPerChunk
+  36 uint32 descriptionBytes including the nul
+  40 uint64 numFrames      0 until the file is closed
+  48 uint32 flags          1 closed cleanly, 2 frames tagged
+  52 uint32 0
+  56 uint64 timestamp ticks per second
+  64 the image description
+
+Then chunks of framesPerChunk frames (the last may have fewer), each:
+  the frame records, recordBytes each: channel 1's frame, channel 2's,
+  and so on, as passed to writeFramesForAllChannels
+  an index block, padded with zeros to a multiple of 4096:
+    "USCRIDX" and a nul
+    uint64 index of the chunk's first frame (0-based)
+    uint32 numEntries, uint32 0
+    numEntries x { uint64 frameTag, uint64 timestamp }
+
+So frame n is at a computable offset; the index only adds its tag and
+timestamp. A file that was not closed (numFrames 0, flag 1 clear) can be
+read by walking the chunks: every complete one has its index block, and
+any frames after the last index block are still there, untagged.
+
+The image description is the one at the first frame. Within a file
+FrameLogger only changes its leading frame tag (see FrameTag.h), which
+is in the index, so RawFrameReader::convertToTif can rebuild each
+frame's description.
+*/
+
+using namespace RawLogFormat;
+
+RawFrameWriter::RawFrameWriter(void) :
+  fImageWidth(0),
+  fImageLength(0),
+  fBytesPerPixel(0),
+  fNumChannels(0),
+  fSampleFormat(1),
+  fFramesPerChunk(DEFAULT_FRAMES_PER_CHUNK),
+  fFH(NULL),
+  fUseAsyncIO(false),
+  fHeaderWritten(false),
+  fNumFrames(0),
+  fTagged(false),
+  fFrameTag(0)
+{
+}
+
+RawFrameWriter::~RawFrameWriter(void)
+{
+  if (isFileOpen()) {
+    closeFile();
+  }
+}
+
+void
+RawFrameWriter::configureChunks(unsigned int framesPerChunk)
+{
+  assert(!isFileOpen());
+  fFramesPerChunk = (framesPerChunk>0) ? framesPerChunk : DEFAULT_FRAMES_PER_CHUNK;
+}
+
+bool
+RawFrameWriter::isFileOpen(void) const
+{
+  return fFH!=NULL || fAsyncWriter.isOpen();
+}
+
+bool
+RawFrameWriter::openFile(const char *fname, const char *modestr, bool bigTiff)
+{
+  if (isFileOpen()) {
+    closeFile();
+  }
+  if (modestr[0]!='w') {
+    handleErr("raw logs can only be written with 'w' modes.\n");
+    return false;
+  }
+
+  fHeaderWritten = false;
+  fNumFrames = 0;
+  fTagged = false;
+  fFrameTag = 0;
+  fChunkIndex.clear();
+  fChunkIndex.reserve(fFramesPerChunk);
+
+  std::string rawName = std::string(fname) + ".raw";
+  if (fUseAsyncIO) {
+    return fAsyncWriter.open(rawName.c_str());
+  }
+  return fopen_s(&fFH,rawName.c_str(),modestr)==0;
+}
+
+void
+RawFrameWriter::closeFile(void)
+{
+  if (!isFileOpen()) {
+    return;
+  }
+  if (!fHeaderWritten) {
+    writeHeader();
+  }
+  if (!fChunkIndex.empty()) {
+    writeIndexBlock();
+  }
+
+  // Checkpoint the header: frame count and flags.
+  unsigned int flags = COMPLETE | (fTagged ? TAGGED : 0);
+  char tail[16];
+  memcpy(tail,&fNumFrames,8);
+  memcpy(tail+8,&flags,4);
+  memset(tail+12,0,4);
+
+  if (fAsyncWriter.isOpen()) {
+    fAsyncWriter.patch(HEADER_NUMFRAMES_OFFSET,tail,sizeof(tail));
+    if (!fAsyncWriter.close()) {
+      handleErr("error writing raw log.\n");
+    }
+  } else {
+    if (_fseeki64(fFH,HEADER_NUMFRAMES_OFFSET,SEEK_SET)!=0 || fwrite(tail,1,sizeof(tail),fFH)!=sizeof(tail)) {
+      handleErr("error writing raw log header.\n");
+    }
+    fclose(fFH);
+    fFH = NULL;
+  }
+}
+
+void
+RawFrameWriter::configureAsyncIO(bool enable, unsigned int bufferBytes, unsigned int numBuffers)
+{
+  assert(!isFileOpen());
+  fUseAsyncIO = enable;
+  fAsyncWriter.configure(bufferBytes,numBuffers);
+}
+
+void
+RawFrameWriter::configureImage(unsigned short imWidth,
+                               unsigned short imLength,
+                               unsigned short bytesPerPixel,
+                               unsigned short numChannels,
+                               bool signedData,
+                               const char *imageDescription,
+                               unsigned int targetBytesPerFullStrip)
+{
+  assert(imWidth>0);
+  assert(imLength>0);
+  assert(bytesPerPixel>0);
+  assert(numChannels>0);
+  // The layout is fixed once frames are written.
+  assert(!fHeaderWritten);
+
+  fImageWidth = imWidth;
+  fImageLength = imLength;
+  fBytesPerPixel = bytesPerPixel;
+  fNumChannels = numChannels;
+  fSampleFormat = signedData ? 2 : 1;
+  // As TifWriter, so that converted files match.
+  fImageDescription = (imageDescription!=NULL) ? imageDescription : "default image description";
+}
+
+void
+RawFrameWriter::modifyImageDescription(unsigned int loc, const char *buf, unsigned int len)
+{
+  assert(loc<fImageDescription.length());
+  len = (unsigned int) std::min((size_t) len,fImageDescription.length()-loc);
+  fImageDescription.replace(loc,len,buf,len);
+}
+
+void
+RawFrameWriter::replaceImageDescription(const char *imageDescription)
+{
+  assert(imageDescription!=NULL);
+  if (fHeaderWritten) {
+    handleErr("image description replaced after the first frame; not logged.\n");
+  }
+  fImageDescription = imageDescription;
+}
+
+void
+RawFrameWriter::setFrameTag(unsigned long frameTag)
+{
+  fFrameTag = frameTag;
+  fTagged = true;
+}
+
+void
+RawFrameWriter::writeFramesForAllChannels(const char *buf, unsigned int sz)
+{
+  unsigned int recordBytes = getBytesPerRecord();
+  assert(sz>=recordBytes);
+  assert(isFileOpen());
+
+  if (!fHeaderWritten) {
+    writeHeader();
+  }
+
+  IndexEntry entry;
+  entry.frameTag = fFrameTag;
+  entry.timestamp = (uint64_t) Platform::perfCounter();
+
+  writeToFile(buf,recordBytes);
+  fChunkIndex.push_back(entry);
+  fNumFrames++;
+  if (fChunkIndex.size()==fFramesPerChunk) {
+    writeIndexBlock();
+  }
+}
+
+bool
+RawFrameWriter::preallocate(unsigned long numFrames)
+{
+  assert(isFileOpen());
+  assert(fImageWidth>0); // configured
+
+  uint64_t numChunks = (numFrames+fFramesPerChunk-1)/fFramesPerChunk;
+  uint64_t numBytes = getHeaderBytes() + (uint64_t) numFrames*getBytesPerRecord()
+    + numChunks*indexBlockBytes(fFramesPerChunk);
+  bool reserved = fAsyncWriter.isOpen() ? fAsyncWriter.reserveSpace(numBytes) : Platform::reserveFileSpace(fFH,numBytes);
+  if (!reserved) {
+    handleErr("could not preallocate raw log.\n");
+    return false;
+  }
+  return true;
+}
+
+void
+RawFrameWriter::handleErr(const char *msg) const
+{
+  CONSOLEPRINT("RawFrameWriter: %s",msg);
+}
+
+void
+RawFrameWriter::writeToFile(const void *buf, size_t sz)
+{
+  if (fAsyncWriter.isOpen()) {
+    // AsyncFileWriter reports the failure itself, once.
+    fAsyncWriter.append(buf,sz);
+    return;
+  }
+  if (fwrite(buf,1,sz,fFH)<sz) {
+    handleErr("error writing raw log.\n");
+  }
+}
+
+unsigned int
+RawFrameWriter::getHeaderBytes(void) const
+{
+  return (unsigned int) alignUp(HEADER_FIXED_BYTES+fImageDescription.length()+1);
+}
+
+void
+RawFrameWriter::buildHeader(std::vector<char> &header) const
+{
+  unsigned int headerBytes = getHeaderBytes();
+  header.assign(headerBytes,0);
+  char *p = &header[0];
+
+  unsigned int u32[2] = {VERSION, headerBytes};
+  unsigned short u16[6] = {fImageWidth, fImageLength, fBytesPerPixel, fSampleFormat, fNumChannels, 0};
+  unsigned int layout[3] = {getBytesPerRecord(), fFramesPerChunk, (unsigned int) fImageDescription.length()+1};
+  unsigned int flags = fTagged ? TAGGED : 0;
+  uint64_t ticksPerSecond = (uint64_t) Platform::perfFrequency();
+
+  memcpy(p,MAGIC,8);
+  memcpy(p+8,u32,8);
+  memcpy(p+16,u16,12);
+  memcpy(p+28,layout,12);
+  // numFrames (40) stays 0 until closeFile
+  memcpy(p+HEADER_FLAGS_OFFSET,&flags,4);
+  memcpy(p+56,&ticksPerSecond,8);
+  memcpy(p+HEADER_FIXED_BYTES,fImageDescription.c_str(),fImageDescription.length()+1);
+}
+
+void
+RawFrameWriter::writeHeader(void)
+{
+  assert(fImageWidth>0); // configured
+  std::vector<char> header;
+  buildHeader(header);
+  writeToFile(&header[0],header.size());
+  fHeaderWritten = true;
+}
+
+void
+RawFrameWriter::writeIndexBlock(void)
+{
+  unsigned int numEntries = (unsigned int) fChunkIndex.size();
+  uint64_t firstFrame = fNumFrames-numEntries;
+  unsigned int counts[2] = {numEntries, 0};
+
+  fIndexBlock.assign(indexBlockBytes(numEntries),0);
+  char *p = &fIndexBlock[0];
+  memcpy(p,INDEX_MAGIC,8);
+  memcpy(p+8,&firstFrame,8);
+  memcpy(p+16,counts,8);
+  if (numEntries>0) {
+    memcpy(p+INDEX_HEADER_BYTES,&fChunkIndex[0],numEntries*sizeof(IndexEntry));
+  }
+  writeToFile(p,fIndexBlock.size());
+  fChunkIndex.clear();
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "FrameWriter.h"
+#include "AsyncFileWriter.h"
+
+// Layout of the raw log container written by RawFrameWriter and read by
+// RawFrameReader. See the notes in RawFrameWriter.cpp.
+namespace RawLogFormat
+{
+  const char MAGIC[8] = {'U','S','C','R','A','W','F',0};
+  const char INDEX_MAGIC[8] = {'U','S','C','R','I','D','X',0};
+  const unsigned int VERSION = 1;
+
+  // Header and index blocks are padded to this, so that frame records
+  // start sector-aligned.
+  const unsigned int BLOCK_ALIGNMENT = 4096;
+
+  // Header fields, then the image description.
+  const unsigned int HEADER_FIXED_BYTES = 64;
+  const unsigned int HEADER_NUMFRAMES_OFFSET = 40;
+  const unsigned int HEADER_FLAGS_OFFSET = 48;
+
+  // Index block: magic, uint64 first frame, uint32 entries, uint32 0.
+  const unsigned int INDEX_HEADER_BYTES = 24;
+
+  enum HeaderFlags {
+    COMPLETE = 1, // closed cleanly: numFrames and the last index block are there
+    TAGGED = 2    // frames carry frame tags
+  };
+
+  struct IndexEntry {
+    uint64_t frameTag;
+    uint64_t timestamp; // Platform::perfCounter ticks when logged
+  };
+
+  inline uint64_t alignUp(uint64_t n)
+  {
+    return (n+BLOCK_ALIGNMENT-1)/BLOCK_ALIGNMENT*BLOCK_ALIGNMENT;
+  }
+
+  inline unsigned int indexBlockBytes(unsigned int numEntries)
+  {
+    return (unsigned int) alignUp(INDEX_HEADER_BYTES+(uint64_t) numEntries*sizeof(IndexEntry));
+  }
+}
+
+// Logs frames to a raw chunked container rather than a TIFF: a header
+// holding the image layout and description, then fixed-size frame
+// records (all channels of a frame together) in chunks, each followed by
+// an index block with the chunk's frame tags and timestamps. There is no
+// per-frame header and no size limit, so logging runs at disk
+// bandwidth; RawFrameReader::convertToTif makes a TIFF of it afterwards,
+// identical to what TifWriter would have logged.
+//
+// Each index block is a checkpoint: a file cut short (eg by a crash)
+// still has the tags and timestamps of every completed chunk, and the
+// frames after them.
+class RawFrameWriter : public FrameWriter {
+
+ public:
+
+  static const unsigned int DEFAULT_FRAMES_PER_CHUNK = 256;
+
+  RawFrameWriter(void);
+
+  ~RawFrameWriter(void);
+
+  // Frames between index checkpoints. Call while no file is open.
+  void configureChunks(unsigned int framesPerChunk);
+
+  // FrameWriter. openFile appends ".raw" to fname and only takes 'w'
+  // modes; bigTiff does not apply. The header is written with the first
+  // frame, so that the description may still be replaced after openFile.
+  bool isFileOpen(void) const;
+  bool openFile(const char *fname, const char *modestr, bool bigTiff);
+  void closeFile(void);
+  void configureAsyncIO(bool enable,
+                        unsigned int bufferBytes = AsyncFileWriter::DEFAULT_BUFFER_BYTES,
+                        unsigned int numBuffers = AsyncFileWriter::DEFAULT_NUM_BUFFERS);
+  void configureImage(unsigned short imWidth,
+                      unsigned short imLength,
+                      unsigned short bytesPerPixel,
+                      unsigned short numChannels,
+                      bool signedData = false,
+                      const char *imageDescription = NULL,
+                      unsigned int targetBytesPerFullStrip = 8192);
+  void modifyImageDescription(unsigned int loc, const char *buf, unsigned int len);
+  void replaceImageDescription(const char *imageDescription);
+  void setFrameTag(unsigned long frameTag);
+  void writeFramesForAllChannels(const char *buf, unsigned int sz);
+  bool preallocate(unsigned long numFrames);
+
+  // Bytes of one frame record, all channels.
+  unsigned int getBytesPerRecord(void) const { return (unsigned int) fNumChannels*fImageWidth*fImageLength*fBytesPerPixel; }
+
+ private:
+  RawFrameWriter(const RawFrameWriter&);
+  RawFrameWriter& operator=(const RawFrameWriter&);
+
+  void handleErr(const char *msg) const;
+
+  void writeToFile(const void *buf, size_t sz);
+
+  // The header as it stands, padded to getHeaderBytes().
+  void buildHeader(std::vector<char> &header) const;
+  unsigned int getHeaderBytes(void) const;
+
+  void writeHeader(void);
+
+  // Append the index block for the frames of the current chunk.
+  void writeIndexBlock(void);
+
+ private:
+  unsigned short fImageWidth;
+  unsigned short fImageLength;
+  unsigned short fBytesPerPixel;
+  unsigned short fNumChannels;
+  unsigned short fSampleFormat;
+  std::string fImageDescription;
+  unsigned int fFramesPerChunk;
+
+  FILE *fFH;
+  AsyncFileWriter fAsyncWriter;
+  bool fUseAsyncIO;
+
+  // Current file.
+  bool fHeaderWritten;
+  uint64_t fNumFrames;
+  bool fTagged;
+  unsigned long fFrameTag; // of the next frame
+  std::vector<RawLogFormat::IndexEntry> fChunkIndex; // frames of the current chunk
+  std::vector<char> fIndexBlock;
+};
@@ -0,0 +1,106 @@
+#include "Misc.h"
+#include "ReplayFrameSource.h"
+
+ReplayFrameSource::ReplayFrameSource(const char *filename, double framesPerSecond, bool loop) :
+  fFilename(filename),
+  fFramesPerSecond(framesPerSecond),
+  fLoop(loop),
+  fFile(NULL),
+  fAtEnd(false),
+  fFramesRead(0)
+{
+}
+
+ReplayFrameSource::~ReplayFrameSource(void)
+{
+  close();
+}
+
+FrameSource::Status
+ReplayFrameSource::open(const FrameFormat &fmt)
+{
+  close();
+  fFormat = fmt;
+  if (fopen_s(&fFile,fFilename.c_str(),"rb")!=0) {
+    fFile = NULL;
+    CONSOLEPRINT("ReplayFrameSource: could not open %s.\n",fFilename.c_str());
+    return RESOURCE_NOT_FOUND;
+  }
+  fAtEnd = false;
+  fFramesRead = 0;
+  fPacer.start(fFramesPerSecond);
+  return SUCCESS;
+}
+
+bool
+ReplayFrameSource::readWholeFrame(void *dst)
+{
+  return fread(dst,1,fFormat.frameSizeBytes,fFile)==fFormat.frameSizeBytes;
+}
+
+FrameSource::Status
+ReplayFrameSource::readFrame(void *dst, uint32_t timeoutMs,
+			     std::size_t *elementsRemaining)
+{
+  *elementsRemaining = 0;
+  if (fFile==NULL) {
+    // open() failed; don't let the copier spin on the error.
+    Platform::sleepMs(timeoutMs);
+    return RESOURCE_NOT_INITIALIZED;
+  }
+  if (fAtEnd) {
+    // Nothing more is coming; behave like an idle FIFO.
+    Platform::sleepMs(timeoutMs);
+    return FIFO_TIMEOUT;
+  }
+
+  unsigned long framesBehind;
+  if (!fPacer.waitForFrame(timeoutMs,&framesBehind)) {
+    return FIFO_TIMEOUT;
+  }
+
+  if (!readWholeFrame(dst)) {
+    // Start over, unless the file does not hold even one frame.
+    if (fLoop && fFramesRead>0) {
+      rewind(fFile);
+      fFramesRead = 0;
+    }
+    if (fFramesRead>0 || !readWholeFrame(dst)) {
+      fAtEnd = true;
+      return FIFO_TIMEOUT;
+    }
+  }
+  fFramesRead++;
+
+  *elementsRemaining = framesBehind*fFormat.frameSizeFifoElements;
+  return SUCCESS;
+}
+
+FrameSource::Status
+ReplayFrameSource::discardElements(std::size_t numElements, uint32_t timeoutMs)
+{
+  if (fFile==NULL) {
+    return RESOURCE_NOT_INITIALIZED;
+  }
+  // Skipping past the end is caught by the next readFrame().
+  std::size_t elementSizeBytes = fFormat.frameSizeBytes/fFormat.frameSizeFifoElements;
+  if (fseek(fFile,(long) (numElements*elementSizeBytes),SEEK_CUR)!=0) {
+    return SOFTWARE_FAULT;
+  }
+  return SUCCESS;
+}
+
+void
+ReplayFrameSource::close(void)
+{
+  if (fFile!=NULL) {
+    fclose(fFile);
+    fFile = NULL;
+  }
+}
+
+const char*
+ReplayFrameSource::name(void) const
+{
+  return "replay";
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdio.h>
+#include <string>
+#include "FrameSource.h"
+
+// Streams a recorded raw FIFO dump from disk at a target rate. The file
+// is simply consecutive frames exactly as a FIFO read returns them
+// (frameSizeBytes each, tag included); a trailing partial frame is
+// ignored. At end of file the source either starts over or, if not
+// looping, keeps timing out as an idle FIFO would.
+class ReplayFrameSource : public FrameSource {
+
+ public:
+
+  // framesPerSecond<=0 replays as fast as frames are read.
+  ReplayFrameSource(const char *filename, double framesPerSecond, bool loop);
+
+  ~ReplayFrameSource(void);
+
+  Status open(const FrameFormat &fmt);
+
+  Status readFrame(void *dst, uint32_t timeoutMs,
+		   std::size_t *elementsRemaining);
+
+  Status discardElements(std::size_t numElements, uint32_t timeoutMs);
+
+  void close(void);
+
+  const char* name(void) const;
+
+ private:
+  // Read one full frame at the current file position.
+  bool readWholeFrame(void *dst);
+
+ private:
+  std::string fFilename;
+  double fFramesPerSecond;
+  bool fLoop;
+  FrameFormat fFormat;
+  FILE *fFile;
+  bool fAtEnd;
+  unsigned long fFramesRead; // since the last rewind
+  FrameRatePacer fPacer;
+};
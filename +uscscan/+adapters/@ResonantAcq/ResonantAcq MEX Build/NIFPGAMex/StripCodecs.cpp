@@ -0,0 +1,275 @@
+#include <string.h>
+#include "StripCodecs.h"
+#include "Misc.h"
+
+namespace
+{
+  // LZ4 block format constants: matches are at least MINMATCH bytes,
+  // the last LASTLITERALS bytes of a block are always literals, and the
+  // last match starts at least MFLIMIT bytes before the end.
+  const std::size_t MINMATCH = 4;
+  const std::size_t LASTLITERALS = 5;
+  const std::size_t MFLIMIT = 12;
+  const std::size_t MAX_DISTANCE = 65535;
+  const unsigned int HASH_LOG = 14;
+
+  // Probes without a match before the compressor starts skipping ahead
+  // (1<<SKIP_TRIGGER of them per extra byte skipped), so that noise,
+  // which has few matches, goes through quickly.
+  const unsigned int SKIP_TRIGGER = 6;
+
+  template <typename SampleT>
+  void differenceRows(const char *src, char *dst, std::size_t numBytes, unsigned int bytesPerRow)
+  {
+    std::size_t samplesPerRow = bytesPerRow/sizeof(SampleT);
+    for (std::size_t row=0;row<numBytes;row+=bytesPerRow) {
+      const SampleT *s = reinterpret_cast<const SampleT*>(src+row);
+      SampleT *d = reinterpret_cast<SampleT*>(dst+row);
+      d[0] = s[0];
+      for (std::size_t i=1;i<samplesPerRow;i++) {
+        d[i] = (SampleT) (s[i]-s[i-1]);
+      }
+    }
+  }
+
+  template <typename SampleT>
+  void accumulateRows(char *buf, std::size_t numBytes, unsigned int bytesPerRow)
+  {
+    std::size_t samplesPerRow = bytesPerRow/sizeof(SampleT);
+    for (std::size_t row=0;row<numBytes;row+=bytesPerRow) {
+      SampleT *b = reinterpret_cast<SampleT*>(buf+row);
+      for (std::size_t i=1;i<samplesPerRow;i++) {
+        b[i] = (SampleT) (b[i]+b[i-1]);
+      }
+    }
+  }
+
+  inline uint32_t read32(const unsigned char *p)
+  {
+    uint32_t v;
+    memcpy(&v,p,sizeof(v));
+    return v;
+  }
+
+  // Hash of the 5 bytes at p (p+8 must be readable). Hashing 5 bytes
+  // rather than the 4 a match needs steers the compressor away from
+  // 4-byte matches, which on 16-bit noise are two pixels that happen
+  // to repeat and cost about as much to encode as they save: on PMT
+  // frames this is worth almost 20% in ratio.
+  inline uint32_t hashAt(const unsigned char *p)
+  {
+    uint64_t v;
+    memcpy(&v,p,sizeof(v));
+    return (uint32_t) (((v<<24)*889523592379ULL) >> (64-HASH_LOG));
+  }
+
+  // Length bytes beyond the 15 that fit in a token nibble.
+  inline unsigned char* putLength(unsigned char *op, std::size_t len)
+  {
+    while (len>=255) {
+      *op++ = 255;
+      len -= 255;
+    }
+    *op++ = (unsigned char) len;
+    return op;
+  }
+
+  // One sequence: token, literals, and (unless last) offset and match
+  // length.
+  inline unsigned char* putSequence(unsigned char *op, const unsigned char *literals, std::size_t litLen,
+                                    std::size_t offset, std::size_t matchLen, bool last)
+  {
+    unsigned char *token = op++;
+    if (litLen>=15) {
+      *token = 15<<4;
+      op = putLength(op,litLen-15);
+    } else {
+      *token = (unsigned char) (litLen<<4);
+    }
+    memcpy(op,literals,litLen);
+    op += litLen;
+    if (last) {
+      return op;
+    }
+
+    *op++ = (unsigned char) (offset & 0xFF);
+    *op++ = (unsigned char) (offset >> 8);
+    matchLen -= MINMATCH;
+    if (matchLen>=15) {
+      *token |= 15;
+      op = putLength(op,matchLen-15);
+    } else {
+      *token |= (unsigned char) matchLen;
+    }
+    return op;
+  }
+
+  // Read the extra length bytes after a 15 nibble. Returns false if the
+  // block ends first.
+  inline bool getLength(const unsigned char *&ip, const unsigned char *iend, std::size_t &len)
+  {
+    unsigned char b;
+    do {
+      if (ip>=iend) {
+        return false;
+      }
+      b = *ip++;
+      len += b;
+    } while (b==255);
+    return true;
+  }
+}
+
+namespace StripCodecs
+{
+  void horizontalDifference(const char *src, char *dst, std::size_t numBytes,
+                            unsigned int bytesPerRow, unsigned int bytesPerSample)
+  {
+    assert(numBytes%bytesPerRow==0);
+    switch (bytesPerSample) {
+    case 1:
+      differenceRows<unsigned char>(src,dst,numBytes,bytesPerRow);
+      break;
+    case 2:
+      differenceRows<uint16_t>(src,dst,numBytes,bytesPerRow);
+      break;
+    case 4:
+      differenceRows<uint32_t>(src,dst,numBytes,bytesPerRow);
+      break;
+    default:
+      assert(false);
+    }
+  }
+
+  void horizontalAccumulate(char *buf, std::size_t numBytes,
+                            unsigned int bytesPerRow, unsigned int bytesPerSample)
+  {
+    assert(numBytes%bytesPerRow==0);
+    switch (bytesPerSample) {
+    case 1:
+      accumulateRows<unsigned char>(buf,numBytes,bytesPerRow);
+      break;
+    case 2:
+      accumulateRows<uint16_t>(buf,numBytes,bytesPerRow);
+      break;
+    case 4:
+      accumulateRows<uint32_t>(buf,numBytes,bytesPerRow);
+      break;
+    default:
+      assert(false);
+    }
+  }
+
+  std::size_t lz4Bound(std::size_t numBytes)
+  {
+    return numBytes + numBytes/255 + 16;
+  }
+
+  std::size_t lz4Compress(const char *src, std::size_t numBytes, char *dst, uint32_t *hashTable)
+  {
+    const unsigned char *base = reinterpret_cast<const unsigned char*>(src);
+    const unsigned char *iend = base+numBytes;
+    const unsigned char *anchor = base; // start of the pending literals
+    unsigned char *op = reinterpret_cast<unsigned char*>(dst);
+
+    if (numBytes>MFLIMIT) {
+      // Table entries are offsets from base. Zeroed, every entry points
+      // at byte 0, which the match check rejects or verifies like any
+      // other candidate.
+      memset(hashTable,0,LZ4_HASH_ENTRIES*sizeof(uint32_t));
+      const unsigned char *mflimit = iend-MFLIMIT;
+      const unsigned char *matchlimit = iend-LASTLITERALS;
+
+      const unsigned char *ip = base+1;
+      hashTable[hashAt(base)] = 0;
+      unsigned int misses = 0;
+      while (ip<=mflimit) {
+        uint32_t seq = read32(ip);
+        uint32_t h = hashAt(ip);
+        const unsigned char *ref = base+hashTable[h];
+        hashTable[h] = (uint32_t) (ip-base);
+
+        if (ref>=ip || (std::size_t) (ip-ref)>MAX_DISTANCE || read32(ref)!=seq) {
+          ip += 1 + (misses++ >> SKIP_TRIGGER);
+          continue;
+        }
+        misses = 0;
+
+        // Extend the match backwards over pending literals, then forwards.
+        while (ip>anchor && ref>base && ip[-1]==ref[-1]) {
+          ip--;
+          ref--;
+        }
+        const unsigned char *mp = ip+MINMATCH;
+        const unsigned char *rp = ref+MINMATCH;
+        while (mp<matchlimit && *mp==*rp) {
+          mp++;
+          rp++;
+        }
+
+        op = putSequence(op,anchor,(std::size_t) (ip-anchor),(std::size_t) (ip-ref),(std::size_t) (mp-ip),false);
+        anchor = ip = mp;
+
+        // Index a position inside the match, so that the next one can
+        // start from it.
+        if (ip<=mflimit) {
+          hashTable[hashAt(ip-2)] = (uint32_t) (ip-2-base);
+        }
+      }
+    }
+
+    op = putSequence(op,anchor,(std::size_t) (iend-anchor),0,0,true);
+    return (std::size_t) (op-reinterpret_cast<unsigned char*>(dst));
+  }
+
+  std::size_t lz4Decompress(const char *src, std::size_t numBytes, char *dst, std::size_t dstCapacity)
+  {
+    const unsigned char *ip = reinterpret_cast<const unsigned char*>(src);
+    const unsigned char *iend = ip+numBytes;
+    unsigned char *ostart = reinterpret_cast<unsigned char*>(dst);
+    unsigned char *op = ostart;
+    unsigned char *oend = ostart+dstCapacity;
+
+    while (ip<iend) {
+      unsigned char token = *ip++;
+
+      std::size_t litLen = token>>4;
+      if (litLen==15 && !getLength(ip,iend,litLen)) {
+        return LZ4_ERROR;
+      }
+      if (litLen>(std::size_t) (iend-ip) || litLen>(std::size_t) (oend-op)) {
+        return LZ4_ERROR;
+      }
+      memcpy(op,ip,litLen);
+      ip += litLen;
+      op += litLen;
+      if (ip==iend) {
+        break; // last sequence: literals only
+      }
+
+      if (iend-ip<2) {
+        return LZ4_ERROR;
+      }
+      std::size_t offset = ip[0] | (ip[1]<<8);
+      ip += 2;
+      if (offset==0 || offset>(std::size_t) (op-ostart)) {
+        return LZ4_ERROR;
+      }
+      std::size_t matchLen = token & 15;
+      if (matchLen==15 && !getLength(ip,iend,matchLen)) {
+        return LZ4_ERROR;
+      }
+      matchLen += MINMATCH;
+      if (matchLen>(std::size_t) (oend-op)) {
+        return LZ4_ERROR;
+      }
+      // Byte by byte: the match may overlap the bytes it produces.
+      const unsigned char *mp = op-offset;
+      for (std::size_t i=0;i<matchLen;i++) {
+        op[i] = mp[i];
+      }
+      op += matchLen;
+    }
+    return (std::size_t) (op-ostart);
+  }
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include "Platform.h" // for uint32_t
+
+// Lossless codec pieces for logged strips (see StripCompressor): the
+// TIFF horizontal differencing predictor, and an LZ4 block codec. The
+// LZ4 blocks follow the LZ4 block format
+// (https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md), so
+// any LZ4 block decoder reads them; the compressor is the plain greedy
+// single-probe one, which is what makes LZ4 fast. Deflate comes from
+// zlib.
+namespace StripCodecs
+{
+  // TIFF Predictor 2: within each row of bytesPerRow bytes, replace
+  // every sample but the first with its difference from the one before,
+  // in the sample's own (wrapping) unsigned arithmetic. Samples are
+  // bytesPerSample (1, 2 or 4) bytes, little-endian. numBytes must be a
+  // multiple of bytesPerRow. src and dst must not overlap.
+  void horizontalDifference(const char *src, char *dst, std::size_t numBytes,
+                            unsigned int bytesPerRow, unsigned int bytesPerSample);
+
+  // Undo horizontalDifference, in place.
+  void horizontalAccumulate(char *buf, std::size_t numBytes,
+                            unsigned int bytesPerRow, unsigned int bytesPerSample);
+
+  // Entries in the hash table lz4Compress takes as scratch space.
+  const std::size_t LZ4_HASH_ENTRIES = 1<<14;
+
+  // Largest LZ4 block numBytes of input can compress to (incompressible
+  // input grows a little).
+  std::size_t lz4Bound(std::size_t numBytes);
+
+  // Compress numBytes of src into dst, which must have room for
+  // lz4Bound(numBytes) bytes, and return the compressed size. hashTable
+  // holds LZ4_HASH_ENTRIES entries; its contents need not be
+  // initialized.
+  std::size_t lz4Compress(const char *src, std::size_t numBytes, char *dst, uint32_t *hashTable);
+
+  // Decompress an LZ4 block of numBytes into dst, writing at most
+  // dstCapacity bytes. Returns the decompressed size, or LZ4_ERROR if
+  // the block is malformed or does not fit.
+  const std::size_t LZ4_ERROR = (std::size_t) -1;
+  std::size_t lz4Decompress(const char *src, std::size_t numBytes, char *dst, std::size_t dstCapacity);
+}
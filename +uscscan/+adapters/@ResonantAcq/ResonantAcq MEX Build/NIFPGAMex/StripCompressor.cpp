@@ -0,0 +1,282 @@
+#include <string.h>
+#include <algorithm>
+#include "zlib.h"
+#include "StripCompressor.h"
+#include "StripCodecs.h"
+#include "Misc.h"
+#include "Atomics.h"
+
+struct StripCompressor::Context {
+  z_stream zs;
+  bool zsInitialized;
+  std::vector<uint32_t> hashTable;
+  std::vector<char> differenced;
+};
+
+StripCompressor::Codec
+StripCompressor::codecFromString(const char *str)
+{
+  if (strcmp(str,"deflate")==0) {
+    return DEFLATE;
+  } else if (strcmp(str,"lz4")==0) {
+    return LZ4;
+  }
+  return NONE;
+}
+
+StripCompressor::StripCompressor(void) :
+  fCodec(NONE),
+  fLevel(DEFAULT_DEFLATE_LEVEL),
+  fPredictor(true),
+  fCallerContext(NULL),
+  fWorkersBusy(0),
+  fNextStrip(0),
+  fFailed(0),
+  fQuit(false),
+  fBuf(NULL),
+  fNumStrips(0),
+  fStripsPerFrame(0),
+  fFrameBytes(0),
+  fStripBytes(0),
+  fBytesPerRow(0),
+  fBytesPerSample(0)
+{
+}
+
+StripCompressor::~StripCompressor(void)
+{
+  stop();
+}
+
+bool
+StripCompressor::start(Codec codec, int level, bool predictor, unsigned int numThreads)
+{
+  stop();
+  if (codec==NONE) {
+    return true;
+  }
+  fCodec = codec;
+  fLevel = (level>=1 && level<=9) ? level : DEFAULT_DEFLATE_LEVEL;
+  fPredictor = predictor;
+
+  fCallerContext = createContext();
+  bool ok = fCallerContext!=NULL;
+
+  fQuit = false;
+  for (unsigned int i=0;ok && i<numThreads;i++) {
+    Worker *w = new Worker();
+    w->owner = this;
+    w->context = createContext();
+    fWorkers.push_back(w);
+    ok = w->context!=NULL && w->thread.start(StripCompressor::workerThreadFcn,w);
+  }
+
+  if (!ok) {
+    CONSOLEPRINT("StripCompressor: could not start %u compression threads.\n",numThreads);
+    stop();
+    return false;
+  }
+  return true;
+}
+
+void
+StripCompressor::stop(void)
+{
+  fQuit = true;
+  for (size_t i=0;i<fWorkers.size();i++) {
+    Worker *w = fWorkers[i];
+    if (w->thread.isStarted()) {
+      w->go.set();
+      w->thread.join(Platform::Event::WAIT_FOREVER);
+    }
+    destroyContext(w->context);
+    delete w;
+  }
+  fWorkers.clear();
+
+  destroyContext(fCallerContext);
+  fCallerContext = NULL;
+  fCodec = NONE;
+}
+
+StripCompressor::Codec
+StripCompressor::codec(void) const
+{
+  return fCodec;
+}
+
+bool
+StripCompressor::predictor(void) const
+{
+  return fPredictor;
+}
+
+unsigned int
+StripCompressor::numThreads(void) const
+{
+  return (unsigned int) fWorkers.size();
+}
+
+StripCompressor::Context*
+StripCompressor::createContext(void)
+{
+  Context *context = new Context;
+  context->zsInitialized = false;
+  if (fCodec==DEFLATE) {
+    memset(&context->zs,0,sizeof(context->zs));
+    if (deflateInit(&context->zs,fLevel)!=Z_OK) {
+      delete context;
+      return NULL;
+    }
+    context->zsInitialized = true;
+  } else {
+    context->hashTable.resize(StripCodecs::LZ4_HASH_ENTRIES);
+  }
+  return context;
+}
+
+void
+StripCompressor::destroyContext(Context *context)
+{
+  if (context==NULL) {
+    return;
+  }
+  if (context->zsInitialized) {
+    deflateEnd(&context->zs);
+  }
+  delete context;
+}
+
+bool
+StripCompressor::compressFrames(const char *buf, unsigned int numFrames, unsigned int frameBytes,
+                                unsigned int stripBytes, unsigned int bytesPerRow, unsigned int bytesPerSample)
+{
+  assert(fCodec!=NONE);
+  assert(stripBytes%bytesPerRow==0 && frameBytes%bytesPerRow==0);
+
+  fBuf = buf;
+  fFrameBytes = frameBytes;
+  fStripBytes = stripBytes;
+  fBytesPerRow = bytesPerRow;
+  fBytesPerSample = bytesPerSample;
+  fStripsPerFrame = (frameBytes+stripBytes-1)/stripBytes;
+  fNumStrips = numFrames*fStripsPerFrame;
+
+  size_t bound = (fCodec==DEFLATE) ? compressBound(stripBytes) : StripCodecs::lz4Bound(stripBytes);
+  if (fOutput.size()!=fNumStrips || (fNumStrips>0 && fOutput[0].size()!=bound)) {
+    fOutput.assign(fNumStrips,std::vector<char>(bound));
+    fOutputBytes.assign(fNumStrips,0);
+  }
+
+  fFailed = 0;
+  atomicExchange(fNextStrip,0);
+  if (!fWorkers.empty()) {
+    fWorkersBusy = (long) fWorkers.size();
+    for (size_t i=0;i<fWorkers.size();i++) {
+      fWorkers[i]->go.set();
+    }
+  }
+
+  work(*fCallerContext);
+
+  // Every worker reports in, even one that found nothing left to take,
+  // so none is still looking at this batch when the next one is set up.
+  if (!fWorkers.empty()) {
+    fBatchDone.wait(Platform::Event::WAIT_FOREVER);
+  }
+  return fFailed==0;
+}
+
+void
+StripCompressor::work(Context &context)
+{
+  for (;;) {
+    long index = atomicIncrement(fNextStrip)-1;
+    if (index>=(long) fNumStrips) {
+      return;
+    }
+    if (!compressStrip(context,(unsigned int) index)) {
+      atomicExchange(fFailed,1);
+    }
+  }
+}
+
+bool
+StripCompressor::compressStrip(Context &context, unsigned int index)
+{
+  unsigned int frame = index/fStripsPerFrame;
+  unsigned int strip = index%fStripsPerFrame;
+  unsigned int offset = strip*fStripBytes;
+  unsigned int numBytes = std::min(fStripBytes,fFrameBytes-offset);
+  const char *src = fBuf + (size_t) frame*fFrameBytes + offset;
+
+  if (fPredictor) {
+    if (context.differenced.size()<numBytes) {
+      context.differenced.resize(fStripBytes);
+    }
+    StripCodecs::horizontalDifference(src,&context.differenced[0],numBytes,fBytesPerRow,fBytesPerSample);
+    src = &context.differenced[0];
+  }
+
+  std::vector<char> &out = fOutput[index];
+  if (fCodec==DEFLATE) {
+    z_stream &zs = context.zs;
+    deflateReset(&zs);
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(src));
+    zs.avail_in = numBytes;
+    zs.next_out = reinterpret_cast<Bytef*>(&out[0]);
+    zs.avail_out = (uInt) out.size();
+    if (deflate(&zs,Z_FINISH)!=Z_STREAM_END) {
+      return false;
+    }
+    fOutputBytes[index] = (unsigned int) zs.total_out;
+  } else {
+    fOutputBytes[index] = (unsigned int) StripCodecs::lz4Compress(src,numBytes,&out[0],&context.hashTable[0]);
+  }
+  return true;
+}
+
+unsigned int
+StripCompressor::stripsPerFrame(void) const
+{
+  return fStripsPerFrame;
+}
+
+const char*
+StripCompressor::compressedStrip(unsigned int frame, unsigned int strip) const
+{
+  return &fOutput[frame*fStripsPerFrame+strip][0];
+}
+
+unsigned int
+StripCompressor::compressedStripBytes(unsigned int frame, unsigned int strip) const
+{
+  return fOutputBytes[frame*fStripsPerFrame+strip];
+}
+
+unsigned int
+StripCompressor::compressedFrameBytes(unsigned int frame) const
+{
+  unsigned int total = 0;
+  for (unsigned int s=0;s<fStripsPerFrame;s++) {
+    total += fOutputBytes[frame*fStripsPerFrame+s];
+  }
+  return total;
+}
+
+void
+StripCompressor::workerThreadFcn(void *arg)
+{
+  Worker *w = static_cast<Worker*>(arg);
+  StripCompressor *obj = w->owner;
+  for (;;) {
+    w->go.wait(Platform::Event::WAIT_FOREVER);
+    if (obj->fQuit) {
+      break;
+    }
+    obj->work(*w->context);
+    if (atomicDecrement(obj->fWorkersBusy)==0) {
+      obj->fBatchDone.set();
+    }
+  }
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <vector>
+#include "Platform.h"
+
+// Compresses the strips of logged frames on a pool of worker threads.
+// Owned by TifWriter; the logger thread hands it each write's frames
+// (all channels) and works on strips alongside the workers until every
+// strip is done, so the frames are compressed in parallel but written
+// in order.
+//
+// Each strip is optionally run through the TIFF horizontal differencing
+// predictor, which pays off when neighbouring samples are correlated
+// (eg signal oversampled along the line) and costs a little on
+// uncorrelated shot noise; see bench_StripCompressor. Then one of:
+// * DEFLATE: a zlib stream, as TIFF compression 8 (Adobe deflate)
+// stores it. level is the zlib level; 1 is the fastest.
+// * LZ4: an LZ4 block (see StripCodecs). Several times faster than
+// deflate at level 1, for a somewhat worse ratio, but TIFF has no code
+// for it, so TifWriter writes these to its own container file.
+//
+// Compressed strips stay in the compressor's buffers until the next
+// compressFrames.
+//
+// Not thread-safe: one thread calls compressFrames at a time.
+class StripCompressor {
+
+ public:
+
+  enum Codec { NONE = 0, DEFLATE, LZ4 };
+
+  // 'deflate' or 'lz4'; anything else (eg 'none') is NONE.
+  static Codec codecFromString(const char *str);
+
+  static const int DEFAULT_DEFLATE_LEVEL = 1;
+
+  StripCompressor(void);
+
+  ~StripCompressor(void);
+
+  // Set up for codec, with or without the predictor, and numThreads
+  // worker threads besides the thread calling compressFrames; with none
+  // that thread does all the work. Stops any workers already running.
+  // Returns false if the codec or threads could not be set up, in which
+  // case the codec is NONE.
+  bool start(Codec codec, int level, bool predictor, unsigned int numThreads);
+
+  // Stop the workers. The codec becomes NONE.
+  void stop(void);
+
+  Codec codec(void) const;
+
+  bool predictor(void) const;
+
+  unsigned int numThreads(void) const;
+
+  // Compress numFrames frames of frameBytes each, back to back in buf.
+  // Each frame is cut into strips of stripBytes (the last one may be
+  // shorter) and each strip into rows of bytesPerRow bytes for the
+  // predictor. stripBytes and frameBytes must be multiples of
+  // bytesPerRow. Returns when every strip is compressed; false if any
+  // failed.
+  bool compressFrames(const char *buf, unsigned int numFrames, unsigned int frameBytes,
+                      unsigned int stripBytes, unsigned int bytesPerRow, unsigned int bytesPerSample);
+
+  // Results of the last compressFrames.
+  unsigned int stripsPerFrame(void) const;
+  const char* compressedStrip(unsigned int frame, unsigned int strip) const;
+  unsigned int compressedStripBytes(unsigned int frame, unsigned int strip) const;
+  unsigned int compressedFrameBytes(unsigned int frame) const;
+
+ private:
+  // Per-thread codec state (zlib stream, LZ4 hash table, predictor
+  // output); defined in the .cpp to keep zlib.h out of this header.
+  struct Context;
+
+  struct Worker {
+    StripCompressor *owner;
+    Context *context;
+    Platform::Thread thread;
+    Platform::Event go; // auto-reset; set once per batch of strips
+  };
+
+  StripCompressor(const StripCompressor&);
+  StripCompressor& operator=(const StripCompressor&);
+
+  static void workerThreadFcn(void *arg);
+
+  Context* createContext(void);
+  void destroyContext(Context *context);
+
+  // Take strips off the current batch until there are none left.
+  void work(Context &context);
+
+  bool compressStrip(Context &context, unsigned int index);
+
+ private:
+  Codec fCodec;
+  int fLevel;
+  bool fPredictor;
+
+  std::vector<Worker*> fWorkers;
+  Context *fCallerContext;
+  Platform::Event fBatchDone; // auto-reset; set by the last worker to finish a batch
+  volatile long fWorkersBusy;
+  volatile long fNextStrip;
+  volatile long fFailed;
+  volatile bool fQuit;
+
+  // The batch being compressed.
+  const char *fBuf;
+  unsigned int fNumStrips;
+  unsigned int fStripsPerFrame;
+  unsigned int fFrameBytes;
+  unsigned int fStripBytes;
+  unsigned int fBytesPerRow;
+  unsigned int fBytesPerSample;
+
+  // Compressed strips, frame-major, each buffer big enough for the
+  // worst case.
+  std::vector< std::vector<char> > fOutput;
+  std::vector<unsigned int> fOutputBytes;
+};
@@ -0,0 +1,102 @@
+#include "Misc.h"
+#include <string.h>
+#include "SyntheticFrameSource.h"
+
+SyntheticFrameSource::SyntheticFrameSource(Pattern pattern, double framesPerSecond) :
+  fPattern(pattern),
+  fFramesPerSecond(framesPerSecond),
+  fNumPixelWords(0),
+  fFrameCount(0),
+  fNoiseState(1)
+{
+}
+
+SyntheticFrameSource::Pattern
+SyntheticFrameSource::patternFromString(const char *str)
+{
+  if (strcmp(str,"noise")==0) {
+    return NOISE;
+  } else if (strcmp(str,"counter")==0) {
+    return FRAME_COUNTER;
+  }
+  return RAMP;
+}
+
+FrameSource::Status
+SyntheticFrameSource::open(const FrameFormat &fmt)
+{
+  fFormat = fmt;
+  std::size_t numChans = fmt.isMultiChannel ? 4 : 1;
+  fNumPixelWords = fmt.linesPerFrame*fmt.pixelsPerLine*numChans;
+  if (fNumPixelWords*2+(fmt.frameTagging ? fmt.tagSizeBytes : 0) > fmt.frameSizeBytes) {
+    return INVALID_PARAMETER;
+  }
+
+  fTemplate.clear();
+  if (fPattern==RAMP) {
+    fTemplate.resize(fNumPixelWords);
+    std::size_t tCount = 0;
+    for (std::size_t yiter=0;yiter<fmt.linesPerFrame;yiter++) {
+      for (std::size_t xiter=0;xiter<fmt.pixelsPerLine;xiter++) {
+	for (std::size_t chan=0;chan<numChans;chan++) {
+	  fTemplate[tCount++] = (int16_t) xiter;
+	}
+      }
+    }
+  }
+
+  fFrameCount = 0;
+  fNoiseState = 1;
+  fPacer.start(fFramesPerSecond);
+  return SUCCESS;
+}
+
+FrameSource::Status
+SyntheticFrameSource::readFrame(void *dst, uint32_t timeoutMs,
+				std::size_t *elementsRemaining)
+{
+  unsigned long framesBehind;
+  if (!fPacer.waitForFrame(timeoutMs,&framesBehind)) {
+    *elementsRemaining = 0;
+    return FIFO_TIMEOUT;
+  }
+
+  int16_t *frame = static_cast<int16_t*>(dst);
+  switch (fPattern) {
+  case NOISE:
+    for (std::size_t i=0;i<fNumPixelWords;i++) {
+      fNoiseState = fNoiseState*1103515245 + 12345;
+      frame[i] = (int16_t) (fNoiseState >> 16);
+    }
+    break;
+  case FRAME_COUNTER:
+    for (std::size_t i=0;i<fNumPixelWords;i++) {
+      frame[i] = (int16_t) fFrameCount;
+    }
+    break;
+  case RAMP:
+  default:
+    memcpy(frame,&fTemplate[0],fNumPixelWords*sizeof(int16_t));
+    break;
+  }
+
+  // Same tag layout as the FPGA: identifier, placeholder, then the
+  // record count split into high and low 16 bits.
+  if (fFormat.frameTagging) {
+    std::size_t tagIdx = fFormat.tagWordIndex();
+    frame[tagIdx] = -32768;
+    frame[tagIdx+1] = 0;
+    frame[tagIdx+2] = (int16_t) (fFrameCount / 65536);
+    frame[tagIdx+3] = (int16_t) (fFrameCount & 0xFFFF);
+  }
+  fFrameCount++;
+
+  *elementsRemaining = framesBehind*fFormat.frameSizeFifoElements;
+  return SUCCESS;
+}
+
+const char*
+SyntheticFrameSource::name(void) const
+{
+  return "synthetic";
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <vector>
+#include "FrameSource.h"
+
+// Generates frames in memory at a target rate, in the FIFO's layout and
+// with frame tags, for running the pipeline without an FPGA.
+class SyntheticFrameSource : public FrameSource {
+
+ public:
+
+  enum Pattern {
+    RAMP = 0,      // each pixel is its index within the line, all channels
+    NOISE,         // pseudo-random
+    FRAME_COUNTER  // every pixel holds the frame number (mod 2^16)
+  };
+
+  // framesPerSecond<=0 generates frames as fast as they are read.
+  SyntheticFrameSource(Pattern pattern, double framesPerSecond);
+
+  // Parse a pattern name ("ramp", "noise", "counter"); unknown names
+  // give RAMP.
+  static Pattern patternFromString(const char *str);
+
+  Status open(const FrameFormat &fmt);
+
+  Status readFrame(void *dst, uint32_t timeoutMs,
+		   std::size_t *elementsRemaining);
+
+  const char* name(void) const;
+
+ private:
+  Pattern fPattern;
+  double fFramesPerSecond;
+  FrameFormat fFormat;
+  std::size_t fNumPixelWords; // int16 words before the tag
+  std::vector<int16_t> fTemplate; // RAMP frame, built once in open()
+  FrameRatePacer fPacer;
+  unsigned long fFrameCount;
+  unsigned long fNoiseState;
+};
@@ -0,0 +1,587 @@
+#include "TifStackReader.h"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include "Misc.h"
+#include "zlib.h"
+#include "StripCodecs.h"
+#include "FrameTag.h"
+
+/*
+INDEX SIDECAR
+
+<file>.idx, all values little-endian:
+  0  "USCTIDX" and a nul
+  8  uint32 version (1)
+  12 uint32 0
+  16 uint64 bytes of the TIFF when indexed
+  24 uint64 last write time of the TIFF when indexed (in the OS's units)
+  32 uint64 numImages
+  40 uint64 offset of the first IFD
+  48 uint64 stride: image i's IFD is at first + i*stride. 0 if the file
+            is not at a fixed stride, when numImages uint64 IFD offsets
+            follow.
+
+A sidecar whose size or time does not match the TIFF is ignored and
+rewritten.
+*/
+
+static const char SIDECAR_MAGIC[8] = {'U','S','C','T','I','D','X',0};
+static const unsigned int SIDECAR_VERSION = 1;
+static const unsigned int SIDECAR_HEADER_BYTES = 56;
+
+// Window mapped at a time when the whole file does not fit in the
+// address space (32-bit builds).
+static const uint64_t WINDOW_BYTES = 64*1024*1024;
+
+// TIFF tags and types used.
+enum {
+  ImageWidthTag = 256,
+  ImageLengthTag = 257,
+  BitsPerSampleTag = 258,
+  CompressionTag = 259,
+  ImageDescriptionTag = 270,
+  StripOffsetsTag = 273,
+  SamplesPerPixelTag = 277,
+  RowsPerStripTag = 278,
+  StripByteCountsTag = 279,
+  PlanarConfigurationTag = 284,
+  PredictorTag = 317,
+  SampleFormatTag = 339
+};
+
+static unsigned int typeBytes(unsigned short type)
+{
+  switch (type) {
+  case 1: case 2: return 1; // BYTE, ASCII
+  case 3: return 2;         // SHORT
+  case 4: return 4;         // long
+  case 16: return 8;        // LONG8
+  default: return 0;
+  }
+}
+
+TifStackReader::TifStackReader(void) :
+  fFileBytes(0),
+  fFileTime(0),
+  fView(NULL),
+  fViewOffset(0),
+  fViewBytes(0),
+  fWholeFileMapped(false),
+  fBigTiff(false),
+  fImageWidth(0),
+  fImageLength(0),
+  fBytesPerPixel(0),
+  fSampleFormat(1),
+  fNumChannels(1),
+  fNumImages(0),
+  fFirstIFD(0),
+  fStride(0),
+  fComplete(false),
+  fIndexFromSidecar(false)
+{
+}
+
+TifStackReader::~TifStackReader(void)
+{
+  close();
+}
+
+bool
+TifStackReader::open(const char *fname, unsigned short numChannels, bool useSidecar)
+{
+  close();
+  fNumChannels = (numChannels>0) ? numChannels : 1;
+
+  // Share writing, so that a file still being logged can be read.
+  if (!fFile.open(fname)) {
+    CONSOLEPRINT("TifStackReader: could not open %s.\n",fname);
+    return false;
+  }
+  if (fFile.size()<16) {
+    CONSOLEPRINT("TifStackReader: %s is not a TIFF.\n",fname);
+    close();
+    return false;
+  }
+  fFileBytes = fFile.size();
+  fFileTime = fFile.writeTime();
+
+  // The whole file if it fits in the address space, else windows of it.
+  if (fFileBytes<=(uint64_t) (size_t) -1) {
+    fView = fFile.map(0,fFileBytes);
+  }
+  if (fView!=NULL) {
+    fWholeFileMapped = true;
+    fViewBytes = fFileBytes;
+  }
+
+  ImageInfo first;
+  if (!readFirstIFD(fFirstIFD) || !parseIFD(fFirstIFD,first) || first.dataEnd>fFileBytes) {
+    CONSOLEPRINT("TifStackReader: %s is not a TIFF TifWriter wrote, or has no complete frame.\n",fname);
+    close();
+    return false;
+  }
+  fImageWidth = first.width;
+  fImageLength = first.length;
+  fBytesPerPixel = first.bytesPerPixel;
+  fSampleFormat = first.sampleFormat;
+
+  std::string sidecar = sidecarName(fname);
+  if (useSidecar && loadSidecar(sidecar)) {
+    fIndexFromSidecar = true;
+    return true;
+  }
+  if (!findFixedStride(first)) {
+    walkIFDs();
+  }
+  if (useSidecar && fComplete) {
+    saveSidecar(sidecar);
+  }
+  return true;
+}
+
+void
+TifStackReader::close(void)
+{
+  unmap();
+  fFile.close();
+  fWholeFileMapped = false;
+  fFileBytes = 0;
+  fNumImages = 0;
+  fStride = 0;
+  fIFDs.clear();
+  fComplete = false;
+  fIndexFromSidecar = false;
+}
+
+bool
+TifStackReader::isOpen(void) const
+{
+  return fFile.isOpen();
+}
+
+const char*
+TifStackReader::map(uint64_t offset, uint64_t numBytes)
+{
+  if (offset>fFileBytes || numBytes>fFileBytes-offset) {
+    return NULL;
+  }
+  if (fView!=NULL && offset>=fViewOffset && offset+numBytes<=fViewOffset+fViewBytes) {
+    return fView + (size_t) (offset-fViewOffset);
+  }
+  if (fWholeFileMapped) {
+    return NULL;
+  }
+
+  unmap();
+  uint64_t granularity = Platform::MappedFile::granularity();
+  uint64_t start = offset/granularity*granularity;
+  uint64_t bytes = std::max(WINDOW_BYTES,offset+numBytes-start);
+  bytes = std::min(bytes,fFileBytes-start);
+  fView = fFile.map(start,bytes);
+  if (fView==NULL) {
+    CONSOLEPRINT("TifStackReader: could not map %lu bytes at %lu.\n",(unsigned long) bytes,(unsigned long) start);
+    return NULL;
+  }
+  fViewOffset = start;
+  fViewBytes = bytes;
+  return fView + (size_t) (offset-start);
+}
+
+void
+TifStackReader::unmap(void)
+{
+  if (fView!=NULL) {
+    fFile.unmap(fView,fViewBytes);
+    fView = NULL;
+  }
+  fViewOffset = 0;
+  fViewBytes = 0;
+}
+
+uint64_t
+TifStackReader::readValue(const char *p, unsigned int valueBytes)
+{
+  uint64_t value = 0;
+  memcpy(&value,p,valueBytes);
+  return value;
+}
+
+bool
+TifStackReader::readValueAt(uint64_t offset, unsigned int valueBytes, uint64_t &value)
+{
+  const char *p = map(offset,valueBytes);
+  if (p==NULL) {
+    return false;
+  }
+  value = readValue(p,valueBytes);
+  return true;
+}
+
+bool
+TifStackReader::readFirstIFD(uint64_t &firstIFD)
+{
+  const char *p = map(0,16);
+  if (p==NULL || p[0]!='I' || p[1]!='I') {
+    return false; // TifWriter writes little-endian only
+  }
+  unsigned short version = (unsigned short) readValue(p+2,2);
+  if (version==42) {
+    fBigTiff = false;
+    firstIFD = readValue(p+4,4);
+  } else if (version==43 && readValue(p+4,2)==8) {
+    fBigTiff = true;
+    firstIFD = readValue(p+8,8);
+  } else {
+    return false;
+  }
+  return firstIFD!=0;
+}
+
+bool
+TifStackReader::parseIFD(uint64_t ifdOffset, ImageInfo &info)
+{
+  unsigned int countBytes = fBigTiff ? 8 : 2;
+  unsigned int entryBytes = fBigTiff ? 20 : 12;
+  unsigned int valueFieldBytes = getOffsetBytes(); // value or offset in an entry
+  unsigned int valueFieldPos = fBigTiff ? 12 : 8;
+
+  uint64_t numEntries;
+  if (!readValueAt(ifdOffset,countBytes,numEntries) || numEntries==0 || numEntries>1000) {
+    return false;
+  }
+  uint64_t entriesOffset = ifdOffset+countBytes;
+  const char *entries = map(entriesOffset,numEntries*entryBytes+valueFieldBytes);
+  if (entries==NULL) {
+    return false;
+  }
+
+  unsigned int bitsPerSample = 0, samplesPerPixel = 1, planarConfiguration = 1;
+  unsigned int numStripOffsets = 0, numStripByteCounts = 0;
+  memset(&info,0,sizeof(info));
+  info.sampleFormat = 1;
+  info.compression = 1;
+  info.predictor = 1;
+  info.rowsPerStrip = 0xFFFFFFFF;
+  info.nextIFD = readValue(entries+numEntries*entryBytes,valueFieldBytes);
+
+  for (unsigned int e=0;e<numEntries;e++) {
+    const char *entry = entries + e*entryBytes;
+    unsigned short tag = (unsigned short) readValue(entry,2);
+    unsigned short type = (unsigned short) readValue(entry+2,2);
+    uint64_t count = readValue(entry+4,fBigTiff ? 8 : 4);
+    unsigned int valueBytes = typeBytes(type);
+    // Where the values are: in the entry if they fit, else at its offset.
+    uint64_t values = (count*valueBytes<=valueFieldBytes) ?
+      entriesOffset+e*entryBytes+valueFieldPos : readValue(entry+valueFieldPos,valueFieldBytes);
+    uint64_t value = (valueBytes>0 && valueBytes<=valueFieldBytes) ? readValue(entry+valueFieldPos,valueBytes) : 0;
+
+    switch (tag) {
+    case ImageWidthTag: info.width = (unsigned short) value; break;
+    case ImageLengthTag: info.length = (unsigned short) value; break;
+    case BitsPerSampleTag: bitsPerSample = (unsigned int) value; break;
+    case CompressionTag: info.compression = (unsigned short) value; break;
+    case ImageDescriptionTag:
+      info.descriptionOffset = values;
+      info.descriptionBytes = (unsigned int) count;
+      break;
+    case StripOffsetsTag:
+      info.stripOffsets = values;
+      info.stripOffsetBytes = valueBytes;
+      numStripOffsets = (unsigned int) count;
+      break;
+    case SamplesPerPixelTag: samplesPerPixel = (unsigned int) value; break;
+    case RowsPerStripTag: info.rowsPerStrip = (unsigned int) value; break;
+    case StripByteCountsTag:
+      info.stripByteCounts = values;
+      info.stripByteCountBytes = valueBytes;
+      numStripByteCounts = (unsigned int) count;
+      break;
+    case PlanarConfigurationTag: planarConfiguration = (unsigned int) value; break;
+    case PredictorTag: info.predictor = (unsigned short) value; break;
+    case SampleFormatTag: info.sampleFormat = (unsigned short) value; break;
+    }
+  }
+
+  if (info.width==0 || info.length==0 || bitsPerSample==0 || bitsPerSample%8!=0 ||
+      samplesPerPixel!=1 || planarConfiguration!=1 ||
+      (info.compression!=1 && info.compression!=8) || (info.predictor!=1 && info.predictor!=2) ||
+      numStripOffsets==0 || numStripOffsets!=numStripByteCounts ||
+      info.stripOffsetBytes<2 || info.stripByteCountBytes<2) {
+    return false;
+  }
+  info.bytesPerPixel = (unsigned short) (bitsPerSample/8);
+  info.rowsPerStrip = std::min(info.rowsPerStrip,(unsigned int) info.length);
+  info.numStrips = numStripOffsets;
+  if (info.numStrips!=(info.length+info.rowsPerStrip-1)/info.rowsPerStrip) {
+    return false;
+  }
+
+  // Where the image data is, and whether it can be read in place.
+  uint64_t imageBytes = (uint64_t) info.width*info.length*info.bytesPerPixel;
+  uint64_t expected = 0;
+  info.contiguous = true;
+  for (unsigned int s=0;s<info.numStrips;s++) {
+    uint64_t offset, byteCount;
+    if (!readValueAt(info.stripOffsets+s*info.stripOffsetBytes,info.stripOffsetBytes,offset) ||
+        !readValueAt(info.stripByteCounts+s*info.stripByteCountBytes,info.stripByteCountBytes,byteCount)) {
+      return false;
+    }
+    if (s==0) {
+      info.dataOffset = offset;
+      expected = offset;
+    }
+    info.contiguous = info.contiguous && offset==expected;
+    expected = offset+byteCount;
+    info.dataEnd = std::max(info.dataEnd,offset+byteCount);
+  }
+  if (info.compression==1 && (!info.contiguous || info.dataEnd-info.dataOffset!=imageBytes)) {
+    info.contiguous = false; // read strip by strip
+  }
+  return true;
+}
+
+uint64_t
+TifStackReader::ifdOffset(uint64_t image) const
+{
+  return fStride!=0 ? fFirstIFD+image*fStride : fIFDs[(size_t) image];
+}
+
+bool
+TifStackReader::imageInfo(uint64_t frame, unsigned short channel, ImageInfo &info)
+{
+  assert(channel<fNumChannels);
+  if (frame>=numFrames() || !parseIFD(ifdOffset(frame*fNumChannels+channel),info)) {
+    return false;
+  }
+  if (info.width!=fImageWidth || info.length!=fImageLength || info.bytesPerPixel!=fBytesPerPixel) {
+    CONSOLEPRINT("TifStackReader: frame %lu has a different image size.\n",(unsigned long) frame);
+    return false;
+  }
+  return true;
+}
+
+bool
+TifStackReader::findFixedStride(const ImageInfo &first)
+{
+  // Compressed frames vary in size; a single image has no stride.
+  if (first.compression!=1 || first.nextIFD<=fFirstIFD) {
+    return false;
+  }
+  uint64_t stride = first.nextIFD-fFirstIFD;
+  uint64_t numImages = (fFileBytes-fFirstIFD)/stride;
+  if (numImages==0) {
+    return false;
+  }
+
+  // The last whole record must hold an IFD laid out as the first, ending
+  // the chain or pointing at the next record.
+  uint64_t lastIFD = fFirstIFD+(numImages-1)*stride;
+  ImageInfo last;
+  if (!parseIFD(lastIFD,last) ||
+      last.width!=first.width || last.length!=first.length || last.bytesPerPixel!=first.bytesPerPixel ||
+      last.compression!=1 || !last.contiguous ||
+      last.dataOffset-lastIFD!=first.dataOffset-fFirstIFD ||
+      last.descriptionOffset-lastIFD!=first.descriptionOffset-fFirstIFD ||
+      last.descriptionBytes!=first.descriptionBytes ||
+      (last.nextIFD!=0 && last.nextIFD!=lastIFD+stride)) {
+    return false;
+  }
+  fStride = stride;
+  fNumImages = numImages;
+  fComplete = last.nextIFD==0;
+  return true;
+}
+
+void
+TifStackReader::walkIFDs(void)
+{
+  unsigned int countBytes = fBigTiff ? 8 : 2;
+  unsigned int entryBytes = fBigTiff ? 20 : 12;
+  fIFDs.clear();
+  fComplete = false;
+  uint64_t offset = fFirstIFD;
+  while (offset!=0) {
+    uint64_t numEntries, next;
+    if (!readValueAt(offset,countBytes,numEntries) ||
+        !readValueAt(offset+countBytes+numEntries*entryBytes,getOffsetBytes(),next)) {
+      break; // the chain runs past the end of the file: still being logged
+    }
+    fIFDs.push_back(offset);
+    if (next!=0 && next<=offset) {
+      CONSOLEPRINT("TifStackReader: IFD chain loops back at %lu; stopping there.\n",(unsigned long) offset);
+      break;
+    }
+    offset = next;
+  }
+  fComplete = offset==0;
+
+  // Drop images whose data is not all there yet.
+  ImageInfo info;
+  while (!fIFDs.empty() && !(parseIFD(fIFDs.back(),info) && info.dataEnd<=fFileBytes)) {
+    fIFDs.pop_back();
+    fComplete = false;
+  }
+  fNumImages = fIFDs.size();
+}
+
+bool
+TifStackReader::loadSidecar(const std::string &sidecar)
+{
+  FILE *fh;
+  if (fopen_s(&fh,sidecar.c_str(),"rb")!=0) {
+    return false;
+  }
+  char header[SIDECAR_HEADER_BYTES];
+  unsigned int version = 0;
+  uint64_t fileBytes = 0, fileTime = 0, numImages = 0, firstIFD = 0, stride = 0;
+  bool ok = fread(header,1,sizeof(header),fh)==sizeof(header) && memcmp(header,SIDECAR_MAGIC,8)==0;
+  if (ok) {
+    memcpy(&version,header+8,4);
+    memcpy(&fileBytes,header+16,8);
+    memcpy(&fileTime,header+24,8);
+    memcpy(&numImages,header+32,8);
+    memcpy(&firstIFD,header+40,8);
+    memcpy(&stride,header+48,8);
+    // Stale if the TIFF changed since.
+    ok = version==SIDECAR_VERSION && fileBytes==fFileBytes && fileTime==fFileTime &&
+      firstIFD==fFirstIFD && numImages>0;
+  }
+  if (ok && stride==0) {
+    fIFDs.resize((size_t) numImages);
+    ok = fread(&fIFDs[0],sizeof(uint64_t),(size_t) numImages,fh)==numImages;
+  }
+  fclose(fh);
+  if (!ok) {
+    fIFDs.clear();
+    return false;
+  }
+  fStride = stride;
+  fNumImages = numImages;
+  fComplete = true;
+  return true;
+}
+
+void
+TifStackReader::saveSidecar(const std::string &sidecar) const
+{
+  char header[SIDECAR_HEADER_BYTES];
+  unsigned int u32[2] = {SIDECAR_VERSION, 0};
+  uint64_t u64[5] = {fFileBytes, fFileTime, fNumImages, fFirstIFD, fStride};
+  memcpy(header,SIDECAR_MAGIC,8);
+  memcpy(header+8,u32,8);
+  memcpy(header+16,u64,40);
+
+  FILE *fh;
+  if (fopen_s(&fh,sidecar.c_str(),"wb")!=0) {
+    CONSOLEPRINT("TifStackReader: could not write index %s; the file will be indexed again next time.\n",sidecar.c_str());
+    return;
+  }
+  bool ok = fwrite(header,1,sizeof(header),fh)==sizeof(header);
+  if (ok && fStride==0 && !fIFDs.empty()) {
+    ok = fwrite(&fIFDs[0],sizeof(uint64_t),fIFDs.size(),fh)==fIFDs.size();
+  }
+  fclose(fh);
+  if (!ok) {
+    CONSOLEPRINT("TifStackReader: error writing index %s.\n",sidecar.c_str());
+    remove(sidecar.c_str());
+  }
+}
+
+std::string
+TifStackReader::imageDescription(uint64_t frame, unsigned short channel)
+{
+  ImageInfo info;
+  const char *p = NULL;
+  if (imageInfo(frame,channel,info) && info.descriptionBytes>0) {
+    p = map(info.descriptionOffset,info.descriptionBytes);
+  }
+  if (p==NULL) {
+    return std::string();
+  }
+  // the count includes the nul
+  return std::string(p,strnlen(p,info.descriptionBytes));
+}
+
+unsigned long
+TifStackReader::frameTag(uint64_t frame)
+{
+  unsigned long tag = 0;
+  std::string description = imageDescription(frame,0);
+  if (sscanf_s(description.c_str(),FrameTag::FORMAT_STRING,&tag)!=1) {
+    return 0;
+  }
+  return tag;
+}
+
+const char*
+TifStackReader::frameData(uint64_t frame, unsigned short channel)
+{
+  ImageInfo info;
+  if (!imageInfo(frame,channel,info) || info.compression!=1 || !info.contiguous) {
+    return NULL;
+  }
+  return map(info.dataOffset,getBytesPerImage());
+}
+
+bool
+TifStackReader::copyImage(const ImageInfo &info, char *dst)
+{
+  unsigned int bytesPerRow = (unsigned int) info.width*info.bytesPerPixel;
+  for (unsigned int s=0;s<info.numStrips;s++) {
+    uint64_t offset, byteCount;
+    if (!readValueAt(info.stripOffsets+s*info.stripOffsetBytes,info.stripOffsetBytes,offset) ||
+        !readValueAt(info.stripByteCounts+s*info.stripByteCountBytes,info.stripByteCountBytes,byteCount)) {
+      return false;
+    }
+    unsigned int rows = std::min(info.rowsPerStrip,(unsigned int) info.length-s*info.rowsPerStrip);
+    unsigned int stripBytes = rows*bytesPerRow;
+    const char *src = map(offset,byteCount);
+    if (src==NULL) {
+      return false;
+    }
+
+    if (info.compression==1) {
+      if (byteCount!=stripBytes) {
+        return false;
+      }
+      memcpy(dst,src,stripBytes);
+    } else {
+      uLongf len = stripBytes;
+      if (uncompress(reinterpret_cast<Bytef*>(dst),&len,reinterpret_cast<const Bytef*>(src),(uLong) byteCount)!=Z_OK ||
+          len!=stripBytes) {
+        CONSOLEPRINT("TifStackReader: damaged strip at %lu.\n",(unsigned long) offset);
+        return false;
+      }
+      if (info.predictor==2) {
+        StripCodecs::horizontalAccumulate(dst,stripBytes,bytesPerRow,info.bytesPerPixel);
+      }
+    }
+    dst += stripBytes;
+  }
+  return true;
+}
+
+bool
+TifStackReader::copyFrames(uint64_t firstFrame, uint64_t numFrames,
+                           const unsigned short *channels, unsigned short numChannels, char *dst)
+{
+  if (firstFrame>this->numFrames() || numFrames>this->numFrames()-firstFrame) {
+    return false;
+  }
+  unsigned int imageBytes = getBytesPerImage();
+  for (uint64_t f=firstFrame;f<firstFrame+numFrames;f++) {
+    for (unsigned short c=0;c<numChannels;c++) {
+      if (channels[c]>=fNumChannels) {
+        return false;
+      }
+      ImageInfo info;
+      if (!imageInfo(f,channels[c],info) || !copyImage(info,dst)) {
+        CONSOLEPRINT("TifStackReader: could not read frame %lu channel %u.\n",(unsigned long) f,(unsigned int) channels[c]+1);
+        return false;
+      }
+      dst += imageBytes;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "Platform.h"
+
+// Random access to the frames of a TIFF or BigTIFF logged by TifWriter,
+// through a read-only mapping of the file.
+//
+// open() builds an index of the file's images (one per channel per
+// frame): for a file at a fixed stride, as TifWriter writes an
+// uncompressed file whose image is not reconfigured, the index is just
+// the first IFD and the stride, checked against the last IFD; otherwise
+// the IFD chain is walked once. The index is saved in a sidecar,
+// <file>.idx, next to the file, and reused while the file's size and
+// modification time match, so that reopening does not touch the IFDs.
+// A file still being logged (or cut short) is read up to its last
+// complete image and gets no sidecar.
+//
+// Images are addressed as frame and channel: image frame*numChannels +
+// channel, numChannels given to open (TIFFs do not record it).
+// Uncompressed images can be read in place (frameData); copyFrames
+// copies any range of frames and channels, inflating deflated strips.
+class TifStackReader {
+
+ public:
+
+  TifStackReader(void);
+
+  ~TifStackReader(void);
+
+  // Map fname and build or load its index. Returns false if the file
+  // cannot be opened or is not a TIFF TifWriter wrote. useSidecar false
+  // neither reads nor writes <fname>.idx.
+  bool open(const char *fname, unsigned short numChannels = 1, bool useSidecar = true);
+
+  void close(void);
+
+  bool isOpen(void) const;
+
+  // Image layout, from the first image; every image has it.
+  unsigned short imageWidth(void) const { return fImageWidth; }
+  unsigned short imageLength(void) const { return fImageLength; }
+  unsigned short bytesPerPixel(void) const { return fBytesPerPixel; }
+  unsigned short numChannels(void) const { return fNumChannels; }
+  bool signedData(void) const { return fSampleFormat==2; }
+  bool bigTiff(void) const { return fBigTiff; }
+
+  // Bytes of one channel's image.
+  unsigned int getBytesPerImage(void) const { return (unsigned int) fImageWidth*fImageLength*fBytesPerPixel; }
+
+  // Complete frames (all channels) in the file.
+  uint64_t numFrames(void) const { return fNumImages/fNumChannels; }
+
+  // The index is the first IFD and a stride, not a walked IFD chain.
+  bool fixedStride(void) const { return fStride!=0; }
+
+  // The index came from the sidecar.
+  bool indexFromSidecar(void) const { return fIndexFromSidecar; }
+
+  // Image description of a frame's channel, and the frame tag FrameLogger
+  // put at its start (0 if there is none).
+  std::string imageDescription(uint64_t frame, unsigned short channel = 0);
+  unsigned long frameTag(uint64_t frame);
+
+  // A channel of a frame, in place in the mapping: imageLength rows of
+  // imageWidth pixels. NULL if the image is compressed. The pointer is
+  // good until the next call on this reader (for a file too large to map
+  // whole, the mapping is a window that moves).
+  const char* frameData(uint64_t frame, unsigned short channel);
+
+  // Copy numFrames frames from firstFrame into dst: for each frame, the
+  // listed channels' images one after another. Returns false if a frame
+  // is out of range or an image cannot be read.
+  bool copyFrames(uint64_t firstFrame, uint64_t numFrames,
+                  const unsigned short *channels, unsigned short numChannels, char *dst);
+
+  static std::string sidecarName(const char *fname) { return std::string(fname) + ".idx"; }
+
+ private:
+  TifStackReader(const TifStackReader&);
+  TifStackReader& operator=(const TifStackReader&);
+
+  // Where an image's pieces are, from its IFD.
+  struct ImageInfo {
+    unsigned short width;
+    unsigned short length;
+    unsigned short bytesPerPixel;
+    unsigned short sampleFormat;
+    unsigned short compression; // 1 none, 8 deflate
+    unsigned short predictor;   // 1 none, 2 horizontal differencing
+    unsigned int rowsPerStrip;
+    uint64_t descriptionOffset;
+    unsigned int descriptionBytes;
+    unsigned int numStrips;
+    uint64_t stripOffsets; // where the values are: in the entry, or an array
+    unsigned int stripOffsetBytes; // bytes per value
+    uint64_t stripByteCounts;
+    unsigned int stripByteCountBytes;
+    uint64_t dataOffset;   // first strip
+    uint64_t dataEnd;      // end of the last strip
+    bool contiguous;               // strips back to back from dataOffset
+    uint64_t nextIFD;
+  };
+
+  // numBytes at offset, through the mapping; NULL past the end of the file.
+  const char* map(uint64_t offset, uint64_t numBytes);
+  void unmap(void);
+
+  // An offset, count or value of valueBytes (1, 2, 4 or 8) bytes.
+  static uint64_t readValue(const char *p, unsigned int valueBytes);
+  unsigned int getOffsetBytes(void) const { return fBigTiff ? 8 : 4; }
+  bool readValueAt(uint64_t offset, unsigned int valueBytes, uint64_t &value);
+
+  bool parseIFD(uint64_t ifdOffset, ImageInfo &info);
+  uint64_t ifdOffset(uint64_t image) const;
+  bool imageInfo(uint64_t frame, unsigned short channel, ImageInfo &info);
+
+  // Index building.
+  bool readFirstIFD(uint64_t &firstIFD);
+  bool findFixedStride(const ImageInfo &first);
+  void walkIFDs(void);
+  bool loadSidecar(const std::string &sidecar);
+  void saveSidecar(const std::string &sidecar) const;
+
+  bool copyImage(const ImageInfo &info, char *dst);
+
+ private:
+  Platform::MappedFile fFile;
+  uint64_t fFileBytes;
+  uint64_t fFileTime; // last write (Platform::MappedFile::writeTime)
+
+  // The mapped view: the whole file, or a window of it.
+  const char *fView;
+  uint64_t fViewOffset;
+  uint64_t fViewBytes;
+  bool fWholeFileMapped;
+
+  bool fBigTiff;
+  unsigned short fImageWidth;
+  unsigned short fImageLength;
+  unsigned short fBytesPerPixel;
+  unsigned short fSampleFormat;
+  unsigned short fNumChannels;
+
+  // Index: image i's IFD is at fFirstIFD + i*fStride, or fIFDs[i].
+  uint64_t fNumImages;
+  uint64_t fFirstIFD;
+  uint64_t fStride;
+  std::vector<uint64_t> fIFDs;
+  bool fComplete; // IFD chain ends where the file does
+  bool fIndexFromSidecar;
+};
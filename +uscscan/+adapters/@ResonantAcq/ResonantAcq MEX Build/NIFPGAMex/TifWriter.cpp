@@ -4,9 +4,11 @@
 // #include "stdafx.h"
 // #endif
 
-#include "stdafx.h"
 #include "TifWriter.h"
 #include <string>
+#include <string.h>
+#include <algorithm>
+#include "Misc.h"
 
 /*
 TIFWRITER IMPLEMENTATION NOTES
@@ -32,20 +34,69 @@ contains the actual image pixels.
 IFD   SuppIFD     Image Data
 |-----|---------|------------------|
 
+
+* BigTIFF. openTifFile(...,bigTiff=true) writes the same structure in
+BigTIFF form (see eg http://www.awaresystems.be/imaging/tiff/bigtiff.html):
+a 16-byte header, 8-byte entry counts and next-IFD offsets, 20-byte
+directory entries whose count and value/offset fields are 8 bytes, and
+LONG8 strip offsets and byte counts. Values of up to 8 bytes (the
+resolutions, single-strip offsets/counts) are then stored in the
+entry itself rather than the SuppIFD. Classic files stop taking frames
+at 4 GB.
+
+
+* Compression. With configureCompression(DEFLATE) each strip is
+deflated, after horizontal differencing if the predictor is on (see
+StripCompressor), and the IFD says so: Compression 8, plus a
+Predictor entry, 2 with differencing and 1 without. The header
+template is the same as for uncompressed frames apart from those, but
+the strip offsets and byte counts, and so the next IFD, depend on each
+frame's compressed size and are filled in per frame. Frames are still
+laid out as above, with the image data being the compressed strips
+back to back; they just no longer sit at a fixed stride.
+
+With configureCompression(LZ4) the file is not a TIFF but an LZ4 strip
+container, holding the same frames and image descriptions. All values
+are little-endian:
+
+Header (16 bytes): "USCLZ4S" and a nul, uint32 version (1), uint32 0.
+
+Then a record per frame (one channel), back to back:
+  uint32 recordBytes      the whole record, including this and padding
+  uint16 imageWidth, imageLength, bytesPerPixel,
+         sampleFormat     TIFF SampleFormat: 1 unsigned, 2 signed
+         rowsPerStrip, predictor (2 horizontal differencing, 1 none)
+  uint32 descriptionBytes including the nul
+  uint32 numStrips
+  uint32 stripBytes[numStrips]
+  the image description
+  the strips: LZ4 blocks, each decompressing to one strip's rows of
+  (differenced) samples
+  zero padding to a multiple of 8 bytes
+
 */  
 
 // used for padding
 static const char ZEROS[8] = {0,0,0,0,0,0,0,0};
 
+static const char CONTAINER_MAGIC[8] = {'U','S','C','L','Z','4','S',0};
+static const unsigned int CONTAINER_VERSION = 1;
+
 TifWriter::TifWriter(void) :
 fImageWidth(0),
 fImageLength(0),
 fBytesPerPixel(0),
 fNumChannels(0),
 fRowsPerStrip(0),
+fFrameHeader(NULL),
+fIFD(NULL),
 fSuppIFD(NULL),
 fSuppIFDSize(0),
-fTiffFH(NULL)
+fTiffFH(NULL),
+fUseAsyncIO(false),
+fLastIFDFileOffset(0),
+fBigTiff(false),
+fSizeLimitReached(false)
 {
   fSuppIFDOffsets.XResolution = 0;
   fSuppIFDOffsets.YResolution = 0;
@@ -69,32 +120,60 @@ TifWriter::~TifWriter() {
     closeTifFile();
   }
   assert(fTiffFH==NULL);
-  if (fSuppIFD!=NULL){
-    delete[] fSuppIFD;
-    fSuppIFD = NULL;
+  assert(!fAsyncWriter.isOpen());
+  if (fFrameHeader!=NULL){
+    delete[] fFrameHeader;
+    fFrameHeader = NULL;
   }
+  fIFD = NULL;
+  fSuppIFD = NULL;
 }
 
 bool TifWriter::isTifFileOpen(void) const {
-  return (fTiffFH!=NULL);
+  return (fTiffFH!=NULL || fAsyncWriter.isOpen());
+}
+
+void TifWriter::configureAsyncIO(bool enable, unsigned int bufferBytes, unsigned int numBuffers) {
+  assert(!isTifFileOpen());
+  fUseAsyncIO = enable;
+  fAsyncWriter.configure(bufferBytes,numBuffers);
+}
+
+void TifWriter::configureCompression(StripCompressor::Codec codec, int level, bool predictor, unsigned int numThreads) {
+  assert(!isTifFileOpen());
+  if (!fCompressor.start(codec,level,predictor,numThreads) && codec!=StripCompressor::NONE) {
+    handleErr("Could not start strip compression; writing uncompressed.\n");
+  }
+  if (fImageWidth>0) {
+    // already configured; the IFD's compression fields have changed
+    setupIFD();
+  }
 }
 
 void TifWriter::closeTifFile(void) {
+  if (fAsyncWriter.isOpen()) {
+    if (fLastIFDFileOffset!=0) {
+      // Terminate the IFD chain: zero the last IFD's next-IFD offset.
+      fAsyncWriter.patch(fLastIFDFileOffset+getNextIFDOffsetInIFD(),&(ZEROS[0]),getOffsetSize());
+    }
+    if (!fAsyncWriter.close()) {
+      handleErr("Error writing to TIFF file.");
+    }
+    fLastIFDFileOffset = 0;
+  }
+
   if (fTiffFH!=NULL) {
-    long int pos = ftell(fTiffFH);
-    unsigned int upos = pos;
-    if (upos!=TifWriter::FIRSTIFDFILEOFFSET) {
-      // a file is open, and the file ptr is not at the first ifd
-      // offset. that means that at least one frame has been written.
-
-      long int x = fFrameOffsets.NextIFD;
-      x *= -1;
-      x += 2+TifWriter::NUMFIELDS*TifWriter::DIRENTRYSIZE;
-      int ecode = fseek(fTiffFH,x,SEEK_CUR); //For long file spport, will need to replace with 64-bit version, e.g. _fseeki64. That alone is insufficient though. Probably need to replace fopen as well.      
+    if (fLastIFDFileOffset!=0) {
+      // at least one frame has been written. Seek to the last IFD by its
+      // recorded offset; the current fFrameOffsets may describe a
+      // different frame layout if the image was reconfigured since.
+      int64_t x = fLastIFDFileOffset+getNextIFDOffsetInIFD();
+      int ecode = _fseeki64(fTiffFH,x,SEEK_SET);
       if (ecode!=0) {
         handleErr("Error fseeking to last IFD.");
       }
-      writeToFile(&(ZEROS[0]),sizeof(unsigned int),1);
+      writeToFile(&(ZEROS[0]),sizeof(char),getOffsetSize());
+      fLastIFDFileOffset = 0;
     }
 
     fclose(fTiffFH);
@@ -102,27 +181,54 @@ void TifWriter::closeTifFile(void) {
   }
 }
 
-bool TifWriter::openTifFile(const char *fname, const char *modestr) {
+bool TifWriter::openTifFile(const char *fname, const char *modestr, bool bigTiff) {
 #ifdef TIFWRITER_DBG
-  mexPrintf("%s\n",__FUNCTION__);
+  CONSOLEPRINT("%s\n",__FUNCTION__);
 #endif
 
   if (isTifFileOpen()) {
     closeTifFile();
   }
-  if (fopen_s(&fTiffFH,fname,modestr)==0) {
+  fLastIFDFileOffset = 0;
+  fSizeLimitReached = false;
+
+  if (bigTiff!=fBigTiff) {
+    fBigTiff = bigTiff;
+    if (fImageWidth>0) {
+      // already configured; redo the IFD in the other format
+      setupIFD();
+    }
+  }
 
-    // 'II'
-    char tmp = 'I';
-    writeToFile(&tmp,sizeof(char),1);
-    writeToFile(&tmp,sizeof(char),1);
+  std::string containerName;
+  if (writesContainer()) {
+    containerName = std::string(fname) + ".lz4s";
+    fname = containerName.c_str();
+  }
 
-    // 42
-    unsigned short fortytwo = 42;
-    writeToFile(&fortytwo,sizeof(unsigned short),1);
+  if (fUseAsyncIO && modestr[0]=='w') {
+    if (!fAsyncWriter.open(fname)) {
+      return false;
+    }
+    if (writesContainer()) {
+      writeContainerHeader();
+      return true;
+    }
+    writeHeader();
 
-    // first IFD
-    writeToFile(&TifWriter::FIRSTIFDFILEOFFSET,sizeof(unsigned int),1);
+    // The padding up to the first IFD is written with the first frame
+    // (see writeSingleFrame).
+    return true;
+  }
+
+  if (fopen_s(&fTiffFH,fname,modestr)==0) {
+
+    if (writesContainer()) {
+      writeContainerHeader();
+      return true;
+    }
+
+    writeHeader();
 
     int ecode = fseek(fTiffFH,TifWriter::FIRSTIFDFILEOFFSET,SEEK_SET);
     if (ecode!=0) {
@@ -134,6 +240,35 @@ bool TifWriter::openTifFile(const char *fname, const char *modestr) {
   return false;
 }
 
+void TifWriter::writeHeader(void) {
+  // 'II'
+  char tmp = 'I';
+  writeToFile(&tmp,sizeof(char),1);
+  writeToFile(&tmp,sizeof(char),1);
+
+  if (fBigTiff) {
+    // 43, offset size 8, 0, first IFD
+    unsigned short hdr[3] = {43, 8, 0};
+    writeToFile(hdr,sizeof(unsigned short),3);
+    uint64_t firstIFD = TifWriter::FIRSTIFDFILEOFFSET;
+    writeToFile(&firstIFD,sizeof(uint64_t),1);
+  } else {
+    // 42
+    unsigned short fortytwo = 42;
+    writeToFile(&fortytwo,sizeof(unsigned short),1);
+
+    // first IFD
+    unsigned int firstIFD = TifWriter::FIRSTIFDFILEOFFSET;
+    writeToFile(&firstIFD,sizeof(unsigned int),1);
+  }
+}
+
+void TifWriter::writeContainerHeader(void) {
+  writeToFile(CONTAINER_MAGIC,sizeof(char),sizeof(CONTAINER_MAGIC));
+  unsigned int version[2] = {CONTAINER_VERSION, 0};
+  writeToFile(version,sizeof(unsigned int),2);
+}
+
 void TifWriter::configureImage(unsigned short imWidth, 
                                unsigned short imLength, 
                                unsigned short bytesPerPixel,
@@ -142,7 +277,7 @@ void TifWriter::configureImage(unsigned short imWidth,
                                const char *imageDescription,
                                unsigned int targetBytesPerFullStrip) {
 #ifdef TIFWRITER_DBG
-                                 mexPrintf("%s\n",__FUNCTION__);
+                                 CONSOLEPRINT("%s\n",__FUNCTION__);
 #endif
                                  CONSOLETRACE();
                                  assert(imWidth>0);
@@ -180,12 +315,12 @@ TifWriter::updateImageDescription(const char *imageDescription)
 
   fImageDescription = imageDescription;
 
-  if (fImageDescription.length() < 2) {
+  if (fImageDescription.length() < 8) {
     // Pad the image description, because at the moment the imagedesc
     // is always offset into the supplementary IFD. This requires that
-    // the description be longer than one character. (Actually the
-    // terminating newline probably suffices, but just to be safe...)
-    fImageDescription += "##";
+    // it (with its terminating nul) not fit in an entry's value field:
+    // 4 bytes, or 8 for BigTIFF.
+    fImageDescription.append(8-fImageDescription.length(),'#');
   }
 }
 
@@ -200,7 +335,7 @@ TifWriter::replaceImageDescription(const char *imageDescription)
 void TifWriter::modifyImageDescription(unsigned int loc, const char *buf, unsigned int len)
 {
   assert(loc<fImageDescription.length());
-  len = (unsigned int) min(len,fImageDescription.length()-loc);
+  len = (unsigned int) std::min((size_t) len,fImageDescription.length()-loc);
   fImageDescription.replace(loc,len,buf,len);
 //  CONSOLEPRINT("image description: %s, %d, %s\n",buf, len, fImageDescription.c_str());
   memcpy(fSuppIFD+fSuppIFDOffsets.ImageDescription+loc,buf,len);
@@ -211,7 +346,7 @@ void TifWriter::handleErr(const char *msg) const {
   if (msg!=NULL) { 
     errmsg += msg;
   }
-  mexPrintf(errmsg.c_str());
+  CONSOLEPRINT("%s",errmsg.c_str());
 }
 
 void TifWriter::putDirectoryEntryShort(void *loc,
@@ -220,7 +355,7 @@ void TifWriter::putDirectoryEntryShort(void *loc,
                                        unsigned int count,
                                        unsigned short value) {
 #ifdef TIFWRITER_DBG
-                                         mexPrintf("%s\n",__FUNCTION__);
+                                         CONSOLEPRINT("%s\n",__FUNCTION__);
 #endif
                                          char *p = (char*)loc;
 
@@ -228,22 +363,22 @@ void TifWriter::putDirectoryEntryShort(void *loc,
                                          p += sizeof(unsigned short);
                                          memcpy(p,&type,sizeof(unsigned short));
                                          p += sizeof(unsigned short);
-                                         memcpy(p,&count,sizeof(unsigned int));
-                                         p += sizeof(unsigned int);
+                                         putOffset(p,count);
+                                         p += getOffsetSize();
                                          memcpy(p,&value,sizeof(unsigned short));
                                          p += sizeof(unsigned short);
 
-                                         unsigned short tmp = 0;
-                                         memcpy(p,&tmp,sizeof(unsigned short));
+                                         // zero the rest of the value field
+                                         memcpy(p,&(ZEROS[0]),getOffsetSize()-sizeof(unsigned short));
 }
 
 void TifWriter::putDirectoryEntryWithOffset(void *loc,
                                             unsigned short tag,
                                             unsigned short type,
                                             unsigned int count,
-                                            unsigned int value) {
+                                            uint64_t value) {
 #ifdef TIFWRITER_DBG
-                                              mexPrintf("%s\n",__FUNCTION__);
+                                              CONSOLEPRINT("%s\n",__FUNCTION__);
 #endif
                                               char *p = (char*)loc;
 
@@ -251,25 +386,104 @@ void TifWriter::putDirectoryEntryWithOffset(void *loc,
                                               p += sizeof(unsigned short);
                                               memcpy(p,&type,sizeof(unsigned short));
                                               p += sizeof(unsigned short);
-                                              memcpy(p,&count,sizeof(unsigned int));
-                                              p += sizeof(unsigned int);
-                                              memcpy(p,&value,sizeof(unsigned int));
+                                              putOffset(p,count);
+                                              p += getOffsetSize();
+                                              putOffset(p,value);
+}
+
+void TifWriter::putOffset(void *loc, uint64_t value) const {
+  if (fBigTiff) {
+    memcpy(loc,&value,sizeof(uint64_t));
+  } else {
+    assert(value<=0xFFFFFFFF);
+    unsigned int v = (unsigned int) value;
+    memcpy(loc,&v,sizeof(unsigned int));
+  }
 }
 
 void TifWriter::setupIFD(void) {
 #ifdef TIFWRITER_DBG
-  mexPrintf("%s\n",__FUNCTION__);
+  CONSOLEPRINT("%s\n",__FUNCTION__);
 #endif
 
+  ////////////
+  // Layout //
+  ////////////
+
+  // Lay out the SuppIFD. Values too big for an IFD entry go here: the
+  // resolutions (classic TIFF only; a RATIONAL is 2*long, which fits
+  // in a BigTIFF entry), the image description, and the strip tables
+  // when there is more than one strip.
+  unsigned int sizeOfSupplementalIFD = 0;
+  if (!fBigTiff) {
+    fSuppIFDOffsets.XResolution = sizeOfSupplementalIFD;
+    sizeOfSupplementalIFD += 2*sizeof(unsigned int);
+    fSuppIFDOffsets.YResolution = sizeOfSupplementalIFD;
+    sizeOfSupplementalIFD += 2*sizeof(unsigned int);
+  }
+
+  fSuppIFDOffsets.ImageDescription = sizeOfSupplementalIFD;
+  sizeOfSupplementalIFD += ((unsigned int) fImageDescription.length()+1)*sizeof(char); //std::string::length() does not account for nul-terminate
+
+  fStripOffsetsAndStripByteCountsAreInIFD = (getStripsPerFrame()==1);
+  if (fStripOffsetsAndStripByteCountsAreInIFD) {
+    fSuppIFDOffsets.StripOffsets = 0; // set to arbitrary value; should be unused
+    fSuppIFDOffsets.StripByteCounts = 0; // set to arbitrary value; should be unused
+  } else {
+    fSuppIFDOffsets.StripOffsets = sizeOfSupplementalIFD;
+    sizeOfSupplementalIFD += getStripsPerFrame()*getOffsetSize();
+    fSuppIFDOffsets.StripByteCounts = sizeOfSupplementalIFD;
+    sizeOfSupplementalIFD += getStripsPerFrame()*getOffsetSize();
+  }
+
+  fSuppIFDSize = sizeOfSupplementalIFD;
+
+  //// Initialize file offsets. These values are the offsets in the
+  //// tiff file of the suppIFD and image data relative to byte 0 of
+  //// the IFD. The point of the computations here is that we place the
+  //// suppIFD and image data at 8-byte boundaries (for no real reason).
+  unsigned int IFDBlocksOfEight = (getIFDSize()+7)/8;
+  fFrameOffsets.SuppIFD = IFDBlocksOfEight*8;
+
+  unsigned int TotalIFDSize = fFrameOffsets.SuppIFD + fSuppIFDSize;
+  unsigned int TotalIFDBlocksOfEight = (TotalIFDSize+7)/8;
+  fFrameOffsets.ImageData = TotalIFDBlocksOfEight*8;
+
+  unsigned int TotalSubfileSize = fFrameOffsets.ImageData + getBytesPerFrame();
+  unsigned int TotalSubfileBlocksOfEight = (TotalSubfileSize+7)/8;
+  fFrameOffsets.NextIFD = TotalSubfileBlocksOfEight*8;
+
+  //// Allocate the frame header template: IFD, padding, SuppIFD,
+  //// padding, up to the image data. Everything in it other than the
+  //// file offsets (see updateOffsetsInIFDAndSuppIFD) and the image
+  //// description is fixed from here on, and each frame's header is
+  //// written from it in one piece.
+  if (fFrameHeader!=NULL) {
+    delete[] fFrameHeader;
+    fFrameHeader = NULL;
+  }
+  fFrameHeader = new char[fFrameOffsets.ImageData];
+  if (fFrameHeader==NULL) {
+    handleErr("Problem allocating frame header.");
+  }
+  memset(fFrameHeader,0,fFrameOffsets.ImageData);
+  fIFD = fFrameHeader;
+  fSuppIFD = fFrameHeader + fFrameOffsets.SuppIFD;
+
   /////////
   // IFD //
   /////////
 
   // number of directory entries
-  unsigned short numdirs = TifWriter::NUMFIELDS;
-  memcpy(&(fIFD[0]),&numdirs,sizeof(unsigned short));
+  if (fBigTiff) {
+    uint64_t numdirs = getNumFields();
+    memcpy(&(fIFD[0]),&numdirs,sizeof(uint64_t));
+  } else {
+    unsigned short numdirs = (unsigned short) getNumFields();
+    memcpy(&(fIFD[0]),&numdirs,sizeof(unsigned short));
+  }
 
-  putDirectoryEntryShort(&(fIFD[2+TifWriter::ImageWidthField*TifWriter::DIRENTRYSIZE]),
+  putDirectoryEntryShort(getDirEntry(TifWriter::ImageWidthField),
     256, // Tag value here and in the following
     // are taken directly from TIFF
     // spec. Could create an enum, but these
@@ -278,147 +492,130 @@ void TifWriter::setupIFD(void) {
     TifWriter::SHORTTIFFTYPE,
     1,
     fImageWidth);
-  putDirectoryEntryShort(&(fIFD[2+TifWriter::ImageLengthField*TifWriter::DIRENTRYSIZE]),
+  putDirectoryEntryShort(getDirEntry(TifWriter::ImageLengthField),
     257,
     TifWriter::SHORTTIFFTYPE,
     1,
     fImageLength);
-  putDirectoryEntryShort(&(fIFD[2+TifWriter::BitsPerSampleField*TifWriter::DIRENTRYSIZE]),
+  putDirectoryEntryShort(getDirEntry(TifWriter::BitsPerSampleField),
     258,
     TifWriter::SHORTTIFFTYPE,
     1,
     fBytesPerPixel*8);
-  putDirectoryEntryShort(&(fIFD[2+TifWriter::CompressionField*TifWriter::DIRENTRYSIZE]),
+  putDirectoryEntryShort(getDirEntry(TifWriter::CompressionField),
     259,
     TifWriter::SHORTTIFFTYPE,
     1,
-    1); // no compression
-  putDirectoryEntryShort(&(fIFD[2+TifWriter::PhotometricInterpretationField*TifWriter::DIRENTRYSIZE]),
+    hasPredictorField() ? 8 : 1); // Adobe deflate, or no compression
+  putDirectoryEntryShort(getDirEntry(TifWriter::PhotometricInterpretationField),
     262,
     TifWriter::SHORTTIFFTYPE,
     1,
     1); // black is zero
-  putDirectoryEntryShort(&(fIFD[2+TifWriter::RowsPerStripField*TifWriter::DIRENTRYSIZE]),
+  putDirectoryEntryShort(getDirEntry(TifWriter::RowsPerStripField),
     278,
     TifWriter::SHORTTIFFTYPE,
     1,
     fRowsPerStrip);
-  putDirectoryEntryShort(&(fIFD[2+TifWriter::ResolutionUnitField*TifWriter::DIRENTRYSIZE]),
+  putDirectoryEntryShort(getDirEntry(TifWriter::ResolutionUnitField),
     296,
     TifWriter::SHORTTIFFTYPE,
     1,
     2); // inches
-  putDirectoryEntryShort(&(fIFD[2+TifWriter::OrientationField*TifWriter::DIRENTRYSIZE]),
+  if (hasPredictorField()) {
+    putDirectoryEntryShort(getDirEntry(TifWriter::PredictorField),
+      317,
+      TifWriter::SHORTTIFFTYPE,
+      1,
+      fCompressor.predictor() ? 2 : 1); // horizontal differencing, or none
+  }
+  putDirectoryEntryShort(getDirEntry(TifWriter::OrientationField),
     274,
     TifWriter::SHORTTIFFTYPE,
     1,
     1); // 0th row is visual top, 0th col is visual left
-  putDirectoryEntryShort(&(fIFD[2+TifWriter::SamplesPerPixelField*TifWriter::DIRENTRYSIZE]),
+  putDirectoryEntryShort(getDirEntry(TifWriter::SamplesPerPixelField),
     277,
     TifWriter::SHORTTIFFTYPE,
     1,
     1); // grayscale
-  putDirectoryEntryShort(&(fIFD[2+TifWriter::PlanarConfigurationField*TifWriter::DIRENTRYSIZE]),
+  putDirectoryEntryShort(getDirEntry(TifWriter::PlanarConfigurationField),
     284,
     TifWriter::SHORTTIFFTYPE,
     1,
     1); // 'chunky' (irrelevant since numSamplesPerPixel=1)
-  putDirectoryEntryShort(&(fIFD[2+TifWriter::SampleFormatField*TifWriter::DIRENTRYSIZE]),
+  putDirectoryEntryShort(getDirEntry(TifWriter::SampleFormatField),
     339,
     TifWriter::SHORTTIFFTYPE,
     1,
     fSampleFormat); // either unsigned or signed 2's complement
 
-  //////////////////////
-  // Supplemental IFD //
-  //////////////////////
-
-  unsigned int sizeOfSupplementalIFD = 0;
+  unsigned int resNum = 72*16*16*16*16*16*16;
+  unsigned int resDen = 1*16*16*16*16*16*16;  
+  uint64_t resRational = ((uint64_t) resDen << 32) | resNum;
 
-  putDirectoryEntryWithOffset(&(fIFD[2+TifWriter::XResolutionField*TifWriter::DIRENTRYSIZE]),
+  putDirectoryEntryWithOffset(getDirEntry(TifWriter::XResolutionField),
     282,
     TifWriter::RATIONALTIFFTYPE,
     1,
-    0); // value is irrelevant, will be overwritten later
-  fSuppIFDOffsets.XResolution = sizeOfSupplementalIFD;
-  sizeOfSupplementalIFD += 2*sizeof(unsigned int); // RATIONAL type is 2*LONG
-
-  putDirectoryEntryWithOffset(&(fIFD[2+TifWriter::YResolutionField*TifWriter::DIRENTRYSIZE]),
+    fBigTiff ? resRational : 0); // classic: value is irrelevant, will be overwritten later
+  putDirectoryEntryWithOffset(getDirEntry(TifWriter::YResolutionField),
     283,
     TifWriter::RATIONALTIFFTYPE,
     1,
-    0);
-  fSuppIFDOffsets.YResolution = sizeOfSupplementalIFD;
-  sizeOfSupplementalIFD += 2*sizeof(unsigned int); // RATIONAL type is 2*LONG
+    fBigTiff ? resRational : 0);
 
-  putDirectoryEntryWithOffset(&(fIFD[2+TifWriter::ImageDescriptionField*TifWriter::DIRENTRYSIZE]),
+  putDirectoryEntryWithOffset(getDirEntry(TifWriter::ImageDescriptionField),
     270,
     TifWriter::ASCIITIFFTYPE,
     (unsigned int) fImageDescription.length()+1,
     0);
-  fSuppIFDOffsets.ImageDescription = sizeOfSupplementalIFD;
-  sizeOfSupplementalIFD += ((unsigned int) fImageDescription.length()+1)*sizeof(char); //std::string::length() does not account for nul-terminate
 
-  if (getStripsPerFrame()==1) {
-    // stripOffsets, stripByteCounts can be stored directly in IFD.
-    fStripOffsetsAndStripByteCountsAreInIFD = true;
+  // Strip offsets and byte counts are long, or LONG8 in BigTIFF.
+  unsigned short stripType = fBigTiff ? TifWriter::LONG8TIFFTYPE : TifWriter::LONGTIFFTYPE;
 
-    putDirectoryEntryShort(&(fIFD[2+TifWriter::StripOffsetsField*TifWriter::DIRENTRYSIZE]),
+  if (fStripOffsetsAndStripByteCountsAreInIFD) {
+    // stripOffsets, stripByteCounts can be stored directly in IFD.
+    putDirectoryEntryWithOffset(getDirEntry(TifWriter::StripOffsetsField),
       273,
-      TifWriter::LONGTIFFTYPE,
+      stripType,
       getStripsPerFrame(),
       0); // irrelevant value, will be set later
-    fSuppIFDOffsets.StripOffsets = 0; // set to arbitrary value; should be unused
 
-    putDirectoryEntryShort(&(fIFD[2+TifWriter::StripByteCountsField*TifWriter::DIRENTRYSIZE]),
+    putDirectoryEntryWithOffset(getDirEntry(TifWriter::StripByteCountsField),
       279,
-      TifWriter::LONGTIFFTYPE,
+      stripType,
       getStripsPerFrame(),
       getBytesPerFrame());
-    fSuppIFDOffsets.StripByteCounts = 0; // set to arbitrary value; should be unused
 
-  } else if (getStripsPerFrame()>1) {
+  } else {
     // stripOffsets, stripByteCounts need to be stored in SuppIFD.
-    fStripOffsetsAndStripByteCountsAreInIFD = false;
 
-    putDirectoryEntryWithOffset(&(fIFD[2+TifWriter::StripOffsetsField*TifWriter::DIRENTRYSIZE]),
+    putDirectoryEntryWithOffset(getDirEntry(TifWriter::StripOffsetsField),
       273,
-      TifWriter::LONGTIFFTYPE,
+      stripType,
       getStripsPerFrame(),
       0); // irrelevant value, will be set later
-    fSuppIFDOffsets.StripOffsets = sizeOfSupplementalIFD;
-    sizeOfSupplementalIFD += getStripsPerFrame()*sizeof(unsigned int);
 
-    putDirectoryEntryWithOffset(&(fIFD[2+TifWriter::StripByteCountsField*TifWriter::DIRENTRYSIZE]),
+    putDirectoryEntryWithOffset(getDirEntry(TifWriter::StripByteCountsField),
       279,
-      TifWriter::LONGTIFFTYPE,
+      stripType,
       getStripsPerFrame(),
       0); // irrelevant value, will be set later
-    fSuppIFDOffsets.StripByteCounts = sizeOfSupplementalIFD;
-    sizeOfSupplementalIFD += getStripsPerFrame()*sizeof(unsigned int);
   }
 
-  fSuppIFDSize = sizeOfSupplementalIFD;
-
-  //// Initialize SuppIFD.
-
-  if (fSuppIFD!=NULL) {
-    delete[] fSuppIFD;
-    fSuppIFD = NULL;
-  }
-  fSuppIFD = new char[fSuppIFDSize];
-  if (fSuppIFD==NULL) {
-    handleErr("Problem allocating supplementary IFD.");
-  }
+  //////////////////////
+  // Supplemental IFD //
+  //////////////////////
 
   // Fill in offset/supplemental data. 
 
-  unsigned int resNum = 72*16*16*16*16*16*16;
-  unsigned int resDen = 1*16*16*16*16*16*16;  
-  memcpy(fSuppIFD+fSuppIFDOffsets.XResolution,&resNum,sizeof(unsigned int));
-  memcpy(fSuppIFD+fSuppIFDOffsets.XResolution+sizeof(unsigned int),&resDen,sizeof(unsigned int));
-  memcpy(fSuppIFD+fSuppIFDOffsets.YResolution,&resNum,sizeof(unsigned int));
-  memcpy(fSuppIFD+fSuppIFDOffsets.YResolution+sizeof(unsigned int),&resDen,sizeof(unsigned int));
+  if (!fBigTiff) {
+    memcpy(fSuppIFD+fSuppIFDOffsets.XResolution,&resNum,sizeof(unsigned int));
+    memcpy(fSuppIFD+fSuppIFDOffsets.XResolution+sizeof(unsigned int),&resDen,sizeof(unsigned int));
+    memcpy(fSuppIFD+fSuppIFDOffsets.YResolution,&resNum,sizeof(unsigned int));
+    memcpy(fSuppIFD+fSuppIFDOffsets.YResolution+sizeof(unsigned int),&resDen,sizeof(unsigned int));
+  }
 
   memcpy(fSuppIFD+fSuppIFDOffsets.ImageDescription,fImageDescription.c_str(),
     (fImageDescription.length()+1)*sizeof(char));
@@ -427,8 +624,7 @@ void TifWriter::setupIFD(void) {
     // Initialize strip offsets in supp IFD (irrelevant, will be updated later)
     unsigned int numStrips = getStripsPerFrame();
     for (unsigned int c=0;c<numStrips;++c) {
-      unsigned int val = 0;
-      memcpy(fSuppIFD+fSuppIFDOffsets.StripOffsets+c*sizeof(unsigned int),&val,sizeof(unsigned int));
+      putOffset(fSuppIFD+fSuppIFDOffsets.StripOffsets+c*getOffsetSize(),0);
     }
 
     // strip bytecounts
@@ -436,117 +632,113 @@ void TifWriter::setupIFD(void) {
     unsigned int bytesPerFullStrip = getBytesPerFullStrip();
     unsigned int sizeFinalStrip = getBytesPerFrame() % bytesPerFullStrip;
     for (unsigned int c=0;c<numFullStrips;++c) {
-      memcpy(fSuppIFD+fSuppIFDOffsets.StripByteCounts+c*sizeof(unsigned int),
-        &bytesPerFullStrip,sizeof(unsigned int));
+      putOffset(fSuppIFD+fSuppIFDOffsets.StripByteCounts+c*getOffsetSize(),bytesPerFullStrip);
     }
     if (sizeFinalStrip>0) {
       assert(getStripsPerFrame() > getNumFullStripsPerFrame());
-      memcpy(fSuppIFD+fSuppIFDOffsets.StripByteCounts+numFullStrips*sizeof(unsigned int),
-        &sizeFinalStrip,sizeof(unsigned int));
+      putOffset(fSuppIFD+fSuppIFDOffsets.StripByteCounts+numFullStrips*getOffsetSize(),sizeFinalStrip);
     }
   }
+}
 
-  //// Initialize file offsets. These values are the offsets in the
-  //// tiff file of the suppIFD and image data relative to byte 0 of
-  //// the IFD. The point of the computations here is that we place the
-  //// suppIFD and image data at 8-byte boundaries (for no real reason).
-  unsigned int IFDBlocksOfEight = (TifWriter::IFDSIZE+7)/8;
-  fFrameOffsets.SuppIFD = IFDBlocksOfEight*8;
-
-  unsigned int TotalIFDSize = fFrameOffsets.SuppIFD + fSuppIFDSize;
-  unsigned int TotalIFDBlocksOfEight = (TotalIFDSize+7)/8;
-  fFrameOffsets.ImageData = TotalIFDBlocksOfEight*8;
-
-  unsigned int TotalSubfileSize = fFrameOffsets.ImageData + getBytesPerFrame();
-  unsigned int TotalSubfileBlocksOfEight = (TotalSubfileSize+7)/8;
-  fFrameOffsets.NextIFD = TotalSubfileBlocksOfEight*8;
+char* TifWriter::getDirEntry(unsigned int field) {
+  assert(field!=TifWriter::PredictorField || hasPredictorField());
+  if (field>TifWriter::PredictorField && !hasPredictorField()) {
+    field--;
+  }
+  return fIFD+getIFDHeaderSize()+field*getDirEntrySize();
 }
 
-void TifWriter::updateOffsetsInIFDAndSuppIFD(unsigned int IFDFileOffset) {
+void TifWriter::updateOffsetsInIFDAndSuppIFD(uint64_t IFDFileOffset) {
 #ifdef TIFWRITER_DBG
-  mexPrintf("%s\n",__FUNCTION__);
+  CONSOLEPRINT("%s\n",__FUNCTION__);
 #endif
 
-  assert(IFDFileOffset>=0);
-
-  unsigned int actualSuppIFDFileOffset = IFDFileOffset + fFrameOffsets.SuppIFD;
+  uint64_t actualSuppIFDFileOffset = IFDFileOffset + fFrameOffsets.SuppIFD;
+  unsigned int valueOffset = getValueOffsetInField();
 
   // update offsets in IFD
-  unsigned int offset = actualSuppIFDFileOffset + fSuppIFDOffsets.XResolution;
-  memcpy(fIFD+2+TifWriter::XResolutionField*TifWriter::DIRENTRYSIZE+TifWriter::VALUEOFFSETINFIELD,
-    &offset,
-    sizeof(unsigned int));
-
-  offset = actualSuppIFDFileOffset + fSuppIFDOffsets.YResolution;
-  memcpy(fIFD+2+TifWriter::YResolutionField*TifWriter::DIRENTRYSIZE+TifWriter::VALUEOFFSETINFIELD,
-    &offset,
-    sizeof(unsigned int));
+  if (!fBigTiff) {
+    putOffset(getDirEntry(TifWriter::XResolutionField)+valueOffset,
+      actualSuppIFDFileOffset + fSuppIFDOffsets.XResolution);
+    putOffset(getDirEntry(TifWriter::YResolutionField)+valueOffset,
+      actualSuppIFDFileOffset + fSuppIFDOffsets.YResolution);
+  }
 
-  offset = actualSuppIFDFileOffset + fSuppIFDOffsets.ImageDescription;
-  memcpy(fIFD+2+TifWriter::ImageDescriptionField*TifWriter::DIRENTRYSIZE+TifWriter::VALUEOFFSETINFIELD,
-    &offset,
-    sizeof(unsigned int));
+  putOffset(getDirEntry(TifWriter::ImageDescriptionField)+valueOffset,
+    actualSuppIFDFileOffset + fSuppIFDOffsets.ImageDescription);
 
   if (!fStripOffsetsAndStripByteCountsAreInIFD) {
-    offset = actualSuppIFDFileOffset + fSuppIFDOffsets.StripOffsets;
-    memcpy(fIFD+2+TifWriter::StripOffsetsField*TifWriter::DIRENTRYSIZE+TifWriter::VALUEOFFSETINFIELD,
-      &offset,
-      sizeof(unsigned int));
-
-    offset = actualSuppIFDFileOffset + fSuppIFDOffsets.StripByteCounts;
-    memcpy(fIFD+2+TifWriter::StripByteCountsField*TifWriter::DIRENTRYSIZE+TifWriter::VALUEOFFSETINFIELD,
-      &offset,
-      sizeof(unsigned int));
+    putOffset(getDirEntry(TifWriter::StripOffsetsField)+valueOffset,
+      actualSuppIFDFileOffset + fSuppIFDOffsets.StripOffsets);
+    putOffset(getDirEntry(TifWriter::StripByteCountsField)+valueOffset,
+      actualSuppIFDFileOffset + fSuppIFDOffsets.StripByteCounts);
   }
 
   // update offset of next IFD
-  offset = IFDFileOffset + fFrameOffsets.NextIFD;
-  memcpy(fIFD+2+TifWriter::NUMFIELDS*TifWriter::DIRENTRYSIZE,
-    &offset,
-    sizeof(unsigned int));
+  putOffset(fIFD+getNextIFDOffsetInIFD(),IFDFileOffset + fFrameOffsets.NextIFD);
 
   // update strip offsets
   unsigned int numStrips = getStripsPerFrame();
   for (unsigned int c=0;c<numStrips;++c) {
-    unsigned int stripFileOffset 
+    uint64_t stripFileOffset 
       = IFDFileOffset + fFrameOffsets.ImageData + c*getBytesPerFullStrip();
 
-    if (fStripOffsetsAndStripByteCountsAreInIFD) {
-      assert(c==0); // should only be one strip
-      memcpy(fIFD+2+TifWriter::StripOffsetsField*TifWriter::DIRENTRYSIZE+TifWriter::VALUEOFFSETINFIELD,
-        &stripFileOffset,
-        sizeof(unsigned int));
-    } else {
-      memcpy(fSuppIFD+fSuppIFDOffsets.StripOffsets+c*sizeof(unsigned int),
-        &stripFileOffset,
-        sizeof(unsigned int));
-    }
+    putStripValue(TifWriter::StripOffsetsField,fSuppIFDOffsets.StripOffsets,c,stripFileOffset);
   }
 
 }
 
+void TifWriter::updateStripsForCompressedFrame(uint64_t IFDFileOffset, unsigned int channel,
+                                               unsigned int recordBytes) {
+  uint64_t stripFileOffset = IFDFileOffset + fFrameOffsets.ImageData;
+  unsigned int numStrips = getStripsPerFrame();
+  assert(numStrips==fCompressor.stripsPerFrame());
+  for (unsigned int c=0;c<numStrips;++c) {
+    unsigned int stripBytes = fCompressor.compressedStripBytes(channel,c);
+    putStripValue(TifWriter::StripOffsetsField,fSuppIFDOffsets.StripOffsets,c,stripFileOffset);
+    putStripValue(TifWriter::StripByteCountsField,fSuppIFDOffsets.StripByteCounts,c,stripBytes);
+    stripFileOffset += stripBytes;
+  }
+
+  putOffset(fIFD+getNextIFDOffsetInIFD(),IFDFileOffset + recordBytes);
+}
+
+void TifWriter::putStripValue(unsigned int field, unsigned int suppIFDOffset, unsigned int c, uint64_t value) {
+  if (fStripOffsetsAndStripByteCountsAreInIFD) {
+    assert(c==0); // should only be one strip
+    putOffset(getDirEntry(field)+getValueOffsetInField(),value);
+  } else {
+    putOffset(fSuppIFD+suppIFDOffset+c*getOffsetSize(),value);
+  }
+}
+
 void TifWriter::writeToFile(const void* buf, size_t sz, size_t cnt) {
+  if (fAsyncWriter.isOpen()) {
+    // AsyncFileWriter reports the failure itself, once.
+    fAsyncWriter.append(buf,sz*cnt);
+    return;
+  }
   size_t n = fwrite(buf,sz,cnt,fTiffFH);
   if (n<cnt) {
     handleErr("Error writing to TIFF file.");
   }
 }
 
+uint64_t TifWriter::filePosition(void) const {
+  if (fAsyncWriter.isOpen()) {
+    return fAsyncWriter.position();
+  }
+  return (uint64_t) _ftelli64(fTiffFH);
+}
+
 void TifWriter::writeIFD(void) {
 #ifdef TIFWRITER_DBG
-  mexPrintf("%s\n",__FUNCTION__);
+  CONSOLEPRINT("%s\n",__FUNCTION__);
 #endif
 
-  writeToFile(&(fIFD[0]),sizeof(char),TifWriter::IFDSIZE);
-
-  unsigned int numPadBytes = fFrameOffsets.SuppIFD - TifWriter::IFDSIZE;
-  writeToFile(&(ZEROS[0]),sizeof(char),numPadBytes);
-
-  writeToFile(fSuppIFD,sizeof(char),fSuppIFDSize);
-  //CONSOLEPRINT("WRITING TO FILE: image description: %s\n",fSuppIFD+fSuppIFDOffsets.ImageDescription);
-
-  numPadBytes = fFrameOffsets.ImageData - (fFrameOffsets.SuppIFD + fSuppIFDSize);
-  writeToFile(&(ZEROS[0]),sizeof(char),numPadBytes);
+  // IFD, SuppIFD and the padding after each, in one write.
+  writeToFile(fFrameHeader,sizeof(char),fFrameOffsets.ImageData);
 
   // file pointer now at start of ImageData for this frame
 }
@@ -556,14 +748,17 @@ void TifWriter::writeIFD(void) {
 // pointing at the current file location.
 void TifWriter::writeSingleFrame(const char *imageBuf, unsigned int sz) {
 #ifdef TIFWRITER_DBG
-  mexPrintf("%s\n",__FUNCTION__);
+  CONSOLEPRINT("%s\n",__FUNCTION__);
 #endif
 
   assert(imageBuf!=NULL);
   assert(sz==getBytesPerFrame());
 
-  long int pos = ftell(fTiffFH);
-  unsigned int upos = pos;
+  uint64_t upos = beginFrame(fFrameOffsets.NextIFD);
+  if (upos==0) {
+    return;
+  }
+  fLastIFDFileOffset = upos;
 
   updateOffsetsInIFDAndSuppIFD(upos);
 
@@ -575,13 +770,109 @@ void TifWriter::writeSingleFrame(const char *imageBuf, unsigned int sz) {
   writeToFile(&(ZEROS[0]),sizeof(char),numPadBytes);
 }
 
+uint64_t TifWriter::beginFrame(unsigned int recordBytes) {
+  if (writesContainer()) {
+    return filePosition();
+  }
+
+  if (fAsyncWriter.isOpen() && filePosition()<TifWriter::FIRSTIFDFILEOFFSET) {
+    // first frame: fill the gap the fopen path leaves by fseeking.
+    fAsyncWriter.appendZeros(TifWriter::FIRSTIFDFILEOFFSET-filePosition());
+  }
+
+  uint64_t upos = filePosition();
+  if (!fBigTiff && upos+recordBytes > 0xFFFFFFFF) {
+    // Classic TIFF offsets are 32-bit. Stop here rather than write a
+    // frame that cannot be addressed.
+    if (!fSizeLimitReached) {
+      handleErr("TIFF file has reached 4 GB; further frames are not written. Use BigTIFF for larger files.\n");
+      fSizeLimitReached = true;
+    }
+    return 0;
+  }
+  return upos;
+}
+
+void TifWriter::writeCompressedFrame(unsigned int channel) {
+  unsigned int imageBytes = fCompressor.compressedFrameBytes(channel);
+  unsigned int recordBytes = (fFrameOffsets.ImageData+imageBytes+7)/8*8;
+  uint64_t upos = beginFrame(recordBytes);
+  if (upos==0) {
+    return;
+  }
+  fLastIFDFileOffset = upos;
+
+  updateOffsetsInIFDAndSuppIFD(upos);
+  updateStripsForCompressedFrame(upos,channel,recordBytes);
+
+  writeIFD();
+
+  unsigned int numStrips = fCompressor.stripsPerFrame();
+  for (unsigned int c=0;c<numStrips;++c) {
+    writeToFile(fCompressor.compressedStrip(channel,c),sizeof(char),fCompressor.compressedStripBytes(channel,c));
+  }
+
+  writeToFile(&(ZEROS[0]),sizeof(char),recordBytes-(fFrameOffsets.ImageData+imageBytes));
+}
+
+void TifWriter::writeContainerRecord(unsigned int channel) {
+  unsigned int numStrips = fCompressor.stripsPerFrame();
+  unsigned int descriptionBytes = (unsigned int) fImageDescription.length()+1;
+  unsigned int headerBytes = 4 + 6*sizeof(unsigned short) + 4 + 4 + 4*numStrips;
+  unsigned int unpaddedBytes = headerBytes + descriptionBytes + fCompressor.compressedFrameBytes(channel);
+  unsigned int recordBytes = (unpaddedBytes+7)/8*8;
+
+  std::vector<char> header(headerBytes);
+  char *p = &header[0];
+  unsigned short predictor = fCompressor.predictor() ? 2 : 1;
+  unsigned short fields[6] = {fImageWidth, fImageLength, fBytesPerPixel, fSampleFormat, fRowsPerStrip, predictor};
+  memcpy(p,&recordBytes,4);
+  p += 4;
+  memcpy(p,fields,sizeof(fields));
+  p += sizeof(fields);
+  memcpy(p,&descriptionBytes,4);
+  p += 4;
+  memcpy(p,&numStrips,4);
+  p += 4;
+  for (unsigned int c=0;c<numStrips;++c) {
+    unsigned int stripBytes = fCompressor.compressedStripBytes(channel,c);
+    memcpy(p,&stripBytes,4);
+    p += 4;
+  }
+
+  writeToFile(&header[0],sizeof(char),headerBytes);
+  writeToFile(fImageDescription.c_str(),sizeof(char),descriptionBytes);
+  for (unsigned int c=0;c<numStrips;++c) {
+    writeToFile(fCompressor.compressedStrip(channel,c),sizeof(char),fCompressor.compressedStripBytes(channel,c));
+  }
+  writeToFile(&(ZEROS[0]),sizeof(char),recordBytes-unpaddedBytes);
+}
+
 void TifWriter::writeFramesForAllChannels(const char *buf, unsigned int sz) {
 #ifdef TIFWRITER_DBG
-  mexPrintf("%s\n",__FUNCTION__);
+  CONSOLEPRINT("%s\n",__FUNCTION__);
 #endif
 
   unsigned int bpf = getBytesPerFrame();
   assert(sz>=fNumChannels*bpf);
+
+  if (fCompressor.codec()!=StripCompressor::NONE) {
+    // All channels' strips in one batch, so the workers have as many
+    // to share as possible.
+    if (!fCompressor.compressFrames(buf,fNumChannels,bpf,getBytesPerFullStrip(),getBytesPerRow(),fBytesPerPixel)) {
+      handleErr("Strip compression failed; frame not written.\n");
+      return;
+    }
+    for (unsigned short c=0;c<fNumChannels;++c) {
+      if (writesContainer()) {
+        writeContainerRecord(c);
+      } else {
+        writeCompressedFrame(c);
+      }
+    }
+    return;
+  }
+
   const char *p = buf;
 
   for (unsigned short c=0;c<fNumChannels;++c) {
@@ -590,6 +881,20 @@ void TifWriter::writeFramesForAllChannels(const char *buf, unsigned int sz) {
   }
 }
 
+bool TifWriter::preallocate(unsigned long numFrames) {
+  assert(isTifFileOpen());
+  assert(fImageWidth>0); // configured
+
+  uint64_t numBytes = TifWriter::FIRSTIFDFILEOFFSET
+    + (uint64_t) numFrames*fNumChannels*getBytesPerFrameRecord();
+  bool reserved = fAsyncWriter.isOpen() ? fAsyncWriter.reserveSpace(numBytes) : Platform::reserveFileSpace(fTiffFH,numBytes);
+  if (!reserved) {
+    handleErr("Could not preallocate TIFF file.\n");
+    return false;
+  }
+  return true;
+}
+
 void TifWriter::writeTestFile(void) {
   // simple test with two iamges
 
@@ -674,7 +979,7 @@ void TifWriter::writeTestFile(void) {
 // 	for (unsigned int c=0;c<NRUN;++c) {
 // 		LARGE_INTEGER pcTic11,  pcToc11, pcFreq11;
 // 		QueryPerformanceFrequency(&pcFreq11);
-// 		LONGLONG pcDiff11;
+// 		int64_t pcDiff11;
 // 		QueryPerformanceCounter(&pcTic11);
 // 	/*	
 // 		for (int z=0;z<8;z++) {
@@ -789,7 +1094,7 @@ void TifWriter::writeTestFile(void) {
 //   fprintf(fDbgFH,"writeFramesAllChan\n");
 //   LARGE_INTEGER pcTic,  pcToc, pcFreq;
 //   QueryPerformanceFrequency(&pcFreq);
-//   LONGLONG pcDiff;
+//   int64_t pcDiff;
 //   QueryPerformanceCounter(&pcTic);
 // #endif
 
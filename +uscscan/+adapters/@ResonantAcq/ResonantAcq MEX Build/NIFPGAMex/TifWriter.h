@@ -1,8 +1,11 @@
 #pragma once
 
 #include <string>
+#include "AsyncFileWriter.h"
+#include "FrameWriter.h"
+#include "StripCompressor.h"
 
-class TifWriter {
+class TifWriter : public FrameWriter {
 
 public:
 
@@ -14,9 +17,35 @@ public:
 
 	void closeTifFile(void);
 
+	// FrameWriter
+	bool isFileOpen(void) const { return isTifFileOpen(); }
+	bool openFile(const char *fname, const char *modestr, bool bigTiff) { return openTifFile(fname,modestr,bigTiff); }
+	void closeFile(void) { closeTifFile(); }
+
+	// Write files opened for writing ('w' modes) through an AsyncFileWriter,
+	// which packs IFDs and image data for consecutive frames into large
+	// aligned buffers and keeps up to numBuffers of them being written at
+	// once. Takes effect from the next openTifFile. Disabled, writes go
+	// through fwrite.
+	void configureAsyncIO(bool enable, 
+		unsigned int bufferBytes = AsyncFileWriter::DEFAULT_BUFFER_BYTES,
+		unsigned int numBuffers = AsyncFileWriter::DEFAULT_NUM_BUFFERS);
+
+	// Compress each strip losslessly, on numThreads worker threads plus the thread calling
+	// writeFramesForAllChannels. DEFLATE writes a standard TIFF (compression 8, Adobe deflate;
+	// level is the zlib level), with horizontal differencing (predictor 2) if predictor is set.
+	// LZ4 has no TIFF compression code, so files are written as an LZ4 strip container instead,
+	// with ".lz4s" appended to the name passed to openTifFile (see the implementation notes).
+	// NONE, the default, writes uncompressed TIFFs. Call while no file is open.
+	void configureCompression(StripCompressor::Codec codec,
+		int level = StripCompressor::DEFAULT_DEFLATE_LEVEL,
+		bool predictor = true,
+		unsigned int numThreads = 0);
+
 	// closes an existing file if one is open. returns true if open successful, false otherwise.
 	// this opens the file, writes the initial TIFF header, and fseeks to the first IFD loc.
-	bool openTifFile(const char *fname, const char *modestr = "wbn");
+	// bigTiff: write a BigTIFF (64-bit offsets) rather than a classic TIFF, which is limited to 4 GB.
+	bool openTifFile(const char *fname, const char *modestr = "wbn", bool bigTiff = false);
 
 	// Call this before calling write*. It is assumed that there is a single sample per pixel.
 	// The default of 8192 bytes/full strip is recommended by the TIFF spec (and eg libtiff).
@@ -46,6 +75,17 @@ public:
 
 	void writeFramesForAllChannels(const char *buf, unsigned int sz);
 
+	// Bytes one frame (one channel) takes in the file: IFD, SuppIFD, image data and padding.
+	// Frames are written at this fixed stride until the image is reconfigured. With compression
+	// this is an upper bound, for uncompressed image data; compressed frames take less.
+	unsigned int getBytesPerFrameRecord(void) const { return fFrameOffsets.NextIFD; }
+
+	// Reserve disk space for numFrames frames (all channels) at the current image configuration,
+	// so that the filesystem allocates the file up front rather than as it grows. Call after
+	// openTifFile and configureImage. The file size itself is unchanged. With compression the
+	// reservation is for uncompressed frames.
+	bool preallocate(unsigned long numFrames);
+
 	static void writeTestFile(void);
 
 private:
@@ -73,25 +113,74 @@ private:
 		unsigned short tag,
 		unsigned short type,
 		unsigned int count,
-		unsigned int value);
+		uint64_t value);
+
+	// Store an offset (or count, or value) in the file's offset size: 4 bytes, 8 for BigTIFF.
+	void putOffset(void *loc, uint64_t value) const;
+
+	// IFD layout, which differs between classic TIFF and BigTIFF.
+	unsigned int getOffsetSize(void) const { return fBigTiff ? 8 : 4; }
+	unsigned int getDirEntrySize(void) const { return fBigTiff ? TifWriter::BIGDIRENTRYSIZE : TifWriter::DIRENTRYSIZE; }
+	unsigned int getIFDHeaderSize(void) const { return fBigTiff ? 8 : 2; } // entry count
+	unsigned int getNextIFDOffsetInIFD(void) const { return getIFDHeaderSize()+getNumFields()*getDirEntrySize(); }
+	unsigned int getIFDSize(void) const { return getNextIFDOffsetInIFD()+getOffsetSize(); }
+	unsigned int getValueOffsetInField(void) const { return 4+getOffsetSize(); } // tag, type, count
+	char* getDirEntry(unsigned int field);
+
+	// The Predictor field is only written for compressed (deflate) TIFFs, so that uncompressed
+	// files are laid out as they always were.
+	bool hasPredictorField(void) const { return fCompressor.codec()==StripCompressor::DEFLATE; }
+	unsigned int getNumFields(void) const { return hasPredictorField() ? TifWriter::NUMFIELDS : TifWriter::NUMFIELDS-1; }
+
+	// True if files are LZ4 strip containers rather than TIFFs.
+	bool writesContainer(void) const { return fCompressor.codec()==StripCompressor::LZ4; }
+
+	// 'II', version and first IFD offset.
+	void writeHeader(void);
+
+	// Container magic and version, in place of the TIFF header.
+	void writeContainerHeader(void);
 
 
-	// Initialize IFD and SuppIFD state.
+	// Initialize IFD and SuppIFD state: lay out a frame and build the frame header template.
 	void setupIFD(void);
 
 	// Given the file offset of the start of a frame, update the offset values in the IFD/suppIFD.
-	void updateOffsetsInIFDAndSuppIFD(unsigned int IFDFileOffset);
+	void updateOffsetsInIFDAndSuppIFD(uint64_t IFDFileOffset);
 
-	// fwrite with errcheck
+	// Then, for channel's compressed frame, overwrite the strip offsets, strip byte counts and
+	// next-IFD offset, which depend on the compressed sizes. recordBytes is the frame's size in
+	// the file, padding included.
+	void updateStripsForCompressedFrame(uint64_t IFDFileOffset, unsigned int channel,
+		unsigned int recordBytes);
+
+	// Store strip c's offset or byte count, in the IFD entry itself when there is one strip.
+	void putStripValue(unsigned int field, unsigned int suppIFDOffset, unsigned int c, uint64_t value);
+
+	// fwrite with errcheck. Appends to the async writer when it is in use.
 	void writeToFile(const void* buf, size_t sz, size_t cnt);
 
-	// This writes the IFD and suppIFD and leaves the fileptr at the location for the imagedata for the frame.
+	// Offset at which the next writeToFile lands.
+	uint64_t filePosition(void) const;
+
+	// This writes the IFD and suppIFD (the frame header template, in one write) and leaves the fileptr
+	// at the location for the imagedata for the frame.
 	void writeIFD(void); 
 
 	// Writes one frame/IFD to the current file. sz is redundant, it must equal the value returned by
 	// getPixelsPerFrame(). the file ptr ends up at the loc for the next ifd.
 	void writeSingleFrame(const char *buf, unsigned int sz);
 
+	// Writes one channel's frame from the compressor's output: as a TIFF frame with its strip
+	// tables patched to the compressed sizes, or as a container record.
+	void writeCompressedFrame(unsigned int channel);
+	void writeContainerRecord(unsigned int channel);
+
+	// Pads the first frame of an async file out to FIRSTIFDFILEOFFSET, and checks that a frame
+	// record of recordBytes fits in a classic TIFF. Returns the offset to write the frame at, or
+	// 0 if it does not fit.
+	uint64_t beginFrame(unsigned int recordBytes);
+
 	// Number of samples assumed to be one (grayscale image).
 	unsigned short fImageWidth;
 	unsigned short fImageLength;
@@ -108,7 +197,8 @@ private:
 		ASCIITIFFTYPE,
 		SHORTTIFFTYPE,
 		LONGTIFFTYPE,
-		RATIONALTIFFTYPE
+		RATIONALTIFFTYPE,
+		LONG8TIFFTYPE = 16  // BigTIFF
 	};
 
 	// TIFF fields currently used by TifWriter
@@ -133,6 +223,7 @@ private:
 		PlanarConfigurationField,       //284, supplementalIFD
 
 		ResolutionUnitField,            //296
+		PredictorField,                 //317, deflate only
 		SampleFormatField,              //339, supplemental IFD
 
 		NUMFIELDS
@@ -142,9 +233,12 @@ private:
 	static const unsigned int IFDSIZE = 2+TifWriter::NUMFIELDS*TifWriter::DIRENTRYSIZE+4;
 	static const unsigned int VALUEOFFSETINFIELD = 8; // in a field, the value or offset-to-value starts at byte 8
 	static const unsigned int FIRSTIFDFILEOFFSET = 104; // divisible by 8
+	static const unsigned int BIGDIRENTRYSIZE = 20;
 
-	char fIFD[TifWriter::IFDSIZE];
-
+	// Per-frame header template, from the IFD up to the image data
+	// (fFrameOffsets.ImageData bytes). fIFD and fSuppIFD point into it.
+	char *fFrameHeader;
+	char *fIFD;
 	char *fSuppIFD;
 	unsigned int fSuppIFDSize;
 	struct { // offsets into the suppIFD for various field data
@@ -167,4 +261,13 @@ private:
 	} fFrameOffsets;
 
 	FILE *fTiffFH;
+
+	AsyncFileWriter fAsyncWriter;
+	bool fUseAsyncIO;
+	uint64_t fLastIFDFileOffset; // file offset of the last IFD written, 0 if none
+
+	bool fBigTiff;
+	bool fSizeLimitReached; // classic TIFF reached 4 GB
+
+	StripCompressor fCompressor;
 };
@@ -18,8 +18,10 @@
 
 #include "StateModelObject.h"
 #include "Misc.h"
+#include "MexMisc.h"
 #include "AsyncMex.h" 
 #include "FrameQueue.h"
+#include "MulticastFrameQueue.h"
 #include "FrameCopier.h"
 #include "TifWriter.h"
 #include "MatlabParams.h"
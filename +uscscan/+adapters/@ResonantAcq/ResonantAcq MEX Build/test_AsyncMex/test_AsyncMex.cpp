@@ -0,0 +1,127 @@
+// test_AsyncMex.cpp : Defines the entry point for the console application.
+//
+// Test for AsyncMex coalesced events under a minimum event interval.
+// This thread plays the Matlab thread, pumping its message queue; a
+// poster thread posts short bursts of events, each ending well inside
+// the interval, and then waits without posting or flushing. Checks:
+// * every burst is delivered in full within a few intervals of its
+// end, ie events held back by the interval are not stranded;
+// * events are coalesced, and callbacks are (roughly) an interval
+// apart.
+//
+// Build as a console app with ../NIFPGAMex on the include path, linking
+// AsyncMex.c from that project.
+
+#include <tchar.h>
+#include <process.h>
+#include "stdio.h"
+#include "AsyncMex.h"
+
+static const double MIN_INTERVAL = 0.1; // seconds
+static const unsigned long NUM_BURSTS = 5;
+static const unsigned long BURST_EVENTS = 10;
+static const DWORD WAIT_AFTER_BURST_MS = 400; // 4 intervals
+
+struct TestState {
+	AsyncMex *asyncM;
+	volatile LONG numDelivered; // written by the callback
+	volatile LONG numCallbacks;
+	LONGLONG lastCallbackTicks;
+	LONGLONG minCallbackGapTicks;
+	volatile LONG posterDone;
+	unsigned long numStranded; // bursts not delivered in time
+};
+
+static void eventCallback(LPARAM lParam, void *userData)
+{
+	TestState *ts = static_cast<TestState*>(userData);
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	if (ts->numCallbacks>0) {
+		LONGLONG gap = now.QuadPart-ts->lastCallbackTicks;
+		if (ts->minCallbackGapTicks==0 || gap<ts->minCallbackGapTicks) {
+			ts->minCallbackGapTicks = gap;
+		}
+	}
+	ts->lastCallbackTicks = now.QuadPart;
+	InterlockedExchangeAdd(&ts->numDelivered,(LONG)lParam);
+	InterlockedIncrement(&ts->numCallbacks);
+}
+
+static unsigned int WINAPI posterFcn(LPVOID userData)
+{
+	TestState *ts = static_cast<TestState*>(userData);
+	LONG numPosted = 0;
+	for (unsigned long burst=0;burst<NUM_BURSTS;burst++) {
+		for (unsigned long i=0;i<BURST_EVENTS;i++) {
+			AsyncMex_postCoalescedEvent(ts->asyncM);
+			numPosted++;
+			Sleep(1);
+		}
+		Sleep(WAIT_AFTER_BURST_MS);
+		LONG numDelivered = ts->numDelivered;
+		if (numDelivered!=numPosted) {
+			printf("FAIL: burst %lu: %ld of %ld events delivered %lu ms after it ended\n",
+				burst,numDelivered,numPosted,WAIT_AFTER_BURST_MS);
+			ts->numStranded++;
+		}
+	}
+	InterlockedExchange(&ts->posterDone,1);
+	return 0;
+}
+
+int _tmain(int argc, _TCHAR* argv[])
+{
+	TestState ts;
+	ts.numDelivered = 0;
+	ts.numCallbacks = 0;
+	ts.lastCallbackTicks = 0;
+	ts.minCallbackGapTicks = 0;
+	ts.posterDone = 0;
+	ts.numStranded = 0;
+
+	// Make sure this thread has a message queue before anyone posts to it.
+	MSG msg;
+	PeekMessage(&msg,NULL,0,0,PM_NOREMOVE);
+	ts.asyncM = AsyncMex_create(eventCallback,&ts);
+	if (ts.asyncM==NULL) {
+		printf("FAIL: AsyncMex_create\n");
+		return 1;
+	}
+	AsyncMex_setMinEventInterval(ts.asyncM,MIN_INTERVAL);
+
+	HANDLE poster = (HANDLE)_beginthreadex(NULL,0,posterFcn,&ts,0,NULL);
+	while (!ts.posterDone) {
+		while (PeekMessage(&msg,NULL,0,0,PM_REMOVE)) {
+		}
+		Sleep(1);
+	}
+	WaitForSingleObject(poster,INFINITE);
+	CloseHandle(poster);
+
+	LARGE_INTEGER freq;
+	QueryPerformanceFrequency(&freq);
+	double minGap = (double)ts.minCallbackGapTicks/freq.QuadPart;
+	printf("events: %lu, delivered: %ld, callbacks: %ld, min gap: %.3f s\n",
+		NUM_BURSTS*BURST_EVENTS,ts.numDelivered,ts.numCallbacks,minGap);
+
+	int failures = 0;
+	if (ts.numStranded>0) {
+		failures++;
+	}
+	if (ts.numCallbacks>=(LONG)(NUM_BURSTS*BURST_EVENTS)) {
+		printf("FAIL: events were not coalesced\n");
+		failures++;
+	}
+	// Timers are only good to a scheduler tick or so.
+	if (ts.numCallbacks>1 && minGap<MIN_INTERVAL/2) {
+		printf("FAIL: callbacks %.3f s apart, under the minimum interval of %.3f s\n",
+			minGap,MIN_INTERVAL);
+		failures++;
+	}
+
+	AsyncMex_destroy(&ts.asyncM);
+
+	printf(failures==0 ? "PASS\n" : "FAILED\n");
+	return failures==0 ? 0 : 1;
+}
@@ -0,0 +1,157 @@
+// test_DisplayAverager.cpp : Defines the entry point for the console application.
+//
+// Test for DisplayAverager. Feeds pseudo-random int16 frames (with the
+// extreme pixel values mixed in) through BOXCAR and EXPONENTIAL
+// averaging, with SIMD enabled and disabled, and checks every emitted
+// average against a straightforward recomputation: the truncated mean
+// of the last numFrames frames, or a per-pixel float EMA rounded half
+// away from zero. Also checks the emit cadence, including the automatic
+// interval, and that reset() starts over. Frame lengths include ragged
+// ones that are not multiples of the SSE2 block size. Finally checks
+// that an overlong BOXCAR window is clamped, so that a full window of
+// the most negative pixel averages without overflowing the sums.
+//
+// Build as a console app with ../NIFPGAMex and .. on the include path,
+// linking DisplayAverager.cpp, FrameKernels.cpp, Misc.cpp and
+// PlatformWin32.cpp from that project.
+
+#include <tchar.h>
+#include "stdio.h"
+#include <vector>
+#include "DisplayAverager.h"
+#include "FrameKernels.h"
+
+static unsigned long gSeed = 4321;
+
+static int16_t randomPixel(void)
+{
+	gSeed = gSeed*1103515245 + 12345;
+	unsigned long r = gSeed>>8;
+	return (r%17==0) ? (int16_t) -32768 : (r%19==0) ? (int16_t) 32767 : (int16_t) (r*2654435761u);
+}
+
+static int16_t referenceRound(float x)
+{
+	int v = (int) (x + (x<0.0f ? -0.5f : 0.5f));
+	return (int16_t) (v>32767 ? 32767 : v<-32768 ? -32768 : v);
+}
+
+static bool runCase(DisplayAverager::Mode mode, size_t numPixels, unsigned int numFrames,
+	double weight, unsigned int interval, unsigned int expectedInterval)
+{
+	const unsigned int NUM_INPUT_FRAMES = 3*numFrames + 2*expectedInterval + 5;
+	bool ok = true;
+
+	for (int simd=0;simd<2 && ok;simd++) {
+		FrameKernels::setSIMDEnable(simd!=0);
+		DisplayAverager avg;
+		avg.configure(mode,numPixels,numFrames,weight,interval);
+		if (avg.interval()!=expectedInterval) {
+			printf("interval is %u, expected %u\n",avg.interval(),expectedInterval);
+			return false;
+		}
+
+		// Twice over, to check reset() starts over.
+		for (int pass=0;pass<2 && ok;pass++) {
+			avg.reset();
+			std::vector< std::vector<int16_t> > frames;
+			std::vector<float> ema(numPixels);
+			unsigned int numEmitted = 0;
+			for (unsigned int f=0;f<NUM_INPUT_FRAMES && ok;f++) {
+				frames.push_back(std::vector<int16_t>(numPixels));
+				for (size_t i=0;i<numPixels;i++)
+					frames.back()[i] = randomPixel();
+				for (size_t i=0;i<numPixels;i++)
+					ema[i] = (f==0) ? (float) frames.back()[i] : ema[i] + (float) weight*((float) frames.back()[i]-ema[i]);
+
+				bool due = avg.addFrame(&frames.back()[0]);
+				if (due!=((f+1)%expectedInterval==0)) {
+					printf("frame %u: averaged frame due is %d\n",f,(int) due);
+					ok = false;
+					break;
+				}
+				if (!due)
+					continue;
+				numEmitted++;
+
+				std::vector<int16_t> result(numPixels);
+				avg.computeAverage(&result[0]);
+				size_t first = (mode==DisplayAverager::BOXCAR && frames.size()>numFrames) ? frames.size()-numFrames : 0;
+				for (size_t i=0;i<numPixels;i++) {
+					int16_t expected;
+					if (mode==DisplayAverager::BOXCAR) {
+						long sum = 0;
+						for (size_t k=first;k<frames.size();k++)
+							sum += frames[k][i];
+						expected = (int16_t) (sum/(long) (frames.size()-first));
+					} else {
+						expected = referenceRound(ema[i]);
+					}
+					if (result[i]!=expected) {
+						printf("%s, %u pixels, simd %d, frame %u: pixel %u is %d, expected %d\n",
+						       mode==DisplayAverager::BOXCAR ? "boxcar" : "exponential",(unsigned) numPixels,
+						       simd,f,(unsigned) i,(int) result[i],(int) expected);
+						ok = false;
+						break;
+					}
+				}
+			}
+			if (ok && numEmitted!=NUM_INPUT_FRAMES/expectedInterval) {
+				printf("emitted %u averaged frames\n",numEmitted);
+				ok = false;
+			}
+		}
+	}
+	FrameKernels::setSIMDEnable(true);
+	return ok;
+}
+
+static bool runClampCase(void)
+{
+	DisplayAverager avg;
+	avg.configure(DisplayAverager::BOXCAR,1,DisplayAverager::MAX_BOXCAR_FRAMES+10,0,0);
+	if (avg.interval()!=DisplayAverager::MAX_BOXCAR_FRAMES) {
+		printf("clamp: interval %u, expected %u\n",avg.interval(),DisplayAverager::MAX_BOXCAR_FRAMES);
+		return false;
+	}
+	const int16_t frame = -32768;
+	for (unsigned int f=0;f<DisplayAverager::MAX_BOXCAR_FRAMES+10;f++) {
+		avg.addFrame(&frame);
+	}
+	int16_t out = 0;
+	avg.computeAverage(&out);
+	if (avg.framesAveraged()!=DisplayAverager::MAX_BOXCAR_FRAMES || out!=frame) {
+		printf("clamp: %lu frames averaged to %d\n",avg.framesAveraged(),(int) out);
+		return false;
+	}
+	return true;
+}
+
+int _tmain(int argc, _TCHAR* argv[])
+{
+	printf("SIMD available: %d\n",(int) FrameKernels::simdEnabled());
+
+	static const size_t lengths[] = { 1, 7, 8, 9, 1031 };
+	bool ok = true;
+	for (size_t l=0;l<sizeof(lengths)/sizeof(lengths[0]);l++) {
+		size_t n = lengths[l];
+		ok = runCase(DisplayAverager::BOXCAR,n,4,0,0,4) && ok;
+		ok = runCase(DisplayAverager::BOXCAR,n,5,0,1,1) && ok;
+		ok = runCase(DisplayAverager::BOXCAR,n,16,0,3,3) && ok;
+		ok = runCase(DisplayAverager::BOXCAR,n,1,0,0,1) && ok;
+		ok = runCase(DisplayAverager::EXPONENTIAL,n,1,0.25,0,4) && ok;
+		ok = runCase(DisplayAverager::EXPONENTIAL,n,1,0.1,2,2) && ok;
+		ok = runCase(DisplayAverager::EXPONENTIAL,n,1,1.0,0,1) && ok;
+	}
+
+	if (DisplayAverager::modeFromString("boxcar")!=DisplayAverager::BOXCAR ||
+	    DisplayAverager::modeFromString("exponential")!=DisplayAverager::EXPONENTIAL ||
+	    DisplayAverager::modeFromString("none")!=DisplayAverager::NONE) {
+		printf("modeFromString failed\n");
+		ok = false;
+	}
+	ok = runClampCase() && ok;
+
+	printf(ok ? "PASS\n" : "FAILED\n");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,281 @@
+// test_DisplayPrep.cpp : Defines the entry point for the console application.
+//
+// Test for DisplayPrep and DisplayPreparer. Prepares pseudo-random
+// int16 frames (with the extreme pixel values mixed in) of one and four
+// channels, binned by 1, 2 and 3 (so frame sizes that do not divide
+// evenly), showing all channels or a subset in a different order,
+// separately and merged, and checks every output byte against a
+// straightforward recomputation: the truncated mean of each bin, mapped
+// linearly from [black white] to [0 255], and for a merge, the sum of
+// each channel in its colour, saturated. Levels include white below
+// black. Then runs frames through a DisplayPreparer between a display
+// queue and a prepared queue, as in the MEX, and checks that each frame
+// arrives prepared, with its tag, and that each is announced downstream;
+// and that new levels are taken up.
+//
+// Build as a console app with ../NIFPGAMex and .. on the include path,
+// linking DisplayPrep.cpp, DisplayPreparer.cpp, MulticastFrameQueue.cpp,
+// PipelineParams.cpp, PipelineStats.cpp, PipelineTrace.cpp,
+// RawFrameWriter.cpp, AsyncFileWriter.cpp, Misc.cpp and
+// PlatformWin32.cpp from that project.
+
+#include <tchar.h>
+#include "stdio.h"
+#include <vector>
+#include <windows.h>
+#include "Misc.h"
+#include "DisplayPrep.h"
+#include "DisplayPreparer.h"
+#include "MulticastFrameQueue.h"
+#include "PipelineStats.h"
+
+static unsigned long gSeed = 8765;
+
+static int16_t randomPixel(void)
+{
+	gSeed = gSeed*1103515245 + 12345;
+	unsigned long r = gSeed>>8;
+	return (r%17==0) ? (int16_t) -32768 : (r%19==0) ? (int16_t) 32767 : (int16_t) (r*2654435761u);
+}
+
+static const double COLORS[4][3] = { {0,1,0}, {1,0,1}, {0.5,0.5,0}, {0.25,1,1} };
+
+static uint8_t referenceLevel(int v, int black, int white)
+{
+	if (white<=black)
+		white = black+1;
+	if (v<=black)
+		return 0;
+	if (v>=white)
+		return 255;
+	return (uint8_t) (((double) v-(double) black)*255.0/((double) white-(double) black)+0.5);
+}
+
+// The binned value of output pixel (r,c) of plane p.
+static int referenceBin(const std::vector<int16_t> &frame, size_t p, size_t lines, size_t pixels,
+	unsigned int bin, size_t r, size_t c)
+{
+	long sum = 0;
+	for (unsigned int i=0;i<bin;i++)
+		for (unsigned int j=0;j<bin;j++)
+			sum += frame[p*lines*pixels + (r*bin+i)*pixels + c*bin+j];
+	return (int) (sum/(long) (bin*bin));
+}
+
+static bool runCase(size_t numPlanes, size_t lines, size_t pixels, unsigned int bin,
+	const std::vector<int> &channels, bool merge, const int levels[4][2])
+{
+	DisplayPrep prep;
+	for (int chan=0;chan<4;chan++) {
+		prep.setLevels(chan,levels[chan][0],levels[chan][1]);
+		prep.setColor(chan,COLORS[chan][0],COLORS[chan][1],COLORS[chan][2]);
+	}
+	prep.configure(numPlanes,lines,pixels,bin,channels,merge);
+
+	std::vector<int> shown(channels);
+	if (shown.empty())
+		for (size_t p=0;p<numPlanes;p++)
+			shown.push_back((int) p);
+	size_t outLines = lines/bin;
+	size_t outPixels = pixels/bin;
+	size_t outPlanes = merge ? 3 : shown.size();
+	if (prep.outputLines()!=outLines || prep.outputPixels()!=outPixels || prep.outputPlanes()!=outPlanes ||
+		prep.outputBytes()!=outLines*outPixels*outPlanes) {
+		printf("%u x %u x %u, bin %u: output is %u x %u x %u\n",(unsigned) numPlanes,(unsigned) lines,
+			(unsigned) pixels,bin,(unsigned) prep.outputLines(),(unsigned) prep.outputPixels(),(unsigned) prep.outputPlanes());
+		return false;
+	}
+
+	for (int f=0;f<3;f++) {
+		std::vector<int16_t> frame(numPlanes*lines*pixels);
+		for (size_t i=0;i<frame.size();i++)
+			frame[i] = randomPixel();
+		std::vector<uint8_t> out(prep.outputBytes()+1,0xAB);
+		prep.prepare(&frame[0],&out[0]);
+		if (out.back()!=0xAB) {
+			printf("wrote past the end of the output\n");
+			return false;
+		}
+
+		for (size_t r=0;r<outLines;r++) {
+			for (size_t c=0;c<outPixels;c++) {
+				unsigned int rgb[3] = {0,0,0};
+				for (size_t i=0;i<shown.size();i++) {
+					int p = shown[i];
+					uint8_t v = referenceLevel(referenceBin(frame,p,lines,pixels,bin,r,c),levels[p][0],levels[p][1]);
+					if (!merge) {
+						uint8_t got = out[i*outLines*outPixels + c*outLines + r];
+						if (got!=v) {
+							printf("%u planes, %u x %u, bin %u, frame %d: channel %d pixel (%u,%u) is %d, expected %d\n",
+								(unsigned) numPlanes,(unsigned) lines,(unsigned) pixels,bin,f,p+1,
+								(unsigned) r,(unsigned) c,(int) got,(int) v);
+							return false;
+						}
+					}
+					for (int k=0;k<3;k++)
+						rgb[k] += v*(unsigned int) (COLORS[p][k]*256.0+0.5);
+				}
+				if (merge) {
+					for (int k=0;k<3;k++) {
+						unsigned int expected = (rgb[k]+128)>>8;
+						if (expected>255)
+							expected = 255;
+						uint8_t got = out[k*outLines*outPixels + c*outLines + r];
+						if (got!=expected) {
+							printf("%u planes, %u x %u, bin %u, frame %d, merged: pixel (%u,%u) colour %d is %d, expected %u\n",
+								(unsigned) numPlanes,(unsigned) lines,(unsigned) pixels,bin,f,
+								(unsigned) r,(unsigned) c,k,(int) got,expected);
+							return false;
+						}
+					}
+				}
+			}
+		}
+	}
+	return true;
+}
+
+struct CountingSink : public FrameEventSink {
+	volatile LONG count;
+	CountingSink(void) : count(0) { }
+	void frameAvailable(void) { InterlockedIncrement(&count); }
+};
+
+static bool waitForCount(volatile LONG *count, LONG expected)
+{
+	for (int i=0;i<500 && *count<expected;i++)
+		Sleep(2);
+	return *count==expected;
+}
+
+// Frames through a DisplayPreparer, as the MEX runs it: copier pushes and
+// posts, preparer prepares and announces, we read the prepared queue.
+static bool runPreparer(void)
+{
+	const unsigned long NUM_FRAMES = 12;
+	PipelineParams params;
+	params.isMultiChannel = true;
+	params.linesPerFrame = 16;
+	params.pixelsPerLine = 20;
+	params.frameTagging = true;
+	params.tagSizeBytes = 8;
+	params.frameSizePixels = params.linesPerFrame*params.pixelsPerLine;
+	params.frameSizeBytes = 4*params.frameSizePixels*2 + params.tagSizeBytes;
+	params.displayPrepEnabled = true;
+	params.displayPrepBinFactor = 2;
+	params.displayPrepNumChannels = 2;
+	params.displayPrepChannels[0] = 3;
+	params.displayPrepChannels[1] = 1;
+
+	MulticastFrameQueue frameQueue;
+	params.displayQueue = frameQueue.addReader(MulticastFrameQueue::DROP_OLDEST);
+	frameQueue.init(params.frameSizeBytes,NUM_FRAMES,NUM_FRAMES);
+	MulticastFrameQueue preparedFrameQueue;
+	params.preparedFrameQueue = &preparedFrameQueue;
+	params.preparedQueue = preparedFrameQueue.addReader(MulticastFrameQueue::DROP_OLDEST);
+	preparedFrameQueue.init(DisplayPreparer::recordSize(&params),NUM_FRAMES,NUM_FRAMES);
+	PipelineStats stats;
+	params.stats = &stats;
+
+	DisplayPreparer preparer(&params);
+	CountingSink sink;
+	if (!preparer.start(&sink)) {
+		printf("preparer did not start\n");
+		return false;
+	}
+
+	std::vector< std::vector<int16_t> > frames;
+	for (unsigned long f=0;f<NUM_FRAMES;f++) {
+		frames.push_back(std::vector<int16_t>(params.frameSizeBytes/2));
+		std::vector<int16_t> &frame = frames.back();
+		for (size_t i=0;i<4*params.frameSizePixels;i++)
+			frame[i] = randomPixel();
+		size_t tagIdx = 4*params.frameSizePixels;
+		frame[tagIdx+2] = (int16_t) (f>>16);
+		frame[tagIdx+3] = (int16_t) (70000+f);
+		frameQueue.push_back(&frame[0]);
+		preparer.frameAvailable();
+		if (f%4==3)
+			Sleep(5);
+	}
+	bool ok = waitForCount(&sink.count,(LONG) NUM_FRAMES);
+	if (!ok)
+		printf("%ld of %lu prepared frames announced\n",(long) sink.count,NUM_FRAMES);
+
+	DisplayPrep reference;
+	DisplayPreparer::configurePrep(&params,reference);
+	std::vector<uint8_t> expected(reference.outputBytes());
+	for (unsigned long f=0;f<NUM_FRAMES && ok;f++) {
+		const char *rec = static_cast<const char*>(params.preparedQueue->acquire_front());
+		if (rec==NULL) {
+			printf("prepared frame %lu missing\n",f);
+			ok = false;
+			break;
+		}
+		unsigned long tag;
+		memcpy(&tag,rec,sizeof(tag));
+		unsigned long expectedTag = (unsigned long) (uint16_t) (f>>16)*65536UL + (uint16_t) (70000+f);
+		reference.prepare(&frames[f][0],&expected[0]);
+		if (tag!=expectedTag || memcmp(rec+DisplayPreparer::TAG_BYTES,&expected[0],expected.size())!=0) {
+			printf("prepared frame %lu (tag %lu) is wrong\n",f,tag);
+			ok = false;
+		}
+		params.preparedQueue->release_front();
+	}
+
+	// New levels: everything above -1 is white.
+	double levels[4][2] = { {-2,-1}, {-2,-1}, {-2,-1}, {-2,-1} };
+	preparer.setLevels(levels);
+	std::vector<int16_t> flat(params.frameSizeBytes/2,100);
+	frameQueue.push_back(&flat[0]);
+	preparer.frameAvailable();
+	ok = waitForCount(&sink.count,(LONG) NUM_FRAMES+1) && ok;
+	const char *rec = static_cast<const char*>(params.preparedQueue->acquire_front());
+	bool levelsOk = rec!=NULL;
+	for (size_t i=0;levelsOk && i<reference.outputBytes();i++)
+		levelsOk = (uint8_t) rec[DisplayPreparer::TAG_BYTES+i]==255;
+	if (rec!=NULL)
+		params.preparedQueue->release_front();
+	if (!levelsOk)
+		printf("new levels not taken up\n");
+
+	preparer.stop();
+	ok = levelsOk && !preparer.isRunning() && preparer.framesPrepared()==NUM_FRAMES+1 && preparer.framesDropped()==0 && ok;
+	printf("preparer: %lu frames prepared, %lu dropped: %s\n",preparer.framesPrepared(),preparer.framesDropped(),ok ? "ok" : "WRONG");
+	return ok;
+}
+
+int _tmain(int argc, _TCHAR* argv[])
+{
+	const int levels[4][2] = { {0,32767}, {-1000,1000}, {-32768,-32768}, {500,-500} };
+	std::vector<int> all;
+	std::vector<int> subset;
+	subset.push_back(3);
+	subset.push_back(0);
+	std::vector<int> one(1,0);
+
+	bool ok = true;
+	static const unsigned int bins[] = { 1, 2, 3 };
+	for (size_t b=0;b<sizeof(bins)/sizeof(bins[0]);b++) {
+		for (int merge=0;merge<2;merge++) {
+			ok = runCase(1,32,40,bins[b],all,merge!=0,levels) && ok;
+			ok = runCase(1,17,23,bins[b],one,merge!=0,levels) && ok;
+			ok = runCase(4,32,40,bins[b],all,merge!=0,levels) && ok;
+			ok = runCase(4,17,23,bins[b],subset,merge!=0,levels) && ok;
+		}
+	}
+
+	// LUT ends.
+	DisplayPrep prep;
+	prep.setLevels(0,-100,100);
+	const uint8_t *lut = prep.lut(0);
+	if (lut[(uint16_t) -32768]!=0 || lut[(uint16_t) -100]!=0 || lut[0]!=128 || lut[100]!=255 || lut[32767]!=255) {
+		printf("LUT ends wrong\n");
+		ok = false;
+	}
+
+	ok = runPreparer() && ok;
+
+	printf(ok ? "PASS\n" : "FAILED\n");
+	return ok ? 0 : 1;
+}
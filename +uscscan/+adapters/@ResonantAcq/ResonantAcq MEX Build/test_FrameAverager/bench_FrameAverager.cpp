@@ -0,0 +1,139 @@
+// bench_FrameAverager.cpp : Defines the entry point for the console application.
+//
+// Microbenchmark for FrameAverager: times adding a 4-channel int16 frame
+// to the sums, and computing the average, for the double/switch code
+// FrameLogger used before (copied below), FrameAverager with scalar
+// kernels, and FrameAverager with SSE2 kernels. Usage:
+//   bench_FrameAverager [numIters]
+//
+// Build as a console app with ../NIFPGAMex and .. on the include path,
+// linking FrameAverager.cpp, FrameKernels.cpp, Misc.cpp and
+// PlatformWin32.cpp from that project; elsewhere, with the CMake build
+// in the parent directory. Build Release; the Debug numbers mean
+// nothing.
+
+#include <stdlib.h>
+#include "stdio.h"
+#include <vector>
+#include "Platform.h"
+#include "FrameAverager.h"
+#include "FrameKernels.h"
+
+static const unsigned int AVERAGE_FACTOR = 8;
+
+static double nowSeconds(void)
+{
+	return (double) Platform::perfCounter() / (double) Platform::perfFrequency();
+}
+
+// Original FrameLogger averaging, with pixelSizeBytes as a runtime value
+// as it was.
+static void legacyAdd(double *buf, const void *p, size_t numPixels, unsigned short pixelSizeBytes)
+{
+	for (int i=0;i<(int) numPixels;i++) {
+		switch (pixelSizeBytes) {
+	case 1:
+		buf[i] += (double) (*((char*)p + i));
+		break;
+	case 2:
+		buf[i] += (double) (*((short*)p + i));
+		break;
+	case 4:
+		buf[i] += (double) (*((long*)p + i));
+		break;
+		}
+	}
+}
+
+static void legacyAverage(const double *buf, void *dst, size_t numPixels, unsigned short pixelSizeBytes, unsigned int factor)
+{
+	for (int i=0;i<(int) numPixels;++i) {
+		double avVal = buf[i] / (double) factor;
+		switch (pixelSizeBytes) {
+	case 1:
+		((char *)dst)[i] = (char)avVal;
+		break;
+	case 2:
+		((short *)dst)[i] = (short)avVal;
+		break;
+	case 4:
+		((long *)dst)[i] = (long)avVal;
+		break;
+		}
+	}
+}
+
+// Microseconds per frame added, and per average computed.
+static void timeLegacy(const std::vector<int16_t> &in, std::vector<int16_t> &out,
+	unsigned int factor, int numIters, double *addUs, double *avgUs)
+{
+	volatile unsigned short pixelSizeBytes = 2;
+	std::vector<double> buf(in.size(),0.0);
+	double t0 = nowSeconds();
+	for (int i=0;i<numIters;i++) {
+		legacyAdd(&buf[0],&in[0],in.size(),pixelSizeBytes);
+	}
+	double t1 = nowSeconds();
+	for (int i=0;i<numIters;i++) {
+		legacyAverage(&buf[0],&out[0],in.size(),pixelSizeBytes,factor);
+	}
+	double t2 = nowSeconds();
+	*addUs = (t1-t0)*1e6/numIters;
+	*avgUs = (t2-t1)*1e6/numIters;
+}
+
+static void timeAverager(const std::vector<int16_t> &in, std::vector<int16_t> &out,
+	unsigned int factor, int numIters, double *addUs, double *avgUs)
+{
+	FrameAverager avg;
+	avg.configure(in.size(),2,true,factor);
+	double t0 = nowSeconds();
+	for (int i=0;i<numIters;i++) {
+		if (i%factor==0)
+			avg.reset();
+		avg.add(&in[0]);
+	}
+	double t1 = nowSeconds();
+	for (int i=0;i<numIters;i++) {
+		avg.computeAverage(&out[0]);
+	}
+	double t2 = nowSeconds();
+	*addUs = (t1-t0)*1e6/numIters;
+	*avgUs = (t2-t1)*1e6/numIters;
+}
+
+int main(int argc, char* argv[])
+{
+	int numIters = (argc>1) ? atoi(argv[1]) : 200;
+	printf("SIMD available: %d, iterations: %d\n",(int) FrameKernels::simdEnabled(),numIters);
+	printf("4-channel int16 frames; add = per frame summed, avg = per average computed\n");
+	printf("%10s %7s %12s %12s %12s %12s %12s %12s\n","frame","factor",
+	       "add legacy","add scalar","add simd","avg legacy","avg scalar","avg simd");
+
+	static const size_t sizes[] = { 256, 512, 1024 };
+	static const unsigned int factors[] = { AVERAGE_FACTOR, 5 };
+	for (size_t s=0;s<sizeof(sizes)/sizeof(sizes[0]);s++) {
+		for (size_t f=0;f<sizeof(factors)/sizeof(factors[0]);f++) {
+			size_t numPixels = 4*sizes[s]*sizes[s];
+			std::vector<int16_t> in(numPixels);
+			std::vector<int16_t> out(numPixels);
+			for (size_t i=0;i<in.size();i++) {
+				in[i] = (int16_t) (i*7919);
+			}
+
+			double add[3], avg[3];
+			timeLegacy(in,out,factors[f],numIters,&add[0],&avg[0]);
+			FrameKernels::setSIMDEnable(false);
+			timeAverager(in,out,factors[f],numIters,&add[1],&avg[1]);
+			FrameKernels::setSIMDEnable(true);
+			timeAverager(in,out,factors[f],numIters,&add[2],&avg[2]);
+
+			char label[32];
+			sprintf(label,"%lux%lu",(unsigned long) sizes[s],(unsigned long) sizes[s]);
+			printf("%10s %7u %10.1fus %10.1fus %10.1fus %10.1fus %10.1fus %10.1fus\n",label,factors[f],
+			       add[0],add[1],add[2],avg[0],avg[1],avg[2]);
+		}
+	}
+
+	return 0;
+}
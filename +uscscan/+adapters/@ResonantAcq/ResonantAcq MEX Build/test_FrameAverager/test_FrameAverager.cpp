@@ -0,0 +1,130 @@
+// test_FrameAverager.cpp : Defines the entry point for the console application.
+//
+// Bit-exactness test for FrameAverager. Averages pseudo-random frames
+// (with the extreme pixel values mixed in) of 8-, 16- and 32-bit
+// pixels, signed and unsigned, over power-of-two and other factors,
+// with SIMD enabled and disabled. Checks the output against the double
+// arithmetic FrameLogger used before FrameAverager existed, copied below
+// and extended to unsigned pixels. Frame lengths include ragged ones
+// that are not multiples of the SSE2 block size.
+//
+// Build as a console app with ../NIFPGAMex and .. on the include path,
+// linking FrameAverager.cpp, FrameKernels.cpp, Misc.cpp and
+// PlatformWin32.cpp from that project.
+
+#include <tchar.h>
+#include "stdio.h"
+#include <string.h>
+#include <vector>
+#include "FrameAverager.h"
+#include "FrameKernels.h"
+
+static unsigned long gSeed = 12345;
+
+static unsigned long nextRandom(void)
+{
+	gSeed = gSeed*1103515245 + 12345;
+	return (gSeed>>8) ^ (gSeed<<13);
+}
+
+// Fill a frame with random bits, forcing some pixels to the type's
+// minimum and maximum.
+template <typename PixelT>
+static void makeFrame(std::vector<PixelT> &frame)
+{
+	PixelT lo = (PixelT) 0;
+	PixelT hi = (PixelT) ~lo;
+	if (hi<lo) {
+		// signed: lo = 100..0, hi = 011..1
+		lo = (PixelT) ((PixelT) 1 << (8*sizeof(PixelT)-1));
+		hi = (PixelT) ~lo;
+	}
+	for (size_t i=0;i<frame.size();i++) {
+		unsigned long r = nextRandom();
+		frame[i] = (r%11==0) ? lo : (r%13==0) ? hi : (PixelT) (r*2654435761u);
+	}
+}
+
+// Original FrameLogger addToAveragingBuffer/computeAverageResult: sum
+// in double, divide in double, cast.
+template <typename PixelT>
+static void referenceAverage(const std::vector< std::vector<PixelT> > &frames, std::vector<PixelT> &result)
+{
+	std::vector<double> buf(result.size(),0.0);
+	for (size_t f=0;f<frames.size();f++)
+		for (size_t i=0;i<buf.size();i++)
+			buf[i] += (double) frames[f][i];
+	for (size_t i=0;i<buf.size();i++) {
+		double avVal = buf[i] / (double) frames.size();
+		result[i] = (PixelT) (__int64) avVal;
+	}
+}
+
+template <typename PixelT>
+static bool runCase(const char *typeName, bool signedData, size_t numPixels, unsigned int factor)
+{
+	std::vector< std::vector<PixelT> > frames(factor,std::vector<PixelT>(numPixels));
+	for (size_t f=0;f<factor;f++)
+		makeFrame(frames[f]);
+	std::vector<PixelT> expected(numPixels);
+	referenceAverage(frames,expected);
+
+	bool ok = true;
+	for (int simd=0;simd<2;simd++) {
+		FrameKernels::setSIMDEnable(simd!=0);
+		FrameAverager avg;
+		if (!avg.configure(numPixels,(unsigned short) sizeof(PixelT),signedData,factor)) {
+			printf("%s: configure failed\n",typeName);
+			return false;
+		}
+		// Twice over, to check reset() clears the sums.
+		for (int pass=0;pass<2;pass++) {
+			avg.reset();
+			for (size_t f=0;f<factor;f++)
+				avg.add(&frames[f][0]);
+			std::vector<PixelT> result(numPixels);
+			avg.computeAverage(&result[0]);
+			for (size_t i=0;i<numPixels;i++) {
+				if (result[i]!=expected[i]) {
+					printf("%s, %u pixels, factor %u, simd %d: pixel %u is %ld, expected %ld\n",
+					       typeName,(unsigned) numPixels,factor,simd,(unsigned) i,
+					       (long) result[i],(long) expected[i]);
+					ok = false;
+					break;
+				}
+			}
+		}
+	}
+	FrameKernels::setSIMDEnable(true);
+	return ok;
+}
+
+int _tmain(int argc, _TCHAR* argv[])
+{
+	printf("SIMD available: %d\n",(int) FrameKernels::simdEnabled());
+
+	static const unsigned int factors[] = { 2, 3, 4, 5, 7, 8, 16, 31, 64, 100 };
+	static const size_t lengths[] = { 1, 7, 8, 9, 64, 1031 };
+
+	bool ok = true;
+	for (size_t f=0;f<sizeof(factors)/sizeof(factors[0]);f++) {
+		for (size_t l=0;l<sizeof(lengths)/sizeof(lengths[0]);l++) {
+			unsigned int factor = factors[f];
+			size_t n = lengths[l];
+			ok = runCase<int16_t>("int16",true,n,factor) && ok;
+			ok = runCase<uint16_t>("uint16",false,n,factor) && ok;
+			ok = runCase<int8_t>("int8",true,n,factor) && ok;
+			ok = runCase<uint8_t>("uint8",false,n,factor) && ok;
+			ok = runCase<int32_t>("int32",true,n,factor) && ok;
+			ok = runCase<uint32_t>("uint32",false,n,factor) && ok;
+		}
+	}
+
+	// Factors past the int32 sum limit for 16-bit pixels.
+	ok = runCase<int16_t>("int16",true,17,40000) && ok;
+	ok = runCase<uint16_t>("uint16",false,17,32768) && ok;
+	ok = runCase<uint16_t>("uint16",false,17,40000) && ok;
+
+	printf(ok ? "PASS\n" : "FAILED\n");
+	return ok ? 0 : 1;
+}
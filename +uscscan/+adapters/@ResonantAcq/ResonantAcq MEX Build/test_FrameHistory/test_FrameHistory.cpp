@@ -0,0 +1,227 @@
+// test_FrameHistory.cpp : Defines the entry point for the console application.
+//
+// Test for FrameHistory. First the ring on its own: records come back
+// oldest first before and after it wraps, pushes after the trigger are
+// ignored, reset rearms it, and a history of capacity 0 still triggers.
+//
+// Then the handoff FrameCopier and FrameLogger do on a logging trigger,
+// with a producer thread, a logger thread and the main thread as the
+// controller. The producer pushes records stamped with their one-based
+// index to a MulticastFrameQueue whose NEVER_DROP logging reader is off,
+// and to the history, until the controller asks for the trigger; then it
+// enables the reader and triggers the history before pushing the record
+// in hand, as FrameCopier::storeFrame does. The logger waits for the
+// trigger, reads the history, then the queue. Checks the logger sees the
+// last capacity records before the trigger and then every record after
+// it, in order, with no gap or repeat at the handoff. (The producer
+// retries a full queue here, so that every record reaches the logger.)
+//
+// Build as a console app with ../NIFPGAMex on the include path, linking
+// FrameHistory.cpp, MulticastFrameQueue.cpp, Misc.cpp and
+// PlatformWin32.cpp from that project.
+
+#include <tchar.h>
+#include <process.h>
+#include "stdio.h"
+#include <vector>
+#include <windows.h>
+#include "Misc.h"
+#include "FrameHistory.h"
+#include "MulticastFrameQueue.h"
+
+static const unsigned long RECORD_SIZE = 256; // bytes
+static const unsigned long QUEUE_CAPACITY = 16;
+static const unsigned long NUM_PUSHES = 200000;
+
+static void fillRecord(char *rec, unsigned long idx)
+{
+	unsigned long *p = reinterpret_cast<unsigned long*>(rec);
+	for (unsigned long i=0;i<RECORD_SIZE/sizeof(unsigned long);i++) {
+		p[i] = idx;
+	}
+}
+
+// Index of a record, or 0 if it is torn.
+static unsigned long recordIdx(const void *rec)
+{
+	const unsigned long *p = static_cast<const unsigned long*>(rec);
+	for (unsigned long i=1;i<RECORD_SIZE/sizeof(unsigned long);i++) {
+		if (p[i]!=p[0]) {
+			return 0;
+		}
+	}
+	return p[0];
+}
+
+// Push numPushes records, trigger, and check the history holds the last
+// capacity of them.
+static bool checkRing(FrameHistory &h, unsigned long numPushes)
+{
+	char rec[RECORD_SIZE];
+	h.reset();
+	for (unsigned long idx=1;idx<=numPushes;idx++) {
+		fillRecord(rec,idx);
+		h.push(rec);
+	}
+	bool ok = !h.isTriggered();
+	h.trigger();
+	fillRecord(rec,numPushes+1);
+	h.push(rec); // ignored
+	unsigned long expectedSize = numPushes<h.capacity() ? numPushes : h.capacity();
+	ok = ok && h.isTriggered() && h.size()==expectedSize && h.total_num_push()==numPushes;
+	for (unsigned long i=0;ok && i<h.size();i++) {
+		ok = recordIdx(h.at(i))==numPushes-expectedSize+1+i;
+	}
+	printf("capacity %lu, %lu pushes: %s\n",h.capacity(),numPushes,ok ? "ok" : "WRONG");
+	return ok;
+}
+
+struct HandoffState {
+	MulticastFrameQueue *q;
+	FrameQueueReader *logging;
+	FrameHistory *history;
+	volatile LONG triggerRequested;
+	volatile LONG producerDone;
+	unsigned long triggerIdx; // first record after the trigger
+	std::vector<unsigned long> logged;
+	unsigned long numTorn;
+};
+
+static unsigned int WINAPI producerFcn(LPVOID userData)
+{
+	HandoffState *hs = static_cast<HandoffState*>(userData);
+	char rec[RECORD_SIZE];
+	bool waiting = true;
+	for (unsigned long idx=1;idx<=NUM_PUSHES;idx++) {
+		fillRecord(rec,idx);
+		if (waiting) {
+			if (InterlockedExchange(&hs->triggerRequested,0)!=0) {
+				hs->logging->setEnabled(true);
+				hs->triggerIdx = idx;
+				hs->history->trigger();
+				waiting = false;
+			} else {
+				hs->history->push(rec);
+			}
+		}
+		while (!hs->q->push_back(rec)) {
+			Sleep(0);
+		}
+	}
+	if (waiting) {
+		// never triggered; let the logger go
+		hs->triggerIdx = NUM_PUSHES+1;
+		hs->history->trigger();
+	}
+	InterlockedExchange(&hs->producerDone,1);
+	return 0;
+}
+
+static unsigned int WINAPI loggerFcn(LPVOID userData)
+{
+	HandoffState *hs = static_cast<HandoffState*>(userData);
+	while (!hs->history->isTriggered()) {
+		Sleep(0);
+	}
+	for (unsigned long i=0;i<hs->history->size();i++) {
+		unsigned long idx = recordIdx(hs->history->at(i));
+		if (idx==0) {
+			hs->numTorn++;
+		}
+		hs->logged.push_back(idx);
+	}
+	while (true) {
+		const void *front = hs->logging->acquire_front();
+		if (front==NULL) {
+			if (hs->producerDone && hs->logging->isEmpty()) {
+				break;
+			}
+			continue;
+		}
+		unsigned long idx = recordIdx(front);
+		if (idx==0) {
+			hs->numTorn++;
+		}
+		hs->logged.push_back(idx);
+		hs->logging->release_front();
+	}
+	return 0;
+}
+
+// Trigger once the producer has pushed triggerAfter records to the
+// history (NUM_PUSHES+1: never).
+static bool runHandoff(unsigned long historyCapacity, unsigned long triggerAfter)
+{
+	HandoffState hs;
+	hs.q = new MulticastFrameQueue();
+	hs.logging = hs.q->addReader(MulticastFrameQueue::NEVER_DROP);
+	hs.q->init(RECORD_SIZE,QUEUE_CAPACITY,QUEUE_CAPACITY);
+	hs.logging->setEnabled(false);
+	hs.history = new FrameHistory();
+	hs.history->init(RECORD_SIZE,historyCapacity);
+	hs.triggerRequested = 0;
+	hs.producerDone = 0;
+	hs.triggerIdx = 0;
+	hs.numTorn = 0;
+	if (triggerAfter==0) {
+		hs.triggerRequested = 1;
+	}
+
+	HANDLE loggerThread = (HANDLE)_beginthreadex(NULL,0,loggerFcn,&hs,0,NULL);
+	HANDLE producer = (HANDLE)_beginthreadex(NULL,0,producerFcn,&hs,0,NULL);
+	if (triggerAfter>0 && triggerAfter<=NUM_PUSHES) {
+		while (hs.history->total_num_push()<triggerAfter) {
+			Sleep(0);
+		}
+		InterlockedExchange(&hs.triggerRequested,1);
+	}
+	WaitForSingleObject(producer,INFINITE);
+	WaitForSingleObject(loggerThread,INFINITE);
+	CloseHandle(producer);
+	CloseHandle(loggerThread);
+
+	// the last historyCapacity records before the trigger, then the rest
+	unsigned long numBefore = hs.triggerIdx-1;
+	unsigned long first = numBefore>historyCapacity ? numBefore-historyCapacity+1 : 1;
+	bool ok = hs.numTorn==0 && hs.logged.size()==NUM_PUSHES-first+1;
+	for (size_t i=0;ok && i<hs.logged.size();i++) {
+		ok = hs.logged[i]==first+i;
+	}
+	ok = ok && (triggerAfter>NUM_PUSHES || hs.triggerIdx>=triggerAfter+1);
+	printf("handoff, history of %lu, triggered at record %lu: %lu logged from record %lu: %s\n",historyCapacity,
+	       hs.triggerIdx,(unsigned long) hs.logged.size(),first,ok ? "ok" : "WRONG");
+
+	delete hs.history;
+	delete hs.q;
+	return ok;
+}
+
+int _tmain(int argc, _TCHAR* argv[])
+{
+	bool ok = true;
+
+	FrameHistory h;
+	ok = h.init(RECORD_SIZE,5) && h.capacity()==5 && h.recordSize()==RECORD_SIZE && ok;
+	ok = checkRing(h,0) && ok;
+	ok = checkRing(h,3) && ok;
+	ok = checkRing(h,5) && ok;
+	ok = checkRing(h,12) && ok;   // wrapped
+	ok = h.init(RECORD_SIZE*5,1) && h.capacity()==1 && ok; // same block
+	ok = checkRing(h,7) && ok;
+	ok = h.init(RECORD_SIZE,0) && h.capacity()==0 && ok;
+	ok = checkRing(h,4) && ok;
+
+	bool sizingOk = FrameHistory::capacityForBytes(1000,10*1024*1024)==10485 &&
+		FrameHistory::capacityForBytes(1000,999)==0 && FrameHistory::capacityForBytes(0,1000)==0;
+	printf("capacityForBytes: %s\n",sizingOk ? "ok" : "WRONG");
+	ok = sizingOk && ok;
+
+	ok = runHandoff(64,0) && ok;            // trigger before the first record
+	ok = runHandoff(64,10) && ok;           // history not full
+	ok = runHandoff(64,50000) && ok;        // history wrapped
+	ok = runHandoff(0,1000) && ok;          // no history
+	ok = runHandoff(1000,NUM_PUSHES+1) && ok; // never triggered
+
+	printf(ok ? "PASS\n" : "FAILED\n");
+	return ok ? 0 : 1;
+}
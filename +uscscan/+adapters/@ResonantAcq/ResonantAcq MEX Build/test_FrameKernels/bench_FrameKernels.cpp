@@ -0,0 +1,79 @@
+// bench_FrameKernels.cpp : Defines the entry point for the console application.
+//
+// Microbenchmark for FrameKernels: times deinterleave4 and transpose,
+// scalar vs SSE2, on 4-channel frames of the usual sizes. Usage:
+//   bench_FrameKernels [numIters]
+//
+// Build as a console app with ../NIFPGAMex and .. on the include path,
+// linking FrameKernels.cpp and PlatformWin32.cpp from that project;
+// elsewhere, with the CMake build in the parent directory. Build
+// Release; the Debug numbers mean nothing.
+
+#include <stdlib.h>
+#include "stdio.h"
+#include <vector>
+#include "Platform.h"
+#include "FrameKernels.h"
+
+static double nowSeconds(void)
+{
+	return (double) Platform::perfCounter() / (double) Platform::perfFrequency();
+}
+
+// Returns microseconds per 4-channel frame.
+static double timeDeinterleave(const std::vector<int16_t> &in, std::vector<int16_t> &out,
+	size_t numPixels, int numIters)
+{
+	double t0 = nowSeconds();
+	for (int i=0;i<numIters;i++) {
+		FrameKernels::deinterleave4(&in[0],&out[0],numPixels);
+	}
+	return (nowSeconds()-t0)*1e6/numIters;
+}
+
+// Returns microseconds per 4-channel frame (4 plane transposes).
+static double timeTranspose(const std::vector<int16_t> &in, std::vector<int16_t> &out,
+	size_t lines, size_t pixels, int numIters)
+{
+	size_t numPixels = lines*pixels;
+	double t0 = nowSeconds();
+	for (int i=0;i<numIters;i++) {
+		for (size_t chan=0;chan<4;chan++) {
+			FrameKernels::transpose(&in[chan*numPixels],&out[chan*numPixels],lines,pixels);
+		}
+	}
+	return (nowSeconds()-t0)*1e6/numIters;
+}
+
+int main(int argc, char* argv[])
+{
+	int numIters = (argc>1) ? atoi(argv[1]) : 200;
+	bool simdAvailable = FrameKernels::simdEnabled();
+	printf("SIMD available: %d, iterations: %d\n",(int)simdAvailable,numIters);
+	printf("%10s %14s %14s %14s %14s\n","frame","deint scalar","deint simd","transp scalar","transp simd");
+
+	static const size_t sizes[] = { 256, 512, 1024, 2048 };
+	for (size_t s=0;s<sizeof(sizes)/sizeof(sizes[0]);s++) {
+		size_t lines = sizes[s];
+		size_t pixels = sizes[s];
+		size_t numPixels = lines*pixels;
+		std::vector<int16_t> in(4*numPixels);
+		std::vector<int16_t> out(4*numPixels);
+		for (size_t i=0;i<in.size();i++) {
+			in[i] = (int16_t) (i*7919);
+		}
+
+		double us[4];
+		FrameKernels::setSIMDEnable(false);
+		us[0] = timeDeinterleave(in,out,numPixels,numIters);
+		us[2] = timeTranspose(in,out,lines,pixels,numIters);
+		FrameKernels::setSIMDEnable(true);
+		us[1] = timeDeinterleave(in,out,numPixels,numIters);
+		us[3] = timeTranspose(in,out,lines,pixels,numIters);
+
+		char label[32];
+		sprintf(label,"%lux%lu",(unsigned long)lines,(unsigned long)pixels);
+		printf("%10s %12.1fus %12.1fus %12.1fus %12.1fus\n",label,us[0],us[1],us[2],us[3]);
+	}
+	return 0;
+}
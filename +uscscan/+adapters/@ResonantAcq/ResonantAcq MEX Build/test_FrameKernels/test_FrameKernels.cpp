@@ -0,0 +1,177 @@
+// test_FrameKernels.cpp : Defines the entry point for the console application.
+//
+// Bit-exactness test for FrameKernels. Runs deinterleave4 and transpose,
+// with SIMD enabled and disabled, on pseudo-random frames of various
+// shapes (including ragged ones that are not multiples of the SSE2
+// block size). Checks the output against the loops FrameCopier and
+// GET_FRAME used before the kernels existed, copied verbatim below.
+// Checks pixelStats the same way, against a plain per-pixel loop, for
+// several ADC bit depths.
+//
+// Build as a console app with ../NIFPGAMex and .. on the include path,
+// linking FrameKernels.cpp from that project.
+
+#include <tchar.h>
+#include "stdio.h"
+#include <vector>
+#include <algorithm>
+#include <string.h>
+#include "FrameKernels.h"
+
+// Original FrameCopier deinterlace loop.
+static void referenceDeinterleave(const int16_t *input, int16_t *output, size_t frameSizePixels)
+{
+	size_t frameTwoOffset   = frameSizePixels;
+	size_t frameThreeOffset = frameSizePixels*2;
+	size_t frameFourOffset  = frameSizePixels*3;
+	size_t deinterlaceCount = 0;
+	const int16_t *sourceArray = input;
+	int16_t *destinationArray = output;
+	while (deinterlaceCount < frameSizePixels)
+	{
+		*destinationArray                      = *(sourceArray++);
+		*(destinationArray + frameTwoOffset)   = *(sourceArray++);
+		*(destinationArray + frameThreeOffset) = *(sourceArray++);
+		*(destinationArray + frameFourOffset)  = *(sourceArray++);
+		destinationArray++;
+		deinterlaceCount++;
+	}
+}
+
+// Original FrameCopier transpose loop (one channel).
+static void referenceTranspose(const int16_t *sourceArray, int16_t *destinationArray,
+	size_t linesPerFrame, size_t pixelsPerLine)
+{
+	size_t transposeCount = 0;
+	for (size_t yiter=0;yiter < pixelsPerLine;yiter++)
+		for (size_t xiter=0;xiter < linesPerFrame;xiter++)
+			destinationArray[transposeCount++] = sourceArray[yiter + (xiter * pixelsPerLine)];
+}
+
+static unsigned long gSeed = 12345;
+static int16_t nextRandom(void)
+{
+	gSeed = gSeed*1103515245 + 12345;
+	return (int16_t) (gSeed >> 8);
+}
+
+static int testShape(size_t lines, size_t pixels)
+{
+	size_t numPixels = lines*pixels;
+	std::vector<int16_t> input(4*numPixels);
+	for (size_t i=0;i<input.size();i++) {
+		input[i] = nextRandom();
+	}
+
+	std::vector<int16_t> expectedPlanes(4*numPixels);
+	referenceDeinterleave(&input[0],&expectedPlanes[0],numPixels);
+	std::vector<int16_t> expectedTransposed(numPixels);
+	referenceTranspose(&expectedPlanes[0],&expectedTransposed[0],lines,pixels);
+
+	int failures = 0;
+	for (int simd=0;simd<2;simd++) {
+		FrameKernels::setSIMDEnable(simd!=0);
+
+		// Guard element past the end catches overruns.
+		std::vector<int16_t> planes(4*numPixels+1,0x5a5a);
+		FrameKernels::deinterleave4(&input[0],&planes[0],numPixels);
+		if (!std::equal(expectedPlanes.begin(),expectedPlanes.end(),planes.begin()) || planes.back()!=0x5a5a) {
+			printf("FAIL: deinterleave4 %lux%lu simd=%d\n",(unsigned long)lines,(unsigned long)pixels,simd);
+			failures++;
+		}
+
+		std::vector<int16_t> transposed(numPixels+1,0x5a5a);
+		FrameKernels::transpose(&expectedPlanes[0],&transposed[0],lines,pixels);
+		if (!std::equal(expectedTransposed.begin(),expectedTransposed.end(),transposed.begin()) || transposed.back()!=0x5a5a) {
+			printf("FAIL: transpose %lux%lu simd=%d\n",(unsigned long)lines,(unsigned long)pixels,simd);
+			failures++;
+		}
+	}
+	FrameKernels::setSIMDEnable(true);
+	return failures;
+}
+
+// Plain per-pixel statistics, as documented in FrameKernels.h.
+static void referencePixelStats(const int16_t *src, size_t numPixels, int bitDepth,
+	FrameKernels::PixelStats &stats)
+{
+	memset(&stats,0,sizeof(stats));
+	int lo = -(1<<(bitDepth-1));
+	int hi = (1<<(bitDepth-1))-1;
+	for (size_t i=0;i<numPixels;i++) {
+		int v = src[i];
+		if (i==0 || v<stats.min)
+			stats.min = (int16_t) v;
+		if (i==0 || v>stats.max)
+			stats.max = (int16_t) v;
+		stats.sum += v;
+		stats.sumSquares += (unsigned __int64) ((__int64) v*v);
+		if (v<=lo || v>=hi)
+			stats.numSaturated++;
+		int c = v<lo ? lo : v>hi ? hi : v;
+		stats.histogram[(c-lo) >> (bitDepth-8)]++;
+	}
+}
+
+static bool samePixelStats(const FrameKernels::PixelStats &a, const FrameKernels::PixelStats &b)
+{
+	return a.min==b.min && a.max==b.max && a.sum==b.sum && a.sumSquares==b.sumSquares &&
+		a.numSaturated==b.numSaturated && memcmp(a.histogram,b.histogram,sizeof(a.histogram))==0;
+}
+
+static int testPixelStats(size_t numPixels, int bitDepth)
+{
+	// Pixels in the ADC's range, with some at and beyond both ends.
+	int16_t mask = (int16_t) ((1<<(bitDepth-1))-1);
+	std::vector<int16_t> input(numPixels+1);
+	for (size_t i=0;i<numPixels;i++) {
+		int16_t v = nextRandom();
+		input[i] = v<0 ? (int16_t) (v|~mask) : (int16_t) (v&mask);
+		if (i%97==5)
+			input[i] = -32768;
+		else if (i%89==3)
+			input[i] = 32767;
+	}
+
+	FrameKernels::PixelStats expected;
+	referencePixelStats(&input[0],numPixels,bitDepth,expected);
+
+	int failures = 0;
+	for (int simd=0;simd<2;simd++) {
+		FrameKernels::setSIMDEnable(simd!=0);
+		FrameKernels::PixelStats stats;
+		FrameKernels::pixelStats(&input[0],numPixels,bitDepth,stats);
+		if (!samePixelStats(expected,stats)) {
+			printf("FAIL: pixelStats %lu pixels, %d bits, simd=%d\n",(unsigned long)numPixels,bitDepth,simd);
+			failures++;
+		}
+	}
+	FrameKernels::setSIMDEnable(true);
+	return failures;
+}
+
+int _tmain(int argc, _TCHAR* argv[])
+{
+	printf("SIMD available: %d\n",(int)FrameKernels::simdEnabled());
+
+	static const size_t shapes[][2] = {
+		{1,1}, {1,7}, {7,1}, {8,8}, {3,17}, {9,15}, {16,64},
+		{63,65}, {64,64}, {100,37}, {128,130}, {512,512}, {500,1021},
+	};
+	int failures = 0;
+	for (size_t i=0;i<sizeof(shapes)/sizeof(shapes[0]);i++) {
+		failures += testShape(shapes[i][0],shapes[i][1]);
+	}
+
+	// Past 65536 pixels the SSE2 kernel works in blocks.
+	static const size_t statsSizes[] = { 0, 1, 7, 8, 9, 1000, 65536, 65541, 512*512, 300000 };
+	static const int bitDepths[] = { 8, 14, 16 };
+	for (size_t i=0;i<sizeof(statsSizes)/sizeof(statsSizes[0]);i++) {
+		for (size_t b=0;b<sizeof(bitDepths)/sizeof(bitDepths[0]);b++) {
+			failures += testPixelStats(statsSizes[i],bitDepths[b]);
+		}
+	}
+
+	printf(failures==0 ? "PASS\n" : "FAILED\n");
+	return failures==0 ? 0 : 1;
+}
@@ -0,0 +1,187 @@
+// test_FrameQueue.cpp : Defines the entry point for the console application.
+//
+// Stress test for the SPSC FrameQueue. A producer thread pushes
+// NUM_PUSHES records, each stamped with its one-based push index, while a
+// consumer thread pops them. The producer waits for room when the queue
+// is full, so that most records get through. Every STALL_INTERVAL pops
+// the consumer stalls until the producer has made STALL_PUSHES pushes
+// without waiting, so that the queue overflows by a known amount.
+// Checks:
+// * records come out in push order, with no duplicates;
+// * every record is either popped or counted as a dropped push;
+// * at least MIN_POPPED records are popped, so the checks see real data;
+// * the recorded dropped-push indices are exactly the gaps the consumer saw.
+//
+// Build as a console app with ../NIFPGAMex on the include path, linking
+// FrameQueue.cpp, Misc.cpp and PlatformWin32.cpp from that project.
+
+#include <tchar.h>
+#include <process.h>
+#include "stdio.h"
+#include "FrameQueue.h"
+
+static const unsigned long NUM_PUSHES = 5000000;
+static const unsigned long RECORD_SIZE = 64; // bytes
+static const unsigned long CAPACITY = 16;
+static const unsigned long MIN_POPPED = NUM_PUSHES*9/10;
+static const unsigned long STALL_INTERVAL = 250000; // pops between consumer stalls
+static const LONG STALL_PUSHES = 10000;
+
+struct TestState {
+	FrameQueue *fq;
+	volatile LONG producerDone;
+	volatile LONG stallPushes; // pushes left in the consumer's stall
+	unsigned long numPopped;
+	unsigned long numOutOfOrder;
+	unsigned long numCorrupt;
+	std::vector<unsigned long> gaps; // push indices the consumer never saw
+};
+
+static void fillRecord(char *rec, unsigned long idx)
+{
+	unsigned long *p = reinterpret_cast<unsigned long*>(rec);
+	for (unsigned long i=0;i<RECORD_SIZE/sizeof(unsigned long);i++) {
+		p[i] = idx;
+	}
+}
+
+static bool checkRecord(const char *rec, unsigned long &idx)
+{
+	const unsigned long *p = reinterpret_cast<const unsigned long*>(rec);
+	idx = p[0];
+	for (unsigned long i=1;i<RECORD_SIZE/sizeof(unsigned long);i++) {
+		if (p[i]!=idx) {
+			return false; // torn record
+		}
+	}
+	return true;
+}
+
+static unsigned int WINAPI producerFcn(LPVOID userData)
+{
+	TestState *ts = static_cast<TestState*>(userData);
+	char rec[RECORD_SIZE];
+	for (unsigned long idx=1;idx<=NUM_PUSHES;idx++) {
+		// Pace the producer to the consumer, except through its stalls.
+		if (ts->stallPushes>0) {
+			InterlockedDecrement(&ts->stallPushes);
+		} else {
+			for (int spin=1;ts->fq->size()>=CAPACITY;spin++) {
+				if (spin%64==0) {
+					Sleep(0);
+				} else {
+					YieldProcessor();
+				}
+			}
+		}
+		fillRecord(rec,idx);
+		ts->fq->push_back(rec);
+	}
+	InterlockedExchange(&ts->producerDone,1);
+	return 0;
+}
+
+static unsigned int WINAPI consumerFcn(LPVOID userData)
+{
+	TestState *ts = static_cast<TestState*>(userData);
+	unsigned long expected = 1;
+	while (true) {
+		const void *front = ts->fq->front_checkout();
+		if (front==NULL) {
+			if (ts->producerDone && ts->fq->isEmpty()) {
+				break;
+			}
+			continue;
+		}
+
+		unsigned long idx;
+		if (!checkRecord(static_cast<const char*>(front),idx)) {
+			ts->numCorrupt++;
+		}
+		ts->fq->front_checkin();
+		ts->fq->pop_front();
+		ts->numPopped++;
+
+		if (idx<expected) {
+			ts->numOutOfOrder++;
+		} else {
+			for (;expected<idx;expected++) {
+				ts->gaps.push_back(expected);
+			}
+			expected = idx+1;
+		}
+
+		// Stall every so often so the producer overflows the queue.
+		if (ts->numPopped % STALL_INTERVAL == 0) {
+			InterlockedExchange(&ts->stallPushes,STALL_PUSHES);
+			while (ts->stallPushes>0 && !ts->producerDone) {
+				Sleep(0);
+			}
+		}
+	}
+	for (;expected<=NUM_PUSHES;expected++) {
+		ts->gaps.push_back(expected);
+	}
+	return 0;
+}
+
+int _tmain(int argc, _TCHAR* argv[])
+{
+	TestState ts;
+	ts.fq = new FrameQueue();
+	ts.fq->init(RECORD_SIZE,CAPACITY,NUM_PUSHES);
+	ts.producerDone = 0;
+	ts.stallPushes = 0;
+	ts.numPopped = 0;
+	ts.numOutOfOrder = 0;
+	ts.numCorrupt = 0;
+
+	HANDLE consumer = (HANDLE)_beginthreadex(NULL,0,consumerFcn,&ts,0,NULL);
+	HANDLE producer = (HANDLE)_beginthreadex(NULL,0,producerFcn,&ts,0,NULL);
+	WaitForSingleObject(producer,INFINITE);
+	WaitForSingleObject(consumer,INFINITE);
+	CloseHandle(producer);
+	CloseHandle(consumer);
+
+	unsigned long tnpb = ts.fq->total_num_push_back();
+	unsigned long ndpb = ts.fq->num_dropped_push_back();
+	const std::vector<unsigned long> &dropped = ts.fq->dropped_push_back();
+
+	printf("tnpb: %lu, ndpb: %lu, popped: %lu, size: %lu\n",
+		tnpb,ndpb,ts.numPopped,ts.fq->size());
+
+	int failures = 0;
+	if (tnpb!=NUM_PUSHES) {
+		printf("FAIL: total_num_push_back %lu != %lu\n",tnpb,NUM_PUSHES);
+		failures++;
+	}
+	if (ts.numPopped+ndpb!=NUM_PUSHES) {
+		printf("FAIL: popped + dropped (%lu + %lu) != %lu\n",ts.numPopped,ndpb,NUM_PUSHES);
+		failures++;
+	}
+	if (ts.numPopped<MIN_POPPED) {
+		printf("FAIL: only %lu records popped (minimum %lu)\n",ts.numPopped,MIN_POPPED);
+		failures++;
+	}
+	if (ts.numOutOfOrder>0) {
+		printf("FAIL: %lu records out of order\n",ts.numOutOfOrder);
+		failures++;
+	}
+	if (ts.numCorrupt>0) {
+		printf("FAIL: %lu torn records\n",ts.numCorrupt);
+		failures++;
+	}
+	if (dropped!=ts.gaps) {
+		printf("FAIL: dropped_push_back (%lu entries) does not match consumer gaps (%lu entries)\n",
+			(unsigned long)dropped.size(),(unsigned long)ts.gaps.size());
+		failures++;
+	}
+	if (ndpb==0) {
+		printf("WARNING: no pushes were dropped; overflow path not exercised\n");
+	}
+
+	delete ts.fq;
+
+	printf(failures==0 ? "PASS\n" : "FAILED\n");
+	return failures==0 ? 0 : 1;
+}
@@ -0,0 +1,140 @@
+// test_FrameSource.cpp : Defines the entry point for the console application.
+//
+// Test for the simulated frame sources. Checks that SyntheticFrameSource
+// produces FIFO-layout frames with consecutive frame tags at roughly the
+// requested rate, and that ReplayFrameSource plays back a dump of those
+// frames byte-for-byte, looping at end of file.
+//
+// Build as a console app with ../NIFPGAMex and .. on the include path,
+// linking FrameSource.cpp, SyntheticFrameSource.cpp,
+// ReplayFrameSource.cpp, Misc.cpp and PlatformWin32.cpp from that project;
+// elsewhere, with the CMake build in the parent directory.
+
+#include "stdio.h"
+#include <string.h>
+#include <vector>
+#include "SyntheticFrameSource.h"
+#include "ReplayFrameSource.h"
+
+static const int NUM_FRAMES = 40;
+static const double FRAME_RATE = 200.0;
+static const char *REPLAY_FILE = "test_FrameSource.bin";
+
+static void makeFormat(FrameFormat &fmt, bool multiChannel)
+{
+	fmt.isMultiChannel = multiChannel;
+	fmt.linesPerFrame = 64;
+	fmt.pixelsPerLine = 48;
+	fmt.frameTagging = true;
+	size_t elementBytes = multiChannel ? 8 : 2;
+	fmt.tagSizeBytes = 8;
+	fmt.frameSizeFifoElements = fmt.linesPerFrame*fmt.pixelsPerLine + fmt.tagSizeBytes/elementBytes;
+	fmt.frameSizeBytes = fmt.frameSizeFifoElements*elementBytes;
+}
+
+static unsigned long frameTag(const FrameFormat &fmt, const std::vector<char> &frame)
+{
+	const int16_t *words = reinterpret_cast<const int16_t*>(&frame[0]) + fmt.tagWordIndex();
+	return (unsigned long) (uint16_t) words[2]*65536 + (uint16_t) words[3];
+}
+
+static bool testSynthetic(bool multiChannel, std::vector< std::vector<char> > &frames)
+{
+	FrameFormat fmt;
+	makeFormat(fmt,multiChannel);
+	SyntheticFrameSource src(SyntheticFrameSource::RAMP,FRAME_RATE);
+	if (src.open(fmt)!=FrameSource::SUCCESS) {
+		printf("synthetic open failed\n");
+		return false;
+	}
+
+	int64_t t0 = Platform::perfCounter();
+	frames.assign(NUM_FRAMES,std::vector<char>(fmt.frameSizeBytes));
+	for (int i=0;i<NUM_FRAMES;i++) {
+		size_t remaining;
+		FrameSource::Status status;
+		do {
+			status = src.readFrame(&frames[i][0],1000,&remaining);
+		} while (status==FrameSource::FIFO_TIMEOUT);
+		if (status!=FrameSource::SUCCESS) {
+			printf("synthetic read failed: %d\n",status);
+			return false;
+		}
+		if (frameTag(fmt,frames[i])!=(unsigned long) i) {
+			printf("frame %d has tag %lu\n",i,frameTag(fmt,frames[i]));
+			return false;
+		}
+		// RAMP: every channel of pixel x holds x.
+		const int16_t *px = reinterpret_cast<const int16_t*>(&frames[i][0]);
+		size_t numChans = multiChannel ? 4 : 1;
+		size_t x = 5;
+		for (size_t c=0;c<numChans;c++) {
+			if (px[(fmt.pixelsPerLine+x)*numChans+c]!=(int16_t) x) {
+				printf("frame %d has wrong ramp value\n",i);
+				return false;
+			}
+		}
+	}
+	int64_t t1 = Platform::perfCounter();
+	src.close();
+
+	double elapsed = (double) (t1-t0)/Platform::perfFrequency();
+	double expected = (NUM_FRAMES-1)/FRAME_RATE;
+	printf("%s: %d frames in %.3f s (expected %.3f s)\n",
+	       multiChannel ? "multi" : "single",NUM_FRAMES,elapsed,expected);
+	if (elapsed<expected*0.9) {
+		printf("synthetic source ran faster than its frame rate\n");
+		return false;
+	}
+	return true;
+}
+
+static bool testReplay(bool multiChannel, const std::vector< std::vector<char> > &frames)
+{
+	FrameFormat fmt;
+	makeFormat(fmt,multiChannel);
+
+	FILE *f;
+	if (fopen_s(&f,REPLAY_FILE,"wb")!=0) {
+		printf("could not create %s\n",REPLAY_FILE);
+		return false;
+	}
+	for (size_t i=0;i<frames.size();i++)
+		fwrite(&frames[i][0],1,frames[i].size(),f);
+	fwrite(&frames[0][0],1,fmt.frameSizeBytes/2,f); // trailing partial frame is ignored
+	fclose(f);
+
+	ReplayFrameSource src(REPLAY_FILE,0,true);
+	if (src.open(fmt)!=FrameSource::SUCCESS) {
+		printf("replay open failed\n");
+		return false;
+	}
+	std::vector<char> frame(fmt.frameSizeBytes);
+	for (size_t i=0;i<frames.size()*2+3;i++) {
+		size_t remaining;
+		FrameSource::Status status = src.readFrame(&frame[0],1000,&remaining);
+		if (status!=FrameSource::SUCCESS) {
+			printf("replay read %u failed: %d\n",(unsigned) i,status);
+			return false;
+		}
+		if (memcmp(&frame[0],&frames[i%frames.size()][0],fmt.frameSizeBytes)!=0) {
+			printf("replayed frame %u differs\n",(unsigned) i);
+			return false;
+		}
+	}
+	src.close();
+	remove(REPLAY_FILE);
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	bool ok = true;
+	for (int mc=0;mc<2 && ok;mc++) {
+		std::vector< std::vector<char> > frames;
+		ok = testSynthetic(mc!=0,frames) && testReplay(mc!=0,frames);
+	}
+
+	printf(ok ? "PASS\n" : "FAILED\n");
+	return ok ? 0 : 1;
+}
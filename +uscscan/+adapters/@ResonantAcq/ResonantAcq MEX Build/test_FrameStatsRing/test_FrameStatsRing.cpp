@@ -0,0 +1,180 @@
+// test_FrameStatsRing.cpp : Defines the entry point for the console application.
+//
+// Test for FrameStatsRing. First on one thread: records are numbered
+// from 1, readAfter returns those after the one given, oldest first,
+// keeps only the newest maxRecords and only those still in the ring
+// once it wraps, and reset restarts the numbering.
+//
+// Then a writer thread fills records as fast as it can, every field
+// stamped with the record's number, while the main thread polls as
+// MATLAB does (getFrameStats). Checks that no record read is torn, that
+// the numbers read only go up, and that the newest record is read last.
+//
+// Build as a console app with ../NIFPGAMex on the include path, linking
+// FrameStatsRing.cpp, Misc.cpp and PlatformWin32.cpp from that project.
+
+#include <tchar.h>
+#include <process.h>
+#include "stdio.h"
+#include <vector>
+#include <windows.h>
+#include "Misc.h"
+#include "FrameStatsRing.h"
+
+static const unsigned long NUM_WRITES = 2000000;
+
+static void writeRecord(FrameStatsRing &ring)
+{
+	FrameStatsRecord &rec = ring.beginWrite();
+	unsigned long n = rec.frameNumber;
+	rec.frameTag = n;
+	rec.numChannels = 4;
+	rec.pixelsPerChannel = n;
+	for (int c=0;c<FrameStatsRecord::MAX_CHANNELS;c++) {
+		FrameKernels::PixelStats &p = rec.channels[c];
+		p.min = (int16_t) n;
+		p.max = (int16_t) n;
+		p.sum = n;
+		p.sumSquares = n;
+		p.numSaturated = n;
+		for (int b=0;b<256;b++) {
+			p.histogram[b] = n;
+		}
+	}
+	ring.commitWrite();
+}
+
+// Every field is the record's number.
+static bool isWhole(const FrameStatsRecord &rec)
+{
+	unsigned long n = rec.frameNumber;
+	if (rec.frameTag!=n || rec.numChannels!=4 || rec.pixelsPerChannel!=n) {
+		return false;
+	}
+	for (int c=0;c<FrameStatsRecord::MAX_CHANNELS;c++) {
+		const FrameKernels::PixelStats &p = rec.channels[c];
+		if (p.min!=(int16_t) n || p.max!=(int16_t) n || p.sum!=(__int64) n ||
+		    p.sumSquares!=(unsigned __int64) n || p.numSaturated!=n) {
+			return false;
+		}
+		for (int b=0;b<256;b++) {
+			if (p.histogram[b]!=n) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+// readAfter(after,maxRecords) returns the records numbered first..last.
+static bool checkRead(const FrameStatsRing &ring, unsigned long after, size_t maxRecords,
+	unsigned long first, unsigned long last)
+{
+	std::vector<FrameStatsRecord> out;
+	size_t n = ring.readAfter(after,maxRecords,out);
+	bool ok = n==out.size() && n==(first<=last ? last-first+1 : 0);
+	for (size_t i=0;ok && i<n;i++) {
+		ok = out[i].frameNumber==first+i && isWhole(out[i]);
+	}
+	if (!ok) {
+		printf("readAfter(%lu,%lu): expected %lu..%lu, got %lu records\n",after,(unsigned long)maxRecords,
+			first,last,(unsigned long)n);
+	}
+	return ok;
+}
+
+static bool testSingleThread(void)
+{
+	const unsigned long CAP = FrameStatsRing::CAPACITY;
+	FrameStatsRing ring;
+	bool ok = checkRead(ring,0,100,1,0);
+
+	for (int i=0;i<5;i++) {
+		writeRecord(ring);
+	}
+	ok = ring.numWritten()==5 && ok;
+	ok = checkRead(ring,0,100,1,5) && ok;
+	ok = checkRead(ring,2,100,3,5) && ok;
+	ok = checkRead(ring,5,100,1,0) && ok;
+	ok = checkRead(ring,0,2,4,5) && ok;
+	ok = checkRead(ring,0,0,1,0) && ok;
+
+	// Wrapped: only the last CAPACITY records are left.
+	for (unsigned long i=5;i<3*CAP+7;i++) {
+		writeRecord(ring);
+	}
+	unsigned long newest = 3*CAP+7;
+	ok = checkRead(ring,0,1000,newest-CAP+1,newest) && ok;
+	ok = checkRead(ring,newest-3,1000,newest-2,newest) && ok;
+	ok = checkRead(ring,0,1,newest,newest) && ok;
+
+	ring.reset();
+	ok = ring.numWritten()==0 && checkRead(ring,0,1000,1,0) && ok;
+	writeRecord(ring);
+	ok = checkRead(ring,0,1000,1,1) && ok;
+
+	printf("single thread: %s\n",ok ? "ok" : "WRONG");
+	return ok;
+}
+
+struct WriterArgs {
+	FrameStatsRing *ring;
+	volatile LONG done;
+};
+
+static unsigned int WINAPI writerFcn(LPVOID userData)
+{
+	WriterArgs *args = static_cast<WriterArgs*>(userData);
+	for (unsigned long i=0;i<NUM_WRITES;i++) {
+		writeRecord(*args->ring);
+	}
+	InterlockedExchange(&args->done,1);
+	return 0;
+}
+
+static bool testConcurrent(void)
+{
+	FrameStatsRing ring;
+	WriterArgs args;
+	args.ring = &ring;
+	args.done = 0;
+	HANDLE writer = (HANDLE)_beginthreadex(NULL,0,writerFcn,&args,0,NULL);
+
+	bool ok = true;
+	unsigned long lastRead = 0;
+	unsigned long numRead = 0;
+	unsigned long numPolls = 0;
+	std::vector<FrameStatsRecord> out;
+	for (;;) {
+		bool writerDone = args.done!=0;
+		out.clear();
+		ring.readAfter(lastRead,16,out);
+		numPolls++;
+		for (size_t i=0;i<out.size();i++) {
+			if (!isWhole(out[i]) || out[i].frameNumber<=lastRead) {
+				ok = false;
+			}
+			lastRead = out[i].frameNumber;
+		}
+		numRead += (unsigned long) out.size();
+		if (writerDone && out.empty()) {
+			break;
+		}
+	}
+	WaitForSingleObject(writer,INFINITE);
+	CloseHandle(writer);
+
+	ok = ring.numWritten()==NUM_WRITES && lastRead==NUM_WRITES && ok;
+	printf("concurrent: %lu written, %lu read in %lu polls, newest %lu: %s\n",
+		ring.numWritten(),numRead,numPolls,lastRead,ok ? "ok" : "WRONG");
+	return ok;
+}
+
+int _tmain(int argc, _TCHAR* argv[])
+{
+	bool ok = testSingleThread();
+	ok = testConcurrent() && ok;
+
+	printf(ok ? "PASS\n" : "FAILED\n");
+	return ok ? 0 : 1;
+}
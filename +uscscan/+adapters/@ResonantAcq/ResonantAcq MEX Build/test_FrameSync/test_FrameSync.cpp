@@ -0,0 +1,145 @@
+// test_FrameSync.cpp : Defines the entry point for the console application.
+//
+// Test for FrameSync. Builds a FIFO stream of tagged frames, cuts
+// elements out of it at a few places (as a FIFO overflow would), and
+// reads it back frame by frame the way FrameCopier does, discarding
+// elements when FrameSync asks. Checks that every frame accepted is
+// intact, that reads get back in sync after each cut, and that frames
+// accepted plus frames reported lost account for every frame sent.
+// Also checks that pixel values equal to the tag identifier do not
+// upset an aligned stream. Runs single- and multi-channel formats.
+//
+// Build as a console app with ../NIFPGAMex and .. on the include path,
+// linking FrameSync.cpp, Misc.cpp and PlatformWin32.cpp from that project.
+
+#include <tchar.h>
+#include "stdio.h"
+#include <string.h>
+#include <vector>
+#include "FrameSync.h"
+
+static const unsigned long NUM_FRAMES = 300;
+static const unsigned long FIRST_TAG = 1000;
+
+static void makeFormat(FrameFormat &fmt, bool multiChannel)
+{
+	fmt.isMultiChannel = multiChannel;
+	fmt.linesPerFrame = 12;
+	fmt.pixelsPerLine = 10;
+	fmt.frameTagging = true;
+	fmt.tagSizeBytes = 8;
+	size_t elementBytes = multiChannel ? 8 : 2;
+	fmt.frameSizeFifoElements = fmt.linesPerFrame*fmt.pixelsPerLine + fmt.tagSizeBytes/elementBytes;
+	fmt.frameSizeBytes = fmt.frameSizeFifoElements*elementBytes;
+}
+
+// Pixel data derived from the tag, with a sprinkling of -32768 (the tag
+// identifier) to tempt the scan.
+static int16_t pixelValue(unsigned long tag, size_t i)
+{
+	return (i%37==5) ? (int16_t) -32768 : (int16_t) (tag*3+i);
+}
+
+static void makeFrame(const FrameFormat &fmt, unsigned long tag, int16_t *words)
+{
+	size_t tagIdx = fmt.tagWordIndex();
+	for (size_t i=0;i<tagIdx;i++)
+		words[i] = pixelValue(tag,i);
+	words[tagIdx] = -32768;
+	words[tagIdx+1] = 0;
+	words[tagIdx+2] = (int16_t) (tag/65536);
+	words[tagIdx+3] = (int16_t) (tag&0xFFFF);
+}
+
+static bool frameIntact(const FrameFormat &fmt, const int16_t *words)
+{
+	size_t tagIdx = fmt.tagWordIndex();
+	unsigned long tag = (unsigned long) (uint16_t) words[tagIdx+2]*65536 + (uint16_t) words[tagIdx+3];
+	for (size_t i=0;i<tagIdx;i++)
+		if (words[i]!=pixelValue(tag,i))
+			return false;
+	return true;
+}
+
+static bool runCase(bool multiChannel, const std::vector<size_t> &cutsAtFrame, size_t cutElements)
+{
+	FrameFormat fmt;
+	makeFormat(fmt,multiChannel);
+	size_t elementBytes = fmt.frameSizeBytes/fmt.frameSizeFifoElements;
+
+	// Build the stream, cutting cutElements elements out of the middle of
+	// the listed frames.
+	std::vector<char> stream;
+	std::vector<int16_t> frame(fmt.frameSizeBytes/2);
+	for (unsigned long f=0;f<NUM_FRAMES;f++) {
+		makeFrame(fmt,FIRST_TAG+f,&frame[0]);
+		const char *bytes = reinterpret_cast<const char*>(&frame[0]);
+		bool cut = false;
+		for (size_t c=0;c<cutsAtFrame.size();c++)
+			cut = cut || cutsAtFrame[c]==f;
+		if (cut) {
+			size_t keepHead = (fmt.frameSizeFifoElements/3)*elementBytes;
+			stream.insert(stream.end(),bytes,bytes+keepHead);
+			stream.insert(stream.end(),bytes+keepHead+cutElements*elementBytes,bytes+fmt.frameSizeBytes);
+		} else {
+			stream.insert(stream.end(),bytes,bytes+fmt.frameSizeBytes);
+		}
+	}
+
+	FrameSync sync;
+	sync.reset(fmt);
+	size_t pos = 0;
+	unsigned long accepted = 0;
+	while (pos+fmt.frameSizeBytes<=stream.size()) {
+		size_t discard;
+		bool ok = sync.checkFrame(&stream[pos],&discard);
+		if (ok) {
+			if (!frameIntact(fmt,reinterpret_cast<const int16_t*>(&stream[pos]))) {
+				printf("accepted a corrupt frame at byte %u\n",(unsigned) pos);
+				return false;
+			}
+			accepted++;
+		}
+		pos += fmt.frameSizeBytes + discard*elementBytes;
+	}
+
+	unsigned long lost = sync.framesLost();
+	unsigned long expectedLast = FIRST_TAG+NUM_FRAMES-1;
+	printf("%s, %u cuts of %u elements: %lu accepted, %lu lost, %lu resyncs, last tag %lu\n",
+	       multiChannel ? "multi" : "single",(unsigned) cutsAtFrame.size(),(unsigned) cutElements,
+	       accepted,lost,sync.numResyncs(),sync.lastTag());
+
+	if (sync.lastTag()!=expectedLast && sync.lastTag()!=expectedLast-1) {
+		printf("did not stay in sync to the end of the stream\n");
+		return false;
+	}
+	if (accepted+lost!=sync.lastTag()-FIRST_TAG+1) {
+		printf("frames accepted and lost do not add up\n");
+		return false;
+	}
+	if (sync.numResyncs()!=cutsAtFrame.size()) {
+		printf("expected %u resyncs\n",(unsigned) cutsAtFrame.size());
+		return false;
+	}
+	return true;
+}
+
+int _tmain(int argc, _TCHAR* argv[])
+{
+	bool ok = true;
+	for (int mc=0;mc<2;mc++) {
+		std::vector<size_t> cuts;
+		ok = runCase(mc!=0,cuts,0) && ok;
+
+		cuts.push_back(10);
+		ok = runCase(mc!=0,cuts,1) && ok;
+
+		cuts.push_back(100);
+		cuts.push_back(150);
+		cuts.push_back(200);
+		ok = runCase(mc!=0,cuts,7) && ok;
+	}
+
+	printf(ok ? "PASS\n" : "FAILED\n");
+	return ok ? 0 : 1;
+}
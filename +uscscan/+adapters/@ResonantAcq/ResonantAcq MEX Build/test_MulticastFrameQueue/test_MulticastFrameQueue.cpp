@@ -0,0 +1,351 @@
+// test_MulticastFrameQueue.cpp : Defines the entry point for the console application.
+//
+// Stress test for MulticastFrameQueue. A producer thread pushes
+// NUM_PUSHES records, each stamped with its one-based push index, to
+// three readers: a NEVER_DROP "logger" and two DROP_OLDEST readers,
+// "display" and "stats". All read records in place and stall now and
+// then, the DROP_OLDEST readers much more often. Checks:
+// * each reader sees records in push order, with no torn records;
+// * the logger sees every record that entered the queue, ie its gaps
+// are exactly the dropped pushes;
+// * for each DROP_OLDEST reader, popped + skipped-ahead + dropped
+// pushes == pushes, ie a dropped push never skipped it ahead.
+// Before the stress run, single-threaded checks that a push which fails
+// because one reader holds the oldest slot leaves the others where they
+// were, and that a reservation of the oldest slot holds a DROP_OLDEST
+// reader back from it but costs it the record only once committed.
+//
+// Build as a console app with ../NIFPGAMex on the include path, linking
+// MulticastFrameQueue.cpp, Misc.cpp and PlatformWin32.cpp from that
+// project.
+
+#include <tchar.h>
+#include <process.h>
+#include "stdio.h"
+#include "MulticastFrameQueue.h"
+
+static const unsigned long NUM_PUSHES = 2000000;
+static const unsigned long RECORD_SIZE = 64; // bytes
+static const unsigned long CAPACITY = 16;
+
+struct ReaderState {
+	FrameQueueReader *reader;
+	unsigned long stallEvery; // pops between 1ms stalls
+	unsigned long numPopped;
+	unsigned long numOutOfOrder;
+	unsigned long numCorrupt;
+	std::vector<unsigned long> gaps; // push indices this reader never saw
+};
+
+struct TestState {
+	MulticastFrameQueue *q;
+	volatile LONG producerDone;
+	ReaderState logger;
+	ReaderState display;
+	ReaderState stats;
+};
+
+struct ReaderArgs {
+	TestState *ts;
+	ReaderState *rs;
+};
+
+static void fillRecord(char *rec, unsigned long idx)
+{
+	unsigned long *p = reinterpret_cast<unsigned long*>(rec);
+	for (unsigned long i=0;i<RECORD_SIZE/sizeof(unsigned long);i++) {
+		p[i] = idx;
+	}
+}
+
+static bool checkRecord(const char *rec, unsigned long &idx)
+{
+	const unsigned long *p = reinterpret_cast<const unsigned long*>(rec);
+	idx = p[0];
+	for (unsigned long i=1;i<RECORD_SIZE/sizeof(unsigned long);i++) {
+		if (p[i]!=idx) {
+			return false; // torn record
+		}
+	}
+	return true;
+}
+
+static unsigned int WINAPI producerFcn(LPVOID userData)
+{
+	TestState *ts = static_cast<TestState*>(userData);
+	char rec[RECORD_SIZE];
+	for (unsigned long idx=1;idx<=NUM_PUSHES;idx++) {
+		if (idx%2==1) {
+			char *slot = static_cast<char*>(ts->q->reserve_back());
+			if (slot!=NULL) {
+				fillRecord(slot,idx);
+				ts->q->commit_back();
+				continue;
+			}
+		}
+		fillRecord(rec,idx);
+		ts->q->push_back(rec);
+	}
+	InterlockedExchange(&ts->producerDone,1);
+	return 0;
+}
+
+static unsigned int WINAPI readerFcn(LPVOID userData)
+{
+	ReaderArgs *args = static_cast<ReaderArgs*>(userData);
+	TestState *ts = args->ts;
+	ReaderState *rs = args->rs;
+	unsigned long expected = 1;
+	while (true) {
+		const void *front = rs->reader->acquire_front();
+		if (front==NULL) {
+			if (ts->producerDone && rs->reader->isEmpty()) {
+				break;
+			}
+			continue;
+		}
+
+		unsigned long idx;
+		if (!checkRecord(static_cast<const char*>(front),idx)) {
+			rs->numCorrupt++;
+		}
+		// Re-check after a delay, while the slot is still acquired.
+		if (rs->numPopped % 1000 == 0) {
+			Sleep(0);
+			unsigned long idx2;
+			if (!checkRecord(static_cast<const char*>(front),idx2) || idx2!=idx) {
+				rs->numCorrupt++;
+			}
+		}
+		rs->reader->release_front();
+		rs->numPopped++;
+
+		if (idx<expected) {
+			rs->numOutOfOrder++;
+		} else {
+			for (;expected<idx;expected++) {
+				rs->gaps.push_back(expected);
+			}
+			expected = idx+1;
+		}
+
+		if (rs->numPopped % rs->stallEvery == 0) {
+			Sleep(1);
+		}
+	}
+	for (;expected<=NUM_PUSHES;expected++) {
+		rs->gaps.push_back(expected);
+	}
+	return 0;
+}
+
+static void initReaderState(ReaderState &rs, FrameQueueReader *r, unsigned long stallEvery)
+{
+	rs.reader = r;
+	rs.stallEvery = stallEvery;
+	rs.numPopped = 0;
+	rs.numOutOfOrder = 0;
+	rs.numCorrupt = 0;
+}
+
+static int checkReader(const char *name, const ReaderState &rs)
+{
+	int failures = 0;
+	printf("%s: popped: %lu, gaps: %lu, skipped ahead: %lu\n",name,
+		rs.numPopped,(unsigned long)rs.gaps.size(),rs.reader->num_dropped_oldest());
+	if (rs.numOutOfOrder>0) {
+		printf("FAIL: %s: %lu records out of order\n",name,rs.numOutOfOrder);
+		failures++;
+	}
+	if (rs.numCorrupt>0) {
+		printf("FAIL: %s: %lu torn records\n",name,rs.numCorrupt);
+		failures++;
+	}
+	return failures;
+}
+
+static int checkDropOldest(const char *name, const ReaderState &rs, unsigned long ndpb)
+{
+	int failures = 0;
+	unsigned long skipped = rs.reader->num_dropped_oldest();
+	if (rs.numPopped+skipped+ndpb!=NUM_PUSHES) {
+		printf("FAIL: %s popped + skipped + dropped (%lu + %lu + %lu) != %lu\n",
+			name,rs.numPopped,skipped,ndpb,NUM_PUSHES);
+		failures++;
+	}
+	if (skipped==0) {
+		printf("WARNING: %s was never skipped ahead; DROP_OLDEST path not exercised\n",name);
+	}
+	return failures;
+}
+
+// Fill a ring whose second DROP_OLDEST reader holds the oldest slot;
+// the next push must fail without skipping the first reader.
+static int testFailedPushLeavesReaders(void)
+{
+	int failures = 0;
+	MulticastFrameQueue q;
+	FrameQueueReader *first = q.addReader(MulticastFrameQueue::DROP_OLDEST);
+	FrameQueueReader *second = q.addReader(MulticastFrameQueue::DROP_OLDEST);
+	q.init(RECORD_SIZE,CAPACITY,CAPACITY);
+
+	char rec[RECORD_SIZE];
+	for (unsigned long idx=1;idx<=CAPACITY;idx++) {
+		fillRecord(rec,idx);
+		q.push_back(rec);
+	}
+	second->acquire_front();
+	fillRecord(rec,CAPACITY+1);
+	if (q.push_back(rec) || q.reserve_back()!=NULL) {
+		printf("FAIL: push into a ring whose oldest slot is acquired succeeded\n");
+		failures++;
+	}
+	if (first->size()!=CAPACITY || first->num_dropped_oldest()!=0) {
+		printf("FAIL: failed push skipped a reader ahead (size %lu, skipped %lu)\n",
+			first->size(),first->num_dropped_oldest());
+		failures++;
+	}
+	unsigned long idx = 0;
+	const void *front = first->acquire_front();
+	if (front==NULL || !checkRecord(static_cast<const char*>(front),idx) || idx!=1) {
+		printf("FAIL: first reader lost its oldest record (front is %lu)\n",idx);
+		failures++;
+	}
+	first->release_front();
+	second->release_front();
+
+	// With the slot released, the next push skips the first reader (now
+	// at 2, not holding the oldest slot) not at all, and the second one.
+	if (!q.push_back(rec) || first->num_dropped_oldest()!=0 ||
+		second->num_dropped_oldest()!=0) {
+		printf("FAIL: push after release\n");
+		failures++;
+	}
+	if (!q.push_back(rec) || first->num_dropped_oldest()!=1 ||
+		second->num_dropped_oldest()!=1) {
+		printf("FAIL: push did not skip both readers ahead\n");
+		failures++;
+	}
+	return failures;
+}
+
+static int testReservationSkipsOnCommit(void)
+{
+	int failures = 0;
+	MulticastFrameQueue q;
+	FrameQueueReader *r = q.addReader(MulticastFrameQueue::DROP_OLDEST);
+	q.init(RECORD_SIZE,CAPACITY,CAPACITY);
+
+	char rec[RECORD_SIZE];
+	for (unsigned long idx=1;idx<=CAPACITY;idx++) {
+		fillRecord(rec,idx);
+		q.push_back(rec);
+	}
+	// Reserve the slot of record 1, eg for a FIFO read that then times out.
+	char *slot = static_cast<char*>(q.reserve_back());
+	if (slot==NULL || q.reserve_back()!=slot) {
+		printf("FAIL: reserve_back of a full DROP_OLDEST ring\n");
+		return failures+1;
+	}
+	if (r->acquire_front()!=NULL) {
+		printf("FAIL: reader acquired a slot reserved by the producer\n");
+		r->release_front();
+		failures++;
+	}
+	q.cancel_back();
+	unsigned long idx = 0;
+	const void *front = r->acquire_front();
+	if (r->num_dropped_oldest()!=0 || front==NULL ||
+		!checkRecord(static_cast<const char*>(front),idx) || idx!=1) {
+		printf("FAIL: cancelled reservation cost the reader its oldest record (front is %lu)\n",idx);
+		failures++;
+	}
+	if (front!=NULL) {
+		r->release_front();
+	}
+
+	// Refill the slot the reader gave up; the reader is then at record 2,
+	// whose slot the next reservation takes.
+	fillRecord(rec,CAPACITY+1);
+	q.push_back(rec);
+	slot = static_cast<char*>(q.reserve_back());
+	if (slot==NULL || r->num_dropped_oldest()!=0) {
+		printf("FAIL: reserve_back skipped the reader ahead before the commit\n");
+		failures++;
+	}
+	if (slot!=NULL) {
+		fillRecord(slot,CAPACITY+2);
+		q.commit_back();
+	}
+	front = r->acquire_front();
+	idx = 0;
+	if (r->num_dropped_oldest()!=1 || r->size()!=CAPACITY || front==NULL ||
+		!checkRecord(static_cast<const char*>(front),idx) || idx!=3) {
+		printf("FAIL: committed reservation did not skip the reader past record 2 (front is %lu)\n",idx);
+		failures++;
+	}
+	return failures;
+}
+
+int _tmain(int argc, _TCHAR* argv[])
+{
+	int failures = testFailedPushLeavesReaders();
+	failures += testReservationSkipsOnCommit();
+
+	TestState ts;
+	ts.q = new MulticastFrameQueue();
+	FrameQueueReader *logger = ts.q->addReader(MulticastFrameQueue::NEVER_DROP);
+	FrameQueueReader *display = ts.q->addReader(MulticastFrameQueue::DROP_OLDEST);
+	FrameQueueReader *stats = ts.q->addReader(MulticastFrameQueue::DROP_OLDEST);
+	ts.q->init(RECORD_SIZE,CAPACITY,NUM_PUSHES);
+	ts.producerDone = 0;
+	initReaderState(ts.logger,logger,50000);
+	initReaderState(ts.display,display,500);
+	initReaderState(ts.stats,stats,700);
+
+	ReaderArgs loggerArgs = { &ts, &ts.logger };
+	ReaderArgs displayArgs = { &ts, &ts.display };
+	ReaderArgs statsArgs = { &ts, &ts.stats };
+	HANDLE loggerThread = (HANDLE)_beginthreadex(NULL,0,readerFcn,&loggerArgs,0,NULL);
+	HANDLE displayThread = (HANDLE)_beginthreadex(NULL,0,readerFcn,&displayArgs,0,NULL);
+	HANDLE statsThread = (HANDLE)_beginthreadex(NULL,0,readerFcn,&statsArgs,0,NULL);
+	HANDLE producer = (HANDLE)_beginthreadex(NULL,0,producerFcn,&ts,0,NULL);
+	WaitForSingleObject(producer,INFINITE);
+	WaitForSingleObject(loggerThread,INFINITE);
+	WaitForSingleObject(displayThread,INFINITE);
+	WaitForSingleObject(statsThread,INFINITE);
+	CloseHandle(producer);
+	CloseHandle(loggerThread);
+	CloseHandle(displayThread);
+	CloseHandle(statsThread);
+
+	unsigned long tnpb = ts.q->total_num_push_back();
+	unsigned long ndpb = ts.q->num_dropped_push_back();
+	const std::vector<unsigned long> &dropped = ts.q->dropped_push_back();
+	printf("tnpb: %lu, ndpb: %lu\n",tnpb,ndpb);
+
+	failures += checkReader("logger",ts.logger);
+	failures += checkReader("display",ts.display);
+	failures += checkReader("stats",ts.stats);
+
+	if (tnpb!=NUM_PUSHES) {
+		printf("FAIL: total_num_push_back %lu != %lu\n",tnpb,NUM_PUSHES);
+		failures++;
+	}
+	if (logger->num_dropped_oldest()!=0) {
+		printf("FAIL: NEVER_DROP reader was skipped ahead\n");
+		failures++;
+	}
+	if (dropped!=ts.logger.gaps) {
+		printf("FAIL: dropped_push_back (%lu entries) does not match logger gaps (%lu entries)\n",
+			(unsigned long)dropped.size(),(unsigned long)ts.logger.gaps.size());
+		failures++;
+	}
+	failures += checkDropOldest("display",ts.display,ndpb);
+	failures += checkDropOldest("stats",ts.stats,ndpb);
+
+	delete ts.q;
+
+	printf(failures==0 ? "PASS\n" : "FAILED\n");
+	return failures==0 ? 0 : 1;
+}
@@ -0,0 +1,193 @@
+// test_NiFpgaFifoSource.cpp : Defines the entry point for the console application.
+//
+// Test for NiFpgaFifoSource's batched reads, against a fake DMA FIFO
+// that implements the NiFpga read/acquire/release calls on a circular
+// host buffer. The buffer size is chosen so frames straddle its end at
+// varying offsets. Checks that batched and one-at-a-time reads both
+// deliver every frame, in order and intact, in single- and multi-channel
+// formats.
+//
+// Build as a console app with ../NIFPGAMex and .. on the include path,
+// linking NiFpgaFifoSource.cpp, Misc.cpp and PlatformWin32.cpp from that
+// project (but not the NiFpga library, which the fake below replaces).
+
+#include <tchar.h>
+#include "stdio.h"
+#include <string.h>
+#include <vector>
+#include "NiFpgaFifoSource.h"
+
+// Fake target-to-host FIFO. Elements written by the "FPGA" are appended
+// at fWrite; the host reads or acquires from fRead.
+static std::vector<char> fifoBuf;
+static size_t fifoElementSize;
+static size_t fifoCapacity; // elements
+static size_t fifoRead, fifoWrite; // absolute element counts
+static size_t fifoAcquired;
+
+static size_t fifoAvailable(void) { return fifoWrite-fifoRead; }
+
+static void fifoReset(size_t elementSize, size_t capacity)
+{
+	fifoElementSize = elementSize;
+	fifoCapacity = capacity;
+	fifoBuf.assign(capacity*elementSize,0);
+	fifoRead = fifoWrite = fifoAcquired = 0;
+}
+
+static bool fifoWriteElements(const char *src, size_t n)
+{
+	if (fifoCapacity-fifoAvailable()<n)
+		return false;
+	for (size_t i=0;i<n;i++,fifoWrite++)
+		memcpy(&fifoBuf[(fifoWrite%fifoCapacity)*fifoElementSize],src+i*fifoElementSize,fifoElementSize);
+	return true;
+}
+
+static NiFpga_Status fakeRead(char *data, size_t n, size_t *elementsRemaining)
+{
+	if (fifoAcquired>0 || fifoAvailable()<n) {
+		*elementsRemaining = fifoAvailable();
+		return NiFpga_Status_FifoTimeout;
+	}
+	for (size_t i=0;i<n;i++,fifoRead++)
+		memcpy(data+i*fifoElementSize,&fifoBuf[(fifoRead%fifoCapacity)*fifoElementSize],fifoElementSize);
+	*elementsRemaining = fifoAvailable();
+	return NiFpga_Status_Success;
+}
+
+static NiFpga_Status fakeAcquire(char **elements, size_t n, size_t *acquired, size_t *elementsRemaining)
+{
+	*acquired = 0;
+	if (fifoAcquired>0 || fifoAvailable()<n) {
+		*elementsRemaining = fifoAvailable();
+		return NiFpga_Status_FifoTimeout;
+	}
+	// The acquired region is contiguous, so it stops at the end of the buffer.
+	size_t pos = fifoRead%fifoCapacity;
+	*acquired = (n < fifoCapacity-pos) ? n : fifoCapacity-pos;
+	*elements = &fifoBuf[pos*fifoElementSize];
+	fifoAcquired = *acquired;
+	*elementsRemaining = fifoAvailable()-fifoAcquired;
+	return NiFpga_Status_Success;
+}
+
+extern "C" {
+
+NiFpga_Status NiFpga_Initialize(void) { return NiFpga_Status_Success; }
+
+NiFpga_Status NiFpga_ReadFifoI16(NiFpga_Session, uint32_t, int16_t *data, size_t n, uint32_t, size_t *rem)
+{
+	return fakeRead(reinterpret_cast<char*>(data),n,rem);
+}
+
+NiFpga_Status NiFpga_ReadFifoI64(NiFpga_Session, uint32_t, int64_t *data, size_t n, uint32_t, size_t *rem)
+{
+	return fakeRead(reinterpret_cast<char*>(data),n,rem);
+}
+
+NiFpga_Status NiFpga_AcquireFifoReadElementsI16(NiFpga_Session, uint32_t, int16_t **elements, size_t n,
+						uint32_t, size_t *acquired, size_t *rem)
+{
+	return fakeAcquire(reinterpret_cast<char**>(elements),n,acquired,rem);
+}
+
+NiFpga_Status NiFpga_AcquireFifoReadElementsI64(NiFpga_Session, uint32_t, int64_t **elements, size_t n,
+						uint32_t, size_t *acquired, size_t *rem)
+{
+	return fakeAcquire(reinterpret_cast<char**>(elements),n,acquired,rem);
+}
+
+NiFpga_Status NiFpga_ReleaseFifoElements(NiFpga_Session, uint32_t, size_t n)
+{
+	if (n!=fifoAcquired)
+		return NiFpga_Status_InvalidParameter;
+	fifoRead += n;
+	fifoAcquired = 0;
+	return NiFpga_Status_Success;
+}
+
+}
+
+static const size_t NUM_FRAMES = 500;
+
+// Frame f holds the int16 sequence f*7+i, so misplaced data is caught.
+static void fillFrame(std::vector<char> &frame, size_t f)
+{
+	int16_t *w = reinterpret_cast<int16_t*>(&frame[0]);
+	for (size_t i=0;i<frame.size()/2;i++)
+		w[i] = (int16_t) (f*7+i);
+}
+
+static bool runCase(bool multiChannel, bool batched)
+{
+	FrameFormat fmt;
+	fmt.isMultiChannel = multiChannel;
+	fmt.linesPerFrame = 16;
+	fmt.pixelsPerLine = 20;
+	size_t elementSize = multiChannel ? 8 : 2;
+	fmt.frameSizeFifoElements = fmt.linesPerFrame*fmt.pixelsPerLine;
+	fmt.frameSizeBytes = fmt.frameSizeFifoElements*elementSize;
+
+	// 5.3 frames, so the wrap falls at a different point in each frame.
+	fifoReset(elementSize,fmt.frameSizeFifoElements*53/10);
+
+	NiFpgaFifoSource src(0,1,2);
+	src.open(fmt);
+
+	std::vector<char> frame(fmt.frameSizeBytes), expected(fmt.frameSizeBytes);
+	size_t written = 0, received = 0;
+	unsigned long step = 0;
+	while (received<NUM_FRAMES) {
+		// Write a varying number of frames between reads.
+		size_t burst = (step++*5)%4+1;
+		for (size_t i=0;i<burst && written<NUM_FRAMES;i++) {
+			fillFrame(frame,written);
+			if (!fifoWriteElements(&frame[0],fmt.frameSizeFifoElements))
+				break;
+			written++;
+		}
+
+		const char *frames;
+		size_t numFrames, remaining;
+		NiFpga_Status status;
+		if (batched) {
+			status = src.acquireFrames(3,0,&frames,&numFrames,&remaining);
+		} else {
+			status = src.readFrame(&frame[0],0,&remaining);
+			frames = &frame[0];
+			numFrames = 1;
+		}
+		if (status==NiFpga_Status_FifoTimeout)
+			continue;
+		if (status!=NiFpga_Status_Success) {
+			printf("read failed: %d\n",status);
+			return false;
+		}
+		for (size_t i=0;i<numFrames;i++,received++) {
+			fillFrame(expected,received);
+			if (memcmp(frames+i*fmt.frameSizeBytes,&expected[0],fmt.frameSizeBytes)!=0) {
+				printf("frame %u corrupt\n",(unsigned) received);
+				return false;
+			}
+		}
+		if (batched)
+			src.releaseFrames();
+	}
+	src.close();
+
+	printf("%s %s: %u frames OK\n",multiChannel ? "multi" : "single",
+	       batched ? "batched" : "single-read",(unsigned) received);
+	return fifoAcquired==0 && fifoAvailable()==0;
+}
+
+int _tmain(int argc, _TCHAR* argv[])
+{
+	bool ok = true;
+	for (int mc=0;mc<2;mc++)
+		for (int b=0;b<2;b++)
+			ok = runCase(mc!=0,b!=0) && ok;
+
+	printf(ok ? "PASS\n" : "FAILED\n");
+	return ok ? 0 : 1;
+}
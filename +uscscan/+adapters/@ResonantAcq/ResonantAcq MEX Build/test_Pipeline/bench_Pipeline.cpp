@@ -0,0 +1,247 @@
+// bench_Pipeline.cpp : Defines the entry point for the console application.
+//
+// Throughput benchmark for the acquisition pipeline, without MATLAB or
+// an FPGA. Runs the real FrameCopier and FrameLogger, set up through
+// PipelineParams the way the MEX sets them up (mexFunction's init,
+// RESIZE_ACQUISITION and START_ACQ), with a SyntheticFrameSource in
+// place of the FPGA FIFO. Nothing reads the display reader, as when
+// MATLAB falls behind.
+//
+// Sweeps frame size, channel count (1 or 4), logging average factor and
+// queue capacity, and writes a CSV row per run: frames/s through the
+// logger, CPU % of the copier thread, of the logger thread and of the
+// whole process (with the source and any compression threads), mean
+// time per frame in each stage (PipelineStats), frames dropped at the
+// queue, and MB/s to disk. Usage:
+//   bench_Pipeline [dir] [numFrames] [framesPerSecond] [csvFile]
+//
+// framesPerSecond 0 (the default) runs the source flat out, so that
+// the copier outruns the logger and the queue drops frames; the fps
+// column is then the pipeline's ceiling. Give the acquisition's frame
+// rate to see whether it keeps up. Point dir at the logging drive.
+//
+// On Windows, build as a console app with ../NIFPGAMex and .. on the
+// include path, linking FrameCopier.cpp, FrameLogger.cpp and the
+// sources they use from that project with PlatformWin32.cpp (see
+// bench_Pipeline.vcproj), and zlib. Elsewhere, build it with the CMake
+// build in the parent directory. Build Release; the Debug numbers mean
+// nothing.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include "Platform.h"
+#include "Misc.h"
+#include "PipelineParams.h"
+#include "FrameCopier.h"
+#include "FrameLogger.h"
+#include "SyntheticFrameSource.h"
+#include "MulticastFrameQueue.h"
+#include "FrameHistory.h"
+#include "FrameStatsRing.h"
+#include "PipelineStats.h"
+
+static const size_t TAG_SIZE_BYTES = 8;
+
+struct BenchConfig {
+	unsigned int linesPerFrame;
+	unsigned int pixelsPerLine;
+	bool multiChannel;
+	unsigned int averageFactor;
+	unsigned long queueCapacity;
+	unsigned long numFrames;
+	double framesPerSecond;
+	std::string fileName;
+};
+
+struct BenchResult {
+	double seconds;
+	unsigned long framesPushed;
+	unsigned long framesDropped;
+	unsigned long framesLogged;
+	double cpuSeconds;       // process
+	double copierCpuSeconds;
+	double loggerCpuSeconds;
+	double fileMB;
+	double fifoReadUs;      // mean per frame, by stage
+	double deinterleaveUs;
+	double loggerWriteUs;
+	double queueDwellUs;
+};
+
+static double nowSeconds(void)
+{
+	return (double) Platform::perfCounter() / (double) Platform::perfFrequency();
+}
+
+// Settings and shared objects as MatlabParams reads them from a
+// ResonantAcq with simulated = true, and as mexFunction creates and
+// sizes them.
+static void initParams(PipelineParams &pp, const BenchConfig &config)
+{
+	size_t elementBytes = config.multiChannel ? 8 : 2;
+	pp.simulated = true;
+	pp.simulatedFrameRate = config.framesPerSecond;
+	pp.pixelsPerLine = config.pixelsPerLine;
+	pp.linesPerFrame = config.linesPerFrame;
+	pp.frameTagging = true;
+	pp.isMultiChannel = config.multiChannel;
+	pp.frameQueueCapacity = config.queueCapacity;
+	pp.frameSizePixels = (size_t) config.linesPerFrame*config.pixelsPerLine;
+	pp.tagSizeBytes = TAG_SIZE_BYTES;
+	pp.tagSizeFifoElements = TAG_SIZE_BYTES/elementBytes;
+	pp.frameSizeFifoElements = pp.frameSizePixels + pp.tagSizeFifoElements;
+	pp.frameSizeBytes = pp.frameSizeFifoElements*elementBytes;
+	pp.numLoggingChannels = config.multiChannel ? 4 : 1;
+
+	pp.loggingEnabled = true;
+	pp.loggingAverageFactor = config.averageFactor;
+	strcpy_s(pp.loggingFullFileName,config.fileName.c_str());
+	strcpy_s(pp.loggingOpenModeString,"wbn");
+	strcpy_s(pp.loggingHeaderString,"benchmark frame");
+	pp.statsEnabled = true;
+
+	pp.frameQueue = new MulticastFrameQueue();
+	pp.matlabQueue = pp.frameQueue->addReader(MulticastFrameQueue::DROP_OLDEST);
+	pp.loggingQueue = pp.frameQueue->addReader(MulticastFrameQueue::NEVER_DROP);
+	pp.averagedFrameQueue = new MulticastFrameQueue();
+	pp.averagedQueue = pp.averagedFrameQueue->addReader(MulticastFrameQueue::DROP_OLDEST);
+	pp.frameHistory = new FrameHistory();
+	pp.stats = new PipelineStats();
+	pp.frameStats = new FrameStatsRing();
+
+	pp.frameQueue->init(pp.frameSizeBytes,pp.frameQueueCapacity,pp.frameQueueCapacity);
+	pp.averagedFrameQueue->init(pp.frameSizeBytes,1,1);
+	pp.frameHistory->init(pp.frameSizeBytes,0);
+}
+
+static void deleteParams(PipelineParams &pp)
+{
+	delete pp.frameStats;
+	delete pp.stats;
+	delete pp.frameHistory;
+	delete pp.averagedFrameQueue;
+	delete pp.frameQueue;
+}
+
+static BenchResult runPipeline(const BenchConfig &config)
+{
+	BenchResult result;
+	memset(&result,0,sizeof(result));
+
+	PipelineParams pp;
+	initParams(pp,config);
+	FrameCopier *copier = new FrameCopier(&pp);
+	FrameLogger *logger = new FrameLogger(&pp);
+
+	// As START_ACQ.
+	double t0 = nowSeconds();
+	double cpu0 = Platform::processCpuSeconds();
+	pp.loggingQueue->setEnabled(true);
+	copier->setFrameSource(new SyntheticFrameSource(SyntheticFrameSource::RAMP,config.framesPerSecond));
+	copier->startProcessing();
+	logger->configureLogFile();
+	if (!logger->arm()) {
+		fprintf(stderr,"bench_Pipeline: could not arm the logger\n");
+		copier->stopProcessing();
+		delete logger;
+		delete copier;
+		deleteParams(pp);
+		return result;
+	}
+	logger->startLogging();
+
+	// Pushes include the ones dropped for a full queue.
+	while (pp.frameQueue->total_num_push_back()<config.numFrames)
+		Platform::sleepMs(1);
+
+	// As STOP_ACQ, but the copier first, so that the logger gets every
+	// frame that made it into the queue.
+	copier->stopProcessing();
+	logger->stopLogging();
+	result.seconds = nowSeconds()-t0;
+	result.cpuSeconds = Platform::processCpuSeconds()-cpu0;
+	result.copierCpuSeconds = copier->getProcessingThreadCpuSeconds();
+	result.loggerCpuSeconds = logger->getLoggingThreadCpuSeconds();
+
+	result.framesPushed = pp.frameQueue->total_num_push_back();
+	result.framesDropped = pp.frameQueue->num_dropped_push_back();
+	result.framesLogged = logger->getFramesLogged();
+	FILE *fh = fopen(config.fileName.c_str(),"rb");
+	if (fh!=NULL) {
+		fseek(fh,0,SEEK_END);
+		result.fileMB = ftell(fh)/(1024.0*1024.0);
+		fclose(fh);
+	}
+	remove(config.fileName.c_str());
+
+	result.fifoReadUs = pp.stats->histogram(PipelineStats::FIFO_READ).mean()/1000;
+	result.deinterleaveUs = pp.stats->histogram(PipelineStats::DEINTERLEAVE).mean()/1000;
+	result.loggerWriteUs = pp.stats->histogram(PipelineStats::LOGGER_WRITE).mean()/1000;
+	result.queueDwellUs = pp.stats->histogram(PipelineStats::LOGGING_QUEUE_DWELL).mean()/1000;
+
+	delete logger;
+	delete copier;
+	deleteParams(pp);
+	return result;
+}
+
+static const char *CSV_HEADER = "lines,pixelsPerLine,channels,averageFactor,queueCapacity,framesLogged,seconds,fps,"
+	"copierCpuPct,loggerCpuPct,cpuPct,fifoReadUs,deinterleaveUs,loggerWriteUs,queueDwellUs,droppedFrames,diskMBps";
+
+static void writeRow(FILE *f, const BenchConfig &config, const BenchResult &r)
+{
+	double secs = r.seconds>0 ? r.seconds : 1;
+	fprintf(f,"%u,%u,%u,%u,%lu,%lu,%.3f,%.1f,%.1f,%.1f,%.1f,%.2f,%.2f,%.2f,%.2f,%lu,%.1f\n",
+		config.linesPerFrame,config.pixelsPerLine,config.multiChannel ? 4 : 1,config.averageFactor,
+		config.queueCapacity,r.framesLogged,r.seconds,r.framesLogged/secs,
+		100*r.copierCpuSeconds/secs,100*r.loggerCpuSeconds/secs,100*r.cpuSeconds/secs,
+		r.fifoReadUs,r.deinterleaveUs,r.loggerWriteUs,r.queueDwellUs,r.framesDropped,r.fileMB/secs);
+	fflush(f);
+}
+
+int main(int argc, char* argv[])
+{
+	std::string dir = (argc>1) ? argv[1] : ".";
+	unsigned long numFrames = (argc>2) ? atoi(argv[2]) : 2000;
+	double framesPerSecond = (argc>3) ? atof(argv[3]) : 0;
+	FILE *csv = (argc>4) ? fopen(argv[4],"w") : NULL;
+
+	printf("%s\n",CSV_HEADER);
+	if (csv!=NULL)
+		fprintf(csv,"%s\n",CSV_HEADER);
+
+	static const unsigned int sizes[] = { 256, 512, 1024 };
+	static const bool channels[] = { false, true };
+	static const unsigned int averageFactors[] = { 1, 4 };
+	static const unsigned long capacities[] = { 4, 32 };
+
+	BenchConfig config;
+	config.framesPerSecond = framesPerSecond;
+	config.fileName = dir + "/bench_Pipeline.tif"; // Windows takes / too
+	for (size_t s=0;s<sizeof(sizes)/sizeof(sizes[0]);s++) {
+		for (size_t c=0;c<sizeof(channels)/sizeof(channels[0]);c++) {
+			for (size_t a=0;a<sizeof(averageFactors)/sizeof(averageFactors[0]);a++) {
+				for (size_t q=0;q<sizeof(capacities)/sizeof(capacities[0]);q++) {
+					config.linesPerFrame = sizes[s];
+					config.pixelsPerLine = sizes[s];
+					config.multiChannel = channels[c];
+					config.averageFactor = averageFactors[a];
+					config.queueCapacity = capacities[q];
+					// keep the amount acquired per run roughly constant
+					config.numFrames = (unsigned long) ((double) numFrames*512*512/((double) sizes[s]*sizes[s]));
+					if (config.numFrames<10)
+						config.numFrames = 10;
+					BenchResult result = runPipeline(config);
+					writeRow(stdout,config,result);
+					if (csv!=NULL)
+						writeRow(csv,config,result);
+				}
+			}
+		}
+	}
+	if (csv!=NULL)
+		fclose(csv);
+	return 0;
+}
@@ -0,0 +1,182 @@
+// test_PipelineStats.cpp : Defines the entry point for the console application.
+//
+// Test for LatencyHistogram and PipelineStats. Checks every value falls
+// in the bucket whose bounds hold it, and within 1/16 of its upper
+// bound; that percentiles of known distributions come out within that;
+// that disabled stats record nothing; and that concurrent writers lose
+// no records. Then times queue dwell as NIFPGAMex does: a producer
+// pushes to a timestamping MulticastFrameQueue and a reader that holds
+// each record for a known time records its dwell from acquired_ticks.
+//
+// Build as a console app with ../NIFPGAMex on the include path, linking
+// PipelineStats.cpp, MulticastFrameQueue.cpp, Misc.cpp and
+// PlatformWin32.cpp from that project.
+
+#include <tchar.h>
+#include <process.h>
+#include "stdio.h"
+#include <windows.h>
+#include "Misc.h"
+#include "PipelineStats.h"
+#include "MulticastFrameQueue.h"
+
+static const int NUM_WRITERS = 4;
+static const unsigned long RECORDS_PER_WRITER = 250000;
+
+// Each value v: lower<=v<=upper for its bucket, and upper-v <= v/16.
+static bool checkBuckets(void)
+{
+	bool ok = true;
+	unsigned __int64 v = 0;
+	while (ok && v < ((unsigned __int64) 1 << LatencyHistogram::MAX_VALUE_BITS)) {
+		unsigned int b = LatencyHistogram::bucketOf(v);
+		unsigned __int64 lo = LatencyHistogram::bucketLowerBound(b);
+		unsigned __int64 hi = LatencyHistogram::bucketUpperBound(b);
+		ok = b<LatencyHistogram::NUM_BUCKETS && lo<=v && v<=hi && (hi-v)*LatencyHistogram::SUB_BUCKETS<=v &&
+			(b==0 || LatencyHistogram::bucketUpperBound(b-1)+1==lo);
+		if (!ok) {
+			printf("value %lu: bucket %u [%lu %lu]\n",(unsigned long) v,b,(unsigned long) lo,(unsigned long) hi);
+		}
+		v = v<1000 ? v+1 : v + v/997;
+	}
+	ok = ok && LatencyHistogram::bucketOf((unsigned __int64) 1 << 50)==LatencyHistogram::NUM_BUCKETS-1;
+	printf("bucket bounds: %s\n",ok ? "ok" : "WRONG");
+	return ok;
+}
+
+static bool near(unsigned __int64 actual, unsigned __int64 expected)
+{
+	return actual>=expected && actual-expected<=expected/LatencyHistogram::SUB_BUCKETS;
+}
+
+static bool checkPercentiles(void)
+{
+	LatencyHistogram h;
+	bool ok = h.count()==0 && h.percentile(0.5)==0 && h.mean()==0.0;
+
+	// 1..100000 ns, uniform
+	for (unsigned __int64 v=1;v<=100000;v++) {
+		h.record(v);
+	}
+	ok = ok && h.count()==100000 && h.maxValue()==100000 && h.mean()==50000.5;
+	ok = ok && near(h.percentile(0.5),50000) && near(h.percentile(0.9),90000) && near(h.percentile(0.99),99000);
+	ok = ok && near(h.percentile(1.0),100000);
+	printf("uniform: p50 %lu p90 %lu p99 %lu: %s\n",(unsigned long) h.percentile(0.5),
+		(unsigned long) h.percentile(0.9),(unsigned long) h.percentile(0.99),ok ? "ok" : "WRONG");
+
+	// 999 fast records and one slow one
+	h.reset();
+	for (int i=0;i<999;i++) {
+		h.record(2000);
+	}
+	h.record(5000000);
+	bool tailOk = near(h.percentile(0.5),2000) && near(h.percentile(0.999),2000) &&
+		near(h.percentile(0.9995),5000000) && h.maxValue()==5000000;
+	printf("tail: p999 %lu p9995 %lu: %s\n",(unsigned long) h.percentile(0.999),
+		(unsigned long) h.percentile(0.9995),tailOk ? "ok" : "WRONG");
+	return ok && tailOk;
+}
+
+static bool checkDisabled(void)
+{
+	PipelineStats stats;
+	stats.setEnabled(false);
+	LONGLONG t0 = stats.start();
+	bool ok = t0==0 && stats.record(PipelineStats::FIFO_READ,t0)==0 &&
+		stats.histogram(PipelineStats::FIFO_READ).count()==0;
+	stats.notePosted();
+	ok = ok && stats.takePosted()==0;
+
+	stats.setEnabled(true);
+	t0 = stats.start();
+	ok = ok && t0!=0 && stats.record(PipelineStats::FIFO_READ,t0)!=0 &&
+		stats.histogram(PipelineStats::FIFO_READ).count()==1;
+	stats.notePosted();
+	ok = ok && stats.takePosted()!=0 && stats.takePosted()==0;
+	stats.reset();
+	ok = ok && stats.histogram(PipelineStats::FIFO_READ).count()==0;
+	printf("enable/disable: %s\n",ok ? "ok" : "WRONG");
+	return ok;
+}
+
+static unsigned int WINAPI writerFcn(LPVOID userData)
+{
+	LatencyHistogram *h = static_cast<LatencyHistogram*>(userData);
+	for (unsigned long i=0;i<RECORDS_PER_WRITER;i++) {
+		h->record(i%1000);
+	}
+	return 0;
+}
+
+static bool checkConcurrentWriters(void)
+{
+	LatencyHistogram h;
+	HANDLE threads[NUM_WRITERS];
+	for (int i=0;i<NUM_WRITERS;i++) {
+		threads[i] = (HANDLE)_beginthreadex(NULL,0,writerFcn,&h,0,NULL);
+	}
+	for (int i=0;i<NUM_WRITERS;i++) {
+		WaitForSingleObject(threads[i],INFINITE);
+		CloseHandle(threads[i]);
+	}
+	unsigned __int64 total = 0;
+	for (unsigned int b=0;b<LatencyHistogram::NUM_BUCKETS;b++) {
+		total += h.bucketCount(b);
+	}
+	unsigned __int64 expected = (unsigned __int64) NUM_WRITERS*RECORDS_PER_WRITER;
+	bool ok = h.count()==expected && total==expected && h.maxValue()==999 && h.mean()==499.5;
+	printf("%d writers: %lu records: %s\n",NUM_WRITERS,(unsigned long) h.count(),ok ? "ok" : "WRONG");
+	return ok;
+}
+
+// Push a record, then acquire it after holdMs; the dwell recorded
+// should be at least holdMs.
+static bool checkQueueDwell(void)
+{
+	PipelineStats stats;
+	stats.setEnabled(true);
+	MulticastFrameQueue q;
+	FrameQueueReader *r = q.addReader(MulticastFrameQueue::DROP_OLDEST);
+	q.init(64,4,4);
+	char rec[64] = {0};
+
+	// not timestamping: nothing to record
+	q.push_back(rec);
+	r->acquire_front();
+	bool ok = r->acquired_ticks()==0;
+	stats.record(PipelineStats::DISPLAY_QUEUE_DWELL,r->acquired_ticks());
+	r->release_front();
+	ok = ok && stats.histogram(PipelineStats::DISPLAY_QUEUE_DWELL).count()==0 && r->acquired_ticks()==0;
+
+	q.setTimestamping(true);
+	const DWORD holdMs = 20;
+	for (int i=0;i<3;i++) {
+		if (i%2==0) {
+			q.push_back(rec);
+		} else {
+			q.reserve_back();
+			q.commit_back();
+		}
+		Sleep(holdMs);
+		r->acquire_front();
+		stats.record(PipelineStats::DISPLAY_QUEUE_DWELL,r->acquired_ticks());
+		r->release_front();
+	}
+	const LatencyHistogram &h = stats.histogram(PipelineStats::DISPLAY_QUEUE_DWELL);
+	ok = ok && h.count()==3 && h.percentile(0.0)>=holdMs*1000000ULL && h.maxValue()<2000000000ULL;
+	printf("queue dwell: %lu records, min %g ms: %s\n",(unsigned long) h.count(),h.percentile(0.0)/1e6,ok ? "ok" : "WRONG");
+	return ok;
+}
+
+int _tmain(int argc, _TCHAR* argv[])
+{
+	bool ok = true;
+	ok = checkBuckets() && ok;
+	ok = checkPercentiles() && ok;
+	ok = checkDisabled() && ok;
+	ok = checkConcurrentWriters() && ok;
+	ok = checkQueueDwell() && ok;
+
+	printf(ok ? "PASS\n" : "FAILED\n");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,116 @@
+// test_PipelineTrace.cpp : Defines the entry point for the console application.
+//
+// Test for PipelineTrace. Several threads record events at two levels
+// while the trace drains to a file, some in bursts bigger than a
+// thread's ring. Reads the file back and checks the header, that only
+// events at or below the trace level were recorded, and that each
+// thread's records are in sequence order with their args intact; the
+// records a full ring dropped show as gaps in the sequence. Then checks
+// that closing the trace stops it.
+//
+// Build as a console app with ../NIFPGAMex on the include path, linking
+// PipelineTrace.cpp, Misc.cpp and PlatformWin32.cpp from that project.
+
+#include <tchar.h>
+#include <process.h>
+#include "stdio.h"
+#include <map>
+#include <vector>
+#include <windows.h>
+#include "Misc.h"
+#include "PipelineTrace.h"
+
+static const int NUM_THREADS = 4;
+static const long EVENTS_PER_THREAD = 100000;
+static const char *TRACE_FILE = "test_PipelineTrace.trace";
+
+static unsigned int WINAPI recorderFcn(LPVOID userData)
+{
+	long threadIdx = (long) (size_t) userData;
+	for (long i=0;i<EVENTS_PER_THREAD;i++) {
+		TRACE_EVENT(TRACE_EVENTS,TRACE_FRAME_STORED,threadIdx,i,-i);
+		TRACE_EVENT(TRACE_FRAMES,TRACE_FRAME_LOGGED,threadIdx,i,0); // above the level
+		if (i%20000==0) {
+			Sleep(2*PipelineTrace::DRAIN_INTERVAL_MS);
+		}
+	}
+	return 0;
+}
+
+struct ThreadRecords {
+	long threadIdx;
+	unsigned long numRecords;
+	unsigned long lastSequence;
+	bool ok;
+};
+
+int _tmain(int argc, _TCHAR* argv[])
+{
+	bool ok = true;
+	PipelineTrace *trace = PipelineTrace::getInstance();
+
+	ok = !PipelineTrace::isTracing(TRACE_EVENTS) && ok;
+	ok = trace->configure(TRACE_EVENTS,TRACE_FILE) && ok;
+	ok = PipelineTrace::isTracing(TRACE_EVENTS) && !PipelineTrace::isTracing(TRACE_FRAMES) && ok;
+
+	HANDLE threads[NUM_THREADS];
+	for (int i=0;i<NUM_THREADS;i++) {
+		threads[i] = (HANDLE)_beginthreadex(NULL,0,recorderFcn,(LPVOID) (size_t) i,0,NULL);
+	}
+	for (int i=0;i<NUM_THREADS;i++) {
+		WaitForSingleObject(threads[i],INFINITE);
+		CloseHandle(threads[i]);
+	}
+	trace->close();
+	ok = !PipelineTrace::isTracing(TRACE_EVENTS) && ok;
+	TRACE_EVENT(TRACE_EVENTS,TRACE_ACQ_STOP,0,0,0); // not recorded
+
+	FILE *f = fopen(TRACE_FILE,"rb");
+	TraceFileHeader header;
+	bool headerOk = f!=NULL && fread(&header,sizeof(header),1,f)==1 && memcmp(header.magic,"NIFTRACE",8)==0 &&
+		header.version==PipelineTrace::FILE_VERSION && header.recordSize==sizeof(TraceRecord) && header.ticksPerSecond>0;
+	printf("header: %s\n",headerOk ? "ok" : "WRONG");
+	ok = headerOk && ok;
+
+	std::map<unsigned long,ThreadRecords> byThread;
+	unsigned long numRecords = 0;
+	unsigned long numWrong = 0;
+	TraceRecord r;
+	while (f!=NULL && fread(&r,sizeof(r),1,f)==1) {
+		numRecords++;
+		if (r.event!=TRACE_FRAME_STORED || r.level!=TRACE_EVENTS || r.args[2]!=-r.args[1]) {
+			numWrong++;
+			continue;
+		}
+		std::map<unsigned long,ThreadRecords>::iterator it = byThread.find(r.threadId);
+		if (it==byThread.end()) {
+			ThreadRecords tr = {r.args[0],0,0,true};
+			it = byThread.insert(std::make_pair(r.threadId,tr)).first;
+		}
+		ThreadRecords &tr = it->second;
+		// one record per event, so the sequence number is the event index
+		bool inOrder = tr.numRecords==0 ? true : r.sequence>tr.lastSequence;
+		tr.ok = tr.ok && inOrder && r.args[0]==tr.threadIdx && (unsigned long) r.args[1]==r.sequence;
+		tr.lastSequence = r.sequence;
+		tr.numRecords++;
+	}
+	if (f!=NULL) {
+		fclose(f);
+	}
+
+	bool recordsOk = numWrong==0 && byThread.size()==NUM_THREADS;
+	for (std::map<unsigned long,ThreadRecords>::const_iterator it=byThread.begin();it!=byThread.end();it++) {
+		const ThreadRecords &tr = it->second;
+		printf("thread %ld: %lu records, last sequence %lu: %s\n",tr.threadIdx,tr.numRecords,tr.lastSequence,tr.ok ? "ok" : "WRONG");
+		recordsOk = recordsOk && tr.ok && tr.numRecords>0 && tr.numRecords<=(unsigned long) EVENTS_PER_THREAD;
+	}
+	std::string s;
+	trace->debugString(s);
+	printf("%s",s.c_str());
+	printf("%lu records, %lu wrong: %s\n",numRecords,numWrong,recordsOk ? "ok" : "WRONG");
+	ok = recordsOk && ok;
+
+	remove(TRACE_FILE);
+	printf(ok ? "PASS\n" : "FAILED\n");
+	return ok ? 0 : 1;
+}
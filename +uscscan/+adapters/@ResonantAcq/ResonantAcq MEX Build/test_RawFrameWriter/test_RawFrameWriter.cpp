@@ -0,0 +1,204 @@
+// test_RawFrameWriter.cpp : Defines the entry point for the console application.
+//
+// Test for the raw log container. Writes tagged frames through
+// RawFrameWriter, with fwrite and with AsyncFileWriter, using chunks small
+// enough that files hold several full chunks and a partial one, and reads
+// them back with RawFrameReader: frame count, flags, tags, timestamps and
+// every frame's pixels. Then checks RawFrameReader::convertToTif gives a
+// file byte-identical to the same frames logged by TifWriter with the
+// same frame tag updates, as FrameLogger would have written them, for
+// TIFF and BigTIFF.
+//
+// Recovery cases cut a closed file back to how a crash would leave it
+// (header not checkpointed, the last index block and part of a record
+// missing) and check the reader still finds every frame on disk, with the
+// tags of each complete chunk.
+//
+// Build as a console app with ../NIFPGAMex and .. on the include path,
+// linking RawFrameWriter.cpp, RawFrameReader.cpp, TifWriter.cpp,
+// AsyncFileWriter.cpp, StripCompressor.cpp, StripCodecs.cpp, Misc.cpp
+// and PlatformWin32.cpp from that project, and zlib.
+
+#include <tchar.h>
+#include "stdio.h"
+#include <string.h>
+#include <vector>
+#include "Misc.h"
+#include "RawFrameWriter.h"
+#include "RawFrameReader.h"
+#include "TifWriter.h"
+#include "FrameTag.h"
+
+static const char *LOG_FILE = "test_RawFrameWriter";
+static const char *RAW_FILE = "test_RawFrameWriter.raw";
+static const char *CONVERTED_FILE = "test_RawFrameWriter_converted.tif";
+static const char *REFERENCE_FILE = "test_RawFrameWriter_reference.tif";
+static const char *DESCRIPTION = "state.acq.frameRate = 30\nstate.acq.linesPerFrame = 512\n";
+
+static void fillFrames(std::vector<char> &buf, unsigned int seed)
+{
+	for (size_t i=0;i<buf.size();i++)
+		buf[i] = (char) (i*7+seed*13+i/251);
+}
+
+static unsigned long frameTagOf(unsigned int f)
+{
+	return 1000+f*3;
+}
+
+// Tag string followed by the rest of the description, as FrameLogger
+// configures it.
+static std::string initialDescription(unsigned long frameTag = 0)
+{
+	char frameTagStr[FrameTag::STRING_LENGTH+1];
+	sprintf_s(frameTagStr,sizeof(frameTagStr),FrameTag::FORMAT_STRING,frameTag);
+	return std::string(frameTagStr) + DESCRIPTION;
+}
+
+// Writes numFrames tagged frames (all channels) of width x length 16-bit
+// pixels through w, as FrameLogger does.
+static void writeFile(FrameWriter &w, const char *fname, unsigned short width, unsigned short length,
+	unsigned short numChannels, unsigned int numFrames, bool bigTiff)
+{
+	std::vector<char> frames((size_t) width*length*2*numChannels);
+	w.openFile(fname,"wbn",bigTiff);
+	w.configureImage(width,length,2,numChannels,true,initialDescription().c_str());
+	for (unsigned int f=0;f<numFrames;f++) {
+		char frameTagStr[FrameTag::STRING_LENGTH+1];
+		sprintf_s(frameTagStr,sizeof(frameTagStr),FrameTag::FORMAT_STRING,frameTagOf(f));
+		w.setFrameTag(frameTagOf(f));
+		w.modifyImageDescription(0,frameTagStr,FrameTag::STRING_LENGTH);
+		fillFrames(frames,f);
+		w.writeFramesForAllChannels(&frames[0],(unsigned int) frames.size());
+	}
+	w.closeFile();
+}
+
+static bool readFile(const char *fname, std::vector<char> &contents)
+{
+	FILE *fh = fopen(fname,"rb");
+	if (fh==NULL)
+		return false;
+	contents.clear();
+	char buf[65536];
+	size_t n;
+	while ((n=fread(buf,1,sizeof(buf),fh))>0)
+		contents.insert(contents.end(),buf,buf+n);
+	fclose(fh);
+	return true;
+}
+
+static bool writeContents(const char *fname, const std::vector<char> &contents, size_t numBytes)
+{
+	FILE *fh = fopen(fname,"wb");
+	if (fh==NULL)
+		return false;
+	bool ok = numBytes==0 || fwrite(&contents[0],1,numBytes,fh)==numBytes;
+	fclose(fh);
+	return ok;
+}
+
+// Check the first numFrames frames of the open reader; the first
+// numTagged carry their tags, the rest none.
+static bool checkFrames(RawFrameReader &reader, unsigned short width, unsigned short length,
+	unsigned short numChannels, unsigned int numFrames, unsigned int numTagged)
+{
+	bool ok = reader.numFrames()==numFrames && reader.imageWidth()==width && reader.imageLength()==length &&
+		reader.bytesPerPixel()==2 && reader.numChannels()==numChannels && reader.signedData() &&
+		reader.getBytesPerRecord()==(unsigned int) width*length*2*numChannels;
+	std::vector<char> expected((size_t) width*length*2*numChannels), actual(expected.size());
+	for (unsigned int f=0;ok && f<numFrames;f++) {
+		fillFrames(expected,f);
+		ok = reader.readFrame(f,&actual[0]) && memcmp(&expected[0],&actual[0],expected.size())==0;
+		if (f<numTagged) {
+			ok = ok && reader.frameTag(f)==frameTagOf(f) && reader.timestamp(f)!=0;
+			ok = ok && (f==0 || reader.timestamp(f)>=reader.timestamp(f-1));
+		} else {
+			ok = ok && reader.frameTag(f)==0 && reader.timestamp(f)==0;
+		}
+	}
+	return ok;
+}
+
+static bool runCase(unsigned short width, unsigned short length, unsigned short numChannels,
+	unsigned int numFrames, unsigned int framesPerChunk, bool async)
+{
+	RawFrameWriter writer;
+	writer.configureChunks(framesPerChunk);
+	if (async)
+		writer.configureAsyncIO(true,65536,3);
+	writeFile(writer,LOG_FILE,width,length,numChannels,numFrames,false);
+
+	RawFrameReader reader;
+	bool ok = reader.open(RAW_FILE) && reader.complete() && (reader.tagged() || numFrames==0);
+	// the header goes out with the first frame, tag and all
+	ok = ok && reader.imageDescription()==initialDescription(numFrames>0 ? frameTagOf(0) : 0);
+	ok = ok && checkFrames(reader,width,length,numChannels,numFrames,numFrames);
+	reader.close();
+
+	// converted log matches a TIFF logged directly
+	std::vector<char> a, b;
+	for (int big=0;ok && big<2;big++) {
+		unsigned __int64 numConverted = 0;
+		ok = RawFrameReader::convertToTif(RAW_FILE,CONVERTED_FILE,big!=0,&numConverted) && numConverted==numFrames;
+		TifWriter tw;
+		writeFile(tw,REFERENCE_FILE,width,length,numChannels,numFrames,big!=0);
+		ok = ok && readFile(CONVERTED_FILE,a) && readFile(REFERENCE_FILE,b);
+		ok = ok && a.size()==b.size() && memcmp(&a[0],&b[0],a.size())==0;
+	}
+	printf("%s %ux%u, %u chan, %u frames, %u per chunk: %s\n",async ? "async" : "sync",
+	       width,length,numChannels,numFrames,framesPerChunk,ok ? "ok" : "WRONG");
+	remove(RAW_FILE);
+	remove(CONVERTED_FILE);
+	remove(REFERENCE_FILE);
+	return ok;
+}
+
+// Write a closed log, then take it back to how a crash would leave it:
+// header not checkpointed, and the file cut dropBytes short.
+static bool runRecoveryCase(unsigned int numFrames, unsigned int framesPerChunk, size_t dropBytes,
+	unsigned int expectedFrames, unsigned int expectedTagged)
+{
+	const unsigned short width = 64, length = 16, numChannels = 2;
+	RawFrameWriter writer;
+	writer.configureChunks(framesPerChunk);
+	writeFile(writer,LOG_FILE,width,length,numChannels,numFrames,false);
+
+	std::vector<char> contents;
+	bool ok = readFile(RAW_FILE,contents) && contents.size()>dropBytes;
+	if (ok) {
+		memset(&contents[RawLogFormat::HEADER_NUMFRAMES_OFFSET],0,16);
+		ok = writeContents(RAW_FILE,contents,contents.size()-dropBytes);
+	}
+
+	RawFrameReader reader;
+	ok = ok && reader.open(RAW_FILE) && !reader.complete();
+	ok = ok && checkFrames(reader,width,length,numChannels,expectedFrames,expectedTagged);
+	reader.close();
+	printf("recovery of %u frames, %u per chunk, %u bytes short: %u frames %s\n",numFrames,framesPerChunk,
+	       (unsigned) dropBytes,expectedFrames,ok ? "ok" : "WRONG");
+	remove(RAW_FILE);
+	return ok;
+}
+
+int _tmain(int argc, _TCHAR* argv[])
+{
+	bool ok = true;
+	for (int async=0;async<2;async++) {
+		ok = runCase(32,8,1,1,4,async!=0) && ok;       // one frame, partial chunk
+		ok = runCase(37,56,1,10,4,async!=0) && ok;     // full chunks and a partial one
+		ok = runCase(256,256,3,12,4,async!=0) && ok;   // several channels, full chunks only
+		ok = runCase(128,64,2,20,256,async!=0) && ok;  // default chunk size
+		ok = runCase(100,30,2,0,4,async!=0) && ok;     // header only
+	}
+
+	// 10 frames of 4096 bytes in chunks of 4: the last chunk has 2 frames
+	// then a 4096-byte index block
+	ok = runRecoveryCase(10,4,4096,10,8) && ok;        // last index block lost
+	ok = runRecoveryCase(10,4,4096+2048,9,8) && ok;    // and half the last frame
+	ok = runRecoveryCase(10,4,4096+2*4096,8,8) && ok;  // cut at a chunk boundary
+	ok = runRecoveryCase(8,4,4096-40,8,4) && ok;       // last index block cut short
+
+	printf(ok ? "PASS\n" : "FAILED\n");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,152 @@
+// bench_StripCompressor.cpp : Defines the entry point for the console application.
+//
+// Throughput and compression ratio of StripCompressor on synthetic PMT
+// frames: 4 channels of 512x512 int16, each pixel a Poisson number of
+// photons (about 120 counts each, with spread) on a baseline with
+// Gaussian read noise. Two scenes: "dark", a uniform 0.02 photons per
+// pixel, and "cells", the same background with a few hundred bright
+// blobs of up to 2 photons per pixel. Each codec is timed with 0 (the
+// calling thread alone) up to maxThreads worker threads; throughput is
+// uncompressed MB/s. Each codec is run with the predictor and without,
+// to show what it buys on the scene.
+// Usage:
+//   bench_StripCompressor [numIters [maxThreads]]
+//
+// At 30 frames/s these frames are 60 MB/s, so a codec and thread count
+// keeps up with logging if it shows more than that, with some margin
+// for the rest of the logger.
+//
+// Build as a console app with ../NIFPGAMex and .. on the include path,
+// linking StripCompressor.cpp, StripCodecs.cpp, Misc.cpp and
+// PlatformWin32.cpp from that project, and zlib; elsewhere, with the
+// CMake build in the parent directory. Build Release; the Debug numbers
+// mean nothing.
+
+#include <stdlib.h>
+#include <math.h>
+#include "stdio.h"
+#include <vector>
+#include "Platform.h"
+#include "Misc.h"
+#include "StripCompressor.h"
+
+static const unsigned int WIDTH = 512;
+static const unsigned int LENGTH = 512;
+static const unsigned int NUM_CHANNELS = 4;
+static const unsigned int STRIP_BYTES = 8192; // TifWriter's default
+
+static unsigned long gSeed = 97531;
+
+static double nowSeconds(void)
+{
+	return (double) Platform::perfCounter() / (double) Platform::perfFrequency();
+}
+
+static double uniform(void)
+{
+	gSeed = gSeed*1103515245 + 12345;
+	return ((gSeed>>8) & 0xFFFFFF) / 16777216.0 + 1e-9;
+}
+
+static double gaussian(double sd)
+{
+	return sd*sqrt(-2.0*log(uniform()))*cos(6.283185307*uniform());
+}
+
+static int poisson(double lambda)
+{
+	double l = exp(-lambda), p = 1.0;
+	int k = 0;
+	do {
+		k++;
+		p *= uniform();
+	} while (p>l);
+	return k-1;
+}
+
+// Photons per pixel: background, plus numBlobs Gaussian blobs.
+static void makeRateMap(std::vector<double> &rate, unsigned int numBlobs)
+{
+	rate.assign(WIDTH*LENGTH,0.02);
+	for (unsigned int b=0;b<numBlobs;b++) {
+		double cx = uniform()*WIDTH, cy = uniform()*LENGTH, r = 4+uniform()*8, peak = 0.5+uniform()*1.5;
+		for (int y=(int) (cy-3*r);y<=(int) (cy+3*r);y++) {
+			for (int x=(int) (cx-3*r);x<=(int) (cx+3*r);x++) {
+				if (x<0 || y<0 || x>=(int) WIDTH || y>=(int) LENGTH)
+					continue;
+				double d2 = ((x-cx)*(x-cx)+(y-cy)*(y-cy))/(r*r);
+				rate[y*WIDTH+x] += peak*exp(-d2/2);
+			}
+		}
+	}
+}
+
+static void makeFrames(std::vector<int16_t> &frames, const std::vector<double> &rate)
+{
+	for (unsigned int c=0;c<NUM_CHANNELS;c++) {
+		for (unsigned int i=0;i<WIDTH*LENGTH;i++) {
+			double v = gaussian(3.0);
+			int photons = poisson(rate[i]);
+			for (int p=0;p<photons;p++)
+				v += 120.0 + gaussian(40.0);
+			v = v>32767 ? 32767 : v<-32768 ? -32768 : v;
+			frames[c*WIDTH*LENGTH+i] = (int16_t) floor(v+0.5);
+		}
+	}
+}
+
+// MB/s and compression ratio.
+static void timeCompressor(const std::vector<std::vector<int16_t> > &frames, StripCompressor::Codec codec,
+	int level, bool predictor, unsigned int numThreads, int numIters, double *mbps, double *ratio)
+{
+	StripCompressor sc;
+	sc.start(codec,level,predictor,numThreads);
+	unsigned int frameBytes = WIDTH*LENGTH*2;
+	double compressed = 0;
+	double t0 = nowSeconds();
+	for (int i=0;i<numIters;i++) {
+		const std::vector<int16_t> &f = frames[i%frames.size()];
+		sc.compressFrames(reinterpret_cast<const char*>(&f[0]),NUM_CHANNELS,frameBytes,STRIP_BYTES,WIDTH*2,2);
+		for (unsigned int c=0;c<NUM_CHANNELS;c++)
+			compressed += sc.compressedFrameBytes(c);
+	}
+	double t1 = nowSeconds();
+	double raw = (double) numIters*NUM_CHANNELS*frameBytes;
+	*mbps = raw/(t1-t0)/1e6;
+	*ratio = raw/compressed;
+}
+
+int main(int argc, char* argv[])
+{
+	int numIters = (argc>1) ? atoi(argv[1]) : 60;
+	unsigned int maxThreads = (argc>2) ? (unsigned int) atoi(argv[2]) : 7;
+	printf("%u channels of %ux%u int16, %u-byte strips, %d iterations\n",NUM_CHANNELS,WIDTH,LENGTH,STRIP_BYTES,numIters);
+
+	static const char *sceneNames[] = { "dark", "cells" };
+	static const unsigned int sceneBlobs[] = { 0, 300 };
+	for (int scene=0;scene<2;scene++) {
+		std::vector<double> rate;
+		makeRateMap(rate,sceneBlobs[scene]);
+		std::vector<std::vector<int16_t> > frames(4,std::vector<int16_t>(NUM_CHANNELS*WIDTH*LENGTH));
+		for (size_t f=0;f<frames.size();f++)
+			makeFrames(frames[f],rate);
+
+		printf("\nscene '%s'\n",sceneNames[scene]);
+		printf("%-28s %8s %10s %7s\n","codec","threads","MB/s","ratio");
+		double mbps, ratio;
+		static const StripCompressor::Codec codecs[] = { StripCompressor::DEFLATE, StripCompressor::DEFLATE, StripCompressor::LZ4 };
+		static const int levels[] = { 1, 6, 0 };
+		static const char *codecNames[] = { "deflate 1", "deflate 6", "lz4" };
+		for (int c=0;c<3;c++) {
+			for (int predictor=1;predictor>=0;predictor--) {
+				char name[64];
+				sprintf_s(name,sizeof(name),"%s%s",codecNames[c],predictor ? "" : ", no predictor");
+				for (unsigned int t=0;t<=maxThreads;t=(t==0 ? 1 : 2*t+1)) {
+					timeCompressor(frames,codecs[c],levels[c],predictor!=0,t,numIters,&mbps,&ratio);
+					printf("%-28s %8u %10.0f %7.2f\n",name,t,mbps,ratio);
+				}
+			}
+		}
+	}
+	return 0;
+}
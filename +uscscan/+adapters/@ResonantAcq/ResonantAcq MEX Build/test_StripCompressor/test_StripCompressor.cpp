@@ -0,0 +1,209 @@
+// test_StripCompressor.cpp : Defines the entry point for the console application.
+//
+// Round-trip test for StripCompressor and StripCodecs. Checks that
+// horizontalAccumulate undoes horizontalDifference for 1-, 2- and
+// 4-byte samples; that lz4Decompress restores what lz4Compress made of
+// blocks of every length up to a few hundred bytes and of long ones
+// (runs, noise, repeats further apart than LZ4's 64KB window), and
+// rejects truncated blocks; and that frames compressed by
+// StripCompressor with each codec, with and without the predictor,
+// with no worker threads and with several, inflate (with zlib) or
+// decompress back to the original frames. Frame shapes include one
+// with a short last strip.
+//
+// Build as a console app with ../NIFPGAMex and .. on the include path,
+// linking StripCompressor.cpp, StripCodecs.cpp, Misc.cpp and
+// PlatformWin32.cpp from that project, and zlib.
+
+#include <tchar.h>
+#include "stdio.h"
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include "zlib.h"
+#include "Misc.h"
+#include "StripCompressor.h"
+#include "StripCodecs.h"
+
+static unsigned long gSeed = 2468;
+
+static unsigned long nextRandom(void)
+{
+	gSeed = gSeed*1103515245 + 12345;
+	return gSeed>>8;
+}
+
+// Mostly dark int16 frames: small noise around zero with occasional
+// photon-sized spikes, like PMT data.
+static void makePMTFrames(std::vector<char> &buf)
+{
+	int16_t *p = reinterpret_cast<int16_t*>(&buf[0]);
+	for (size_t i=0;i<buf.size()/2;i++) {
+		unsigned long r = nextRandom();
+		p[i] = (int16_t) ((int) (r%7)-3 + ((r>>4)%40==0 ? 150+(int) ((r>>10)%100) : 0));
+	}
+}
+
+static bool testPredictor(void)
+{
+	static const unsigned int sampleSizes[] = { 1, 2, 4 };
+	const unsigned int bytesPerRow = 40;
+	const size_t numBytes = 7*bytesPerRow;
+	std::vector<char> src(numBytes), dst(numBytes);
+	for (size_t i=0;i<numBytes;i++)
+		src[i] = (char) nextRandom();
+
+	bool ok = true;
+	for (size_t s=0;s<3;s++) {
+		StripCodecs::horizontalDifference(&src[0],&dst[0],numBytes,bytesPerRow,sampleSizes[s]);
+		// the first sample of each row is kept as is
+		ok = ok && memcmp(&src[bytesPerRow],&dst[bytesPerRow],sampleSizes[s])==0;
+		StripCodecs::horizontalAccumulate(&dst[0],numBytes,bytesPerRow,sampleSizes[s]);
+		if (memcmp(&src[0],&dst[0],numBytes)!=0) {
+			printf("predictor, %u-byte samples: round trip differs\n",sampleSizes[s]);
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+static bool lz4RoundTrip(const char *what, const std::vector<char> &src)
+{
+	std::vector<uint32_t> hashTable(StripCodecs::LZ4_HASH_ENTRIES);
+	std::vector<char> compressed(StripCodecs::lz4Bound(src.size()));
+	std::vector<char> restored(src.size()+1);
+	const char *in = src.empty() ? "" : &src[0];
+	size_t n = StripCodecs::lz4Compress(in,src.size(),&compressed[0],&hashTable[0]);
+	size_t m = StripCodecs::lz4Decompress(&compressed[0],n,&restored[0],restored.size());
+	if (n>compressed.size() || m!=src.size() || (m>0 && memcmp(&src[0],&restored[0],m)!=0)) {
+		printf("lz4, %s, %u bytes: round trip failed (%u compressed, %u restored)\n",
+		       what,(unsigned) src.size(),(unsigned) n,(unsigned) m);
+		return false;
+	}
+	// Cutting the block short must be caught, not read past.
+	if (n>1 && StripCodecs::lz4Decompress(&compressed[0],n-1,&restored[0],restored.size())==src.size() &&
+	    memcmp(&src[0],&restored[0],src.size())==0) {
+		printf("lz4, %s, %u bytes: truncated block decompressed\n",what,(unsigned) src.size());
+		return false;
+	}
+	return true;
+}
+
+static bool testLZ4(void)
+{
+	bool ok = true;
+	for (size_t len=0;len<300;len++) {
+		std::vector<char> runs(len), noise(len);
+		for (size_t i=0;i<len;i++) {
+			runs[i] = (char) (i/13);
+			noise[i] = (char) nextRandom();
+		}
+		ok = lz4RoundTrip("runs",runs) && ok;
+		ok = lz4RoundTrip("noise",noise) && ok;
+	}
+
+	std::vector<char> big(300000);
+	makePMTFrames(big);
+	ok = lz4RoundTrip("PMT frames",big) && ok;
+	std::fill(big.begin(),big.end(),(char) 0);
+	ok = lz4RoundTrip("zeros",big) && ok;
+	// a 1000-byte pattern repeated 70000 bytes apart, beyond the window
+	for (size_t i=0;i<big.size();i++)
+		big[i] = (char) nextRandom();
+	for (size_t i=0;i<1000;i++)
+		big[i+70000] = big[i];
+	ok = lz4RoundTrip("distant repeat",big) && ok;
+	return ok;
+}
+
+// Restore one compressed strip to numBytes of raw (undifferenced) data.
+static bool restoreStrip(StripCompressor::Codec codec, bool predictor, const char *src, unsigned int srcBytes,
+	char *dst, unsigned int numBytes, unsigned int bytesPerRow, unsigned int bytesPerSample)
+{
+	if (codec==StripCompressor::DEFLATE) {
+		uLongf n = numBytes;
+		if (uncompress(reinterpret_cast<Bytef*>(dst),&n,reinterpret_cast<const Bytef*>(src),srcBytes)!=Z_OK ||
+		    n!=numBytes)
+			return false;
+	} else if (StripCodecs::lz4Decompress(src,srcBytes,dst,numBytes)!=numBytes) {
+		return false;
+	}
+	if (predictor)
+		StripCodecs::horizontalAccumulate(dst,numBytes,bytesPerRow,bytesPerSample);
+	return true;
+}
+
+static bool runCase(StripCompressor::Codec codec, bool predictor, unsigned int numThreads, unsigned int width,
+	unsigned int length, unsigned int bytesPerSample, unsigned int numFrames, unsigned int stripBytes)
+{
+	unsigned int bytesPerRow = width*bytesPerSample;
+	unsigned int frameBytes = bytesPerRow*length;
+	stripBytes = stripBytes/bytesPerRow*bytesPerRow;
+
+	StripCompressor sc;
+	if (!sc.start(codec,StripCompressor::DEFAULT_DEFLATE_LEVEL,predictor,numThreads) || sc.numThreads()!=numThreads) {
+		printf("start failed\n");
+		return false;
+	}
+
+	bool ok = true;
+	// A few writes, to check the workers pick up each batch.
+	for (int write=0;write<3 && ok;write++) {
+		std::vector<char> frames((size_t) frameBytes*numFrames);
+		makePMTFrames(frames);
+		if (!sc.compressFrames(&frames[0],numFrames,frameBytes,stripBytes,bytesPerRow,bytesPerSample)) {
+			printf("compressFrames failed\n");
+			return false;
+		}
+
+		std::vector<char> restored(frameBytes);
+		unsigned int compressedBytes = 0;
+		for (unsigned int f=0;f<numFrames && ok;f++) {
+			unsigned int frameTotal = 0;
+			for (unsigned int s=0;s<sc.stripsPerFrame() && ok;s++) {
+				unsigned int n = std::min(stripBytes,frameBytes-s*stripBytes);
+				frameTotal += sc.compressedStripBytes(f,s);
+				ok = restoreStrip(codec,predictor,sc.compressedStrip(f,s),sc.compressedStripBytes(f,s),
+				                  &restored[s*stripBytes],n,bytesPerRow,bytesPerSample);
+			}
+			ok = ok && frameTotal==sc.compressedFrameBytes(f);
+			ok = ok && memcmp(&restored[0],&frames[(size_t) f*frameBytes],frameBytes)==0;
+			compressedBytes += frameTotal;
+		}
+		if (write==0 || !ok) {
+			printf("%s%s, %u threads, %ux%u x %u bytes, %u frames, %u-byte strips: ratio %.2f %s\n",
+			       codec==StripCompressor::DEFLATE ? "deflate" : "lz4",predictor ? "" : " (no predictor)",numThreads,width,length,
+			       bytesPerSample,numFrames,stripBytes,(double) frames.size()/compressedBytes,ok ? "ok" : "WRONG");
+		}
+	}
+	return ok;
+}
+
+int _tmain(int argc, _TCHAR* argv[])
+{
+	bool ok = testPredictor();
+	ok = testLZ4() && ok;
+
+	static const StripCompressor::Codec codecs[] = { StripCompressor::DEFLATE, StripCompressor::LZ4 };
+	static const unsigned int threads[] = { 0, 1, 4 };
+	for (size_t c=0;c<2;c++) {
+		for (size_t t=0;t<3;t++) {
+			ok = runCase(codecs[c],true,threads[t],512,512,2,4,8192) && ok;   // the logging default
+			ok = runCase(codecs[c],true,threads[t],300,37,2,3,8192) && ok;    // short last strip
+			ok = runCase(codecs[c],true,threads[t],64,16,2,1,8192) && ok;     // one strip
+			ok = runCase(codecs[c],true,threads[t],100,50,1,2,1000) && ok;    // 8-bit
+			ok = runCase(codecs[c],true,threads[t],100,50,4,2,4000) && ok;    // 32-bit
+			ok = runCase(codecs[c],false,threads[t],300,37,2,3,8192) && ok;
+		}
+	}
+
+	if (StripCompressor::codecFromString("deflate")!=StripCompressor::DEFLATE ||
+	    StripCompressor::codecFromString("lz4")!=StripCompressor::LZ4 ||
+	    StripCompressor::codecFromString("none")!=StripCompressor::NONE) {
+		printf("codecFromString failed\n");
+		ok = false;
+	}
+
+	printf(ok ? "PASS\n" : "FAILED\n");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,217 @@
+// test_TifStackReader.cpp : Defines the entry point for the console application.
+//
+// Test for TifStackReader. Logs tagged frames with TifWriter and reads
+// them back: frame count, every channel of every frame in place
+// (frameData) and through copyFrames with channel subsets and reordering,
+// and the frame tags. Cases cover TIFF and BigTIFF, one and several
+// channels and strips, files at a fixed stride (indexed from the first
+// and last IFD), a file reconfigured mid-way and deflated files (both
+// indexed by walking the IFD chain; deflated frames are only copied).
+//
+// Each file is opened twice to check the second open takes the index
+// from the sidecar and reads the same, then rewritten to check a stale
+// sidecar is ignored. A file cut short while logging is read up to its
+// last complete frame and gets no sidecar.
+//
+// Build as a console app with ../NIFPGAMex and .. on the include path,
+// linking TifStackReader.cpp, TifWriter.cpp, AsyncFileWriter.cpp,
+// StripCompressor.cpp, StripCodecs.cpp, Misc.cpp and PlatformWin32.cpp
+// from that project, and zlib.
+
+#include <tchar.h>
+#include "stdio.h"
+#include <string.h>
+#include <vector>
+#include "Misc.h"
+#include "TifWriter.h"
+#include "TifStackReader.h"
+#include "FrameTag.h"
+
+static const char *TIF_FILE = "test_TifStackReader.tif";
+
+static void fillFrames(std::vector<char> &buf, unsigned int seed)
+{
+	for (size_t i=0;i<buf.size();i++)
+		buf[i] = (char) (i*7+seed*13+i/251);
+}
+
+static unsigned long frameTagOf(unsigned int f)
+{
+	return 5000+f*2;
+}
+
+// Writes numFrames tagged frames (all channels) of width x length 16-bit
+// pixels. reconfigure switches to a shorter description half way, which
+// changes the stride. Returns the stride of the last frame.
+static unsigned int writeFile(TifWriter &tw, unsigned short width, unsigned short length, unsigned short numChannels,
+	unsigned int numFrames, bool bigTiff, bool reconfigure)
+{
+	char frameTagStr[FrameTag::STRING_LENGTH+1];
+	sprintf_s(frameTagStr,sizeof(frameTagStr),FrameTag::FORMAT_STRING,0UL);
+	std::string description = std::string(frameTagStr) + "state.acq.linesPerFrame = 512\n";
+
+	std::vector<char> frames((size_t) width*length*2*numChannels);
+	tw.openTifFile(TIF_FILE,"wbn",bigTiff);
+	tw.configureImage(width,length,2,numChannels,true,description.c_str());
+	for (unsigned int f=0;f<numFrames;f++) {
+		if (reconfigure && f==numFrames/2)
+			tw.configureImage(width,length,2,numChannels,true,frameTagStr);
+		sprintf_s(frameTagStr,sizeof(frameTagStr),FrameTag::FORMAT_STRING,frameTagOf(f));
+		tw.modifyImageDescription(0,frameTagStr,FrameTag::STRING_LENGTH);
+		fillFrames(frames,f);
+		tw.writeFramesForAllChannels(&frames[0],(unsigned int) frames.size());
+	}
+	unsigned int stride = tw.getBytesPerFrameRecord();
+	tw.closeTifFile();
+	return stride;
+}
+
+// Check numFrames frames of the open reader.
+static bool checkFrames(TifStackReader &reader, unsigned short width, unsigned short length,
+	unsigned short numChannels, unsigned int numFrames, bool inPlace)
+{
+	unsigned int imageBytes = (unsigned int) width*length*2;
+	bool ok = reader.numFrames()==numFrames && reader.imageWidth()==width && reader.imageLength()==length &&
+		reader.bytesPerPixel()==2 && reader.signedData() && reader.getBytesPerImage()==imageBytes;
+	std::vector<char> expected((size_t) imageBytes*numChannels);
+	for (unsigned int f=0;ok && f<numFrames;f++) {
+		fillFrames(expected,f);
+		ok = reader.frameTag(f)==frameTagOf(f);
+		for (unsigned short c=0;ok && c<numChannels;c++) {
+			const char *p = reader.frameData(f,c);
+			ok = inPlace ? (p!=NULL && memcmp(p,&expected[c*imageBytes],imageBytes)==0) : p==NULL;
+		}
+	}
+
+	// all frames, channels reversed
+	std::vector<unsigned short> channels;
+	for (unsigned short c=numChannels;c>0;c--)
+		channels.push_back(c-1);
+	std::vector<char> copied((size_t) imageBytes*numChannels*(numFrames>0 ? numFrames : 1));
+	ok = ok && reader.copyFrames(0,numFrames,&channels[0],numChannels,&copied[0]);
+	for (unsigned int f=0;ok && f<numFrames;f++) {
+		fillFrames(expected,f);
+		for (unsigned short c=0;ok && c<numChannels;c++)
+			ok = memcmp(&copied[((size_t) f*numChannels+c)*imageBytes],&expected[channels[c]*imageBytes],imageBytes)==0;
+	}
+
+	// the last channel of a range in the middle
+	if (ok && numFrames>=3) {
+		unsigned short last = numChannels-1;
+		ok = reader.copyFrames(1,2,&last,1,&copied[0]);
+		for (unsigned int f=1;ok && f<3;f++) {
+			fillFrames(expected,f);
+			ok = memcmp(&copied[(f-1)*imageBytes],&expected[last*imageBytes],imageBytes)==0;
+		}
+	}
+	// out of range
+	ok = ok && !reader.copyFrames(numFrames,1,&channels[0],1,&copied[0]);
+	return ok;
+}
+
+static bool runCase(unsigned short width, unsigned short length, unsigned short numChannels, unsigned int numFrames,
+	bool bigTiff, bool reconfigure, StripCompressor::Codec codec)
+{
+	std::string sidecar = TifStackReader::sidecarName(TIF_FILE);
+	remove(sidecar.c_str());
+	bool compressed = codec!=StripCompressor::NONE;
+	bool expectFixedStride = !reconfigure && !compressed && numFrames*numChannels>1;
+	{
+		TifWriter tw;
+		tw.configureCompression(codec);
+		writeFile(tw,width,length,numChannels,numFrames,bigTiff,reconfigure);
+	}
+
+	TifStackReader reader;
+	bool ok = reader.open(TIF_FILE,numChannels) && !reader.indexFromSidecar() && reader.bigTiff()==bigTiff;
+	ok = ok && reader.fixedStride()==expectFixedStride;
+	ok = ok && checkFrames(reader,width,length,numChannels,numFrames,!compressed);
+	reader.close();
+
+	// again, from the sidecar
+	ok = ok && reader.open(TIF_FILE,numChannels) && reader.indexFromSidecar();
+	ok = ok && reader.fixedStride()==expectFixedStride;
+	ok = ok && checkFrames(reader,width,length,numChannels,numFrames,!compressed);
+	reader.close();
+
+	// a stale sidecar is not used
+	{
+		TifWriter tw;
+		tw.configureCompression(codec);
+		writeFile(tw,width,length,numChannels,numFrames+1,bigTiff,reconfigure);
+	}
+	ok = ok && reader.open(TIF_FILE,numChannels) && !reader.indexFromSidecar();
+	ok = ok && checkFrames(reader,width,length,numChannels,numFrames+1,!compressed);
+	reader.close();
+
+	printf("%s%s%s %ux%u, %u chan, %u frames: %s\n",bigTiff ? "BigTIFF" : "TIFF",
+	       compressed ? " deflate" : "",reconfigure ? " reconfigured" : "",width,length,numChannels,numFrames,
+	       ok ? "ok" : "WRONG");
+	remove(TIF_FILE);
+	remove(sidecar.c_str());
+	return ok;
+}
+
+// A file as logging leaves it: the last frame not yet written, so the
+// IFD chain runs off the end of the file, and dropBytes of the frame
+// before it missing too.
+static bool runUnclosedCase(bool bigTiff, bool reconfigure, size_t dropBytes, unsigned int expectedFrames)
+{
+	const unsigned short width = 64, length = 40, numChannels = 2;
+	const unsigned int numFrames = 6;
+	std::string sidecar = TifStackReader::sidecarName(TIF_FILE);
+	remove(sidecar.c_str());
+	TifWriter tw;
+	unsigned int stride = writeFile(tw,width,length,numChannels,numFrames,bigTiff,reconfigure);
+	dropBytes += numChannels*stride;
+
+	std::vector<char> contents;
+	FILE *fh = fopen(TIF_FILE,"rb");
+	bool ok = fh!=NULL;
+	if (ok) {
+		char buf[65536];
+		size_t n;
+		while ((n=fread(buf,1,sizeof(buf),fh))>0)
+			contents.insert(contents.end(),buf,buf+n);
+		fclose(fh);
+		ok = contents.size()>dropBytes && (fh=fopen(TIF_FILE,"wb"))!=NULL;
+	}
+	if (ok) {
+		fwrite(&contents[0],1,contents.size()-dropBytes,fh);
+		fclose(fh);
+	}
+
+	TifStackReader reader;
+	ok = ok && reader.open(TIF_FILE,numChannels) && !reader.indexFromSidecar();
+	ok = ok && reader.fixedStride()==!reconfigure;
+	ok = ok && checkFrames(reader,width,length,numChannels,expectedFrames,true);
+	reader.close();
+	fh = fopen(sidecar.c_str(),"rb");
+	ok = ok && fh==NULL;
+	if (fh!=NULL)
+		fclose(fh);
+	printf("unclosed %s%s, last frame and %u bytes missing: %u frames %s\n",bigTiff ? "BigTIFF" : "TIFF",
+	       reconfigure ? " reconfigured" : "",(unsigned) (dropBytes-numChannels*stride),expectedFrames,ok ? "ok" : "WRONG");
+	remove(TIF_FILE);
+	return ok;
+}
+
+int _tmain(int argc, _TCHAR* argv[])
+{
+	bool ok = true;
+	for (int big=0;big<2;big++) {
+		ok = runCase(32,8,1,1,big!=0,false,StripCompressor::NONE) && ok;      // one image
+		ok = runCase(37,56,1,20,big!=0,false,StripCompressor::NONE) && ok;    // single strip
+		ok = runCase(256,256,3,12,big!=0,false,StripCompressor::NONE) && ok;  // multi-strip, several channels
+		ok = runCase(256,256,3,12,big!=0,true,StripCompressor::NONE) && ok;   // stride changes
+		ok = runCase(300,37,2,6,big!=0,false,StripCompressor::DEFLATE) && ok; // deflated
+
+		ok = runUnclosedCase(big!=0,false,0,5) && ok;
+		ok = runUnclosedCase(big!=0,false,100,4) && ok;  // into the last channel's image data
+		ok = runUnclosedCase(big!=0,true,0,5) && ok;
+		ok = runUnclosedCase(big!=0,true,100,4) && ok;
+	}
+
+	printf(ok ? "PASS\n" : "FAILED\n");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,88 @@
+// bench_TifWriter.cpp : Defines the entry point for the console application.
+//
+// Logging throughput benchmark for TifWriter: writes numFrames 16-bit
+// frames of each size to a file in dir, through fwrite and through the
+// async writer, and reports MB/s (image data plus headers, including the
+// final close). Usage:
+//   bench_TifWriter [dir] [numFrames] [bufferMB] [numBuffers]
+//
+// Point dir at the drive to be measured. The async path bypasses the
+// system file cache, so its numbers reflect the device; the fwrite path
+// may land in the cache, particularly for short runs, so use enough
+// frames to exceed free memory for a fair comparison.
+//
+// Build as a console app with ../NIFPGAMex and .. on the include path,
+// linking TifWriter.cpp, AsyncFileWriter.cpp, StripCompressor.cpp,
+// StripCodecs.cpp, Misc.cpp and PlatformWin32.cpp from that project, and
+// zlib; elsewhere, with the CMake build in the parent directory. Build
+// Release.
+
+#include <stdlib.h>
+#include "stdio.h"
+#include <string>
+#include <vector>
+#include "Platform.h"
+#include "Misc.h"
+#include "TifWriter.h"
+
+static double nowSeconds(void)
+{
+	return (double) Platform::perfCounter() / (double) Platform::perfFrequency();
+}
+
+// Returns MB/s.
+static double timeWrites(bool async, const std::string &fname, unsigned short width, unsigned short length,
+	unsigned int numFrames, unsigned int bufferBytes, unsigned int numBuffers)
+{
+	std::vector<char> frame((size_t) width*length*2);
+	for (size_t i=0;i<frame.size();i++)
+		frame[i] = (char) (i*31);
+
+	TifWriter tw;
+	tw.configureAsyncIO(async,bufferBytes,numBuffers);
+	double t0 = nowSeconds();
+	tw.openTifFile(fname.c_str(),"wbn");
+	tw.configureImage(width,length,2,1,true,"0000000000 benchmark frame");
+	for (unsigned int f=0;f<numFrames;f++) {
+		tw.writeFramesForAllChannels(&frame[0],(unsigned int) frame.size());
+	}
+	tw.closeTifFile();
+	double elapsed = nowSeconds()-t0;
+
+	FILE *fh = fopen(fname.c_str(),"rb");
+	double mb = 0;
+	if (fh!=NULL) {
+		fseek(fh,0,SEEK_END);
+		mb = ftell(fh)/(1024.0*1024.0);
+		fclose(fh);
+	}
+	remove(fname.c_str());
+	return mb/elapsed;
+}
+
+int main(int argc, char* argv[])
+{
+	std::string dir = (argc>1) ? argv[1] : ".";
+	unsigned int numFrames = (argc>2) ? atoi(argv[2]) : 2000;
+	unsigned int bufferMB = (argc>3) ? atoi(argv[3]) : 8;
+	unsigned int numBuffers = (argc>4) ? atoi(argv[4]) : 4;
+	std::string fname = dir + "/bench_TifWriter.tif";
+
+	printf("%u frames per run, async: %u x %u MB buffers\n",numFrames,numBuffers,bufferMB);
+	printf("%10s %12s %12s %12s\n","frame","MB/frame","fwrite MB/s","async MB/s");
+
+	static const unsigned short sizes[] = { 128, 256, 512, 1024, 2048 };
+	for (size_t s=0;s<sizeof(sizes)/sizeof(sizes[0]);s++) {
+		unsigned short n = sizes[s];
+		// keep the amount written per run roughly constant
+		unsigned int frames = (unsigned int) ((double) numFrames*512*512/((double) n*n));
+		if (frames<10)
+			frames = 10;
+		double syncRate = timeWrites(false,fname,n,n,frames,bufferMB*1024*1024,numBuffers);
+		double asyncRate = timeWrites(true,fname,n,n,frames,bufferMB*1024*1024,numBuffers);
+		char label[32];
+		sprintf(label,"%ux%u",n,n);
+		printf("%10s %12.3f %12.1f %12.1f\n",label,n*n*2/(1024.0*1024.0),syncRate,asyncRate);
+	}
+	return 0;
+}
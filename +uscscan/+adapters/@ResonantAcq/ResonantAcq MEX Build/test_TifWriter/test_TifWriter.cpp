@@ -0,0 +1,311 @@
+// test_TifWriter.cpp : Defines the entry point for the console application.
+//
+// Test for TifWriter's async I/O path. Writes the same frames to one file
+// through fwrite and to another through AsyncFileWriter, and checks the
+// two files are byte-identical. Cases cover single- and multi-strip
+// frames, several channels, image description updates between frames,
+// a reconfigure mid-file, and write buffers small enough that frames
+// straddle buffers and the closing IFD patch lands in a buffer already
+// written. Also walks the IFD chain to check it ends after the last
+// frame, and that frames sit at the fixed stride getBytesPerFrameRecord()
+// reports until the image is reconfigured. Files are preallocated.
+// Each case runs for classic TIFF and BigTIFF.
+//
+// Compressed cases do the same with deflate, walking the IFDs to check
+// the compression and predictor tags and inflating every strip from its
+// offset and byte count back to the frame written, and with LZ4, whose
+// container records are walked and decompressed likewise; with and
+// without the predictor.
+//
+// Build as a console app with ../NIFPGAMex and .. on the include path,
+// linking TifWriter.cpp, AsyncFileWriter.cpp, StripCompressor.cpp,
+// StripCodecs.cpp, Misc.cpp and PlatformWin32.cpp from that project, and
+// zlib.
+
+#include <tchar.h>
+#include "stdio.h"
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include "zlib.h"
+#include "Misc.h"
+#include "TifWriter.h"
+#include "StripCodecs.h"
+
+static const char *SYNC_FILE = "test_TifWriter_sync.tif";
+static const char *ASYNC_FILE = "test_TifWriter_async.tif";
+static const char *SYNC_CONTAINER = "test_TifWriter_sync.tif.lz4s";
+static const char *ASYNC_CONTAINER = "test_TifWriter_async.tif.lz4s";
+
+static void fillFrames(std::vector<char> &buf, unsigned int seed)
+{
+	for (size_t i=0;i<buf.size();i++)
+		buf[i] = (char) (i*7+seed*13+i/251);
+}
+
+// Writes numFrames frames (all channels) of width x length 16-bit pixels.
+// Returns false if preallocation failed. *stride is the frame record size
+// for the first half of the file.
+static bool writeFile(TifWriter &tw, const char *fname, unsigned short width, unsigned short length,
+	unsigned short numChannels, unsigned int numFrames, bool bigTiff, unsigned int *stride)
+{
+	std::vector<char> frames((size_t) width*length*2*numChannels);
+	tw.openTifFile(fname,"wbn",bigTiff);
+	tw.configureImage(width,length,2,numChannels,true,"0000000000 frame description");
+	bool ok = tw.preallocate(numFrames);
+	*stride = tw.getBytesPerFrameRecord();
+	for (unsigned int f=0;f<numFrames;f++) {
+		char tag[11];
+		sprintf(tag,"%010u",f);
+		tw.modifyImageDescription(0,tag,10);
+		fillFrames(frames,f);
+		tw.writeFramesForAllChannels(&frames[0],(unsigned int) frames.size());
+		if (f==numFrames/2) {
+			// switch to a shorter description half way through
+			tw.configureImage(width,length,2,numChannels,true,"0000000000 short");
+		}
+	}
+	tw.closeTifFile();
+	return ok;
+}
+
+static bool readFile(const char *fname, std::vector<char> &contents)
+{
+	FILE *fh = fopen(fname,"rb");
+	if (fh==NULL)
+		return false;
+	contents.clear();
+	char buf[65536];
+	size_t n;
+	while ((n=fread(buf,1,sizeof(buf),fh))>0)
+		contents.insert(contents.end(),buf,buf+n);
+	fclose(fh);
+	return true;
+}
+
+// Number of IFDs reachable from the header, or -1 if the header is wrong
+// or the chain runs off the end of the file. Their offsets are returned
+// in ifdOffsets.
+static int countIFDs(const std::vector<char> &file, bool bigTiff, std::vector<unsigned __int64> &ifdOffsets)
+{
+	// offsets and entry counts are 4/2 bytes in classic TIFF, 8 in BigTIFF
+	size_t offsetSize = bigTiff ? 8 : 4;
+	size_t countSize = bigTiff ? 8 : 2;
+	size_t entrySize = bigTiff ? 20 : 12;
+	unsigned short version;
+	memcpy(&version,&file[2],2);
+	if (version!=(bigTiff ? 43 : 42))
+		return -1;
+
+	int n = 0;
+	ifdOffsets.clear();
+	unsigned __int64 offset = 0;
+	memcpy(&offset,&file[bigTiff ? 8 : 4],offsetSize);
+	while (offset!=0) {
+		if (offset+countSize>file.size())
+			return -1;
+		ifdOffsets.push_back(offset);
+		unsigned __int64 numEntries = 0;
+		memcpy(&numEntries,&file[(size_t) offset],countSize);
+		unsigned __int64 next = offset+countSize+numEntries*entrySize;
+		if (next+offsetSize>file.size())
+			return -1;
+		offset = 0;
+		memcpy(&offset,&file[(size_t) next],offsetSize);
+		n++;
+	}
+	return n;
+}
+
+static bool runCase(unsigned short width, unsigned short length, unsigned short numChannels,
+	unsigned int numFrames, unsigned int bufferBytes, unsigned int numBuffers, bool bigTiff)
+{
+	unsigned int stride;
+	TifWriter syncWriter;
+	bool ok = writeFile(syncWriter,SYNC_FILE,width,length,numChannels,numFrames,bigTiff,&stride);
+
+	TifWriter asyncWriter;
+	asyncWriter.configureAsyncIO(true,bufferBytes,numBuffers);
+	ok = writeFile(asyncWriter,ASYNC_FILE,width,length,numChannels,numFrames,bigTiff,&stride) && ok;
+
+	std::vector<char> a, b;
+	ok = ok && readFile(SYNC_FILE,a) && readFile(ASYNC_FILE,b);
+	ok = ok && a.size()==b.size() && memcmp(&a[0],&b[0],a.size())==0;
+	std::vector<unsigned __int64> ifdOffsets;
+	int numIFDs = ok && numFrames>0 ? countIFDs(b,bigTiff,ifdOffsets) : 0;
+	ok = ok && numIFDs==(int) (numFrames*numChannels);
+
+	// frames up to and including the reconfigure are at a fixed stride
+	for (size_t i=0;ok && numFrames>0 && i<(numFrames/2+1)*numChannels;i++)
+		ok = ifdOffsets[i]==104+i*stride;
+	printf("%s %ux%u, %u chan, %u frames, %u x %u byte buffers: %u bytes, %d IFDs %s\n",
+	       bigTiff ? "BigTIFF" : "TIFF",width,length,numChannels,numFrames,numBuffers,bufferBytes,(unsigned) a.size(),
+	       numIFDs,ok ? "ok" : "WRONG");
+	remove(SYNC_FILE);
+	remove(ASYNC_FILE);
+	return ok;
+}
+
+// Value of the first entry with tag in the IFD at offset, or -1.
+static __int64 getTag(const std::vector<char> &file, bool bigTiff, unsigned __int64 offset, unsigned short tag,
+	unsigned __int64 *count)
+{
+	size_t countSize = bigTiff ? 8 : 2;
+	size_t entrySize = bigTiff ? 20 : 12;
+	size_t valueSize = bigTiff ? 8 : 4;
+	unsigned __int64 numEntries = 0;
+	memcpy(&numEntries,&file[(size_t) offset],countSize);
+	for (unsigned __int64 e=0;e<numEntries;e++) {
+		const char *entry = &file[(size_t) (offset+countSize+e*entrySize)];
+		unsigned short t, type;
+		memcpy(&t,entry,2);
+		memcpy(&type,entry+2,2);
+		if (t!=tag)
+			continue;
+		*count = 0;
+		memcpy(count,entry+4,valueSize);
+		unsigned __int64 value = 0;
+		memcpy(&value,entry+4+valueSize,type==3 ? 2 : valueSize); // SHORTs sit in the first 2 bytes
+		return (__int64) value;
+	}
+	return -1;
+}
+
+// Strip c's value from a StripOffsets/StripByteCounts entry.
+static unsigned __int64 getStripValue(const std::vector<char> &file, bool bigTiff, unsigned __int64 offset,
+	unsigned short tag, unsigned int c)
+{
+	unsigned __int64 count;
+	unsigned __int64 value = (unsigned __int64) getTag(file,bigTiff,offset,tag,&count);
+	if (count==1)
+		return value;
+	unsigned __int64 v = 0;
+	memcpy(&v,&file[(size_t) (value+c*(bigTiff ? 8 : 4))],bigTiff ? 8 : 4);
+	return v;
+}
+
+// Check each frame in a deflate TIFF or LZ4 container restores to what
+// writeFile wrote.
+static bool checkCompressedFrames(const std::vector<char> &file, StripCompressor::Codec codec, bool predictor, bool bigTiff,
+	unsigned short width, unsigned short length, unsigned short numChannels, unsigned int numFrames)
+{
+	unsigned int frameBytes = width*length*2;
+	std::vector<char> frames(frameBytes*numChannels);
+	std::vector<char> restored(frameBytes);
+	std::vector<unsigned __int64> ifdOffsets;
+	if (codec==StripCompressor::DEFLATE && countIFDs(file,bigTiff,ifdOffsets)!=(int) (numFrames*numChannels))
+		return false;
+
+	size_t record = 16;
+	if (codec==StripCompressor::LZ4 && memcmp(&file[0],"USCLZ4S",8)!=0)
+		return false;
+
+	for (unsigned int f=0;f<numFrames;f++) {
+		fillFrames(frames,f);
+		for (unsigned int c=0;c<numChannels;c++) {
+			unsigned int rowsPerStrip;
+			unsigned int numStrips;
+			std::vector<unsigned __int64> stripOffsets, stripBytes;
+			if (codec==StripCompressor::DEFLATE) {
+				unsigned __int64 ifd = ifdOffsets[f*numChannels+c], count;
+				if (getTag(file,bigTiff,ifd,259,&count)!=8 || getTag(file,bigTiff,ifd,317,&count)!=(predictor ? 2 : 1))
+					return false;
+				rowsPerStrip = (unsigned int) getTag(file,bigTiff,ifd,278,&count);
+				getTag(file,bigTiff,ifd,273,&count);
+				numStrips = (unsigned int) count;
+				for (unsigned int s=0;s<numStrips;s++) {
+					stripOffsets.push_back(getStripValue(file,bigTiff,ifd,273,s));
+					stripBytes.push_back(getStripValue(file,bigTiff,ifd,279,s));
+				}
+			} else {
+				unsigned int recordBytes, descriptionBytes;
+				unsigned short fields[6];
+				memcpy(&recordBytes,&file[record],4);
+				memcpy(fields,&file[record+4],sizeof(fields));
+				memcpy(&descriptionBytes,&file[record+16],4);
+				memcpy(&numStrips,&file[record+20],4);
+				if (fields[0]!=width || fields[1]!=length || fields[2]!=2 || fields[5]!=(predictor ? 2 : 1))
+					return false;
+				rowsPerStrip = fields[4];
+				unsigned __int64 offset = record+24+4*numStrips+descriptionBytes;
+				for (unsigned int s=0;s<numStrips;s++) {
+					unsigned int n;
+					memcpy(&n,&file[record+24+4*s],4);
+					stripOffsets.push_back(offset);
+					stripBytes.push_back(n);
+					offset += n;
+				}
+				record += recordBytes;
+			}
+
+			unsigned int stripBytesRaw = rowsPerStrip*width*2;
+			for (unsigned int s=0;s<numStrips;s++) {
+				unsigned int n = std::min(stripBytesRaw,frameBytes-s*stripBytesRaw);
+				char *dst = &restored[s*stripBytesRaw];
+				const char *src = &file[(size_t) stripOffsets[s]];
+				if (codec==StripCompressor::DEFLATE) {
+					uLongf len = n;
+					if (uncompress(reinterpret_cast<Bytef*>(dst),&len,reinterpret_cast<const Bytef*>(src),
+					               (uLong) stripBytes[s])!=Z_OK || len!=n)
+						return false;
+				} else if (StripCodecs::lz4Decompress(src,(size_t) stripBytes[s],dst,n)!=n) {
+					return false;
+				}
+				if (predictor)
+					StripCodecs::horizontalAccumulate(dst,n,width*2,2);
+			}
+			if (memcmp(&restored[0],&frames[c*frameBytes],frameBytes)!=0)
+				return false;
+		}
+	}
+	return codec==StripCompressor::DEFLATE || record==file.size();
+}
+
+static bool runCompressedCase(StripCompressor::Codec codec, bool predictor, unsigned short width, unsigned short length,
+	unsigned short numChannels, unsigned int numFrames, unsigned int bufferBytes, bool bigTiff)
+{
+	unsigned int stride;
+	TifWriter syncWriter;
+	syncWriter.configureCompression(codec,StripCompressor::DEFAULT_DEFLATE_LEVEL,predictor,2);
+	bool ok = writeFile(syncWriter,SYNC_FILE,width,length,numChannels,numFrames,bigTiff,&stride);
+
+	TifWriter asyncWriter;
+	asyncWriter.configureAsyncIO(true,bufferBytes,3);
+	asyncWriter.configureCompression(codec,StripCompressor::DEFAULT_DEFLATE_LEVEL,predictor,0);
+	ok = writeFile(asyncWriter,ASYNC_FILE,width,length,numChannels,numFrames,bigTiff,&stride) && ok;
+
+	bool container = codec==StripCompressor::LZ4;
+	std::vector<char> a, b;
+	ok = ok && readFile(container ? SYNC_CONTAINER : SYNC_FILE,a) && readFile(container ? ASYNC_CONTAINER : ASYNC_FILE,b);
+	ok = ok && a.size()==b.size() && memcmp(&a[0],&b[0],a.size())==0;
+	ok = ok && checkCompressedFrames(b,codec,predictor,bigTiff,width,length,numChannels,numFrames);
+	printf("%s%s %ux%u, %u chan, %u frames: %u bytes %s\n",
+	       container ? "LZ4 container" : bigTiff ? "deflate BigTIFF" : "deflate TIFF",predictor ? "" : " (no predictor)",
+	       width,length,numChannels,numFrames,(unsigned) a.size(),ok ? "ok" : "WRONG");
+	remove(container ? SYNC_CONTAINER : SYNC_FILE);
+	remove(container ? ASYNC_CONTAINER : ASYNC_FILE);
+	return ok;
+}
+
+int _tmain(int argc, _TCHAR* argv[])
+{
+	bool ok = true;
+	for (int big=0;big<2;big++) {
+		ok = runCase(32,8,1,1,4096,2,big!=0) && ok;         // one strip per frame, less than a buffer
+		ok = runCase(37,56,1,20,4096,2,big!=0) && ok;       // frames straddle buffers
+		ok = runCase(256,256,3,12,65536,3,big!=0) && ok;    // multi-strip, several channels
+		ok = runCase(512,512,1,8,8*1024*1024,4,big!=0) && ok; // default buffer size
+		ok = runCase(100,30,2,0,4096,2,big!=0) && ok;       // header only
+
+		for (int codec=StripCompressor::DEFLATE;codec<=StripCompressor::LZ4;codec++) {
+			StripCompressor::Codec cc = (StripCompressor::Codec) codec;
+			ok = runCompressedCase(cc,true,32,8,1,3,4096,big!=0) && ok;    // one strip per frame
+			ok = runCompressedCase(cc,true,300,37,3,6,4096,big!=0) && ok;  // short last strip
+			ok = runCompressedCase(cc,false,300,37,3,6,4096,big!=0) && ok;
+			ok = runCompressedCase(cc,true,512,512,2,4,65536,big!=0) && ok;
+		}
+	}
+
+	printf(ok ? "PASS\n" : "FAILED\n");
+	return ok ? 0 : 1;
+}
@@ -50,13 +50,54 @@ classdef ResonantAcq < most.MachineDataFile
         loggingFullFileName;
         loggingOpenModeString = 'wbn';
         loggingHeaderString;
+        loggingBigTiff = false;      % Write log files as BigTIFF (64-bit offsets), with no 4 GB file size limit
+        loggingPreallocateFrames = 0; % Frames (all channels) to reserve disk space for when each log file is opened, so it is allocated up front. 0 = none
+        loggingAsyncWrites = true;   % Write log files with overlapped, unbuffered I/O, several large writes in flight. Applies to 'w' open modes
+        loggingWriteBufferMB = 8;    % Size of each async log file write, in MB
+        loggingWritesInFlight = 4;   % Number of async log file writes that may be outstanding at once
+        loggingCompression = 'none'; % Lossless compression of logged frames. One of {'none','deflate','lz4'}. 'deflate' writes standard compressed TIFFs; 'lz4' is faster but writes an LZ4 strip container (.lz4s appended to the file name)
+        loggingCompressionLevel = 1; % zlib level for 'deflate', 1 (fastest) to 9
+        loggingCompressionPredictor = true; % Difference neighbouring pixels before compressing. Helps on smooth or oversampled images; costs a little on shot-noise-limited ones
+        loggingCompressionThreads = 2; % Compression threads, besides the logging thread
+        loggingFormat = 'tiff';      % One of {'tiff','raw'}. 'raw' logs frames with no per-frame headers or 4 GB limit to a chunked container (.raw appended to the file name), with an index of frame tags and timestamps; convert it with convertRawLog
+        loggingRawFramesPerChunk = 256; % Raw logs: frames between index checkpoints. A log cut short keeps the index of every complete chunk
+        loggingWaitForTrigger = false; % With loggingEnable, start logging at a trigger (triggerLogging, or loggingTriggerEventName) rather than at start
+        loggingTriggerEventName = '';  % Name of a Win32 event that triggers logging when set, eg by another process. '' = triggerLogging only
+        loggingPreTriggerFrames = 0;   % Frames from before the trigger to log first, kept in locked memory while waiting. 0 = use loggingPreTriggerMB
+        loggingPreTriggerMB = 0;       % Memory for frames from before the trigger, if loggingPreTriggerFrames is 0
         
         
         acquisitionTriggerIn = '';% Input terminal of the Resonant Scanner Sync signal. Valid Values are one of {'', 'PFI1'..'PFI3', 'PXI_Trig0'..'PXI_Trig7'}
         periodTriggerIn = '';     % Input terminal of Acquisition Start Trigger. Valid Values are one of {'', 'PFI1'..'PFI3', 'PXI_Trig0'..'PXI_Trig7'}
         
+        fifoBatchedReads = false;  % Read all frames waiting in the FIFO host buffer in place, in one call, rather than copying out one frame per read
+        fifoMaxFramesPerBatch = 8; % Upper bound on frames per batched read. Should not exceed fifoSizeFrames
+        
+        displayAveragingMode = 'none';  % Average frames natively before they reach frameAcquiredFcn/getFrame. One of {'none','boxcar','exponential'}
+        displayAveragingFrames = 4;     % 'boxcar': number of most recent frames averaged
+        displayAveragingWeight = 0.25;  % 'exponential': weight of each new frame, in (0,1]
+        displayAveragingInterval = 0;   % Acquired frames per averaged frame delivered to MATLAB. 0 = displayAveragingFrames ('boxcar') or round(1/displayAveragingWeight) ('exponential')
+        
+        statsEnabled = true;       % Time each pipeline stage during acquisition; see getStats()
+        traceLevel = 0;            % Binary trace of the acquisition threads to traceFile: 0 = off, 1 = start/stop, triggers, drops and errors, 2 = every frame
+        traceFile = '';            % File for the binary trace (see PipelineTrace.h for its format)
+        frameStatsEnable = false;  % Compute per-channel statistics of every frame natively (min, max, mean, std, saturated pixels, histogram), for getFrameStats
+        
+        frameEventCoalescing = false; % At most one frameAcquiredFcn call waiting, however many frames arrive; it gets an evnt struct with framesNotified and framesAvailable, and should read them all (readFrames)
+        frameEventMaxRate = 0;        % With frameEventCoalescing, at most this many frameAcquiredFcn calls/s (eg the display refresh rate). 0 = no limit
+        displayPrepEnable = false;    % Bin, contrast and optionally merge display frames natively, on their own thread, so that readFrames and frameAcquiredFcn get small uint8 images: (linesPerFrame/bin) x (pixelsPerLine/bin) x channels shown (or R, G, B when merged). getFrame/readFrame are not available
+        displayPrepBinFactor = 1;     % Pixels averaged along each axis into one display pixel
+        displayPrepChannels = [];     % Channels shown, in order (1-4; in single-channel mode the one channel is 1). [] = all acquired
+        displayPrepLevels = repmat([0 32767],4,1); % [black white] of each channel, in raw pixel values, mapped to 0 and 255. Takes effect at once during an acquisition
+        displayPrepMerge = false;     % Merge the channels shown into one RGB image
+        displayPrepColors = [0 1 0; 1 0 0; 0 0 1; 1 1 1]; % RGB colour, in [0,1], of each channel in the merge
+        frameEventData = false;       % Deliver the frames in frameAcquiredFcn's evnt struct (frames, tags, framesLostFifo, displayDropped) instead of having it read them: the next frame, or with frameEventCoalescing all of them. See eventFrames
+        
         %simulated mode
         simulated=false;
+        simulatedFrameRate = 20;     % Frames/s delivered in simulated mode. 0 = as fast as the pipeline consumes them.
+        simulatedPattern = 'ramp';   % Synthetic frame content in simulated mode. One of {'ramp','noise','counter'}
+        simulatedReplayFile = '';    % Raw FIFO dump to replay in simulated mode instead of synthesizing frames
     end
        
     %Constructor-initialized
@@ -229,6 +270,103 @@ classdef ResonantAcq < most.MachineDataFile
 %                    obj.stop();
 %             end
         end
+
+        function [frames, tags, framesRemaining] = readFrames(obj,n)
+            % Read up to n queued frames (default Inf: all of them) in one
+            % call, oldest first. frames is linesPerFrame x pixelsPerLine
+            % x channels x numFrames int16, numFrames possibly 0; tags is
+            % numFrames x 1. framesRemaining is the number still queued.
+            % With displayPrepEnable, frames are the prepared uint8 ones.
+            assert(obj.acqRunning,'Acquisition is not running');
+            if nargin < 2
+                n = Inf;
+            end
+
+            [frames, tags, framesRemaining] = ResonantAcqMex(obj,'getFrames',n);
+
+            obj.framesAcquired = obj.framesAcquired + size(frames,4);
+        end
+
+        function [frames, tags] = eventFrames(obj,evnt)
+            % The frames for a frameAcquiredFcn call given evnt, as
+            % readFrames returns them: delivered in evnt with
+            % frameEventData, else read now.
+            if obj.frameEventData
+                frames = evnt.frames;
+                tags = evnt.tags;
+                obj.framesAcquired = obj.framesAcquired + size(frames,4);
+            else
+                [frames, tags] = obj.readFrames();
+            end
+        end
+
+        function triggerLogging(obj)
+            % Start logging now, with loggingWaitForTrigger: the frames
+            % kept from before the trigger are logged first, then live
+            % frames.
+            assert(obj.acqRunning,'Acquisition is not running');
+            ResonantAcqMex(obj,'triggerLogging');
+        end
+
+        function stats = getStats(obj)
+            % Latency of each stage of the acquisition pipeline (FIFO
+            % read, deinterleave, transpose, queue dwell, logger write,
+            % frame callback, display prep, frame statistics), in
+            % microseconds, and frame counters, since the acquisition
+            % started. Stages are timed only with statsEnabled.
+            stats = ResonantAcqMex(obj,'getStats');
+        end
+
+        function stats = getFrameStats(obj,maxFrames)
+            % Per-channel statistics of the frames acquired since the
+            % last call, with frameStatsEnable: at most maxFrames
+            % (default Inf) of them, the newest, oldest first. Only the
+            % last 64 frames are kept. No frames are read, so this is
+            % cheap to poll. stats has frameNumber and frameTag (1 x
+            % frames); min, max, mean, std and numSaturated (pixels at
+            % either end of the ADC range) (channels x frames); and
+            % histogram (256 x channels x frames), the ADC range in 256
+            % equal bins.
+            if nargin < 2
+                maxFrames = inf;
+            end
+            stats = ResonantAcqMex(obj,'getFrameStats',maxFrames);
+        end
+
+        function numFrames = convertRawLog(obj,rawFile,tifFile,bigTiff)
+            % Convert a log written with loggingFormat 'raw' to the TIFF
+            % that loggingFormat 'tiff' would have written, frame tags
+            % included. bigTiff (default false) writes a BigTIFF.
+            if nargin < 4
+                bigTiff = false;
+            end
+            numFrames = ResonantAcqMex(obj,'convertRawLog',rawFile,tifFile,bigTiff);
+        end
+
+        function [frames, tags] = readLoggedFrames(obj,fileName,firstFrame,numFrames,channels,numChannels)
+            % Read frames from a TIFF logged with loggingFormat 'tiff',
+            % through a memory mapping of the file, without loading the
+            % rest of it. frames is linesPerFrame x pixelsPerLine x
+            % numel(channels) x numFrames; tags holds each frame's frame
+            % tag (0 if untagged). firstFrame defaults to 1, numFrames to
+            % the rest of the file (Inf), channels to all of them.
+            % numChannels is the number of channels logged (default 1).
+            % The file's index is kept in <fileName>.idx, so that reopening
+            % a long file is quick.
+            if nargin < 3 || isempty(firstFrame)
+                firstFrame = 1;
+            end
+            if nargin < 4 || isempty(numFrames)
+                numFrames = inf;
+            end
+            if nargin < 5
+                channels = [];
+            end
+            if nargin < 6
+                numChannels = 1;
+            end
+            [frames, tags] = ResonantAcqMex(obj,'readLoggedFrames',fileName,firstFrame,numFrames,double(channels),numChannels);
+        end
     end
     
     %% Property Access Methods
@@ -320,6 +458,17 @@ classdef ResonantAcq < most.MachineDataFile
             obj.flagResizeAcquisition = true;
         end
         
+        function set.displayPrepLevels(obj,val)
+            %validation
+            validateattributes(val,{'numeric'},{'ncols' 2 'nonempty'});
+            %set prop
+            obj.displayPrepLevels = val;
+            %side effects
+            if obj.acqRunning
+                ResonantAcqMex(obj,'updateDisplayLevels');
+            end
+        end
+        
         function set.pixelsPerLine(obj,val)
             %validation
             obj.zprpAssertNotRunning('pixelsPerLine');
@@ -103,7 +103,8 @@ classdef Model < most.Model
             %Set the park angle to what is set in the defaults.
             
             %Register the callback with the scanner controller.
-            obj.hAcq.frameAcquiredFcn = @(src,evnt)obj.zzzFrameAcquiredFcn;
+            %evnt is passed only with frameEventCoalescing.
+            obj.hAcq.frameAcquiredFcn = @(src,varargin)obj.zzzFrameAcquiredFcn(src,varargin{:});
             
             %Initialize the figure/image objects
             for i = 1:obj.MAX_NUM_CHANNELS
@@ -218,12 +219,20 @@ classdef Model < most.Model
                 figure(obj.hFigs(obj.channelsActive(i)));
             end
             
+            %Natively prepared frames are binned
+            binFactor = 1;
+            if obj.hAcq.displayPrepEnable
+                binFactor = obj.hAcq.displayPrepBinFactor;
+            end
+            numLines = floor((obj.linesPerFrame + obj.flybackLinesPerFrame) / binFactor);
+            numPixels = floor(obj.pixelsPerLine / binFactor);
+            
             for i=1:numel(hImages_)
                 hAx = get(hImages_(i),'Parent');
-                set(hAx,    'XLim',[1 obj.pixelsPerLine],...
-                    'YLim',[1 obj.linesPerFrame + obj.flybackLinesPerFrame]);
+                set(hAx,    'XLim',[1 numPixels],...
+                    'YLim',[1 numLines]);
                 
-                set(hImages_(i),'CData',zeros(obj.linesPerFrame+obj.flybackLinesPerFrame,obj.pixelsPerLine));
+                set(hImages_(i),'CData',zeros(numLines,numPixels));
             end
         end
         
@@ -275,6 +284,8 @@ classdef Model < most.Model
             end
             
             
+            obj.zprpUpdateDisplayPrep();
+            
             %Start Loop Repeat timer
             if isequal(obj.acqMode,'loop') && ~obj.triggerTypeExternal
                 start(obj.hLoopRepeatTimer);
@@ -370,18 +381,45 @@ classdef Model < most.Model
                 return;
             end
             
-            frame = struct();
-            frameData = obj.hAcq.readFrame(); 
-            assert(~isempty(frameData),'Got empty frame data');
-            
-            obj.frameCounter = obj.frameCounter + 1;
+            if nargin < 3
+                evnt = [];
+            end
             
-            %display the frame
-            % fprintf('displaying frame #%u\n',obj.frameCounter);
-            for i = 1:length(obj.channelsActive);
-                chan = obj.channelsActive(i);
-                set(obj.hImages(chan),'CData',frameData{i});
-            end            
+            if isstruct(evnt) || obj.hAcq.displayPrepEnable
+                %Coalesced or data-carrying frame events, or natively
+                %prepared frames: take every frame delivered or waiting,
+                %and display only the newest
+                frames = obj.hAcq.eventFrames(evnt);
+                numFrames = size(frames,4);
+                if numFrames == 0
+                    return;
+                end
+                
+                obj.frameCounter = obj.frameCounter + numFrames;
+                
+                if obj.hAcq.displayPrepEnable && obj.hAcq.displayPrepMerge
+                    %One RGB image, in the first active channel's figure
+                    set(obj.hImages(obj.channelsActive(1)),'CData',frames(:,:,:,end));
+                else
+                    for i = 1:length(obj.channelsActive);
+                        chan = obj.channelsActive(i);
+                        set(obj.hImages(chan),'CData',frames(:,:,i,end));
+                    end
+                end
+            else
+                frame = struct();
+                frameData = obj.hAcq.readFrame(); 
+                assert(~isempty(frameData),'Got empty frame data');
+                
+                obj.frameCounter = obj.frameCounter + 1;
+                
+                %display the frame
+                % fprintf('displaying frame #%u\n',obj.frameCounter);
+                for i = 1:length(obj.channelsActive);
+                    chan = obj.channelsActive(i);
+                    set(obj.hImages(chan),'CData',frameData{i});
+                end
+            end
             
             if ~strcmp(obj.acqState,'focus') && obj.frameCounter >= obj.grabNumFrames
                 disp('stopping');
@@ -727,7 +765,41 @@ classdef Model < most.Model
         end
         
         function zprpUpdateChanLUT(obj,chanIdx,newVal)
-            set(obj.hAxes(chanIdx),'CLim',newVal);
+            if obj.hAcq.displayPrepEnable
+                obj.zprpUpdateDisplayPrep();
+            else
+                set(obj.hAxes(chanIdx),'CLim',newVal);
+            end
+        end
+        
+        function zprpUpdateDisplayPrep(obj)
+            %Pass the active channels and channel LUTs to the acquisition's
+            %native display prep. Prepared frames are uint8, already
+            %scaled by the LUTs, so the axes show them as they are.
+            chanLUTs = {obj.chan1LUT obj.chan2LUT obj.chan3LUT obj.chan4LUT};
+            levels = obj.hAcq.displayPrepLevels;
+            for i=1:min(numel(chanLUTs),size(levels,1))
+                if ~isempty(chanLUTs{i})
+                    levels(i,:) = chanLUTs{i};
+                end
+            end
+            
+            if obj.multiChannel
+                obj.hAcq.displayPrepChannels = obj.channelsActive;
+            elseif ~isempty(obj.channelsActive) && ~isempty(chanLUTs{obj.channelsActive(1)})
+                %Single-channel frames hold the active channel only
+                levels(1,:) = chanLUTs{obj.channelsActive(1)};
+                obj.hAcq.displayPrepChannels = [];
+            end
+            obj.hAcq.displayPrepLevels = levels;
+            
+            for i=1:numel(chanLUTs)
+                if obj.hAcq.displayPrepEnable
+                    set(obj.hAxes(i),'CLim',[0 255]);
+                elseif ~isempty(chanLUTs{i})
+                    set(obj.hAxes(i),'CLim',chanLUTs{i});
+                end
+            end
         end
         
         